@@ -0,0 +1,276 @@
+/*
+spdk_coro.hpp 的 benchmark：同一組 reactor / thread / io_channel，分別用
+  (1) 原本的 callback 鏈 (submit_one_io → io_complete → resubmit)
+  (2) C++20 coroutine (每個 worker 是一個 co_await bdev.read() 的迴圈)
+各跑 RUN_SEC 秒，比較 IOPS；coroutine 版要落在 callback 版的 3% 以內
+
+編譯：g++ -std=c++20 -O2 -o bdev_coro_bench bdev_coro_bench.cpp \
+        $(pkg-config --cflags --libs spdk_bdev spdk_env_dpdk spdk_thread spdk_event spdk_event_bdev)
+*/
+#include "spdk/stdinc.h"
+#include "spdk/env.h"
+#include "spdk/event.h"
+#include "spdk/bdev.h"
+#include "spdk/thread.h"
+
+#include "spdk_coro.hpp"
+#include "spdk_bench_preflight.h"
+
+#define REACTOR_CORES   2
+#define QD_PER_THREAD   32
+#define IO_SIZE         4096
+#define RUN_SEC         10
+#define BDEV_NAME       "Nvme0n1"
+
+enum bench_mode {
+    MODE_CALLBACK,
+    MODE_CORO,
+    MODE_NUM,
+};
+
+static const char *g_mode_name[MODE_NUM] = { "callback", "coroutine" };
+
+struct thread_ctx;
+
+struct cb_task {
+    struct thread_ctx *t;
+    void *buf;
+    uint64_t offset;
+};
+
+struct thread_ctx {
+    struct spdk_thread      *th;
+    struct spdk_io_channel  *ch;
+    void                    *bufs[QD_PER_THREAD];
+    struct cb_task          tasks[QD_PER_THREAD];
+    uint64_t                completed;
+    uint32_t                active;     // 尚未結束的 worker 數
+    uint64_t                arena_misses;   // 該 reactor 的 frame_arena 累計 miss，worker 全部結束時記下
+    char                    name[32];
+};
+
+static struct thread_ctx g_ctx[REACTOR_CORES];
+static struct spdk_bdev_desc *g_desc;
+static uint64_t g_num_blocks_io;        // bdev 可容納幾個 IO_SIZE
+static volatile bool g_stop;
+static enum bench_mode g_mode;
+static uint64_t g_start_tsc;
+static uint32_t g_threads_done;
+static double g_iops[MODE_NUM];
+static struct spdk_poller *g_timer;
+
+static void run_mode(enum bench_mode mode);
+
+static void thread_fini(void *arg)
+{
+    struct thread_ctx *t = (struct thread_ctx *)arg;
+
+    for (int i = 0; i < QD_PER_THREAD; i++) {
+        spdk_dma_free(t->bufs[i]);
+    }
+    spdk_put_io_channel(t->ch);
+    spdk_thread_exit(t->th);
+}
+
+/* ---------------- 所有 thread 的 worker 都停下後，回到 app thread 統計 ---------------- */
+static void mode_done(void *arg)
+{
+    uint64_t total = 0;
+    double sec = (double)(spdk_get_ticks() - g_start_tsc) / spdk_get_ticks_hz();
+
+    (void)arg;
+    if (++g_threads_done < REACTOR_CORES) {
+        return;
+    }
+    for (int i = 0; i < REACTOR_CORES; i++) {
+        total += g_ctx[i].completed;
+    }
+    g_iops[g_mode] = total / sec;
+    printf("%-10s %12.0f IOPS\n", g_mode_name[g_mode], g_iops[g_mode]);
+
+    if (g_mode + 1 < MODE_NUM) {
+        run_mode((enum bench_mode)(g_mode + 1));
+        return;
+    }
+    uint64_t misses = 0;
+    for (int i = 0; i < REACTOR_CORES; i++) {
+        misses += g_ctx[i].arena_misses;
+    }
+    printf("coroutine / callback = %.2f%%, frame arena misses on workers = %lu\n",
+           g_iops[MODE_CORO] * 100.0 / g_iops[MODE_CALLBACK], misses);
+    for (int i = 0; i < REACTOR_CORES; i++) {
+        spdk_thread_send_msg(g_ctx[i].th, thread_fini, &g_ctx[i]);
+    }
+    spdk_for_each_thread([](void *) {}, NULL, [](void *) {
+        spdk_bdev_close(g_desc);
+        spdk_app_stop(0);
+    });
+}
+
+static void worker_exit(struct thread_ctx *t)
+{
+    if (--t->active == 0) {
+        /* arena 是 thread_local，只能在 worker 自己的 thread 上讀 */
+        t->arena_misses = spdk_coro::frame_arena::local().misses();
+        spdk_thread_send_msg(spdk_thread_get_app_thread(), mode_done, NULL);
+    }
+}
+
+static uint64_t next_offset(uint64_t prev)
+{
+    uint64_t n = prev / IO_SIZE + REACTOR_CORES * QD_PER_THREAD;
+
+    return (n % g_num_blocks_io) * IO_SIZE;
+}
+
+/* ---------------- (1) callback 鏈 ---------------- */
+static void submit_one_io(struct cb_task *task);
+
+static void io_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct cb_task *task = (struct cb_task *)cb_arg;
+
+    spdk_bdev_free_io(bdev_io);
+    task->t->completed++;
+    if (g_stop) {
+        worker_exit(task->t);
+        return;
+    }
+    task->offset = next_offset(task->offset);
+    submit_one_io(task);
+}
+
+static void submit_one_io(struct cb_task *task)
+{
+    int rc = spdk_bdev_read(g_desc, task->t->ch, task->buf, task->offset, IO_SIZE, io_complete, task);
+
+    if (rc != 0) {
+        fprintf(stderr, "[%s] spdk_bdev_read rc=%d\n", task->t->name, rc);
+        worker_exit(task->t);
+    }
+}
+
+/* ---------------- (2) coroutine ---------------- */
+static spdk_coro::task<void> coro_worker(struct thread_ctx *t, void *buf, uint64_t offset)
+{
+    spdk_coro::bdev bdev(g_desc, t->ch);
+
+    while (!g_stop) {
+        int rc = co_await bdev.read(buf, offset, IO_SIZE);
+        if (rc != 0) {
+            fprintf(stderr, "[%s] read rc=%d\n", t->name, rc);
+            break;
+        }
+        t->completed++;
+        offset = next_offset(offset);
+    }
+    worker_exit(t);
+}
+
+static void thread_start(void *arg)
+{
+    struct thread_ctx *t = (struct thread_ctx *)arg;
+    int idx = (int)(t - g_ctx);
+
+    t->completed = 0;
+    t->active = QD_PER_THREAD;
+    for (int i = 0; i < QD_PER_THREAD; i++) {
+        uint64_t offset = ((uint64_t)(idx * QD_PER_THREAD + i) % g_num_blocks_io) * IO_SIZE;
+
+        if (g_mode == MODE_CALLBACK) {
+            t->tasks[i].t = t;
+            t->tasks[i].buf = t->bufs[i];
+            t->tasks[i].offset = offset;
+            submit_one_io(&t->tasks[i]);
+        } else {
+            spdk_coro::spawn(coro_worker(t, t->bufs[i], offset));
+        }
+    }
+}
+
+static int stop_timer(void *arg)
+{
+    (void)arg;
+    g_stop = true;
+    spdk_poller_unregister(&g_timer);
+    return SPDK_POLLER_BUSY;
+}
+
+static void run_mode(enum bench_mode mode)
+{
+    g_mode = mode;
+    g_stop = false;
+    g_threads_done = 0;
+    g_start_tsc = spdk_get_ticks();
+    for (int i = 0; i < REACTOR_CORES; i++) {
+        spdk_thread_send_msg(g_ctx[i].th, thread_start, &g_ctx[i]);
+    }
+    g_timer = SPDK_POLLER_REGISTER(stop_timer, NULL, RUN_SEC * 1000000ULL);
+}
+
+/* ---------------- 每個 reactor 一個 thread，先拿好 io_channel 與 buffer ---------------- */
+static void thread_init(void *arg)
+{
+    struct thread_ctx *t = (struct thread_ctx *)arg;
+
+    t->ch = spdk_bdev_get_io_channel(g_desc);
+    for (int i = 0; i < QD_PER_THREAD; i++) {
+        t->bufs[i] = spdk_dma_zmalloc(IO_SIZE, 0x1000, NULL);
+    }
+}
+
+static void threads_ready(void *arg)
+{
+    (void)arg;
+    run_mode(MODE_CALLBACK);
+}
+
+static void app_start(void *arg)
+{
+    struct spdk_bdev *bdev;
+    struct spdk_cpuset cpumask;
+    int rc;
+
+    (void)arg;
+    rc = spdk_bdev_open_ext(BDEV_NAME, false, [](enum spdk_bdev_event_type, struct spdk_bdev *, void *) {},
+                            NULL, &g_desc);
+    if (rc != 0) {
+        fprintf(stderr, "open bdev %s failed rc=%d\n", BDEV_NAME, rc);
+        spdk_app_stop(-1);
+        return;
+    }
+    bdev = spdk_bdev_desc_get_bdev(g_desc);
+    g_num_blocks_io = spdk_bdev_get_num_blocks(bdev) * spdk_bdev_get_block_size(bdev) / IO_SIZE;
+
+    for (int i = 0; i < REACTOR_CORES; i++) {
+        snprintf(g_ctx[i].name, sizeof(g_ctx[i].name), "r%d", i);
+        spdk_cpuset_zero(&cpumask);
+        spdk_cpuset_set_cpu(&cpumask, i, true);
+        g_ctx[i].th = spdk_thread_create(g_ctx[i].name, &cpumask);
+    }
+    /* 等所有 thread 都拿到 channel 後才開始計時 */
+    for (int i = 0; i < REACTOR_CORES; i++) {
+        spdk_thread_send_msg(g_ctx[i].th, thread_init, &g_ctx[i]);
+    }
+    spdk_for_each_thread([](void *) {}, NULL, threads_ready);
+}
+
+int main(int argc, char **argv)
+{
+    struct spdk_app_opts opts;
+
+    spdk_app_opts_init(&opts, sizeof(opts));
+    opts.name = "bdev_coro_bench";
+    opts.reactor_mask = "0x3";
+    if (spdk_bench_preflight_run(opts.name, opts.reactor_mask, NULL) != 0) {
+        return -1;
+    }
+    if (argc > 1) {
+        opts.json_config_file = argv[1];   // 例如 bdev_nvme_attach_controller 的設定檔
+    }
+
+    int rc = spdk_app_start(&opts, app_start, NULL);
+    if (rc) fprintf(stderr, "spdk_app_start rc=%d\n", rc);
+    spdk_app_fini();
+    return rc;
+}
@@ -6,6 +6,7 @@
 #include "spdk/event.h"
 #include "spdk/bdev.h"
 #include "spdk/thread.h"
+#include "spdk_bench_preflight.h"
 
 #define THREADS_PER_REACTOR  2
 #define IO_PER_THREAD        4
@@ -72,6 +73,9 @@ int main(int argc, char **argv) {
     spdk_app_opts_init(&opts, sizeof(opts));
     opts.name = "bdev_multicore_multi_threads";
     opts.reactor_mask = "0x3"; // core0 & core1
+    if (spdk_bench_preflight_run(opts.name, opts.reactor_mask, NULL) != 0) {
+        return -1;
+    }
     spdk_app_start(&opts, app_start, NULL);
     spdk_app_fini();
     return 0;
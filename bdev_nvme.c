@@ -10,6 +10,7 @@
 #include "spdk/bdev_module.h"
 #include "spdk/bdev_nvme.h"
 #include "spdk/io_channel.h"
+#include "spdk_bench_preflight.h"
 
 #define TEST_IO_SIZE 4096
 
@@ -65,6 +66,9 @@ int main(int argc, char **argv)
     spdk_env_opts_init(&opts);
     opts.name = "spdk_bdev_example";
     opts.core_mask = "0x1"; // 使用 core 0
+    if (spdk_bench_preflight_run(opts.name, opts.core_mask, NULL) != 0) {
+        return -1;
+    }
     if (spdk_env_init(&opts) < 0) {
         fprintf(stderr, "SPDK env init failed\n");
         return -1;
@@ -8,10 +8,14 @@
 #include "spdk/bdev.h"
 #include "spdk/bdev_module.h"
 #include "spdk/io_channel.h"
+#include "spdk_bench_preflight.h"
 
 #define NUM_REACTORS 2       // 使用的 reactor 數
 #define IO_PER_REACTOR 4     // 每個 reactor 同時發送 IO 數
 #define TEST_IO_SIZE 4096    // 每次 IO 大小
+// 0: busy poll；>0: 每輪 poll 後 sleep 的 us 數（舊行為 1000，每個 completion 會多等最多 1ms）
+// interrupt mode 的版本見 spdk_nvme_multi_io_full.c (intr)
+#define POLL_SLEEP_US 0
 
 struct reactor_ctx {
     struct spdk_bdev *bdev;
@@ -75,7 +79,9 @@ static int reactor_thread(void *arg)
     // Reactor poll loop
     while (true) {
         spdk_bdev_poll(ctx->ch);
-        usleep(1000);
+        if (POLL_SLEEP_US > 0) {
+            usleep(POLL_SLEEP_US);
+        }
     }
 
     return 0;
@@ -89,6 +95,9 @@ int main(int argc, char **argv)
     spdk_env_opts_init(&opts);
     opts.name = "spdk_bdev_multi_core";
     opts.core_mask = "0x3"; // Core 0,1
+    if (spdk_bench_preflight_run(opts.name, opts.core_mask, NULL) != 0) {
+        return -1;
+    }
     if (spdk_env_init(&opts) < 0) {
         fprintf(stderr, "SPDK env init failed\n");
         return -1;
@@ -0,0 +1,854 @@
+/*
+per-IO 的 CPU 運算 (checksum / 壓縮 / 加密 / dedup fingerprint) 移出 poll thread：work-stealing offload pool
+
+inline 時運算直接跑在 bdev completion callback 裡，poll thread 的 core 先滿，其他 core 閒著。
+這裡把運算丟給一組專用的 offload SPDK threads (各佔一個 core)：
+
+  io thread ──SPSC sq──> offload worker 的 deque ──(pop / 被 steal)──> 執行 ──SPSC cq──> io thread
+
+  - 每個 (io thread, worker) 一條 SPSC submission ring，worker 每輪把自己的 ring 倒進自己的 Chase-Lev deque
+  - worker 從自己 deque 的 bottom pop；沒事做時隨機挑別的 worker 從 top steal，負載不均時自動攤平
+  - 做完的 task 經 (worker, io thread) 的 SPSC completion ring 回 io thread，io thread 的 poller 收回來再送下一個 IO
+  - 不用 spdk_thread_send_msg：那條路每個 message 要從 mempool 拿一個 msg、走 MP/SC 的 spdk_ring，
+    而這裡每條 ring 只有一個 producer 一個 consumer，head/tail 各一個 cache line 就夠
+  - ring 容量 >= QD、deque 容量 >= 所有 io thread 的 QD 總和，在飛的 task 數不會超過，所以永遠不會滿
+
+運算用 spdk_crc32c_update 對整個 buffer 做 CRC32C，重複 passes 次來模擬更重的運算 (壓縮/加密約 10~50 passes)
+
+  sudo ./bdev_offload_pool <inline|offload|nosteal> [io_cores] [offload_cores] [passes] [bdev.json]
+
+  core 0 = app thread，core 1..io_cores = io threads，後面 offload_cores 個 core = offload workers
+  nosteal：同樣 offload，但關掉 stealing，用來看 steal 對 tail latency 的幫助
+
+輸出 IOPS、總 latency 分位數，以及拆開的 device / 排隊 (在 ring 與 deque 裡等) / 運算時間，
+每個 worker 的執行數、steal 數與 busy%；結果 append 到 offload_result.csv，
+固定 io_cores 改 offload_cores 跑幾輪就是 scaling 曲線，和 inline 同 passes 比就是 latency 代價
+
+編譯：gcc -o bdev_offload_pool bdev_offload_pool.c spdk_bench_preflight.c \
+        $(pkg-config --cflags --libs spdk_bdev spdk_env_dpdk spdk_thread spdk_event spdk_event_bdev spdk_util)
+*/
+#include "spdk/stdinc.h"
+#include "spdk/env.h"
+#include "spdk/event.h"
+#include "spdk/bdev.h"
+#include "spdk/thread.h"
+#include "spdk/crc32.h"
+#include "spdk/util.h"
+#include "spdk_bench_preflight.h"
+#include "spdk_bench_util.h"
+
+#define BDEV_NAME           "Nvme0n1"   // 依你的環境調整
+#define MAX_IO_THREADS      16
+#define MAX_WORKERS         32
+#define IO_QD               64          // 每個 io thread 的 queue depth
+#define IO_SIZE             4096
+#define RAMP_SEC            2
+#define RUN_SEC             10
+#define OFFLOAD_BATCH       16          // worker 每輪最多執行的 task 數，做完就回 reactor，讓 ring 不會被晾太久
+#define RESULT_CSV          "offload_result.csv"
+#define CACHE_LINE          64
+
+enum run_mode {
+    MODE_INLINE,
+    MODE_OFFLOAD,
+    MODE_NOSTEAL,
+};
+
+static const char *g_mode_name[] = { "inline", "offload", "nosteal" };
+
+/* ---------------- Chase-Lev work-stealing deque (固定容量) ---------------- */
+struct ws_deque {
+    int64_t top __attribute__((aligned(CACHE_LINE)));       // thief 用 CAS 推進
+    int64_t bottom __attribute__((aligned(CACHE_LINE)));    // 只有 owner 寫
+    int64_t mask __attribute__((aligned(CACHE_LINE)));
+    void  **buf;
+};
+
+static int
+ws_init(struct ws_deque *d, uint32_t size)
+{
+    d->top = d->bottom = 0;
+    d->mask = size - 1;
+    d->buf = calloc(size, sizeof(void *));
+    return d->buf ? 0 : -ENOMEM;
+}
+
+/* owner only */
+static inline int
+ws_push(struct ws_deque *d, void *obj)
+{
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+
+    if (b - __atomic_load_n(&d->top, __ATOMIC_ACQUIRE) > d->mask) {
+        return -ENOSPC;
+    }
+    __atomic_store_n(&d->buf[b & d->mask], obj, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* owner only：從 bottom 拿 (LIFO)，只剩一個時和 thief 用 CAS 搶 top */
+static inline void *
+ws_pop(struct ws_deque *d)
+{
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    int64_t t;
+    void *obj = NULL;
+
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if (t <= b) {
+        obj = __atomic_load_n(&d->buf[b & d->mask], __ATOMIC_RELAXED);
+        if (t == b) {
+            if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                obj = NULL;
+            }
+            __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return obj;
+}
+
+/* 任何 thread：從 top 拿最舊的，CAS 失敗 (被別人搶走) 就回 NULL */
+static inline void *
+ws_steal(struct ws_deque *d)
+{
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    int64_t b;
+    void *obj;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return NULL;
+    }
+    obj = __atomic_load_n(&d->buf[t & d->mask], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return obj;
+}
+
+/* ---------------- 資料結構 ---------------- */
+struct lat_stats {
+    uint64_t ios;
+    uint64_t errors;
+    uint64_t lat_sum_ns;
+    uint64_t lat_max_ns;
+    uint64_t dev_sum_ns;        // submit → bdev completion
+    uint64_t wait_sum_ns;       // 在 sq / deque / cq 裡排隊的時間
+    uint64_t compute_sum_ns;    // 真正在算 CRC 的時間
+    uint64_t hist[LAT_BUCKETS];
+};
+
+struct io_thread;
+
+struct off_task {
+    struct io_thread *io;
+    void     *buf;
+    uint64_t  submit_tsc;
+    uint64_t  dev_done_tsc;
+    uint64_t  compute_ticks;
+    uint32_t  crc;
+    bool      success;
+};
+
+struct io_thread {
+    int                      idx;
+    int                      core;
+    char                     name[32];
+    struct spdk_thread      *th;
+    struct spdk_io_channel  *ch;
+    struct spdk_poller      *poller;
+    struct off_task          tasks[IO_QD];
+    struct off_task         *free_tasks[IO_QD];
+    uint32_t                 nfree;
+    uint32_t                 outstanding;    // 含還在 offload pool 裡的
+    uint32_t                 next_worker;
+    bool                     stopping;
+    uint64_t                 region_start;
+    uint64_t                 region_slots;
+    uint64_t                 rng;
+    uint64_t                 stats_tsc;
+    uint64_t                 end_tsc;
+    struct lat_stats         stats;
+};
+
+struct offload_worker {
+    int                      idx;
+    int                      core;
+    char                     name[32];
+    struct spdk_thread      *th;
+    struct spdk_poller      *poller;
+    struct ws_deque          dq;
+    uint64_t                 rng;
+    uint64_t                 executed;
+    uint64_t                 stolen;
+    uint64_t                 busy_tsc;
+    uint64_t                 stats_tsc;
+    uint64_t                 end_tsc;
+};
+
+static enum run_mode g_mode = MODE_OFFLOAD;
+static int g_nio = 1;
+static int g_nworkers = 2;
+static uint32_t g_passes = 4;
+static char g_reactor_mask[32];
+
+static struct io_thread g_io[MAX_IO_THREADS];
+static struct offload_worker g_workers[MAX_WORKERS];
+static struct spsc_ring g_sq[MAX_IO_THREADS][MAX_WORKERS];     // io thread → worker
+static struct spsc_ring g_cq[MAX_WORKERS][MAX_IO_THREADS];     // worker → io thread
+
+static struct spdk_bdev_desc *g_desc;
+static uint32_t g_block_size;
+static struct spdk_poller *g_timer;
+static int g_pending;
+static int g_rc;
+
+static double
+lat_percentile_us(const struct lat_stats *s, double p)
+{
+    return lat_hist_percentile_us(s->hist, s->ios, s->lat_max_ns, p);
+}
+
+static inline uint64_t
+ticks_to_ns(uint64_t ticks)
+{
+    return ticks * SPDK_SEC_TO_NSEC / spdk_get_ticks_hz();
+}
+
+/* 要 offload 的運算本體 */
+static inline uint32_t
+compute_run(struct off_task *task)
+{
+    uint32_t crc = ~0u;
+
+    for (uint32_t i = 0; i < g_passes; i++) {
+        crc = spdk_crc32c_update(task->buf, IO_SIZE, crc);
+    }
+    return ~crc;
+}
+
+/* ---------------- offload worker ---------------- */
+static void worker_exited(void *arg);
+
+static inline void
+worker_exec(struct offload_worker *ow, struct off_task *task)
+{
+    uint64_t start = spdk_get_ticks();
+    int rc;
+
+    task->crc = compute_run(task);
+    task->compute_ticks = spdk_get_ticks() - start;
+    ow->executed++;
+    rc = spsc_enqueue(&g_cq[ow->idx][task->io->idx], task);
+    assert(rc == 0);    // cq 容量 >= IO_QD
+    (void)rc;
+}
+
+static int
+worker_poll(void *arg)
+{
+    struct offload_worker *ow = arg;
+    void *in[OFFLOAD_BATCH];
+    struct off_task *task;
+    uint64_t start = spdk_get_ticks();
+    int done = 0;
+
+    for (int i = 0; i < g_nio; i++) {
+        uint32_t n = spsc_dequeue(&g_sq[i][ow->idx], in, OFFLOAD_BATCH);
+
+        for (uint32_t j = 0; j < n; j++) {
+            int rc = ws_push(&ow->dq, in[j]);
+
+            assert(rc == 0);    // deque 容量 >= 所有 io thread 的 QD 總和
+            (void)rc;
+        }
+    }
+
+    while (done < OFFLOAD_BATCH && (task = ws_pop(&ow->dq)) != NULL) {
+        worker_exec(ow, task);
+        done++;
+    }
+
+    /* 自己沒事做才去偷，每輪從隨機的 victim 開始繞一圈，偷到一個就回去 */
+    if (done == 0 && g_mode == MODE_OFFLOAD && g_nworkers > 1) {
+        int first = (int)(xorshift64(&ow->rng) % g_nworkers);
+
+        for (int k = 0; k < g_nworkers; k++) {
+            int v = (first + k) % g_nworkers;
+
+            if (v == ow->idx) {
+                continue;
+            }
+            task = ws_steal(&g_workers[v].dq);
+            if (task) {
+                ow->stolen++;
+                worker_exec(ow, task);
+                done++;
+                break;
+            }
+        }
+    }
+
+    if (done == 0) {
+        return SPDK_POLLER_IDLE;
+    }
+    ow->busy_tsc += spdk_get_ticks() - start;
+    return SPDK_POLLER_BUSY;
+}
+
+static void
+worker_init(void *arg)
+{
+    struct offload_worker *ow = arg;
+
+    ow->poller = SPDK_POLLER_REGISTER(worker_poll, ow, 0);
+    spdk_thread_send_msg(spdk_thread_get_app_thread(), worker_exited, ow);
+}
+
+static void
+worker_reset(void *arg)
+{
+    struct offload_worker *ow = arg;
+
+    ow->executed = ow->stolen = ow->busy_tsc = 0;
+    ow->stats_tsc = spdk_get_ticks();
+}
+
+static void
+worker_fini(void *arg)
+{
+    struct offload_worker *ow = arg;
+
+    ow->end_tsc = spdk_get_ticks();
+    spdk_poller_unregister(&ow->poller);
+    spdk_thread_send_msg(spdk_thread_get_app_thread(), worker_exited, ow);
+    spdk_thread_exit(ow->th);
+}
+
+/* ---------------- io thread ---------------- */
+static void io_exited(void *arg);
+static void io_fill(struct io_thread *io);
+
+static void
+io_fini(struct io_thread *io)
+{
+    spdk_poller_unregister(&io->poller);
+    for (int i = 0; i < IO_QD; i++) {
+        spdk_dma_free(io->tasks[i].buf);
+    }
+    if (io->ch) {
+        spdk_put_io_channel(io->ch);
+    }
+    spdk_thread_send_msg(spdk_thread_get_app_thread(), io_exited, io);
+    spdk_thread_exit(io->th);
+}
+
+/* 運算完成 (inline 或從 cq 收回來)：記錄 latency，送下一個 */
+static void
+io_task_finish(struct io_thread *io, struct off_task *task)
+{
+    uint64_t now = spdk_get_ticks();
+    uint64_t ns = ticks_to_ns(now - task->submit_tsc);
+    uint64_t dev_ns = ticks_to_ns(task->dev_done_tsc - task->submit_tsc);
+    uint64_t compute_ns = ticks_to_ns(task->compute_ticks);
+    struct lat_stats *s = &io->stats;
+
+    s->ios++;
+    s->lat_sum_ns += ns;
+    s->dev_sum_ns += dev_ns;
+    s->compute_sum_ns += compute_ns;
+    s->wait_sum_ns += ns - spdk_min(ns, dev_ns + compute_ns);
+    if (ns > s->lat_max_ns) {
+        s->lat_max_ns = ns;
+    }
+    s->hist[lat_bucket(ns)]++;
+    if (!task->success) {
+        s->errors++;
+    }
+
+    io->outstanding--;
+    io->free_tasks[io->nfree++] = task;
+    if (io->stopping) {
+        if (io->outstanding == 0) {
+            io_fini(io);
+        }
+        return;
+    }
+    io_fill(io);
+}
+
+static void
+io_done(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct off_task *task = cb_arg;
+    struct io_thread *io = task->io;
+    int rc;
+
+    spdk_bdev_free_io(bdev_io);
+    task->dev_done_tsc = spdk_get_ticks();
+    task->success = success;
+
+    if (g_mode == MODE_INLINE) {
+        task->crc = compute_run(task);
+        task->compute_ticks = spdk_get_ticks() - task->dev_done_tsc;
+        io_task_finish(io, task);
+        return;
+    }
+
+    /* round-robin 分給 worker，分得不平均的部分交給 stealing */
+    rc = spsc_enqueue(&g_sq[io->idx][io->next_worker], task);
+    assert(rc == 0);    // sq 容量 >= IO_QD
+    (void)rc;
+    io->next_worker = (io->next_worker + 1) % g_nworkers;
+}
+
+static int
+io_submit_one(struct io_thread *io)
+{
+    struct off_task *task = io->free_tasks[io->nfree - 1];
+    uint64_t io_blocks = IO_SIZE / g_block_size;
+    uint64_t blk = io->region_start + (xorshift64(&io->rng) % io->region_slots) * io_blocks;
+    int rc;
+
+    task->submit_tsc = spdk_get_ticks();
+    rc = spdk_bdev_read_blocks(g_desc, io->ch, task->buf, blk, io_blocks, io_done, task);
+    if (rc != 0) {
+        /* -ENOMEM：bdev_io pool 用完，等下一次 completion 或 poller 再補 */
+        if (rc != -ENOMEM) {
+            fprintf(stderr, "[%s] submit rc=%d\n", io->name, rc);
+            io->stats.errors++;
+        }
+        return rc;
+    }
+    io->nfree--;
+    io->outstanding++;
+    return 0;
+}
+
+static void
+io_fill(struct io_thread *io)
+{
+    while (!io->stopping && io->nfree > 0) {
+        if (io_submit_one(io) != 0) {
+            break;
+        }
+    }
+}
+
+/* 收 offload 的 completion；inline 時只負責 -ENOMEM 之後補 queue */
+static int
+io_poll(void *arg)
+{
+    struct io_thread *io = arg;
+    void *out[IO_QD];
+    int done = 0;
+
+    for (int w = 0; g_mode != MODE_INLINE && w < g_nworkers; w++) {
+        uint32_t n = spsc_dequeue(&g_cq[w][io->idx], out, IO_QD);
+
+        for (uint32_t i = 0; i < n; i++) {
+            io_task_finish(io, out[i]);
+        }
+        done += n;
+    }
+    if (!io->stopping && io->outstanding < IO_QD) {
+        io_fill(io);
+    }
+    return done ? SPDK_POLLER_BUSY : SPDK_POLLER_IDLE;
+}
+
+static void
+io_init(void *arg)
+{
+    struct io_thread *io = arg;
+
+    io->ch = spdk_bdev_get_io_channel(g_desc);
+    if (!io->ch) {
+        fprintf(stderr, "[%s] get_io_channel failed\n", io->name);
+        g_rc = -1;
+    }
+    for (int i = 0; i < IO_QD; i++) {
+        io->tasks[i].io = io;
+        io->tasks[i].buf = spdk_dma_zmalloc(IO_SIZE, 0x1000, NULL);
+        if (!io->tasks[i].buf) {
+            g_rc = -1;
+        }
+        io->free_tasks[io->nfree++] = &io->tasks[i];
+    }
+    spdk_thread_send_msg(spdk_thread_get_app_thread(), io_exited, io);
+}
+
+static void
+io_start(void *arg)
+{
+    struct io_thread *io = arg;
+
+    io->poller = SPDK_POLLER_REGISTER(io_poll, io, 0);
+    io_fill(io);
+}
+
+static void
+io_reset(void *arg)
+{
+    struct io_thread *io = arg;
+
+    memset(&io->stats, 0, sizeof(io->stats));
+    io->stats_tsc = spdk_get_ticks();
+}
+
+static void
+io_stop(void *arg)
+{
+    struct io_thread *io = arg;
+
+    io->end_tsc = spdk_get_ticks();
+    io->stopping = true;
+    if (io->outstanding == 0) {
+        io_fini(io);
+    }
+}
+
+/* ---------------- app thread ---------------- */
+enum app_state {
+    APP_INIT,       // 等 worker / io thread 初始化
+    APP_RUN,        // ramp + 量測中
+    APP_DRAIN,      // 等 io thread 收完在飛的 IO
+    APP_STOP,       // 等 offload worker 結束
+};
+
+static enum app_state g_state = APP_INIT;
+
+static void
+report(void)
+{
+    static struct lat_stats sum;
+    double sec = 0, iops, busy_sum = 0;
+    uint64_t executed = 0, stolen = 0;
+    FILE *f;
+    bool new_file;
+
+    memset(&sum, 0, sizeof(sum));
+    for (int i = 0; i < g_nio; i++) {
+        struct lat_stats *s = &g_io[i].stats;
+
+        sum.ios += s->ios;
+        sum.errors += s->errors;
+        sum.lat_sum_ns += s->lat_sum_ns;
+        sum.dev_sum_ns += s->dev_sum_ns;
+        sum.wait_sum_ns += s->wait_sum_ns;
+        sum.compute_sum_ns += s->compute_sum_ns;
+        sum.lat_max_ns = spdk_max(sum.lat_max_ns, s->lat_max_ns);
+        for (uint32_t b = 0; b < LAT_BUCKETS; b++) {
+            sum.hist[b] += s->hist[b];
+        }
+        sec = spdk_max(sec, (double)(g_io[i].end_tsc - g_io[i].stats_tsc) / spdk_get_ticks_hz());
+    }
+    if (sum.ios == 0 || sec <= 0) {
+        fprintf(stderr, "no IO completed\n");
+        return;
+    }
+    iops = sum.ios / sec;
+
+    printf("mode=%s io_cores=%d offload_cores=%d passes=%u qd=%d bs=%d\n", g_mode_name[g_mode], g_nio,
+           g_mode == MODE_INLINE ? 0 : g_nworkers, g_passes, IO_QD, IO_SIZE);
+    printf("  %10.0f IOPS  %8.1f MiB/s  avg %8.1f  p50 %8.1f  p99 %8.1f  p999 %8.1f  max %8.1f us  err %lu\n", iops,
+           iops * IO_SIZE / (1024 * 1024), sum.lat_sum_ns / 1000.0 / sum.ios, lat_percentile_us(&sum, 50),
+           lat_percentile_us(&sum, 99), lat_percentile_us(&sum, 99.9), sum.lat_max_ns / 1000.0, sum.errors);
+    printf("  per IO: device %.1f us  queued %.1f us  compute %.1f us\n", sum.dev_sum_ns / 1000.0 / sum.ios,
+           sum.wait_sum_ns / 1000.0 / sum.ios, sum.compute_sum_ns / 1000.0 / sum.ios);
+
+    for (int w = 0; g_mode != MODE_INLINE && w < g_nworkers; w++) {
+        struct offload_worker *ow = &g_workers[w];
+        double busy = ow->end_tsc > ow->stats_tsc ? 100.0 * ow->busy_tsc / (ow->end_tsc - ow->stats_tsc) : 0;
+
+        printf("  [%-10s] core %2d  executed %10lu  stolen %8lu  busy %5.1f%%\n", ow->name, ow->core,
+               ow->executed, ow->stolen, busy);
+        executed += ow->executed;
+        stolen += ow->stolen;
+        busy_sum += busy;
+    }
+
+    f = fopen(RESULT_CSV, "a");
+    if (!f) {
+        perror(RESULT_CSV);
+        return;
+    }
+    new_file = ftell(f) == 0;
+    if (new_file) {
+        fprintf(f, "mode,io_cores,offload_cores,passes,qd,bs,sec,iops,avg_us,p50_us,p99_us,p999_us,max_us,"
+                   "device_us,queued_us,compute_us,stolen_pct,worker_busy_pct,errors\n");
+    }
+    fprintf(f, "%s,%d,%d,%u,%d,%d,%.2f,%.0f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f,%lu\n",
+            g_mode_name[g_mode], g_nio, g_mode == MODE_INLINE ? 0 : g_nworkers, g_passes, IO_QD, IO_SIZE, sec,
+            iops, sum.lat_sum_ns / 1000.0 / sum.ios, lat_percentile_us(&sum, 50), lat_percentile_us(&sum, 99),
+            lat_percentile_us(&sum, 99.9), sum.lat_max_ns / 1000.0, sum.dev_sum_ns / 1000.0 / sum.ios,
+            sum.wait_sum_ns / 1000.0 / sum.ios, sum.compute_sum_ns / 1000.0 / sum.ios,
+            executed ? 100.0 * stolen / executed : 0, g_mode == MODE_INLINE ? 0 : busy_sum / g_nworkers,
+            sum.errors);
+    fclose(f);
+}
+
+static int
+run_timer(void *arg)
+{
+    (void)arg;
+
+    spdk_poller_unregister(&g_timer);
+    g_state = APP_DRAIN;
+    g_pending = g_nio;
+    for (int i = 0; i < g_nio; i++) {
+        spdk_thread_send_msg(g_io[i].th, io_stop, &g_io[i]);
+    }
+    return SPDK_POLLER_BUSY;
+}
+
+static int
+ramp_timer(void *arg)
+{
+    (void)arg;
+
+    spdk_poller_unregister(&g_timer);
+    for (int i = 0; i < g_nio; i++) {
+        spdk_thread_send_msg(g_io[i].th, io_reset, &g_io[i]);
+    }
+    for (int w = 0; g_mode != MODE_INLINE && w < g_nworkers; w++) {
+        spdk_thread_send_msg(g_workers[w].th, worker_reset, &g_workers[w]);
+    }
+    g_timer = SPDK_POLLER_REGISTER(run_timer, NULL, RUN_SEC * 1000000ULL);
+    return SPDK_POLLER_BUSY;
+}
+
+static void
+all_stopped(void)
+{
+    if (g_rc == 0) {
+        report();
+    }
+    spdk_bdev_close(g_desc);
+    spdk_app_stop(g_rc);
+}
+
+/* io_init / io_fini 都回這裡，靠 g_state 分辨 */
+static void
+io_exited(void *arg)
+{
+    (void)arg;
+
+    if (--g_pending > 0) {
+        return;
+    }
+    if (g_state == APP_INIT) {
+        if (g_rc != 0) {
+            /* 初始化失敗：不送 IO，直接走收尾 */
+            run_timer(NULL);
+            return;
+        }
+        g_state = APP_RUN;
+        for (int i = 0; i < g_nio; i++) {
+            spdk_thread_send_msg(g_io[i].th, io_start, &g_io[i]);
+        }
+        g_timer = SPDK_POLLER_REGISTER(ramp_timer, NULL, RAMP_SEC * 1000000ULL);
+        return;
+    }
+
+    /* io thread 都收完了，pool 裡不會再有 task，可以關 worker */
+    if (g_mode == MODE_INLINE) {
+        all_stopped();
+        return;
+    }
+    g_state = APP_STOP;
+    g_pending = g_nworkers;
+    for (int w = 0; w < g_nworkers; w++) {
+        spdk_thread_send_msg(g_workers[w].th, worker_fini, &g_workers[w]);
+    }
+}
+
+static void
+worker_exited(void *arg)
+{
+    (void)arg;
+
+    if (--g_pending > 0) {
+        return;
+    }
+    if (g_state == APP_STOP) {
+        all_stopped();
+        return;
+    }
+    /* worker 都就緒，接著起 io thread */
+    g_pending = g_nio;
+    for (int i = 0; i < g_nio; i++) {
+        spdk_thread_send_msg(g_io[i].th, io_init, &g_io[i]);
+    }
+}
+
+static int
+alloc_rings(void)
+{
+    uint32_t ring_size = pow2_roundup(IO_QD);
+    uint32_t dq_size = pow2_roundup(IO_QD * g_nio);
+
+    for (int w = 0; w < g_nworkers; w++) {
+        if (ws_init(&g_workers[w].dq, dq_size) != 0) {
+            return -ENOMEM;
+        }
+        for (int i = 0; i < g_nio; i++) {
+            if (spsc_init(&g_sq[i][w], ring_size) != 0 || spsc_init(&g_cq[w][i], ring_size) != 0) {
+                return -ENOMEM;
+            }
+        }
+    }
+    return 0;
+}
+
+static void
+bdev_event_cb(enum spdk_bdev_event_type type, struct spdk_bdev *bdev, void *event_ctx)
+{
+    (void)event_ctx;
+    if (type == SPDK_BDEV_EVENT_REMOVE) {
+        fprintf(stderr, "bdev %s removed, stopping\n", spdk_bdev_get_name(bdev));
+        g_rc = -1;
+        spdk_app_stop(-1);
+        return;
+    }
+    printf("bdev %s event %d ignored\n", spdk_bdev_get_name(bdev), type);
+}
+
+static void
+app_start(void *arg)
+{
+    struct spdk_cpuset cpumask;
+    struct spdk_bdev *bdev;
+    uint64_t slots;
+    int rc;
+
+    (void)arg;
+    rc = spdk_bdev_open_ext(BDEV_NAME, false, bdev_event_cb, NULL, &g_desc);
+    if (rc != 0) {
+        fprintf(stderr, "open bdev %s failed rc=%d\n", BDEV_NAME, rc);
+        spdk_app_stop(-1);
+        return;
+    }
+    bdev = spdk_bdev_desc_get_bdev(g_desc);
+    g_block_size = spdk_bdev_get_block_size(bdev);
+    slots = spdk_bdev_get_num_blocks(bdev) / (IO_SIZE / g_block_size) / g_nio;
+    if (IO_SIZE % g_block_size || slots == 0) {
+        fprintf(stderr, "IO_SIZE %d does not fit bdev block size %u\n", IO_SIZE, g_block_size);
+        spdk_bdev_close(g_desc);
+        spdk_app_stop(-1);
+        return;
+    }
+    if (g_mode != MODE_INLINE && alloc_rings() != 0) {
+        fprintf(stderr, "ring alloc failed\n");
+        spdk_bdev_close(g_desc);
+        spdk_app_stop(-1);
+        return;
+    }
+
+    /* io thread：core 1..nio，各自讀 bdev 的一段 */
+    for (int i = 0; i < g_nio; i++) {
+        struct io_thread *io = &g_io[i];
+
+        io->idx = i;
+        io->core = 1 + i;
+        io->region_slots = slots;
+        io->region_start = slots * (IO_SIZE / g_block_size) * i;
+        io->rng = 0x9E3779B97F4A7C15ULL ^ (uint64_t)(i + 1);
+        snprintf(io->name, sizeof(io->name), "io%d", i);
+        spdk_cpuset_zero(&cpumask);
+        spdk_cpuset_set_cpu(&cpumask, io->core, true);
+        io->th = spdk_thread_create(io->name, &cpumask);
+    }
+
+    if (g_mode == MODE_INLINE) {
+        g_pending = 1;
+        worker_exited(NULL);
+        return;
+    }
+
+    /* offload worker：接在 io thread 後面的 core */
+    g_pending = g_nworkers;
+    for (int w = 0; w < g_nworkers; w++) {
+        struct offload_worker *ow = &g_workers[w];
+
+        ow->idx = w;
+        ow->core = 1 + g_nio + w;
+        ow->rng = 0xD1B54A32D192ED03ULL ^ (uint64_t)(w + 1);
+        snprintf(ow->name, sizeof(ow->name), "offload%d", w);
+        spdk_cpuset_zero(&cpumask);
+        spdk_cpuset_set_cpu(&cpumask, ow->core, true);
+        ow->th = spdk_thread_create(ow->name, &cpumask);
+        spdk_thread_send_msg(ow->th, worker_init, ow);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct spdk_app_opts opts;
+    int ncores;
+    int rc;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <inline|offload|nosteal> [io_cores] [offload_cores] [passes] [bdev.json]\n",
+                argv[0]);
+        return -1;
+    }
+    for (rc = 0; rc < (int)SPDK_COUNTOF(g_mode_name); rc++) {
+        if (strcmp(argv[1], g_mode_name[rc]) == 0) {
+            g_mode = rc;
+            break;
+        }
+    }
+    if (rc == (int)SPDK_COUNTOF(g_mode_name)) {
+        fprintf(stderr, "unknown mode %s\n", argv[1]);
+        return -1;
+    }
+    if (argc > 2) {
+        g_nio = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        g_nworkers = atoi(argv[3]);
+    }
+    if (argc > 4) {
+        g_passes = (uint32_t)atoi(argv[4]);
+    }
+    if (g_nio < 1 || g_nio > MAX_IO_THREADS || g_nworkers < 1 || g_nworkers > MAX_WORKERS) {
+        fprintf(stderr, "io_cores must be 1..%d, offload_cores 1..%d\n", MAX_IO_THREADS, MAX_WORKERS);
+        return -1;
+    }
+    if (g_mode == MODE_INLINE) {
+        g_nworkers = 0;
+    }
+
+    ncores = 1 + g_nio + g_nworkers;
+    if (ncores > 64) {
+        fprintf(stderr, "too many cores (%d)\n", ncores);
+        return -1;
+    }
+    snprintf(g_reactor_mask, sizeof(g_reactor_mask), "0x%llx",
+             ncores == 64 ? ~0ULL : (1ULL << ncores) - 1);
+
+    spdk_app_opts_init(&opts, sizeof(opts));
+    opts.name = "bdev_offload_pool";
+    opts.reactor_mask = g_reactor_mask;
+    if (spdk_bench_preflight_run(opts.name, opts.reactor_mask, NULL) != 0) {
+        return -1;
+    }
+    if (argc > 5) {
+        opts.json_config_file = argv[5];
+    }
+
+    rc = spdk_app_start(&opts, app_start, NULL);
+    if (rc) {
+        fprintf(stderr, "spdk_app_start rc=%d\n", rc);
+    }
+    spdk_app_fini();
+    return rc;
+}
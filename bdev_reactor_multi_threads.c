@@ -2,118 +2,386 @@
 單一 reactor 上有多個 SPDK threads（每個 thread 都各自拿到一條 bdev io_channel → 對應到底層各自的 NVMe qpair）
 
 註：同一 reactor 下的多 SPDK thread 不會發生真正的 CPU context switch，是協作式輪詢，不像 OS 內核 thread 那樣上下文切換
+
+channel 模式 (argv[1])：
+  private : 原本的行為，每個 thread 自己 spdk_bdev_get_io_channel → N 個 thread 就有 N 個 qpair、
+            N 個 bdev_nvme poll group poller，reactor 每一輪都要把它們全部 poll 一遍
+  shared  : 只有 leader thread (t0) 拿 channel，其他 thread 的 IO 掛到 reactor 共用的 pending list，
+            由 leader 的 poller 在 leader 自己的 thread context 送出；completion 也回到 leader，直接更新原 thread 的計數
+            → 整個 reactor 只有一個 qpair / 一個 poll group
+  同一 reactor 上的 thread 由同一個 OS thread 輪流執行，所以 pending list 不需要 lock 也不需要 atomic。
+  thread 都用只含 REACTOR_CORE 的 cpumask 建立，scheduler 不會把它們搬走 (存取 list 時都 assert 目前的 core)；
+  channel 也只在 leader 上使用，bdev 層看到的永遠是 channel 所屬的 thread
+
+  sudo ./bdev_reactor_multi_threads [private|shared] [threads] [bdev.json]
+
+每個 thread 維持 IO_QD 個 read 跑 RUN_SEC 秒，輸出 IOPS、平均 latency、channel (qpair) 數，
+以及 spdk_thread_get_stats 的 busy/idle tsc：idle 幾乎都是空 poll 的 poll group，busy ticks/IO 是每個 IO 的 CPU 成本。
+threads 從 1 往上加，兩種模式各跑一次，就能看到 polling 成本怎麼跟著 thread 數長
 */
 #include "spdk/stdinc.h"
 #include "spdk/env.h"
 #include "spdk/event.h"
 #include "spdk/bdev.h"
 #include "spdk/thread.h"
+#include "spdk/queue.h"
+#include "spdk/util.h"
+#include "spdk_bench_preflight.h"
+#include "spdk_bench_util.h"
 
-#define THREADS_PER_REACTOR  3     // 同一個 reactor 上要建立的 threads 數
-#define IO_PER_THREAD        8     // 每個 thread 送出的 IO（read）數
+#define THREADS_PER_REACTOR  3     // 同一個 reactor 上要建立的 threads 數 (argv[2] 可覆蓋)
+#define MAX_THREADS          64
+#define IO_QD                8     // 每個 thread 同時在飛的 IO（read）數
+#define RAMP_SEC             1
+#define RUN_SEC              5
+#define REACTOR_CORE         0
 #define BDEV_NAME            "Nvme0n1"  // 依你的環境調整
 
+struct thread_ctx;
+
+struct io_task {
+    struct thread_ctx *tctx;
+    void *buf;
+    uint64_t submit_tsc;
+    TAILQ_ENTRY(io_task) link;
+};
+
+TAILQ_HEAD(io_task_list, io_task);
+
 struct thread_ctx {
     struct spdk_thread      *th;
     struct spdk_bdev_desc   *desc;
-    struct spdk_io_channel  *ch;
+    struct spdk_io_channel  *ch;        // shared 模式只有 leader 有
     struct spdk_bdev        *bdev;
-    uint64_t                 submitted;
+    struct spdk_poller      *poller;    // 送 pending list 的 poller (shared 模式只有 leader 有)
+    struct io_task_list      retry;     // private 模式：自己 -ENOMEM 的 IO
+    struct io_task           tasks[IO_QD];
+    uint64_t                 rng;
     uint64_t                 completed;
+    uint64_t                 lat_sum_tsc;
+    uint64_t                 start_tsc;
+    uint64_t                 end_tsc;
+    struct spdk_thread_stats stats_start;
+    struct spdk_thread_stats stats_end;
     char                     name[32];
 };
 
-struct io_task {
-    struct thread_ctx *tctx;
-    void *buf;
-};
-
-static struct thread_ctx g_ctx[THREADS_PER_REACTOR];
+static struct thread_ctx g_ctx[MAX_THREADS];
+static struct thread_ctx *g_leader = &g_ctx[0];
+static struct io_task_list g_shared_pending = TAILQ_HEAD_INITIALIZER(g_shared_pending);
+static int g_nthreads = THREADS_PER_REACTOR;
+static bool g_shared = false;
 static struct spdk_bdev_desc *g_desc = NULL;
-static uint64_t g_total_expected = 0;
-static uint64_t g_total_completed = 0;
+static struct spdk_poller *g_timer;
+static uint64_t g_outstanding = 0;
+static bool g_stopping = false;
+static int g_pending;
+static int g_rc;
+
+static void submit_one_io(struct thread_ctx *t, struct io_task *task);
+static void all_drained(void *arg);
+static void run_abort(void *arg);
 
+/* 等著送出去的 IO 掛在哪：shared 是整個 reactor 一條，private 是各 thread 自己的 */
+static inline struct io_task_list *
+pending_list(struct thread_ctx *t)
+{
+    return g_shared ? &g_shared_pending : &t->retry;
+}
+
+static void
+io_task_retire(void)
+{
+    if (__atomic_sub_fetch(&g_outstanding, 1, __ATOMIC_RELAXED) == 0) {
+        spdk_thread_send_msg(spdk_thread_get_app_thread(), all_drained, NULL);
+    }
+}
+
+/* private：跑在 t 自己的 thread；shared：一律跑在 leader (channel 的擁有者) */
 static void
 io_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 {
     struct io_task *task = cb_arg;
     struct thread_ctx *t = task->tctx;
 
+    spdk_bdev_free_io(bdev_io);
+    if (!success) {
+        fprintf(stderr, "[%s] I/O failed\n", t->name);
+    }
     t->completed++;
-    __atomic_fetch_add(&g_total_completed, 1, __ATOMIC_RELAXED);
+    t->lat_sum_tsc += spdk_get_ticks() - task->submit_tsc;
 
-    printf("[%-10s] I/O completed: %s  (thread: %lu/%lu, total: %lu/%lu)\n",
-           spdk_thread_get_name(spdk_get_thread()),
-           success ? "OK" : "FAIL",
-           t->completed, (uint64_t)IO_PER_THREAD,
-           g_total_completed, g_total_expected);
+    if (g_stopping) {
+        io_task_retire();
+        return;
+    }
+    submit_one_io(t, task);
+}
 
-    spdk_bdev_free_io(bdev_io);
-    spdk_free(task->buf);
-    free(task);
+static int
+bdev_submit(struct spdk_io_channel *ch, struct io_task *task)
+{
+    struct thread_ctx *t = task->tctx;
+    uint64_t nb = spdk_bdev_get_num_blocks(t->bdev);
+    uint64_t lba = xorshift64(&t->rng) % (nb ? nb : 1);
 
-    if (g_total_completed == g_total_expected) {
-        spdk_app_stop(0);
-    }
+    return spdk_bdev_read_blocks(t->desc, ch, task->buf, lba, 1, io_complete, task);
 }
 
 static void
-submit_one_io(struct thread_ctx *t, uint64_t lba, uint32_t num_blocks)
+submit_one_io(struct thread_ctx *t, struct io_task *task)
 {
-    struct io_task *task = calloc(1, sizeof(*task));
-    if (!task) {
-        fprintf(stderr, "[%s] calloc io_task failed\n", t->name);
-        return;
-    }
-    task->tctx = t;
+    struct spdk_io_channel *ch = g_shared ? g_leader->ch : t->ch;
+    int rc;
 
-    uint32_t bsz = spdk_bdev_get_block_size(t->bdev);
-    task->buf = spdk_zmalloc((size_t)bsz * num_blocks, 0x1000, NULL,
-                             SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
-    if (!task->buf) {
-        fprintf(stderr, "[%s] spdk_zmalloc failed\n", t->name);
-        free(task);
+    task->submit_tsc = spdk_get_ticks();
+    if (g_shared && spdk_get_thread() != g_leader->th) {
+        /* 不是 channel 的擁有者：掛到 pending，等 leader 的 poller 送 */
+        assert(spdk_env_get_current_core() == REACTOR_CORE);
+        TAILQ_INSERT_TAIL(&g_shared_pending, task, link);
         return;
     }
-
-    int rc = spdk_bdev_read(t->desc, t->ch, task->buf,
-                            lba * bsz, bsz * num_blocks,
-                            io_complete, task);
-    if (rc == 0) {
-        t->submitted++;
-        printf("[%-10s] submit READ  lba=%" PRIu64 " blocks=%u (submitted %lu/%u)\n",
-               t->name, lba, num_blocks, t->submitted, (uint32_t)IO_PER_THREAD);
-    } else {
+    rc = bdev_submit(ch, task);
+    if (rc == -ENOMEM) {
+        /* bdev_io pool 用完，等 poller 重送 */
+        TAILQ_INSERT_TAIL(pending_list(t), task, link);
+    } else if (rc != 0) {
         fprintf(stderr, "[%s] spdk_bdev_read submit failed rc=%d\n", t->name, rc);
-        spdk_free(task->buf);
-        free(task);
+        io_task_retire();
     }
 }
 
+/* 把 pending list 送進 self 的 channel；shared 模式只在 leader 上註冊 */
+static int
+pending_poll(void *arg)
+{
+    struct thread_ctx *self = arg;
+    struct io_task_list *list = pending_list(self);
+    struct io_task *task;
+    int n = 0;
+
+    assert(spdk_env_get_current_core() == REACTOR_CORE);
+    while ((task = TAILQ_FIRST(list)) != NULL) {
+        if (g_stopping) {
+            /* 收尾中：還沒送出去的就不送了 */
+            TAILQ_REMOVE(list, task, link);
+            io_task_retire();
+            continue;
+        }
+        if (bdev_submit(self->ch, task) == -ENOMEM) {
+            break;
+        }
+        TAILQ_REMOVE(list, task, link);
+        n++;
+    }
+    return n ? SPDK_POLLER_BUSY : SPDK_POLLER_IDLE;
+}
+
 static void
 thread_work(void *arg)
 {
     struct thread_ctx *t = arg;
     t->bdev = spdk_bdev_desc_get_bdev(t->desc);
 
-    t->ch = spdk_bdev_get_io_channel(t->desc);
-    if (!t->ch) {
-        fprintf(stderr, "[%s] get_io_channel failed\n", t->name);
+    if (g_stopping) {
+        /* 別的 thread 初始化失敗，已經在收尾 */
+        return;
+    }
+    /* shared 模式只有 leader 拿 channel，其他 thread 完全不碰 bdev_nvme 的 poll group */
+    if (!g_shared || t == g_leader) {
+        t->ch = spdk_bdev_get_io_channel(t->desc);
+        if (!t->ch) {
+            fprintf(stderr, "[%s] get_io_channel failed\n", t->name);
+            spdk_thread_send_msg(spdk_thread_get_app_thread(), run_abort, NULL);
+            return;
+        }
+        t->poller = SPDK_POLLER_REGISTER(pending_poll, t, 0);
+    }
+
+    printf("[%-10s] start on reactor core %d, channel: %s\n",
+           t->name, spdk_env_get_current_core(), t->ch ? "own" : "shared via leader");
+
+    for (uint32_t i = 0; i < IO_QD; ++i) {
+        struct io_task *task = &t->tasks[i];
+
+        task->tctx = t;
+        task->buf = spdk_zmalloc(spdk_bdev_get_block_size(t->bdev), 0x1000, NULL,
+                                 SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
+        if (!task->buf) {
+            fprintf(stderr, "[%s] spdk_zmalloc failed\n", t->name);
+            spdk_thread_send_msg(spdk_thread_get_app_thread(), run_abort, NULL);
+            return;
+        }
+        __atomic_fetch_add(&g_outstanding, 1, __ATOMIC_RELAXED);
+        submit_one_io(t, task);
+    }
+}
+
+/* ---------------- 量測 / 收尾 ---------------- */
+static void
+thread_reset(void *arg)
+{
+    struct thread_ctx *t = arg;
+
+    t->completed = 0;
+    t->lat_sum_tsc = 0;
+    t->start_tsc = spdk_get_ticks();
+    spdk_thread_get_stats(&t->stats_start);
+}
+
+static void
+thread_stop(void *arg)
+{
+    struct thread_ctx *t = arg;
+
+    t->end_tsc = spdk_get_ticks();
+    spdk_thread_get_stats(&t->stats_end);
+}
+
+static void
+thread_exited(void *arg)
+{
+    (void)arg;
+
+    if (--g_pending > 0) {
         return;
     }
+    spdk_bdev_close(g_desc);
+    spdk_app_stop(g_rc);
+}
+
+static void
+thread_fini(void *arg)
+{
+    struct thread_ctx *t = arg;
+
+    spdk_poller_unregister(&t->poller);
+    for (uint32_t i = 0; i < IO_QD; ++i) {
+        spdk_free(t->tasks[i].buf);
+    }
+    if (t->ch) {
+        spdk_put_io_channel(t->ch);
+    }
+    spdk_thread_send_msg(spdk_thread_get_app_thread(), thread_exited, t);
+    spdk_thread_exit(t->th);
+}
 
-    uint64_t nb  = spdk_bdev_get_num_blocks(t->bdev);
-    uint32_t bsz = spdk_bdev_get_block_size(t->bdev);
-    (void)bsz;
+static void
+report(void)
+{
+    uint64_t ios = 0, lat_tsc = 0, busy = 0, idle = 0;
+    double sec = 0;
+    int channels = 0;
 
-    printf("[%-10s] start on reactor core %d, nb=%" PRIu64 " blocks, bsz=%u\n",
-           t->name, spdk_env_get_current_core(), nb, bsz);
+    for (int i = 0; i < g_nthreads; i++) {
+        struct thread_ctx *t = &g_ctx[i];
+        uint64_t t_busy = t->stats_end.busy_tsc - t->stats_start.busy_tsc;
+        uint64_t t_idle = t->stats_end.idle_tsc - t->stats_start.idle_tsc;
+        double t_sec = (double)(t->end_tsc - t->start_tsc) / spdk_get_ticks_hz();
 
-    /* 送出多個 read IO；這裡用簡單的遞增 LBA（也可改成隨機） */
-    for (uint32_t i = 0; i < IO_PER_THREAD; ++i) {
-        uint64_t lba = (i % (nb ? nb : 1));   // 保證在範圍內
-        submit_one_io(t, lba, 1);
+        printf("[%-10s] %8.0f IOPS  busy %12lu  idle %12lu tsc\n",
+               t->name, t_sec > 0 ? t->completed / t_sec : 0, t_busy, t_idle);
+        ios += t->completed;
+        lat_tsc += t->lat_sum_tsc;
+        busy += t_busy;
+        idle += t_idle;
+        channels += t->ch != NULL;
+        sec = spdk_max(sec, t_sec);
     }
+    if (ios == 0 || sec <= 0) {
+        fprintf(stderr, "no IO completed\n");
+        return;
+    }
+    printf("mode=%s threads=%d channels=%d qd/thread=%d: %.0f IOPS  avg %.1f us  "
+           "busy %.0f ticks/IO  idle(polling) %.1f%% of thread time\n",
+           g_shared ? "shared" : "private", g_nthreads, channels, IO_QD, ios / sec,
+           (double)lat_tsc / ios * 1e6 / spdk_get_ticks_hz(), (double)busy / ios,
+           busy + idle ? 100.0 * idle / (busy + idle) : 0);
+}
+
+/* 所有在飛的 IO 都收完了：印結果，各 thread 放掉 channel 後結束 */
+static void
+all_drained(void *arg)
+{
+    (void)arg;
+
+    if (g_rc == 0) {
+        report();
+    }
+    g_pending = g_nthreads;
+    for (int i = 0; i < g_nthreads; i++) {
+        spdk_thread_send_msg(g_ctx[i].th, thread_fini, &g_ctx[i]);
+    }
+}
+
+static int
+run_timer(void *arg)
+{
+    (void)arg;
+
+    spdk_poller_unregister(&g_timer);
+    for (int i = 0; i < g_nthreads; i++) {
+        spdk_thread_send_msg(g_ctx[i].th, thread_stop, &g_ctx[i]);
+    }
+    g_stopping = true;
+    return SPDK_POLLER_BUSY;
+}
+
+static int
+ramp_timer(void *arg)
+{
+    (void)arg;
+
+    spdk_poller_unregister(&g_timer);
+    for (int i = 0; i < g_nthreads; i++) {
+        spdk_thread_send_msg(g_ctx[i].th, thread_reset, &g_ctx[i]);
+    }
+    g_timer = SPDK_POLLER_REGISTER(run_timer, NULL, RUN_SEC * 1000000ULL);
+    return SPDK_POLLER_BUSY;
+}
+
+/*
+ * 有 thread 拿不到 channel 或 buffer、或 bdev 被移除：不量了，直接進收尾，g_rc 沒設過就設成 -1。
+ * 已經送出去的 IO 照常收回 (g_stopping 之後 completion 只 retire)；leader 沒有 channel 時
+ * shared pending list 沒人送，這裡直接 retire 掉，否則 g_outstanding 永遠到不了 0
+ */
+static void
+run_abort(void *arg)
+{
+    struct io_task *task;
+
+    (void)arg;
+    if (g_rc == 0) {
+        g_rc = -1;
+    }
+    if (g_stopping) {
+        return;
+    }
+    spdk_poller_unregister(&g_timer);
+    g_stopping = true;
+    if (g_shared && !g_leader->ch) {
+        while ((task = TAILQ_FIRST(&g_shared_pending)) != NULL) {
+            TAILQ_REMOVE(&g_shared_pending, task, link);
+            __atomic_sub_fetch(&g_outstanding, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (__atomic_load_n(&g_outstanding, __ATOMIC_RELAXED) == 0) {
+        all_drained(NULL);
+    }
+}
+
+static void
+bdev_event_cb(enum spdk_bdev_event_type type, struct spdk_bdev *bdev, void *event_ctx)
+{
+    (void)event_ctx;
+    if (type == SPDK_BDEV_EVENT_REMOVE) {
+        /* 走 run_abort 收尾：thread_exited 的 spdk_app_stop(g_rc) 才不會把結果蓋回 0 */
+        fprintf(stderr, "bdev %s removed, stopping\n", spdk_bdev_get_name(bdev));
+        g_rc = -ENODEV;
+        run_abort(NULL);
+        return;
+    }
+    printf("bdev %s event %d ignored\n", spdk_bdev_get_name(bdev), type);
 }
 
 static void
@@ -121,7 +389,8 @@ app_start(void *arg)
 {
     (void)arg;
     struct spdk_bdev *bdev = NULL;
-    int rc = spdk_bdev_open_ext(BDEV_NAME, true, NULL, NULL, &g_desc);
+    struct spdk_cpuset cpumask;
+    int rc = spdk_bdev_open_ext(BDEV_NAME, true, bdev_event_cb, NULL, &g_desc);
     if (rc != 0) {
         fprintf(stderr, "open bdev %s failed rc=%d\n", BDEV_NAME, rc);
         spdk_app_stop(-1);
@@ -129,20 +398,22 @@ app_start(void *arg)
     }
     bdev = spdk_bdev_desc_get_bdev(g_desc);
 
-    g_total_expected = THREADS_PER_REACTOR * IO_PER_THREAD;
-    g_total_completed = 0;
+    spdk_cpuset_zero(&cpumask);
+    spdk_cpuset_set_cpu(&cpumask, REACTOR_CORE, true);
 
     /* 在同一個 reactor（因為 reactor_mask=0x1）上建立多個 SPDK threads */
-    for (int i = 0; i < THREADS_PER_REACTOR; ++i) {
+    for (int i = 0; i < g_nthreads; ++i) {
         snprintf(g_ctx[i].name, sizeof(g_ctx[i].name), "t%d", i);
-        g_ctx[i].th   = spdk_thread_create(g_ctx[i].name, NULL);
+        g_ctx[i].th   = spdk_thread_create(g_ctx[i].name, &cpumask);
         g_ctx[i].desc = g_desc;
         g_ctx[i].bdev = bdev;
-        g_ctx[i].submitted = g_ctx[i].completed = 0;
+        g_ctx[i].rng  = 0x9E3779B97F4A7C15ULL ^ (uint64_t)(i + 1);
+        TAILQ_INIT(&g_ctx[i].retry);
 
         /* 把工作投遞到該 thread 執行（同一個 reactor 的 loop 會輪流跑它們） */
         spdk_thread_send_msg(g_ctx[i].th, thread_work, &g_ctx[i]);
     }
+    g_timer = SPDK_POLLER_REGISTER(ramp_timer, NULL, RAMP_SEC * 1000000ULL);
 }
 
 int main(int argc, char **argv)
@@ -152,6 +423,27 @@ int main(int argc, char **argv)
     opts.name = "bdev_reactor_multi_threads";
     opts.reactor_mask = "0x1";  // 單一 reactor（core0）
 
+    if (argc > 1) {
+        if (strcmp(argv[1], "shared") != 0 && strcmp(argv[1], "private") != 0) {
+            fprintf(stderr, "usage: %s [private|shared] [threads] [bdev.json]\n", argv[0]);
+            return -1;
+        }
+        g_shared = strcmp(argv[1], "shared") == 0;
+    }
+    if (argc > 2) {
+        g_nthreads = atoi(argv[2]);
+        if (g_nthreads < 1 || g_nthreads > MAX_THREADS) {
+            fprintf(stderr, "threads must be 1..%d\n", MAX_THREADS);
+            return -1;
+        }
+    }
+    if (argc > 3) {
+        opts.json_config_file = argv[3];
+    }
+    if (spdk_bench_preflight_run(opts.name, opts.reactor_mask, NULL) != 0) {
+        return -1;
+    }
+
     int rc = spdk_app_start(&opts, app_start, NULL);
     if (rc) fprintf(stderr, "spdk_app_start rc=%d\n", rc);
     spdk_app_fini();
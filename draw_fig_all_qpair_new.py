@@ -16,6 +16,18 @@ if not os.path.exists(csv_file):
 # === 1. 讀取 CSV ===
 df = pd.read_csv(csv_file)
 
+# spdk_job_engine 的 CSV：只取 steady 列，欄位換成這裡用的名字 (thread_num = 每個 core 的 thread 數)
+if "mibps" in df.columns and "throughput" not in df.columns:
+    df = df[df["phase"] == "steady"].copy()
+    # colocate 的 job 寄住在別的 job 的 thread 上，cores 是 0；CSV 裡看不出 host 是誰，不畫
+    colocated = df["cores"] == 0
+    if colocated.any():
+        print(f"Warning: skip colocated jobs (cores=0): {', '.join(sorted(df.loc[colocated, 'job'].unique()))}")
+        df = df[~colocated].copy()
+    df["core_num"] = df["cores"]
+    df["thread_num"] = df["threads"] // df["cores"]
+    df["throughput"] = df["mibps"].astype(str) + " MiB/s"
+
 # === 2. throughput 單位轉換 ===
 def to_mibps(val):
     if pd.isna(val):
@@ -96,7 +108,15 @@ metrics = [
     ("iops", "IOPS", ymax_iops),
     ("thr_cpu_util", "Thread CPU Util (%)", None),
     ("po_cpu_util", "Poller CPU Util (%)", None),
+    # spdk_perf_counters：每個 IO 的硬體 counter，看 thread 變多時慢在 cache 還是 TLB
+    ("cycles_per_io", "Cycles / IO", None),
+    ("ipc", "IPC", None),
+    ("llc_miss_per_io", "LLC miss / IO", None),
+    ("dtlb_miss_per_io", "dTLB miss / IO", None),
+    ("br_miss_per_io", "Branch miss / IO", None),
 ]
+# 沒有的欄位 (或整欄空的，例如 counter 開不起來) 不畫
+metrics = [m for m in metrics if m[0] in df.columns and df[m[0]].notna().any()]
 html1 = "<h2>View 1: by bs</h2><table border=1>"
 
 for metric, ylabel, ymax in metrics:
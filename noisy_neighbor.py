@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+"""
+noisy neighbor：頻寬大的 aggressor 和延遲敏感的 victim 共用資源時，victim 的 latency 被拉高多少
+
+用 spdk_job_engine 跑，每種 aggressor 各跑一輪共用層級，最後和 victim 單獨跑 (none) 的結果比：
+  none          只有 victim
+  same_device   aggressor 在別的 core，只共用 device (--aggr-bdev 給同 controller 的另一個 namespace 就是只共用 controller)
+  same_reactor  aggressor 在同一個 core 的另一條 SPDK thread：搶 reactor 的 CPU，qpair / poll group 各自一份
+  same_thread   aggressor 寄住在 victim 的 thread (colocate)：同一條 io_channel，bdev_nvme 的 poll group 和 qpair 都共用
+bdev_nvme 的 poll group 是每條 thread 一個，所以「同 poll group」就是 same_thread。
+
+  sudo python3 noisy_neighbor.py --json jobs/nvme_tcp_bdev.json --bdev Nvme0n1 --victim-core 1 --other-core 2 \\
+      --aggressor seqwrite:rw=write,bs=131072,qd=32 --aggressor hotread:rw=randread,bs=4096,qd=128
+  python3 noisy_neighbor.py ... --dry-run        # 只產生 ini，不跑
+
+每輪的 ini 和 engine 的 CSV 放在 --out 目錄，彙整表印在 stdout 並寫到 <out>/summary.csv：
+  victim 的 IOPS / p50 / p99 / p999 (us)，和 none 相比的倍數，以及 aggressor 同時跑出的 MiB/s
+"""
+import argparse
+import csv
+import os
+import subprocess
+import sys
+from typing import Dict, List, Optional, Tuple
+
+LEVELS = ["none", "same_device", "same_reactor", "same_thread"]
+
+
+def warn(msg: str):
+    print(f"[WARN] {msg}", file=sys.stderr)
+
+
+def info(msg: str):
+    print(f"[INFO] {msg}", file=sys.stderr)
+
+
+def parse_keys(spec: str) -> List[Tuple[str, str]]:
+    keys = []
+    for kv in spec.split(","):
+        kv = kv.strip()
+        if not kv:
+            continue
+        if "=" not in kv:
+            raise ValueError(f"'{kv}' is not key=value")
+        k, v = kv.split("=", 1)
+        keys.append((k.strip(), v.strip()))
+    return keys
+
+
+def parse_aggressor(spec: str) -> Tuple[str, List[Tuple[str, str]]]:
+    if ":" not in spec:
+        raise ValueError(f"--aggressor '{spec}' should be name:key=value,...")
+    name, keys = spec.split(":", 1)
+    return name.strip(), parse_keys(keys)
+
+
+def write_ini(path: str, args, level: str, aggr: Optional[Tuple[str, List[Tuple[str, str]]]], csv_path: str):
+    cores = {args.victim_core}
+    if level == "same_device":
+        cores.add(args.other_core)
+    mask = sum(1 << c for c in cores)
+
+    lines = [
+        f"; noisy_neighbor.py: level={level} aggressor={aggr[0] if aggr else '-'}",
+        "[global]",
+        f"reactor_mask = {hex(mask)}",
+        f"csv          = {csv_path}",
+        f"ramp         = {args.ramp}",
+        f"runtime      = {args.runtime}",
+    ]
+    if args.json:
+        lines.append(f"json_config  = {args.json}")
+    lines += ["", "[victim]", f"bdev  = {args.bdev}", f"cores = {args.victim_core}"]
+    if level == "same_reactor":
+        lines.append("share_cores = 1")
+    # 和 aggressor 同一個 bdev 時錯開區段，免得 write 和 read 打同一塊 (cache hit 會讓結果偏好)
+    shared = args.split and not (args.aggr_bdev and args.aggr_bdev != args.bdev)
+    if shared:
+        lines.append(f"size = {args.split}")
+    lines += [f"{k} = {v}" for k, v in args.victim_keys]
+
+    if aggr is not None:
+        name, keys = aggr
+        lines += ["", f"[{name}]", f"bdev  = {args.aggr_bdev or args.bdev}"]
+        if level == "same_device":
+            lines.append(f"cores = {args.other_core}")
+        elif level == "same_reactor":
+            lines += [f"cores = {args.victim_core}", "share_cores = 1"]
+        else:
+            lines.append("colocate = victim")
+        if shared:
+            lines.append(f"offset = {args.split}")
+        lines += [f"{k} = {v}" for k, v in keys]
+
+    with open(path, "w", encoding="utf-8") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def read_result(csv_path: str, job: str) -> Optional[Dict[str, float]]:
+    """engine CSV 裡 job 的 steady 列；sweep 時取第一個點"""
+    if not os.path.exists(csv_path):
+        return None
+    with open(csv_path, newline="", encoding="utf-8") as f:
+        for r in csv.DictReader(f):
+            if r["job"] == job and r["phase"] == "steady":
+                return {k: float(r[k]) for k in ("iops", "mibps", "avg_us", "p50_us", "p99_us", "p999_us", "errors")}
+    return None
+
+
+def run_one(args, tag: str, level: str, aggr) -> Optional[Tuple[Dict[str, float], Optional[Dict[str, float]]]]:
+    ini = os.path.join(args.out, f"{tag}.ini")
+    out_csv = os.path.join(args.out, f"{tag}.csv")
+    write_ini(ini, args, level, aggr, out_csv)
+    if args.dry_run:
+        info(f"wrote {ini}")
+        return None
+
+    info(f"running {tag}")
+    if os.path.exists(out_csv):
+        os.remove(out_csv)
+    rc = subprocess.call([args.engine, ini])
+    if rc != 0:
+        warn(f"{tag}: {args.engine} exited with {rc}")
+    victim = read_result(out_csv, "victim")
+    if victim is None:
+        warn(f"{tag}: no victim steady row in {out_csv}")
+        return None
+    if victim["errors"]:
+        warn(f"{tag}: victim had {int(victim['errors'])} IO errors")
+    return victim, read_result(out_csv, aggr[0]) if aggr else None
+
+
+def ratio(a: float, b: float) -> str:
+    return f"{a / b:.2f}x" if b > 0 else "-"
+
+
+def main():
+    ap = argparse.ArgumentParser(description="victim latency inflation per sharing level (spdk_job_engine)")
+    ap.add_argument("--engine", default="./spdk_job_engine")
+    ap.add_argument("--json", default="", help="bdev json_config for the engine")
+    ap.add_argument("--bdev", default="Nvme0n1", help="victim bdev")
+    ap.add_argument("--aggr-bdev", default="", help="aggressor bdev (default: same as victim)")
+    ap.add_argument("--victim-core", type=int, default=1)
+    ap.add_argument("--other-core", type=int, default=2, help="aggressor core for same_device")
+    ap.add_argument("--victim", default="rw=randread,bs=4096,qd=1",
+                    help="victim job keys (default: %(default)s)")
+    ap.add_argument("--aggressor", action="append", default=[],
+                    help="name:key=value,... (repeatable), e.g. seqwrite:rw=write,bs=131072,qd=32")
+    ap.add_argument("--levels", default=",".join(LEVELS[1:]), help="sharing levels besides none")
+    ap.add_argument("--split", default="", help="aggressor offset (bytes) on a shared bdev, e.g. 4294967296")
+    ap.add_argument("--ramp", type=int, default=2)
+    ap.add_argument("--runtime", type=int, default=20)
+    ap.add_argument("--out", default="noisy_neighbor")
+    ap.add_argument("--dry-run", action="store_true", help="only write the ini files")
+    args = ap.parse_args()
+
+    try:
+        args.victim_keys = parse_keys(args.victim)
+        aggressors = [parse_aggressor(a) for a in args.aggressor] or \
+            [("seqwrite", parse_keys("rw=write,bs=131072,qd=32"))]
+    except ValueError as e:
+        ap.error(str(e))
+    levels = [l.strip() for l in args.levels.split(",") if l.strip()]
+    for l in levels:
+        if l not in LEVELS[1:]:
+            ap.error(f"unknown level {l}, choose from {','.join(LEVELS[1:])}")
+    for name, _ in aggressors:
+        if name == "victim" or not name:
+            ap.error(f"bad aggressor name '{name}'")
+    if args.victim_core == args.other_core and "same_device" in levels:
+        ap.error("same_device needs --other-core different from --victim-core")
+    os.makedirs(args.out, exist_ok=True)
+
+    base = run_one(args, "none", "none", None)
+    results = []
+    for aggr in aggressors:
+        for level in levels:
+            results.append((aggr[0], level, run_one(args, f"{aggr[0]}_{level}", level, aggr)))
+    if args.dry_run:
+        return
+    if base is None:
+        warn("no baseline result, inflation not computed")
+
+    hdr = ["aggressor", "level", "victim_iops", "p50_us", "p99_us", "p999_us",
+           "p50_x", "p99_x", "p999_x", "aggr_mibps"]
+    rows = []
+    if base is not None:
+        v = base[0]
+        rows.append(["-", "none", f"{v['iops']:.0f}", f"{v['p50_us']:.1f}", f"{v['p99_us']:.1f}",
+                     f"{v['p999_us']:.1f}", "1.00x", "1.00x", "1.00x", "-"])
+    for name, level, res in results:
+        if res is None:
+            rows.append([name, level] + ["-"] * (len(hdr) - 2))
+            continue
+        v, a = res
+        b = base[0] if base else None
+        rows.append([name, level, f"{v['iops']:.0f}", f"{v['p50_us']:.1f}", f"{v['p99_us']:.1f}",
+                     f"{v['p999_us']:.1f}",
+                     ratio(v["p50_us"], b["p50_us"]) if b else "-",
+                     ratio(v["p99_us"], b["p99_us"]) if b else "-",
+                     ratio(v["p999_us"], b["p999_us"]) if b else "-",
+                     f"{a['mibps']:.1f}" if a else "-"])
+
+    widths = [max(len(h), *(len(r[i]) for r in rows)) for i, h in enumerate(hdr)]
+    print("  ".join(h.rjust(w) for h, w in zip(hdr, widths)))
+    for r in rows:
+        print("  ".join(c.rjust(w) for c, w in zip(r, widths)))
+
+    summary = os.path.join(args.out, "summary.csv")
+    with open(summary, "w", newline="", encoding="utf-8") as f:
+        w = csv.writer(f)
+        w.writerow(hdr)
+        w.writerows(rows)
+    info(f"summary written to {summary}")
+
+
+if __name__ == "__main__":
+    main()
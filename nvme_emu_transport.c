@@ -0,0 +1,1108 @@
+/*
+in-process 模擬 NVMe controller：註冊成 SPDK 的 custom transport "EMU"，engine 用 spdk_nvme_connect 直接連，不需要實體 drive
+
+CI 機器沒有 NVMe，raw engine (nvme_multicore_multi_qpair.c、spdk_nvme_multi_io_full.c ...) 都 hard-code PCIe 位址跑不起來。
+這個檔案和 engine 一起編 (SPDK_NVME_TRANSPORT_REGISTER 是 constructor，link 進來就註冊好)，trid 給
+  "trtype:EMU traddr:emu0"
+就會走到這裡；不同 traddr 是不同台 controller。
+
+模擬的部分：
+  - register：CAP / VS / CC / CSTS，CC.EN → CSTS.RDY，CC.SHN → CSTS.SHST 立刻完成，ctrlr init state machine 照常跑
+  - admin：IDENTIFY (ctrlr / ns / active ns list)、SET/GET FEATURES (number of queues)、GET LOG PAGE (全 0)、
+           ABORT、AER (一直掛著，detach 時 abort)，其他回 INVALID OPCODE
+  - IO：READ / WRITE / FLUSH / WRITE ZEROES / DSM，資料放在 hugepage (spdk_zmalloc SPDK_MALLOC_DMA) 的 store 裡，
+        namespace 比 store 大時 LBA 對 store 取餘數 (store_mb=0 就完全不搬資料，只模擬時間)
+  - service time：每個 command 送進來時就決定完成時間，qpair 上用 min-heap 依完成時間排，
+        process_completions 只收已經到時間的 (所以 host 晚 poll 就會看到晚完成，和真的 drive 一樣)
+      dist=fixed      read_us / write_us
+      dist=lognormal  平均 read_us / write_us，sigma 是 ln 的標準差
+      dist=bimodal    lognormal，但 slow_pct% 的 command 改用 slow_us (GC / read retry)
+      gc_period_ms / gc_ms：每 gc_period_ms 有 gc_ms 整台停住，這段時間開始的 command 全部延到停頓結束
+      par：整台 controller 同時服務幾個 command (die 數)；0 = 不限，qpair 之間完全沒有共用狀態
+  - qpair：IO queue 數 nq、深度 mqes+1，qpair 滿時回 -EAGAIN 讓 SPDK 自己排隊 (和 PCIe 一樣)
+  - timeout：ctrlr 有註冊 timeout callback 時，每次 poll 檢查還沒完成的 command
+  - poll group：支援 (busy poll)，不支援 interrupt mode
+
+參數用環境變數 NVME_EMU，逗號分隔 key=value，例如
+  NVME_EMU="dist=bimodal,read_us=80,write_us=20,sigma=0.3,slow_pct=1,slow_us=3000,par=64,nq=32,mqes=1023"
+  ns_gb=16 lba=512 store_mb=256 nq=128 mqes=1023 mdts_kb=128 par=0 dist=fixed read_us=80 write_us=20
+  sigma=0.3 slow_pct=1 slow_us=2000 gc_period_ms=0 gc_ms=0 seed=1   (等號後是預設值)
+同一個 seed 每個 qpair 抽到的 service time 序列都一樣 (seed 和 qid 決定)，跑幾次都可以比
+
+detach 時印每台 controller 服務了多少 command、平均 device 時間、等 par 的平均時間
+
+編譯 (要 SPDK source tree 裡的 lib/nvme/nvme_internal.h)：
+  gcc -o nvme_multicore_multi_qpair nvme_multicore_multi_qpair.c nvme_emu_transport.c spdk_nvme_attach.c spdk_bench_preflight.c \
+      -I$SPDK_DIR/lib/nvme $(pkg-config --cflags --libs spdk_nvme spdk_env_dpdk spdk_thread spdk_event) -lm
+  sudo ./nvme_multicore_multi_qpair "trtype:EMU traddr:emu0"
+*/
+#include "spdk/stdinc.h"
+#include "spdk/env.h"
+#include "spdk/nvme.h"
+#include "spdk/nvme_spec.h"
+#include "spdk/string.h"
+#include "spdk/util.h"
+#include "nvme_internal.h"
+
+#define EMU_TRANSPORT_NAME      "EMU"
+#define EMU_NSID                1
+#define EMU_MAX_PAR             1024
+#define EMU_PAGE_SIZE           4096
+#define EMU_ENV                 "NVME_EMU"
+
+enum emu_dist {
+    EMU_DIST_FIXED,
+    EMU_DIST_LOGNORMAL,
+    EMU_DIST_BIMODAL,
+};
+
+static const char *g_emu_dist_name[] = { "fixed", "lognormal", "bimodal" };
+
+struct emu_opts {
+    uint64_t        ns_gb;
+    uint32_t        lba;
+    uint64_t        store_mb;
+    uint32_t        nq;
+    uint32_t        mqes;
+    uint32_t        mdts_kb;
+    uint32_t        par;
+    enum emu_dist   dist;
+    double          read_us;
+    double          write_us;
+    double          sigma;
+    double          slow_pct;
+    double          slow_us;
+    uint64_t        gc_period_ms;
+    uint64_t        gc_ms;
+    uint64_t        seed;
+};
+
+/* 一個 slot = 一個 cid，qpair 建立時就配好，submit 不 malloc */
+struct emu_slot {
+    struct nvme_request     *req;
+    uint64_t                done_tsc;
+    uint16_t                cid;
+    STAILQ_ENTRY(emu_slot)  link;
+};
+
+struct emu_ctrlr;
+
+struct emu_qpair {
+    struct spdk_nvme_qpair  qpair;
+    struct emu_ctrlr        *ectrlr;
+    uint32_t                num_entries;
+    struct emu_slot         *slots;
+    STAILQ_HEAD(, emu_slot) free_slots;
+    /* 依 done_tsc 排的 min-heap，放 outstanding 的 command */
+    struct emu_slot         **heap;
+    uint32_t                heap_len;
+    /* admin qpair：還沒回的 AER */
+    STAILQ_HEAD(, emu_slot) aers;
+    uint64_t                rng;
+
+    /* 統計，qpair 刪掉時加到 ctrlr */
+    uint64_t                cmds;
+    uint64_t                dev_ticks;
+    uint64_t                wait_ticks;
+};
+
+struct emu_ctrlr {
+    struct spdk_nvme_ctrlr      ctrlr;
+    struct spdk_nvme_registers  regs;
+    struct emu_opts             opts;
+    uint64_t                    nsze;
+    uint8_t                     *store;
+    uint64_t                    store_bytes;
+    uint64_t                    t0;
+
+    /* par > 0 時整台共用的 server (die)，每個記下何時空出來 */
+    pthread_spinlock_t          par_lock;
+    uint64_t                    *server_free;
+
+    uint64_t                    cmds;
+    uint64_t                    dev_ticks;
+    uint64_t                    wait_ticks;
+};
+
+static inline struct emu_ctrlr *
+emu_ctrlr(struct spdk_nvme_ctrlr *ctrlr)
+{
+    return SPDK_CONTAINEROF(ctrlr, struct emu_ctrlr, ctrlr);
+}
+
+static inline struct emu_qpair *
+emu_qpair(struct spdk_nvme_qpair *qpair)
+{
+    return SPDK_CONTAINEROF(qpair, struct emu_qpair, qpair);
+}
+
+/* ---------------- 參數 ---------------- */
+static void
+emu_parse_opts(struct emu_opts *o)
+{
+    const char *env = getenv(EMU_ENV);
+    char *buf, *tok, *save = NULL, *val;
+
+    o->ns_gb = 16;
+    o->lba = 512;
+    o->store_mb = 256;
+    o->nq = 128;
+    o->mqes = 1023;
+    o->mdts_kb = 128;
+    o->par = 0;
+    o->dist = EMU_DIST_FIXED;
+    o->read_us = 80;
+    o->write_us = 20;
+    o->sigma = 0.3;
+    o->slow_pct = 1;
+    o->slow_us = 2000;
+    o->gc_period_ms = 0;
+    o->gc_ms = 0;
+    o->seed = 1;
+
+    if (env == NULL || (buf = strdup(env)) == NULL) {
+        return;
+    }
+    for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        val = strchr(tok, '=');
+        if (val == NULL) {
+            fprintf(stderr, "%s: ignoring '%s'\n", EMU_ENV, tok);
+            continue;
+        }
+        *val++ = '\0';
+        if (strcmp(tok, "ns_gb") == 0) {
+            o->ns_gb = strtoull(val, NULL, 0);
+        } else if (strcmp(tok, "lba") == 0) {
+            o->lba = strtoul(val, NULL, 0);
+        } else if (strcmp(tok, "store_mb") == 0) {
+            o->store_mb = strtoull(val, NULL, 0);
+        } else if (strcmp(tok, "nq") == 0) {
+            o->nq = strtoul(val, NULL, 0);
+        } else if (strcmp(tok, "mqes") == 0) {
+            o->mqes = strtoul(val, NULL, 0);
+        } else if (strcmp(tok, "mdts_kb") == 0) {
+            o->mdts_kb = strtoul(val, NULL, 0);
+        } else if (strcmp(tok, "par") == 0) {
+            o->par = strtoul(val, NULL, 0);
+        } else if (strcmp(tok, "dist") == 0) {
+            if (strcmp(val, "lognormal") == 0) {
+                o->dist = EMU_DIST_LOGNORMAL;
+            } else if (strcmp(val, "bimodal") == 0) {
+                o->dist = EMU_DIST_BIMODAL;
+            } else if (strcmp(val, "fixed") == 0) {
+                o->dist = EMU_DIST_FIXED;
+            } else {
+                fprintf(stderr, "%s: unknown dist=%s\n", EMU_ENV, val);
+            }
+        } else if (strcmp(tok, "read_us") == 0) {
+            o->read_us = strtod(val, NULL);
+        } else if (strcmp(tok, "write_us") == 0) {
+            o->write_us = strtod(val, NULL);
+        } else if (strcmp(tok, "sigma") == 0) {
+            o->sigma = strtod(val, NULL);
+        } else if (strcmp(tok, "slow_pct") == 0) {
+            o->slow_pct = strtod(val, NULL);
+        } else if (strcmp(tok, "slow_us") == 0) {
+            o->slow_us = strtod(val, NULL);
+        } else if (strcmp(tok, "gc_period_ms") == 0) {
+            o->gc_period_ms = strtoull(val, NULL, 0);
+        } else if (strcmp(tok, "gc_ms") == 0) {
+            o->gc_ms = strtoull(val, NULL, 0);
+        } else if (strcmp(tok, "seed") == 0) {
+            o->seed = strtoull(val, NULL, 0);
+        } else {
+            fprintf(stderr, "%s: unknown option %s\n", EMU_ENV, tok);
+        }
+    }
+    free(buf);
+
+    if (o->lba < 512 || (o->lba & (o->lba - 1)) || o->lba > EMU_PAGE_SIZE) {
+        fprintf(stderr, "%s: lba must be 512..4096 and a power of 2, using 512\n", EMU_ENV);
+        o->lba = 512;
+    }
+    o->nq = spdk_max(spdk_min(o->nq, 65535u), 1u);
+    o->mqes = spdk_max(spdk_min(o->mqes, 65535u), 1u);
+    o->par = spdk_min(o->par, (uint32_t)EMU_MAX_PAR);
+    o->mdts_kb = spdk_max(o->mdts_kb, (uint32_t)(EMU_PAGE_SIZE / 1024));
+    if (o->seed == 0) {
+        o->seed = 1;
+    }
+}
+
+/* ---------------- service time ---------------- */
+static inline uint64_t
+emu_rand(uint64_t *s)
+{
+    uint64_t x = *s;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *s = x;
+    return x;
+}
+
+/* (0, 1] */
+static inline double
+emu_rand_unit(uint64_t *s)
+{
+    return ((emu_rand(s) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t
+emu_us_to_ticks(double us)
+{
+    return us <= 0 ? 0 : (uint64_t)(us * spdk_get_ticks_hz() / 1000000.0);
+}
+
+static uint64_t
+emu_sample_service(struct emu_qpair *eq, bool is_read)
+{
+    const struct emu_opts *o = &eq->ectrlr->opts;
+    double mean = is_read ? o->read_us : o->write_us;
+    double mu, n;
+
+    if (o->dist == EMU_DIST_BIMODAL && emu_rand_unit(&eq->rng) * 100.0 < o->slow_pct) {
+        mean = o->slow_us;
+    }
+    if (o->dist == EMU_DIST_FIXED || o->sigma <= 0 || mean <= 0) {
+        return emu_us_to_ticks(mean);
+    }
+    /* lognormal，平均值 = mean：mu = ln(mean) - sigma^2 / 2；常態分布用 Box-Muller */
+    mu = log(mean) - o->sigma * o->sigma / 2;
+    n = sqrt(-2.0 * log(emu_rand_unit(&eq->rng))) * cos(6.283185307179586 * emu_rand_unit(&eq->rng));
+    return emu_us_to_ticks(exp(mu + o->sigma * n));
+}
+
+/* 落在 GC 停頓裡就延到停頓結束 */
+static inline uint64_t
+emu_gc_adjust(const struct emu_ctrlr *ec, uint64_t start)
+{
+    uint64_t period = ec->opts.gc_period_ms * spdk_get_ticks_hz() / 1000;
+    uint64_t len = ec->opts.gc_ms * spdk_get_ticks_hz() / 1000;
+    uint64_t phase;
+
+    if (period == 0 || len == 0 || start < ec->t0) {
+        return start;
+    }
+    phase = (start - ec->t0) % period;
+    return phase < len ? start + (len - phase) : start;
+}
+
+/* command 進來時就決定何時完成 */
+static uint64_t
+emu_schedule(struct emu_qpair *eq, bool is_read, uint64_t now)
+{
+    struct emu_ctrlr *ec = eq->ectrlr;
+    uint64_t svc = emu_sample_service(eq, is_read);
+    uint64_t start = now, done;
+    uint32_t i, best = 0;
+
+    if (ec->opts.par == 0) {
+        start = emu_gc_adjust(ec, now);
+        done = start + svc;
+    } else {
+        /* 交給最早空出來的 server */
+        pthread_spin_lock(&ec->par_lock);
+        for (i = 1; i < ec->opts.par; i++) {
+            if (ec->server_free[i] < ec->server_free[best]) {
+                best = i;
+            }
+        }
+        start = emu_gc_adjust(ec, spdk_max(now, ec->server_free[best]));
+        done = start + svc;
+        ec->server_free[best] = done;
+        pthread_spin_unlock(&ec->par_lock);
+    }
+
+    eq->wait_ticks += start - now;
+    eq->dev_ticks += svc;
+    return done;
+}
+
+/* ---------------- min-heap (done_tsc) ---------------- */
+static void
+emu_heap_push(struct emu_qpair *eq, struct emu_slot *s)
+{
+    uint32_t i = eq->heap_len++, p;
+
+    while (i > 0) {
+        p = (i - 1) / 2;
+        if (eq->heap[p]->done_tsc <= s->done_tsc) {
+            break;
+        }
+        eq->heap[i] = eq->heap[p];
+        i = p;
+    }
+    eq->heap[i] = s;
+}
+
+static struct emu_slot *
+emu_heap_pop(struct emu_qpair *eq)
+{
+    struct emu_slot *top = eq->heap[0], *last;
+    uint32_t i = 0, c;
+
+    last = eq->heap[--eq->heap_len];
+    while ((c = 2 * i + 1) < eq->heap_len) {
+        if (c + 1 < eq->heap_len && eq->heap[c + 1]->done_tsc < eq->heap[c]->done_tsc) {
+            c++;
+        }
+        if (last->done_tsc <= eq->heap[c]->done_tsc) {
+            break;
+        }
+        eq->heap[i] = eq->heap[c];
+        i = c;
+    }
+    if (eq->heap_len > 0) {
+        eq->heap[i] = last;
+    }
+    return top;
+}
+
+/* ---------------- 資料搬移 ---------------- */
+/* payload 從 byte offset `off` 開始的 len bytes 和 buf 互搬 */
+static void
+emu_payload_copy(struct nvme_request *req, uint8_t *buf, uint32_t off, uint32_t len, bool to_payload)
+{
+    void *sge;
+    uint32_t sge_len, n;
+    uint8_t *p;
+
+    if (nvme_payload_type(&req->payload) == NVME_PAYLOAD_TYPE_CONTIG) {
+        p = (uint8_t *)req->payload.contig_or_cb_arg + req->payload_offset + off;
+        if (to_payload) {
+            memcpy(p, buf, len);
+        } else {
+            memcpy(buf, p, len);
+        }
+        return;
+    }
+
+    req->payload.reset_sgl_fn(req->payload.contig_or_cb_arg, req->payload_offset + off);
+    while (len > 0) {
+        if (req->payload.next_sge_fn(req->payload.contig_or_cb_arg, &sge, &sge_len) != 0 || sge_len == 0) {
+            break;
+        }
+        n = spdk_min(len, sge_len);
+        if (to_payload) {
+            memcpy(sge, buf, n);
+        } else {
+            memcpy(buf, sge, n);
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+/* store 比 namespace 小時 LBA 取餘數，跨過 store 尾巴就分兩段 */
+static void
+emu_store_rw(struct emu_ctrlr *ec, struct nvme_request *req, uint64_t slba, uint32_t nlb, bool is_read)
+{
+    uint64_t off = (slba * ec->opts.lba) % ec->store_bytes;
+    uint32_t len = nlb * ec->opts.lba, done = 0, n;
+
+    while (done < len) {
+        n = (uint32_t)spdk_min((uint64_t)(len - done), ec->store_bytes - off);
+        emu_payload_copy(req, ec->store + off, done, n, is_read);
+        done += n;
+        off = 0;
+    }
+}
+
+/* ---------------- command 執行 (完成時才做，和 drive DMA 的時間點一樣) ---------------- */
+static void
+emu_exec_io(struct emu_ctrlr *ec, struct nvme_request *req, struct spdk_nvme_cpl *cpl)
+{
+    const struct spdk_nvme_cmd *cmd = &req->cmd;
+    uint64_t slba = ((uint64_t)cmd->cdw11 << 32) | cmd->cdw10;
+    uint32_t nlb = (cmd->cdw12 & 0xffff) + 1;
+    uint64_t off;
+
+    if (cmd->nsid != EMU_NSID) {
+        cpl->status.sc = SPDK_NVME_SC_INVALID_NAMESPACE_OR_FORMAT;
+        return;
+    }
+
+    switch (cmd->opc) {
+    case SPDK_NVME_OPC_READ:
+    case SPDK_NVME_OPC_WRITE:
+    case SPDK_NVME_OPC_WRITE_ZEROES:
+        if (slba + nlb > ec->nsze || slba + nlb < slba) {
+            cpl->status.sc = SPDK_NVME_SC_LBA_OUT_OF_RANGE;
+            return;
+        }
+        if (ec->store == NULL) {
+            return;
+        }
+        if (cmd->opc == SPDK_NVME_OPC_WRITE_ZEROES) {
+            for (uint64_t i = 0; i < nlb; i++) {
+                off = ((slba + i) * ec->opts.lba) % ec->store_bytes;
+                memset(ec->store + off, 0, ec->opts.lba);
+            }
+        } else {
+            emu_store_rw(ec, req, slba, nlb, cmd->opc == SPDK_NVME_OPC_READ);
+        }
+        break;
+    case SPDK_NVME_OPC_FLUSH:
+    case SPDK_NVME_OPC_DATASET_MANAGEMENT:
+        break;
+    default:
+        cpl->status.sc = SPDK_NVME_SC_INVALID_OPCODE;
+        break;
+    }
+}
+
+static void
+emu_identify(struct emu_ctrlr *ec, struct nvme_request *req)
+{
+    uint8_t cns = req->cmd.cdw10 & 0xff;
+    uint8_t buf[sizeof(struct spdk_nvme_ctrlr_data)] = {};
+    struct spdk_nvme_ctrlr_data *cdata = (void *)buf;
+    struct spdk_nvme_ns_data *nsdata = (void *)buf;
+    uint32_t *nslist = (void *)buf;
+    char sn[sizeof(cdata->sn) + 1];
+
+    SPDK_STATIC_ASSERT(sizeof(struct spdk_nvme_ctrlr_data) >= sizeof(struct spdk_nvme_ns_data), "identify buf");
+
+    switch (cns) {
+    case SPDK_NVME_IDENTIFY_CTRLR:
+        cdata->vid = 0x1b36;
+        cdata->ssvid = 0x1b36;
+        snprintf(sn, sizeof(sn), "EMU-%s", ec->ctrlr.trid.traddr);
+        spdk_strcpy_pad(cdata->sn, sn, sizeof(cdata->sn), ' ');
+        spdk_strcpy_pad(cdata->mn, "SPDK emulated NVMe", sizeof(cdata->mn), ' ');
+        spdk_strcpy_pad(cdata->fr, "1.0", sizeof(cdata->fr), ' ');
+        cdata->mdts = spdk_u32log2(ec->opts.mdts_kb * 1024 / EMU_PAGE_SIZE);
+        cdata->cntlid = 1;
+        cdata->ver.raw = ec->regs.vs.raw;
+        cdata->acl = 3;
+        cdata->aerl = 3;
+        cdata->sqes.min = 6;
+        cdata->sqes.max = 6;
+        cdata->cqes.min = 4;
+        cdata->cqes.max = 4;
+        cdata->nn = 1;
+        cdata->oncs.dsm = 1;
+        cdata->oncs.write_zeroes = 1;
+        cdata->vwc.present = 1;
+        break;
+    case SPDK_NVME_IDENTIFY_NS:
+        if (req->cmd.nsid != EMU_NSID) {
+            break;      // inactive ns：全 0
+        }
+        nsdata->nsze = ec->nsze;
+        nsdata->ncap = ec->nsze;
+        nsdata->nuse = ec->nsze;
+        nsdata->nlbaf = 0;
+        nsdata->flbas.format = 0;
+        nsdata->lbaf[0].lbads = spdk_u32log2(ec->opts.lba);
+        /* write zeroes / dsm 過的 LBA 讀回來是 0 */
+        nsdata->dlfeat.bits.read_value = SPDK_NVME_DEALLOC_READ_00;
+        nsdata->dlfeat.bits.write_zero_deallocate = 1;
+        break;
+    case SPDK_NVME_IDENTIFY_ACTIVE_NS_LIST:
+        if (req->cmd.nsid < EMU_NSID) {
+            nslist[0] = EMU_NSID;
+        }
+        break;
+    default:
+        /* ns id descriptor list 等：回全 0 = 沒有 */
+        break;
+    }
+
+    emu_payload_copy(req, buf, 0, spdk_min(req->payload_size, (uint32_t)sizeof(buf)), true);
+}
+
+/* 回 false 表示 command 先不完成 (AER) */
+static bool
+emu_exec_admin(struct emu_ctrlr *ec, struct emu_qpair *eq, struct emu_slot *s, struct spdk_nvme_cpl *cpl)
+{
+    struct nvme_request *req = s->req;
+    uint8_t fid = req->cmd.cdw10 & 0xff;
+    uint32_t nq = ec->opts.nq;
+    uint8_t zero[EMU_PAGE_SIZE] = {};
+    uint32_t off, n;
+
+    switch (req->cmd.opc) {
+    case SPDK_NVME_OPC_IDENTIFY:
+        emu_identify(ec, req);
+        break;
+    case SPDK_NVME_OPC_SET_FEATURES:
+    case SPDK_NVME_OPC_GET_FEATURES:
+        if (fid == SPDK_NVME_FEAT_NUMBER_OF_QUEUES) {
+            cpl->cdw0 = (nq - 1) | ((nq - 1) << 16);
+        }
+        break;
+    case SPDK_NVME_OPC_GET_LOG_PAGE:
+        for (off = 0; off < req->payload_size; off += n) {
+            n = spdk_min(req->payload_size - off, (uint32_t)sizeof(zero));
+            emu_payload_copy(req, zero, off, n, true);
+        }
+        break;
+    case SPDK_NVME_OPC_ABORT:
+        cpl->cdw0 = 1;          // bit 0 = 1：沒有 abort 到
+        break;
+    case SPDK_NVME_OPC_ASYNC_EVENT_REQUEST:
+        STAILQ_INSERT_TAIL(&eq->aers, s, link);
+        return false;
+    case SPDK_NVME_OPC_KEEP_ALIVE:
+    case SPDK_NVME_OPC_CREATE_IO_SQ:
+    case SPDK_NVME_OPC_CREATE_IO_CQ:
+    case SPDK_NVME_OPC_DELETE_IO_SQ:
+    case SPDK_NVME_OPC_DELETE_IO_CQ:
+        break;
+    default:
+        cpl->status.sc = SPDK_NVME_SC_INVALID_OPCODE;
+        break;
+    }
+    return true;
+}
+
+static inline void
+emu_slot_put(struct emu_qpair *eq, struct emu_slot *s)
+{
+    s->req = NULL;
+    STAILQ_INSERT_HEAD(&eq->free_slots, s, link);
+}
+
+static void
+emu_complete_slot(struct emu_qpair *eq, struct emu_slot *s, const struct spdk_nvme_cpl *cpl)
+{
+    struct nvme_request *req = s->req;
+    struct spdk_nvme_cpl c = *cpl;
+
+    c.cid = s->cid;
+    c.sqid = eq->qpair.id;
+    emu_slot_put(eq, s);
+    eq->cmds++;
+    nvme_complete_request(req->cb_fn, req->cb_arg, &eq->qpair, req, &c);
+    nvme_free_request(req);
+}
+
+/* ---------------- qpair ---------------- */
+static struct spdk_nvme_qpair *
+emu_qpair_create(struct spdk_nvme_ctrlr *ctrlr, uint16_t qid, uint32_t num_entries,
+                 uint32_t num_requests, enum spdk_nvme_qprio qprio, bool async)
+{
+    struct emu_ctrlr *ec = emu_ctrlr(ctrlr);
+    struct emu_qpair *eq;
+    uint32_t i;
+    int rc;
+
+    eq = calloc(1, sizeof(*eq));
+    if (eq == NULL) {
+        return NULL;
+    }
+    eq->ectrlr = ec;
+    eq->num_entries = num_entries;
+    eq->rng = ec->opts.seed * 0x9e3779b97f4a7c15ULL + qid + 1;
+    eq->slots = calloc(num_entries, sizeof(*eq->slots));
+    eq->heap = calloc(num_entries, sizeof(*eq->heap));
+    if (eq->slots == NULL || eq->heap == NULL) {
+        goto err;
+    }
+    STAILQ_INIT(&eq->free_slots);
+    STAILQ_INIT(&eq->aers);
+    /* 和 NVMe SQ 一樣最多 num_entries - 1 個 outstanding */
+    for (i = 0; i + 1 < num_entries; i++) {
+        eq->slots[i].cid = i;
+        STAILQ_INSERT_TAIL(&eq->free_slots, &eq->slots[i], link);
+    }
+
+    rc = nvme_qpair_init(&eq->qpair, qid, ctrlr, qprio, num_requests, async);
+    if (rc != 0) {
+        goto err;
+    }
+    return &eq->qpair;
+
+err:
+    free(eq->slots);
+    free(eq->heap);
+    free(eq);
+    return NULL;
+}
+
+static void
+emu_qpair_abort_reqs(struct spdk_nvme_qpair *qpair, uint32_t dnr)
+{
+    struct emu_qpair *eq = emu_qpair(qpair);
+    struct nvme_request *req;
+    struct emu_slot *s;
+
+    while (eq->heap_len > 0) {
+        s = emu_heap_pop(eq);
+        req = s->req;
+        emu_slot_put(eq, s);
+        nvme_qpair_manual_complete_request(qpair, req, SPDK_NVME_SCT_GENERIC,
+                                           SPDK_NVME_SC_ABORTED_SQ_DELETION, dnr, true);
+    }
+}
+
+static void
+emu_admin_qpair_abort_aers(struct spdk_nvme_qpair *qpair)
+{
+    struct emu_qpair *eq = emu_qpair(qpair);
+    struct nvme_request *req;
+    struct emu_slot *s;
+
+    while ((s = STAILQ_FIRST(&eq->aers)) != NULL) {
+        STAILQ_REMOVE_HEAD(&eq->aers, link);
+        req = s->req;
+        emu_slot_put(eq, s);
+        nvme_qpair_manual_complete_request(qpair, req, SPDK_NVME_SCT_GENERIC,
+                                           SPDK_NVME_SC_ABORTED_SQ_DELETION, 0, false);
+    }
+}
+
+static void
+emu_qpair_destroy(struct spdk_nvme_qpair *qpair)
+{
+    struct emu_qpair *eq = emu_qpair(qpair);
+    struct emu_ctrlr *ec = eq->ectrlr;
+
+    emu_qpair_abort_reqs(qpair, 1);
+    if (qpair->id == 0) {
+        emu_admin_qpair_abort_aers(qpair);
+    }
+    __atomic_fetch_add(&ec->cmds, eq->cmds, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ec->dev_ticks, eq->dev_ticks, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ec->wait_ticks, eq->wait_ticks, __ATOMIC_RELAXED);
+
+    nvme_qpair_deinit(qpair);
+    free(eq->slots);
+    free(eq->heap);
+    free(eq);
+}
+
+static int
+emu_qpair_submit_request(struct spdk_nvme_qpair *qpair, struct nvme_request *req)
+{
+    struct emu_qpair *eq = emu_qpair(qpair);
+    struct spdk_nvme_ctrlr *ctrlr = qpair->ctrlr;
+    struct emu_slot *s;
+    uint64_t now;
+
+    s = STAILQ_FIRST(&eq->free_slots);
+    if (spdk_unlikely(s == NULL)) {
+        return -EAGAIN;     // SPDK 放進 queued_req，下次 process_completions 再送
+    }
+    STAILQ_REMOVE_HEAD(&eq->free_slots, link);
+    s->req = req;
+    req->cmd.cid = s->cid;
+
+    now = spdk_get_ticks();
+    if (spdk_unlikely(ctrlr->timeout_enabled) && req->submit_tick == 0) {
+        req->submit_tick = now;
+    }
+
+    if (qpair->id == 0) {
+        s->done_tsc = now;      // admin 下一次 poll 就完成
+    } else {
+        s->done_tsc = emu_schedule(eq, req->cmd.opc == SPDK_NVME_OPC_READ, now);
+    }
+    emu_heap_push(eq, s);
+    return 0;
+}
+
+static void
+emu_qpair_check_timeout(struct emu_qpair *eq, uint64_t now)
+{
+    struct spdk_nvme_ctrlr_process *active_proc;
+    uint32_t i;
+
+    active_proc = nvme_ctrlr_get_current_process(eq->qpair.ctrlr);
+    if (active_proc == NULL || active_proc->timeout_cb_fn == NULL) {
+        return;
+    }
+    /* heap 不是依 submit 時間排，全部看一遍 */
+    for (i = 0; i < eq->heap_len; i++) {
+        nvme_request_check_timeout(eq->heap[i]->req, eq->heap[i]->cid, active_proc, now);
+    }
+}
+
+static int32_t
+emu_qpair_process_completions(struct spdk_nvme_qpair *qpair, uint32_t max_completions)
+{
+    struct emu_qpair *eq = emu_qpair(qpair);
+    struct emu_ctrlr *ec = eq->ectrlr;
+    struct spdk_nvme_cpl cpl;
+    struct emu_slot *s;
+    uint64_t now = spdk_get_ticks();
+    uint32_t n = 0;
+
+    if (max_completions == 0) {
+        max_completions = eq->num_entries;
+    }
+
+    while (n < max_completions && eq->heap_len > 0 && eq->heap[0]->done_tsc <= now) {
+        s = emu_heap_pop(eq);
+        memset(&cpl, 0, sizeof(cpl));
+        if (qpair->id == 0) {
+            if (!emu_exec_admin(ec, eq, s, &cpl)) {
+                continue;
+            }
+        } else {
+            emu_exec_io(ec, s->req, &cpl);
+        }
+        emu_complete_slot(eq, s, &cpl);
+        n++;
+    }
+
+    if (spdk_unlikely(qpair->ctrlr->timeout_enabled)) {
+        emu_qpair_check_timeout(eq, now);
+    }
+    return n;
+}
+
+static int
+emu_qpair_reset(struct spdk_nvme_qpair *qpair)
+{
+    (void)qpair;
+    return 0;
+}
+
+static int
+emu_qpair_iterate_requests(struct spdk_nvme_qpair *qpair,
+                           int (*iter_fn)(struct nvme_request *req, void *arg), void *arg)
+{
+    struct emu_qpair *eq = emu_qpair(qpair);
+    uint32_t i;
+    int rc;
+
+    for (i = 0; i < eq->heap_len; i++) {
+        rc = iter_fn(eq->heap[i]->req, arg);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/* ---------------- ctrlr ---------------- */
+static struct spdk_nvme_qpair *
+emu_ctrlr_create_io_qpair(struct spdk_nvme_ctrlr *ctrlr, uint16_t qid,
+                          const struct spdk_nvme_io_qpair_opts *opts)
+{
+    return emu_qpair_create(ctrlr, qid, opts->io_queue_size, opts->io_queue_requests,
+                            opts->qprio, opts->async_mode);
+}
+
+static int
+emu_ctrlr_delete_io_qpair(struct spdk_nvme_ctrlr *ctrlr, struct spdk_nvme_qpair *qpair)
+{
+    (void)ctrlr;
+    emu_qpair_destroy(qpair);
+    return 0;
+}
+
+static int
+emu_ctrlr_connect_qpair(struct spdk_nvme_ctrlr *ctrlr, struct spdk_nvme_qpair *qpair)
+{
+    (void)ctrlr;
+    /* 沒有 CREATE IO SQ/CQ 要等，直接 connected */
+    nvme_qpair_set_state(qpair, NVME_QPAIR_CONNECTED);
+    return 0;
+}
+
+static void
+emu_ctrlr_disconnect_qpair(struct spdk_nvme_ctrlr *ctrlr, struct spdk_nvme_qpair *qpair)
+{
+    (void)ctrlr;
+    emu_qpair_abort_reqs(qpair, 0);
+    nvme_transport_ctrlr_disconnect_qpair_done(qpair);
+}
+
+static int
+emu_ctrlr_set_reg_4(struct spdk_nvme_ctrlr *ctrlr, uint32_t offset, uint32_t value)
+{
+    struct emu_ctrlr *ec = emu_ctrlr(ctrlr);
+    union spdk_nvme_cc_register cc;
+
+    if (offset + 4 > sizeof(ec->regs)) {
+        return -EINVAL;
+    }
+    memcpy((uint8_t *)&ec->regs + offset, &value, 4);
+
+    if (offset == offsetof(struct spdk_nvme_registers, cc)) {
+        cc.raw = value;
+        ec->regs.csts.bits.rdy = cc.bits.en;
+        /* shutdown 不用時間，寫下去就完成 */
+        ec->regs.csts.bits.shst = cc.bits.shn ? SPDK_NVME_SHST_COMPLETE : SPDK_NVME_SHST_NORMAL;
+    }
+    return 0;
+}
+
+static int
+emu_ctrlr_set_reg_8(struct spdk_nvme_ctrlr *ctrlr, uint32_t offset, uint64_t value)
+{
+    struct emu_ctrlr *ec = emu_ctrlr(ctrlr);
+
+    if (offset + 8 > sizeof(ec->regs)) {
+        return -EINVAL;
+    }
+    memcpy((uint8_t *)&ec->regs + offset, &value, 8);
+    return 0;
+}
+
+static int
+emu_ctrlr_get_reg_4(struct spdk_nvme_ctrlr *ctrlr, uint32_t offset, uint32_t *value)
+{
+    struct emu_ctrlr *ec = emu_ctrlr(ctrlr);
+
+    if (offset + 4 > sizeof(ec->regs)) {
+        return -EINVAL;
+    }
+    memcpy(value, (uint8_t *)&ec->regs + offset, 4);
+    return 0;
+}
+
+static int
+emu_ctrlr_get_reg_8(struct spdk_nvme_ctrlr *ctrlr, uint32_t offset, uint64_t *value)
+{
+    struct emu_ctrlr *ec = emu_ctrlr(ctrlr);
+
+    if (offset + 8 > sizeof(ec->regs)) {
+        return -EINVAL;
+    }
+    memcpy(value, (uint8_t *)&ec->regs + offset, 8);
+    return 0;
+}
+
+static uint32_t
+emu_ctrlr_get_max_xfer_size(struct spdk_nvme_ctrlr *ctrlr)
+{
+    return emu_ctrlr(ctrlr)->opts.mdts_kb * 1024;
+}
+
+static uint16_t
+emu_ctrlr_get_max_sges(struct spdk_nvme_ctrlr *ctrlr)
+{
+    (void)ctrlr;
+    return 1;
+}
+
+static int
+emu_ctrlr_enable(struct spdk_nvme_ctrlr *ctrlr)
+{
+    (void)ctrlr;
+    return 0;
+}
+
+static void
+emu_regs_init(struct emu_ctrlr *ec)
+{
+    struct spdk_nvme_registers *r = &ec->regs;
+
+    memset(r, 0, sizeof(*r));
+    r->cap.bits.mqes = ec->opts.mqes;
+    r->cap.bits.cqr = 1;
+    r->cap.bits.to = 1;             // 500 ms
+    r->cap.bits.css = SPDK_NVME_CAP_CSS_NVM;
+    r->cap.bits.mpsmin = 0;         // 4 KiB
+    r->cap.bits.mpsmax = 0;
+    r->vs.bits.mjr = 1;
+    r->vs.bits.mnr = 3;
+}
+
+static struct spdk_nvme_ctrlr *
+emu_ctrlr_construct(const struct spdk_nvme_transport_id *trid,
+                    const struct spdk_nvme_ctrlr_opts *opts, void *devhandle)
+{
+    struct emu_ctrlr *ec;
+    int rc;
+
+    (void)devhandle;
+    ec = calloc(1, sizeof(*ec));
+    if (ec == NULL) {
+        return NULL;
+    }
+    emu_parse_opts(&ec->opts);
+    ec->nsze = ec->opts.ns_gb * 1024 * 1024 * 1024 / ec->opts.lba;
+    ec->t0 = spdk_get_ticks();
+    pthread_spin_init(&ec->par_lock, PTHREAD_PROCESS_PRIVATE);
+
+    if (ec->opts.par > 0) {
+        ec->server_free = calloc(ec->opts.par, sizeof(*ec->server_free));
+        if (ec->server_free == NULL) {
+            goto err;
+        }
+    }
+    if (ec->opts.store_mb > 0) {
+        ec->store_bytes = ec->opts.store_mb * 1024 * 1024;
+        ec->store = spdk_zmalloc(ec->store_bytes, EMU_PAGE_SIZE, NULL, SPDK_ENV_SOCKET_ID_ANY,
+                                 SPDK_MALLOC_DMA);
+        if (ec->store == NULL) {
+            fprintf(stderr, "nvme_emu %s: no hugepage memory for %" PRIu64 " MiB store\n",
+                    trid->traddr, ec->opts.store_mb);
+            goto err;
+        }
+    }
+    emu_regs_init(ec);
+
+    ec->ctrlr.opts = *opts;
+    ec->ctrlr.trid = *trid;
+    rc = nvme_ctrlr_construct(&ec->ctrlr);
+    if (rc != 0) {
+        goto err;
+    }
+
+    ec->ctrlr.adminq = emu_qpair_create(&ec->ctrlr, 0, ec->ctrlr.opts.admin_queue_size,
+                                        ec->ctrlr.opts.admin_queue_size, SPDK_NVME_QPRIO_URGENT, false);
+    if (ec->ctrlr.adminq == NULL) {
+        nvme_ctrlr_destruct(&ec->ctrlr);
+        return NULL;
+    }
+
+    rc = nvme_ctrlr_add_process(&ec->ctrlr, NULL);
+    if (rc != 0) {
+        nvme_ctrlr_destruct(&ec->ctrlr);
+        return NULL;
+    }
+
+    printf("nvme_emu %s: %" PRIu64 " GiB ns, lba %u, store %" PRIu64 " MiB, %u IO queues x %u, "
+           "dist %s read %.0f us write %.0f us, par %u\n",
+           trid->traddr, ec->opts.ns_gb, ec->opts.lba, ec->opts.store_mb, ec->opts.nq, ec->opts.mqes + 1,
+           g_emu_dist_name[ec->opts.dist], ec->opts.read_us, ec->opts.write_us, ec->opts.par);
+    return &ec->ctrlr;
+
+err:
+    spdk_free(ec->store);
+    free(ec->server_free);
+    pthread_spin_destroy(&ec->par_lock);
+    free(ec);
+    return NULL;
+}
+
+static int
+emu_ctrlr_destruct(struct spdk_nvme_ctrlr *ctrlr)
+{
+    struct emu_ctrlr *ec = emu_ctrlr(ctrlr);
+    double us_per_tick = 1000000.0 / spdk_get_ticks_hz();
+
+    if (ctrlr->adminq) {
+        emu_qpair_destroy(ctrlr->adminq);
+        ctrlr->adminq = NULL;
+    }
+    nvme_ctrlr_destruct_finish(ctrlr);
+    nvme_ctrlr_free_processes(ctrlr);
+
+    printf("nvme_emu %s: %" PRIu64 " cmds, avg device %.2f us, avg wait for par %.2f us\n",
+           ctrlr->trid.traddr, ec->cmds, ec->cmds ? ec->dev_ticks * us_per_tick / ec->cmds : 0,
+           ec->cmds ? ec->wait_ticks * us_per_tick / ec->cmds : 0);
+
+    spdk_free(ec->store);
+    free(ec->server_free);
+    pthread_spin_destroy(&ec->par_lock);
+    free(ec);
+    return 0;
+}
+
+static int
+emu_ctrlr_scan(struct spdk_nvme_probe_ctx *probe_ctx, bool direct_connect)
+{
+    (void)direct_connect;
+    /* 沒有 bus 可以掃，trid 給什麼就「找到」什麼 */
+    return nvme_ctrlr_probe(&probe_ctx->trid, probe_ctx, NULL);
+}
+
+/* ---------------- poll group (busy poll，同 PCIe) ---------------- */
+struct emu_poll_group {
+    struct spdk_nvme_transport_poll_group group;
+};
+
+static struct spdk_nvme_transport_poll_group *
+emu_poll_group_create(void)
+{
+    struct emu_poll_group *g = calloc(1, sizeof(*g));
+
+    return g ? &g->group : NULL;
+}
+
+static int
+emu_poll_group_qpair_noop(struct spdk_nvme_qpair *qpair)
+{
+    (void)qpair;
+    return 0;
+}
+
+static int
+emu_poll_group_add_remove(struct spdk_nvme_transport_poll_group *tgroup, struct spdk_nvme_qpair *qpair)
+{
+    (void)tgroup;
+    (void)qpair;
+    return 0;
+}
+
+static int64_t
+emu_poll_group_process_completions(struct spdk_nvme_transport_poll_group *tgroup,
+                                   uint32_t completions_per_qpair,
+                                   spdk_nvme_disconnected_qpair_cb disconnected_qpair_cb)
+{
+    struct spdk_nvme_qpair *qpair, *tmp;
+    int64_t total = 0;
+    int32_t n;
+
+    STAILQ_FOREACH_SAFE(qpair, &tgroup->disconnected_qpairs, poll_group_stailq, tmp) {
+        disconnected_qpair_cb(qpair, tgroup->group->ctx);
+    }
+    STAILQ_FOREACH_SAFE(qpair, &tgroup->connected_qpairs, poll_group_stailq, tmp) {
+        n = spdk_nvme_qpair_process_completions(qpair, completions_per_qpair);
+        if (spdk_unlikely(n < 0)) {
+            disconnected_qpair_cb(qpair, tgroup->group->ctx);
+            total = -ENXIO;
+        } else if (spdk_likely(total >= 0)) {
+            total += n;
+        }
+    }
+    return total;
+}
+
+static int
+emu_poll_group_destroy(struct spdk_nvme_transport_poll_group *tgroup)
+{
+    if (!STAILQ_EMPTY(&tgroup->connected_qpairs) || !STAILQ_EMPTY(&tgroup->disconnected_qpairs)) {
+        return -EBUSY;
+    }
+    free(SPDK_CONTAINEROF(tgroup, struct emu_poll_group, group));
+    return 0;
+}
+
+static const struct spdk_nvme_transport_ops emu_ops = {
+    .name = EMU_TRANSPORT_NAME,
+    .type = SPDK_NVME_TRANSPORT_CUSTOM,
+    .ctrlr_construct = emu_ctrlr_construct,
+    .ctrlr_scan = emu_ctrlr_scan,
+    .ctrlr_destruct = emu_ctrlr_destruct,
+    .ctrlr_enable = emu_ctrlr_enable,
+
+    .ctrlr_set_reg_4 = emu_ctrlr_set_reg_4,
+    .ctrlr_set_reg_8 = emu_ctrlr_set_reg_8,
+    .ctrlr_get_reg_4 = emu_ctrlr_get_reg_4,
+    .ctrlr_get_reg_8 = emu_ctrlr_get_reg_8,
+
+    .ctrlr_get_max_xfer_size = emu_ctrlr_get_max_xfer_size,
+    .ctrlr_get_max_sges = emu_ctrlr_get_max_sges,
+
+    .ctrlr_create_io_qpair = emu_ctrlr_create_io_qpair,
+    .ctrlr_delete_io_qpair = emu_ctrlr_delete_io_qpair,
+    .ctrlr_connect_qpair = emu_ctrlr_connect_qpair,
+    .ctrlr_disconnect_qpair = emu_ctrlr_disconnect_qpair,
+
+    .qpair_abort_reqs = emu_qpair_abort_reqs,
+    .qpair_reset = emu_qpair_reset,
+    .qpair_submit_request = emu_qpair_submit_request,
+    .qpair_process_completions = emu_qpair_process_completions,
+    .qpair_iterate_requests = emu_qpair_iterate_requests,
+    .admin_qpair_abort_aers = emu_admin_qpair_abort_aers,
+
+    .poll_group_create = emu_poll_group_create,
+    .poll_group_connect_qpair = emu_poll_group_qpair_noop,
+    .poll_group_disconnect_qpair = emu_poll_group_qpair_noop,
+    .poll_group_add = emu_poll_group_add_remove,
+    .poll_group_remove = emu_poll_group_add_remove,
+    .poll_group_process_completions = emu_poll_group_process_completions,
+    .poll_group_destroy = emu_poll_group_destroy,
+};
+
+SPDK_NVME_TRANSPORT_REGISTER(emu, &emu_ops);
@@ -4,10 +4,13 @@
 #include "spdk/stdinc.h"
 #include "spdk/env.h"
 #include "spdk/nvme.h"
+#include "spdk_bench_preflight.h"
+#include "spdk_nvme_attach.h"
 
 #define NUM_QPAIR   4
 #define IO_PER_QP   4
 #define NAMESPACE_ID 1
+#define DEFAULT_TRADDR "0000:01:00.0"
 
 struct qpair_ctx {
     struct spdk_nvme_qpair *qpair;
@@ -50,16 +53,17 @@ static int init_ctrlr(struct spdk_nvme_ctrlr *ctrlr, struct thread_ctx *t) {
     return 0;
 }
 
+static struct spdk_nvme_transport_id g_trid = {};
+
 static void app_start(void *arg) {
     (void)arg;
+    struct nvme_attach_ctrlr attach;
     struct spdk_nvme_ctrlr *ctrlr;
-    struct spdk_nvme_transport_id trid = {};
     struct thread_ctx *tctx[2];
 
-    trid.trtype = SPDK_NVME_TRANSPORT_PCIE;
-    snprintf(trid.traddr, sizeof(trid.traddr), "0000:01:00.0");
-    ctrlr = spdk_nvme_connect(&trid, NULL, 0);
-    if (!ctrlr) return;
+    spdk_nvme_attach_init(&attach, &g_trid);
+    if (spdk_nvme_attach_all(&attach, 1, NULL, NULL, NULL) != 0) return;
+    ctrlr = attach.ctrlr;
 
     for (int core = 0; core < 2; core++) {
         tctx[core] = malloc(sizeof(struct thread_ctx));
@@ -70,9 +74,24 @@ static void app_start(void *arg) {
 
 int main(int argc, char **argv) {
     struct spdk_app_opts opts;
+
+    // argv[1] 可給完整 trid，例如 "trtype:EMU traddr:emu0" (nvme_emu_transport.c)
+    if (argc > 1) {
+        if (spdk_nvme_transport_id_parse(&g_trid, argv[1]) != 0) {
+            fprintf(stderr, "invalid trid: %s\n", argv[1]);
+            return -1;
+        }
+    } else {
+        spdk_nvme_trid_populate_transport(&g_trid, SPDK_NVME_TRANSPORT_PCIE);
+        snprintf(g_trid.traddr, sizeof(g_trid.traddr), "%s", DEFAULT_TRADDR);
+    }
+
     spdk_app_opts_init(&opts, sizeof(opts));
     opts.name = "nvme_multicore_multi_qpair";
     opts.reactor_mask = "0x3"; // core0 & core1
+    if (spdk_bench_preflight_run(opts.name, opts.reactor_mask, NULL) != 0) {
+        return -1;
+    }
     spdk_app_start(&opts, app_start, NULL);
     spdk_app_fini();
     return 0;
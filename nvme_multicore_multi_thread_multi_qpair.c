@@ -1,114 +1,457 @@
 /*
 多核 reactor，每個 reactor 多 thread，每個 thread 多 qpair
+
+每個 reactor 是一個 pinned env thread，輪流跑它的 thread；每個 thread 擁有很多 qpair：
+  qpair 0     hot：4K read，QD 32，完成就立刻再送 (closed loop)
+  其他 qpair  cold：每 COLD_INTERVAL_US 挑下一個 cold qpair 送一個 128K read，大部分時間沒有 IO 在飛
+
+polling 模式 (argv[2])：
+  naive : 舊的作法，每一輪對每個 qpair 都呼叫 process_completions(qpair, 0)
+  sched : polling scheduler
+          - 每個 qpair 記 outstanding 數，只有 outstanding > 0 的 qpair 在 active list 裡，沒 IO 的 qpair 完全不碰
+          - 每次 poll 一個 qpair 最多收 POLL_BUDGET 個 completion，hot qpair 收不完留到下一輪，不會餓死其他 qpair
+          - 空 poll 時延後下一次 poll：從 BACKOFF_MIN_US 開始每次加倍，上限是這個 qpair latency EWMA 的 1/2^BACKOFF_SHIFT，
+            所以 latency 短的 qpair 幾乎不 back off，只有在飛的都是長 latency command 的 qpair 才會少 poll
+            (代價：completion 最多晚 latency/2^BACKOFF_SHIFT 被看到)
+結束時每個 thread 印 IOPS、hot / cold 平均 latency、poll 次數、空 poll 比例，
+以及空 poll 花掉的 cycles (佔整個 reactor loop 的 %)，兩種模式比較這個數字
+
+用法：
+  ./nvme_multicore_multi_thread_multi_qpair [trid] [naive|sched] [qpairs_per_thread]
+  qpair 總數是 REACTOR_CORES x THREADS_PER_REACTOR x qpairs_per_thread，controller 要有這麼多 IO queue
 */
 #include "spdk/stdinc.h"
 #include "spdk/env.h"
 #include "spdk/nvme.h"
+#include "spdk/util.h"
+#include "spdk_bench_preflight.h"
+#include "spdk_nvme_attach.h"
 
-#define REACTOR_CORES   2
+#define REACTOR_CORES        2
 #define THREADS_PER_REACTOR  2
-#define QPAIRS_PER_THREAD    2
-#define IO_PER_QP            4
+#define QPAIRS_PER_THREAD    32     // 預設，argv[3] 可改
+#define MAX_QPAIRS_PER_THREAD 1024
 #define NAMESPACE_ID         1
+#define DEFAULT_TRADDR       "0000:01:00.0"
+
+#define HOT_QD               32
+#define HOT_IO_SIZE          4096
+#define COLD_IO_SIZE         (128 * 1024)
+#define COLD_INTERVAL_US     100    // 每個 thread 每隔多久送一個 cold IO
+#define RUN_SEC              5
+
+#define POLL_BUDGET          8      // 每次 poll 一個 qpair 最多收幾個 completion
+#define BACKOFF_MIN_US       1
+#define BACKOFF_SHIFT        3      // back off 上限 = latency EWMA / 8
+#define LAT_EWMA_SHIFT       4      // EWMA 權重 1/16
+
+enum poll_mode {
+    POLL_NAIVE,
+    POLL_SCHED,
+};
+
+static const char *g_mode_name[] = { "naive", "sched" };
+static enum poll_mode g_mode = POLL_SCHED;
+static int g_qpairs_per_thread = QPAIRS_PER_THREAD;
+static struct spdk_nvme_ctrlr *g_ctrlr;
+static uint64_t g_backoff_min_tsc;
+
+struct qpair_ctx;
+
+struct io_req {
+    struct qpair_ctx *qp;
+    void *buf;
+    uint64_t submit_tsc;
+};
 
 struct qpair_ctx {
     struct spdk_nvme_qpair *qpair;
+    struct thread_ctx *t;
     int id;
+    bool hot;
+    int qd;
+    uint32_t nlb;
+    uint64_t next_lba;
+
+    struct io_req *reqs;
+    struct io_req **free_reqs;
+    int nfree;
+
+    uint32_t outstanding;
+    int active_idx;             // 在 thread active list 裡的位置，-1 表示不在
+    uint64_t next_poll_tsc;     // 在這之前不 poll (back off)
+    uint64_t backoff_tsc;
+    uint64_t lat_ewma_tsc;
 };
 
 struct thread_ctx {
-    struct spdk_nvme_ctrlr *ctrlr;
-    struct qpair_ctx qpairs[QPAIRS_PER_THREAD];
     char name[32];
+    struct spdk_nvme_ns *ns;
+    struct qpair_ctx *qpairs;
+    int nqp;
+    struct qpair_ctx **active;  // outstanding > 0 的 qpair
+    int nactive;
+    int next_cold;
+    uint64_t next_cold_tsc;
+    uint64_t cold_interval_tsc;
+    bool draining;              // 收尾中，hot qpair 不再補送
+
+    uint64_t completed[2];      // [0] cold, [1] hot
+    uint64_t lat_sum[2];
+    uint64_t polls;
+    uint64_t empty_polls;
+    uint64_t empty_tsc;         // 空 poll 花掉的 cycles
+    uint64_t backoff_skips;     // 因為 back off 沒 poll 的次數
 };
 
 struct reactor_ctx {
     int core;
     struct thread_ctx threads[THREADS_PER_REACTOR];
+    uint64_t loop_tsc;
 };
 
+static void submit_one(struct qpair_ctx *qp);
+
+static void active_add(struct thread_ctx *t, struct qpair_ctx *qp) {
+    qp->active_idx = t->nactive;
+    t->active[t->nactive++] = qp;
+    qp->backoff_tsc = 0;
+    qp->next_poll_tsc = 0;
+}
+
+static void active_del(struct thread_ctx *t, struct qpair_ctx *qp) {
+    struct qpair_ctx *last = t->active[--t->nactive];
+
+    t->active[qp->active_idx] = last;
+    last->active_idx = qp->active_idx;
+    qp->active_idx = -1;
+}
+
 static void io_complete(void *arg, const struct spdk_nvme_cpl *cpl) {
-    struct qpair_ctx *qp = arg;
-    printf("[%-10s] qpair %d I/O completed, status=0x%x\n",
-           spdk_thread_get_name(spdk_get_thread()), qp->id, cpl->status.sc);
+    struct io_req *req = arg;
+    struct qpair_ctx *qp = req->qp;
+    struct thread_ctx *t = qp->t;
+    uint64_t lat = spdk_get_ticks() - req->submit_tsc;
+
+    if (spdk_nvme_cpl_is_error(cpl)) {
+        fprintf(stderr, "[%-10s] qpair %d I/O failed, status=0x%x\n", t->name, qp->id, cpl->status.sc);
+    }
+    t->completed[qp->hot]++;
+    t->lat_sum[qp->hot] += lat;
+    if (qp->lat_ewma_tsc == 0) {
+        qp->lat_ewma_tsc = lat;
+    } else {
+        qp->lat_ewma_tsc += (int64_t)(lat - qp->lat_ewma_tsc) >> LAT_EWMA_SHIFT;
+    }
+
+    qp->free_reqs[qp->nfree++] = req;
+    if (--qp->outstanding == 0) {
+        active_del(t, qp);
+    }
+    if (qp->hot && !t->draining) {
+        submit_one(qp);
+    }
 }
 
-static void thread_work(void *arg) {
-    struct thread_ctx *t = arg;
-    struct spdk_nvme_ns *ns = spdk_nvme_ctrlr_get_ns(t->ctrlr, NAMESPACE_ID);
+static void submit_one(struct qpair_ctx *qp) {
+    struct thread_ctx *t = qp->t;
+    struct io_req *req;
+    int rc;
 
-    printf("[%-10s] submitting IO on %d qpairs\n", t->name, QPAIRS_PER_THREAD);
-    for (int i = 0; i < QPAIRS_PER_THREAD; i++) {
-        struct qpair_ctx *qp = &t->qpairs[i];
-        void *buf = spdk_zmalloc(spdk_nvme_ns_get_sector_size(ns),
-                                 0x1000, NULL, SPDK_ENV_LCORE_ID_ANY, SPDK_MALLOC_DMA);
-        for (int j = 0; j < IO_PER_QP; j++) {
-            spdk_nvme_ns_cmd_read(ns, qp->qpair, buf, j, 1, io_complete, qp, 0);
-        }
+    if (qp->nfree == 0) {
+        return;
+    }
+    req = qp->free_reqs[--qp->nfree];
+    req->submit_tsc = spdk_get_ticks();
+    rc = spdk_nvme_ns_cmd_read(t->ns, qp->qpair, req->buf, qp->next_lba, qp->nlb, io_complete, req, 0);
+    if (rc != 0) {
+        qp->free_reqs[qp->nfree++] = req;
+        return;
+    }
+    qp->next_lba = (qp->next_lba + qp->nlb) % (spdk_nvme_ns_get_num_sectors(t->ns) - qp->nlb);
+    if (qp->outstanding++ == 0) {
+        active_add(t, qp);
     }
 }
 
-static int init_thread(struct spdk_nvme_ctrlr *ctrlr, struct thread_ctx *t, const char *name) {
-    t->ctrlr = ctrlr;
+static int init_thread(struct thread_ctx *t, const char *name) {
+    uint32_t sector = spdk_nvme_ns_get_sector_size(spdk_nvme_ctrlr_get_ns(g_ctrlr, NAMESPACE_ID));
+    uint64_t hz = spdk_get_ticks_hz();
+
     snprintf(t->name, sizeof(t->name), "%s", name);
-    for (int i = 0; i < QPAIRS_PER_THREAD; i++) {
-        t->qpairs[i].id = i;
-        t->qpairs[i].qpair = spdk_nvme_ctrlr_alloc_io_qpair(ctrlr, NULL, 0);
-        if (!t->qpairs[i].qpair) {
-            fprintf(stderr, "alloc qpair %d failed\n", i);
+    t->ns = spdk_nvme_ctrlr_get_ns(g_ctrlr, NAMESPACE_ID);
+    t->nqp = g_qpairs_per_thread;
+    t->qpairs = calloc(t->nqp, sizeof(*t->qpairs));
+    t->active = calloc(t->nqp, sizeof(*t->active));
+    t->cold_interval_tsc = COLD_INTERVAL_US * hz / 1000000;
+    t->next_cold = 1;
+    if (!t->qpairs || !t->active) {
+        return -1;
+    }
+
+    for (int i = 0; i < t->nqp; i++) {
+        struct qpair_ctx *qp = &t->qpairs[i];
+        uint32_t io_size = i == 0 ? HOT_IO_SIZE : COLD_IO_SIZE;
+
+        qp->t = t;
+        qp->id = i;
+        qp->hot = (i == 0);
+        qp->qd = qp->hot ? HOT_QD : 1;
+        qp->nlb = io_size / sector;
+        qp->next_lba = (uint64_t)i * 1024 * 1024 / sector;
+        qp->active_idx = -1;
+        qp->qpair = spdk_nvme_ctrlr_alloc_io_qpair(g_ctrlr, NULL, 0);
+        if (!qp->qpair) {
+            fprintf(stderr, "[%-10s] alloc qpair %d failed\n", t->name, i);
             return -1;
         }
+        qp->reqs = calloc(qp->qd, sizeof(*qp->reqs));
+        qp->free_reqs = calloc(qp->qd, sizeof(*qp->free_reqs));
+        if (!qp->reqs || !qp->free_reqs) {
+            return -1;
+        }
+        for (int j = 0; j < qp->qd; j++) {
+            qp->reqs[j].qp = qp;
+            qp->reqs[j].buf = spdk_zmalloc(io_size, 0x1000, NULL, SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
+            if (!qp->reqs[j].buf) {
+                fprintf(stderr, "[%-10s] alloc buffer failed\n", t->name);
+                return -1;
+            }
+            qp->free_reqs[qp->nfree++] = &qp->reqs[j];
+        }
     }
     return 0;
 }
 
-static void reactor_start(void *arg) {
-    struct reactor_ctx *rctx = arg;
+static void fini_thread(struct thread_ctx *t) {
+    if (!t->qpairs) {
+        return;
+    }
+    for (int i = 0; i < t->nqp; i++) {
+        struct qpair_ctx *qp = &t->qpairs[i];
+
+        if (qp->qpair) {
+            spdk_nvme_ctrlr_free_io_qpair(qp->qpair);
+        }
+        for (int j = 0; qp->reqs && j < qp->qd; j++) {
+            spdk_free(qp->reqs[j].buf);
+        }
+        free(qp->reqs);
+        free(qp->free_reqs);
+    }
+    free(t->qpairs);
+    free(t->active);
+}
+
+static void poll_qpair(struct thread_ctx *t, struct qpair_ctx *qp, uint32_t budget) {
+    uint64_t t0 = spdk_get_ticks(), t1, cap;
+    int n = spdk_nvme_qpair_process_completions(qp->qpair, budget);
+
+    t1 = spdk_get_ticks();
+    t->polls++;
+    if (n > 0) {
+        qp->backoff_tsc = 0;
+        qp->next_poll_tsc = 0;
+        return;
+    }
+    t->empty_polls++;
+    t->empty_tsc += t1 - t0;
+    if (g_mode == POLL_SCHED) {
+        cap = qp->lat_ewma_tsc >> BACKOFF_SHIFT;
+        qp->backoff_tsc = spdk_min(qp->backoff_tsc ? qp->backoff_tsc * 2 : g_backoff_min_tsc, cap);
+        qp->next_poll_tsc = t1 + qp->backoff_tsc;
+    }
+}
+
+/* 舊的作法：每個 qpair 每一輪都 poll */
+static void poll_naive(struct thread_ctx *t) {
+    for (int i = 0; i < t->nqp; i++) {
+        poll_qpair(t, &t->qpairs[i], 0);
+    }
+}
+
+/*
+ * 只走 active list。從尾巴往前走：callback 裡 qpair 變空時 active_del 會把最後一個搬到它的位置，
+ * 那個已經 poll 過了；新加進來的接在尾巴，這一輪不會碰到
+ */
+static void poll_sched(struct thread_ctx *t) {
+    uint64_t now = spdk_get_ticks();
+
+    for (int i = t->nactive - 1; i >= 0; i--) {
+        struct qpair_ctx *qp = t->active[i];
+
+        if (now < qp->next_poll_tsc) {
+            t->backoff_skips++;
+            continue;
+        }
+        poll_qpair(t, qp, POLL_BUDGET);
+    }
+}
+
+static void thread_step(struct thread_ctx *t, uint64_t now) {
+    if (now >= t->next_cold_tsc && t->nqp > 1) {
+        submit_one(&t->qpairs[t->next_cold]);
+        t->next_cold = t->next_cold + 1 < t->nqp ? t->next_cold + 1 : 1;
+        t->next_cold_tsc = now + t->cold_interval_tsc;
+    }
+    if (g_mode == POLL_NAIVE) {
+        poll_naive(t);
+    } else {
+        poll_sched(t);
+    }
+}
+
+static int reactor_main(void *arg) {
+    struct reactor_ctx *r = arg;
+    uint64_t hz = spdk_get_ticks_hz();
+    uint64_t start, end, now;
+    bool busy;
+
     for (int t = 0; t < THREADS_PER_REACTOR; t++) {
         char tname[32];
-        snprintf(tname, sizeof(tname), "r%d_t%d", rctx->core, t);
-        init_thread(rctx->threads + t, rctx->threads[t].name, tname);
-        spdk_thread_send_msg(spdk_get_thread(), thread_work, rctx->threads + t);
+
+        snprintf(tname, sizeof(tname), "r%d_t%d", r->core, t);
+        if (init_thread(&r->threads[t], tname) != 0) {
+            return -1;
+        }
+    }
+    printf("[core %d] %d threads x %d qpairs, mode %s\n", r->core, THREADS_PER_REACTOR,
+           g_qpairs_per_thread, g_mode_name[g_mode]);
+
+    for (int t = 0; t < THREADS_PER_REACTOR; t++) {
+        for (int j = 0; j < HOT_QD; j++) {
+            submit_one(&r->threads[t].qpairs[0]);
+        }
+    }
+
+    start = spdk_get_ticks();
+    end = start + RUN_SEC * hz;
+    now = start;
+    while (now < end) {
+        for (int t = 0; t < THREADS_PER_REACTOR; t++) {
+            thread_step(&r->threads[t], now);
+        }
+        now = spdk_get_ticks();
+    }
+    r->loop_tsc = now - start;
+
+    /* 收尾：hot qpair 不再補送，等所有 IO 完成 */
+    for (int t = 0; t < THREADS_PER_REACTOR; t++) {
+        r->threads[t].draining = true;
+    }
+    do {
+        busy = false;
+        for (int t = 0; t < THREADS_PER_REACTOR; t++) {
+            for (int q = 0; q < r->threads[t].nqp; q++) {
+                if (r->threads[t].qpairs[q].outstanding > 0) {
+                    spdk_nvme_qpair_process_completions(r->threads[t].qpairs[q].qpair, 0);
+                    busy = true;
+                }
+            }
+        }
+    } while (busy);
+    return 0;
+}
+
+static void print_report(struct reactor_ctx *reactors) {
+    uint64_t hz = spdk_get_ticks_hz();
+
+    printf("%-6s %-10s %5s %10s %12s %12s %12s %8s %12s %8s %10s\n", "mode", "thread", "qps", "IOPS",
+           "hot avg(us)", "cold avg(us)", "polls", "empty%", "empty cyc/IO", "empty%cpu", "backoff");
+    for (int core = 0; core < REACTOR_CORES; core++) {
+        struct reactor_ctx *r = &reactors[core];
+        uint64_t empty_tsc = 0;
+
+        if (r->loop_tsc == 0) {
+            printf("[core %d] failed to start\n", core);
+            continue;
+        }
+        for (int i = 0; i < THREADS_PER_REACTOR; i++) {
+            struct thread_ctx *t = &r->threads[i];
+            uint64_t done = t->completed[0] + t->completed[1];
+
+            empty_tsc += t->empty_tsc;
+            printf("%-6s %-10s %5d %10.0f %12.1f %12.1f %12" PRIu64 " %7.1f%% %12.0f %7.1f%% %10" PRIu64 "\n",
+                   g_mode_name[g_mode], t->name, t->nqp, (double)done * hz / r->loop_tsc,
+                   t->completed[1] ? (double)t->lat_sum[1] * 1000000 / hz / t->completed[1] : 0.0,
+                   t->completed[0] ? (double)t->lat_sum[0] * 1000000 / hz / t->completed[0] : 0.0,
+                   t->polls, t->polls ? t->empty_polls * 100.0 / t->polls : 0.0,
+                   done ? (double)t->empty_tsc / done : 0.0,
+                   t->empty_tsc * 100.0 / r->loop_tsc, t->backoff_skips);
+        }
+        printf("[core %d] empty polls used %.1f%% of the reactor loop\n", core, empty_tsc * 100.0 / r->loop_tsc);
     }
 }
 
 int main(int argc, char **argv) {
-    struct spdk_app_opts opts;
-    struct spdk_nvme_ctrlr *ctrlr;
+    struct spdk_env_opts opts;
     struct spdk_nvme_transport_id trid = {};
-    struct reactor_ctx reactors[REACTOR_CORES];
+    struct nvme_attach_ctrlr attach;
+    static struct reactor_ctx reactors[REACTOR_CORES];
+
+    if (argc > 2) {
+        for (int m = POLL_NAIVE; m <= POLL_SCHED; m++) {
+            if (strcmp(argv[2], g_mode_name[m]) == 0) {
+                g_mode = m;
+            }
+        }
+    }
+    if (argc > 3) {
+        g_qpairs_per_thread = atoi(argv[3]);
+        if (g_qpairs_per_thread < 1 || g_qpairs_per_thread > MAX_QPAIRS_PER_THREAD) {
+            fprintf(stderr, "qpairs_per_thread must be 1..%d\n", MAX_QPAIRS_PER_THREAD);
+            return -1;
+        }
+    }
 
-    spdk_app_opts_init(&opts, sizeof(opts));
+    spdk_env_opts_init(&opts);
     opts.name = "nvme_multi_reactor_thread_qpair";
-    opts.reactor_mask = "0x3"; // core0 & core1
-    spdk_env_init(&opts);
+    opts.core_mask = "0x3"; // core0 & core1
+    if (spdk_bench_preflight_run(opts.name, opts.core_mask, NULL) != 0) {
+        return -1;
+    }
+    if (spdk_env_init(&opts) < 0) {
+        fprintf(stderr, "Unable to initialize SPDK env\n");
+        return -1;
+    }
+    g_backoff_min_tsc = BACKOFF_MIN_US * spdk_get_ticks_hz() / 1000000;
 
-    trid.trtype = SPDK_NVME_TRANSPORT_PCIE;
-    snprintf(trid.traddr, sizeof(trid.traddr), "0000:01:00.0");
+    // argv[1] 可給完整 trid，例如 "trtype:EMU traddr:emu0" (nvme_emu_transport.c)
+    if (argc > 1) {
+        if (spdk_nvme_transport_id_parse(&trid, argv[1]) != 0) {
+            fprintf(stderr, "invalid trid: %s\n", argv[1]);
+            return -1;
+        }
+    } else {
+        spdk_nvme_trid_populate_transport(&trid, SPDK_NVME_TRANSPORT_PCIE);
+        snprintf(trid.traddr, sizeof(trid.traddr), "%s", DEFAULT_TRADDR);
+    }
 
-    ctrlr = spdk_nvme_connect(&trid, NULL, 0);
-    if (!ctrlr) {
+    spdk_nvme_attach_init(&attach, &trid);
+    if (spdk_nvme_attach_all(&attach, 1, NULL, NULL, NULL) != 0) {
         fprintf(stderr, "connect NVMe ctrlr failed\n");
         return -1;
     }
+    g_ctrlr = attach.ctrlr;
 
+    // reactor 1.. 用 pinned env thread，reactor 0 由 main thread 自己跑
     for (int core = 0; core < REACTOR_CORES; core++) {
         reactors[core].core = core;
-        reactor_start(&reactors[core]);
     }
+    for (int core = 1; core < REACTOR_CORES; core++) {
+        spdk_env_thread_launch_pinned(core, reactor_main, &reactors[core]);
+    }
+    reactor_main(&reactors[0]);
+    spdk_env_thread_wait_all();
 
-    /* Polling loop (簡化示範) */
-    while (1) {
-        for (int core = 0; core < REACTOR_CORES; core++) {
-            for (int t = 0; t < THREADS_PER_REACTOR; t++) {
-                for (int q = 0; q < QPAIRS_PER_THREAD; q++) {
-                    spdk_nvme_qpair_process_completions(
-                        reactors[core].threads[t].qpairs[q].qpair, 0);
-                }
-            }
+    print_report(reactors);
+
+    for (int core = 0; core < REACTOR_CORES; core++) {
+        for (int t = 0; t < THREADS_PER_REACTOR; t++) {
+            fini_thread(&reactors[core].threads[t]);
         }
     }
-
-    spdk_nvme_detach(ctrlr);
+    spdk_nvme_detach(g_ctrlr);
+    spdk_env_fini();
     return 0;
 }
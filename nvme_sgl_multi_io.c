@@ -0,0 +1,283 @@
+/*
+單一 core，一個 qpair，用 spdk_nvme_ns_cmd_readv / writev 送出 scatter-gather IO
+每個 IO 由 N 個不連續的 segment 組成（各自 spdk_zmalloc，模擬碎片化的 buffer）
+依序掃過不同的 segment 數，量測每個 IO 的 submit / 總 CPU 成本，看 overhead 如何隨 segment 數成長
+
+controller 支援 SGL 時，SPDK 會自動用 SGL 描述 payload，否則退回 PRP list
+（PRP 只能描述 4K 對齊的 segment，seg_size < 4K 時只有 SGL controller 能跑）
+
+用法：
+  ./nvme_sgl_multi_io [trid] [seg_size] [max_segs]
+  seg_size 每個 segment 的 bytes (預設 4096，要是 sector size 的倍數)，
+  segment 數從 1 每次加倍掃到 max_segs (預設 32，最多 SEGS_LIMIT)
+*/
+#include "spdk/stdinc.h"
+#include "spdk/env.h"
+#include "spdk/nvme.h"
+#include "spdk_bench_preflight.h"
+#include "spdk_nvme_attach.h"
+
+#define NAMESPACE_ID     1
+#define QUEUE_DEPTH      32
+#define IO_PER_ROUND     100000
+#define DEFAULT_SEG_SIZE 4096    // 每個 segment 大小 (bytes)
+#define DEFAULT_MAX_SEGS 32      // 掃到的最大 segment 數
+#define SEGS_LIMIT       256     // max_segs 上限 (io_task 的 iov 陣列大小)
+#define DO_WRITE         0       // 0: readv, 1: writev
+#define DEFAULT_TRADDR   "0000:01:00.0"
+
+static uint32_t g_seg_size = DEFAULT_SEG_SIZE;
+static int g_max_segs = DEFAULT_MAX_SEGS;
+
+struct io_task {
+    struct iovec iov[SEGS_LIMIT];
+    int iovcnt;
+    /* reset_sgl / next_sge 的走訪位置 */
+    int iov_pos;
+    uint32_t iov_offset;
+    struct round_ctx *round;
+};
+
+struct round_ctx {
+    struct spdk_nvme_ns *ns;
+    struct spdk_nvme_qpair *qpair;
+    int segs;
+    uint64_t lba_count;     // 每個 IO 的 block 數
+    uint64_t max_lba;
+    uint64_t next_lba;
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t failed;
+    uint64_t submit_tsc;    // 花在 readv/writev 呼叫裡的 ticks
+};
+
+static void reset_sgl(void *cb_arg, uint32_t offset) {
+    struct io_task *task = cb_arg;
+
+    task->iov_pos = 0;
+    while (task->iov_pos < task->iovcnt && offset >= task->iov[task->iov_pos].iov_len) {
+        offset -= task->iov[task->iov_pos].iov_len;
+        task->iov_pos++;
+    }
+    task->iov_offset = offset;
+}
+
+static int next_sge(void *cb_arg, void **address, uint32_t *length) {
+    struct io_task *task = cb_arg;
+    struct iovec *iov;
+
+    /* driver 要的比 iov 多：lba_count 和 iov 總長對不上，回錯誤讓 submit 失敗，不要讀過頭 */
+    if (task->iov_pos >= task->iovcnt) {
+        return -EINVAL;
+    }
+    iov = &task->iov[task->iov_pos];
+    *address = (uint8_t *)iov->iov_base + task->iov_offset;
+    *length = iov->iov_len - task->iov_offset;
+    task->iov_pos++;
+    task->iov_offset = 0;
+    return 0;
+}
+
+static int submit_task(struct io_task *task);
+
+static void io_complete(void *arg, const struct spdk_nvme_cpl *cpl) {
+    struct io_task *task = arg;
+    struct round_ctx *r = task->round;
+
+    r->completed++;
+    if (spdk_nvme_cpl_is_error(cpl)) {
+        r->failed++;
+    }
+    if (r->submitted < IO_PER_ROUND) {
+        submit_task(task);
+    }
+}
+
+static int submit_task(struct io_task *task) {
+    struct round_ctx *r = task->round;
+    uint64_t lba = r->next_lba;
+    uint64_t tsc;
+    int rc;
+
+    r->next_lba += r->lba_count;
+    if (r->next_lba + r->lba_count > r->max_lba) {
+        r->next_lba = 0;
+    }
+
+    tsc = spdk_get_ticks();
+    if (DO_WRITE) {
+        rc = spdk_nvme_ns_cmd_writev(r->ns, r->qpair, lba, r->lba_count, io_complete, task, 0,
+                                     reset_sgl, next_sge);
+    } else {
+        rc = spdk_nvme_ns_cmd_readv(r->ns, r->qpair, lba, r->lba_count, io_complete, task, 0,
+                                    reset_sgl, next_sge);
+    }
+    r->submit_tsc += spdk_get_ticks() - tsc;
+
+    if (rc != 0) {
+        fprintf(stderr, "submit %s segs=%d failed rc=%d\n", DO_WRITE ? "writev" : "readv", r->segs, rc);
+        return rc;
+    }
+    r->submitted++;
+    return 0;
+}
+
+static int alloc_task(struct io_task *task, int segs) {
+    task->iovcnt = segs;
+    for (int i = 0; i < segs; i++) {
+        task->iov[i].iov_base = spdk_zmalloc(g_seg_size, 0x1000, NULL, SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
+        task->iov[i].iov_len = g_seg_size;
+        if (!task->iov[i].iov_base) {
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+static void free_task(struct io_task *task) {
+    for (int i = 0; i < task->iovcnt; i++) {
+        spdk_free(task->iov[i].iov_base);
+    }
+}
+
+static void run_round(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair, int segs) {
+    static struct io_task tasks[QUEUE_DEPTH];
+    struct round_ctx r = {};
+    uint32_t sector = spdk_nvme_ns_get_sector_size(ns);
+    uint64_t start_tsc, elapsed, hz = spdk_get_ticks_hz();
+    int started = 0;
+
+    if ((uint64_t)g_seg_size * segs > spdk_nvme_ns_get_max_io_xfer_size(ns)) {
+        printf("%5d segs: skip, %lu bytes > max xfer %u\n", segs, (uint64_t)g_seg_size * segs,
+               spdk_nvme_ns_get_max_io_xfer_size(ns));
+        return;
+    }
+
+    r.ns = ns;
+    r.qpair = qpair;
+    r.segs = segs;
+    r.lba_count = (uint64_t)g_seg_size * segs / sector;
+    r.max_lba = spdk_nvme_ns_get_num_sectors(ns);
+
+    /* 先全部清掉：中途配置失敗時 out: 只會 free 到這一輪配到的，不會碰到上一輪已經 free 的 iov */
+    memset(tasks, 0, sizeof(tasks));
+    for (int i = 0; i < QUEUE_DEPTH; i++) {
+        tasks[i].round = &r;
+        if (alloc_task(&tasks[i], segs) != 0) {
+            fprintf(stderr, "spdk_zmalloc failed\n");
+            goto out;
+        }
+    }
+
+    start_tsc = spdk_get_ticks();
+    for (int i = 0; i < QUEUE_DEPTH; i++) {
+        if (submit_task(&tasks[i]) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        printf("%5d segs: not supported by this controller (PRP needs 4K-aligned segments)\n", segs);
+        goto out;
+    }
+    while (r.completed < r.submitted) {
+        spdk_nvme_qpair_process_completions(qpair, 0);
+    }
+    elapsed = spdk_get_ticks() - start_tsc;
+
+    printf("%5d segs %8lu B/IO: %10.0f IOPS %8.1f MiB/s  submit %6.0f ticks/IO  total %6.0f ticks/IO  fail %lu\n",
+           segs, (uint64_t)g_seg_size * segs,
+           (double)r.completed * hz / elapsed,
+           (double)r.completed * g_seg_size * segs * hz / elapsed / (1024 * 1024),
+           (double)r.submit_tsc / r.submitted,
+           (double)elapsed / r.completed, r.failed);
+
+out:
+    for (int i = 0; i < QUEUE_DEPTH; i++) {
+        free_task(&tasks[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    struct spdk_env_opts opts;
+    struct spdk_nvme_transport_id trid = {};
+    struct nvme_attach_ctrlr attach;
+    struct spdk_nvme_ctrlr *ctrlr;
+    struct spdk_nvme_ns *ns;
+    struct spdk_nvme_qpair *qpair;
+    uint64_t flags;
+
+    if (argc > 2) {
+        g_seg_size = (uint32_t)atoi(argv[2]);
+        if (g_seg_size == 0 || g_seg_size % 512 != 0) {
+            fprintf(stderr, "seg_size must be a positive multiple of 512\n");
+            return -1;
+        }
+    }
+    if (argc > 3) {
+        g_max_segs = atoi(argv[3]);
+        if (g_max_segs < 1 || g_max_segs > SEGS_LIMIT) {
+            fprintf(stderr, "max_segs must be 1..%d\n", SEGS_LIMIT);
+            return -1;
+        }
+    }
+
+    spdk_env_opts_init(&opts);
+    opts.name = "nvme_sgl_multi_io";
+    opts.core_mask = "0x1";
+    if (spdk_bench_preflight_run(opts.name, opts.core_mask, NULL) != 0) {
+        return -1;
+    }
+    if (spdk_env_init(&opts) < 0) {
+        fprintf(stderr, "Unable to initialize SPDK env\n");
+        return -1;
+    }
+
+    // argv[1] 可給完整 trid，例如 "trtype:TCP adrfam:IPv4 traddr:127.0.0.1 trsvcid:4420 subnqn:..."
+    if (argc > 1) {
+        if (spdk_nvme_transport_id_parse(&trid, argv[1]) != 0) {
+            fprintf(stderr, "invalid trid: %s\n", argv[1]);
+            return -1;
+        }
+    } else {
+        spdk_nvme_trid_populate_transport(&trid, SPDK_NVME_TRANSPORT_PCIE);
+        snprintf(trid.traddr, sizeof(trid.traddr), "%s", DEFAULT_TRADDR);
+    }
+
+    spdk_nvme_attach_init(&attach, &trid);
+    if (spdk_nvme_attach_all(&attach, 1, NULL, NULL, NULL) != 0) {
+        fprintf(stderr, "connect NVMe ctrlr failed\n");
+        return -1;
+    }
+    ctrlr = attach.ctrlr;
+    ns = spdk_nvme_ctrlr_get_ns(ctrlr, NAMESPACE_ID);
+    qpair = spdk_nvme_ctrlr_alloc_io_qpair(ctrlr, NULL, 0);
+    if (!ns || !qpair) {
+        fprintf(stderr, "get ns / alloc qpair failed\n");
+        spdk_nvme_detach(ctrlr);
+        return -1;
+    }
+    if (g_seg_size % spdk_nvme_ns_get_sector_size(ns) != 0) {
+        fprintf(stderr, "seg_size %u is not a multiple of sector size %u\n", g_seg_size,
+                spdk_nvme_ns_get_sector_size(ns));
+        spdk_nvme_ctrlr_free_io_qpair(qpair);
+        spdk_nvme_detach(ctrlr);
+        return -1;
+    }
+
+    flags = spdk_nvme_ctrlr_get_flags(ctrlr);
+    printf("%s: payload described by %s, max SGEs %u, seg size %u, qd %d, %s\n",
+           trid.traddr,
+           (trid.trtype != SPDK_NVME_TRANSPORT_PCIE || (flags & SPDK_NVME_CTRLR_SGL_SUPPORTED)) ?
+           "SGL" : "PRP list",
+           spdk_nvme_ctrlr_get_max_sges(ctrlr), g_seg_size, QUEUE_DEPTH,
+           DO_WRITE ? "writev" : "readv");
+
+    for (int segs = 1; segs <= g_max_segs; segs *= 2) {
+        run_round(ns, qpair, segs);
+    }
+
+    spdk_nvme_ctrlr_free_io_qpair(qpair);
+    spdk_nvme_detach(ctrlr);
+    spdk_env_fini();
+    return 0;
+}
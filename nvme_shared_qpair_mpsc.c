@@ -0,0 +1,709 @@
+/*
+SPDK threads 比 controller 的 HW IO queue 多時：多個 thread 共用一個 qpair，透過 lock-free MPSC staging ring 送 IO
+
+nvme_multicore_multi_thread_multi_qpair.c 每個 thread 各自 alloc qpair，
+REACTOR_CORES x THREADS_PER_REACTOR x QPAIRS_PER_THREAD 超過 controller 的 IO queue 數 (常見 16~32) 就 alloc 失敗。
+
+exclusive：每個 thread 一個自己的 qpair (對照組)，直接 submit / process_completions
+shared   ：只建 qpairs 個 qpair，thread 依編號切成連續的組，每組一個 qpair，組內第一個 thread 是 owner
+  producer thread ──MPSC sq──> owner thread ──spdk_nvme_ns_cmd_read──> qpair
+  owner 的 completion callback ──SPSC cq──> producer thread
+  - sq：Vyukov bounded MPSC (每格一個 sequence)，producer 用 CAS 搶位置，不用 lock；
+    同一 reactor 上的 thread 是協作式輪流跑，不會真的搶，但跨 reactor 的組也用同一套
+  - owner 自己的 IO 直接 submit，不經 ring
+  - qpair 滿 (-ENOMEM) 時 owner 把拿出來的那個 request 留著，下一輪先送它
+  - ring 容量 >= 組內 QD 總和，不會滿；io_queue_size 也盡量開到組內 QD 總和
+
+  sudo ./nvme_shared_qpair_mpsc <exclusive|shared> [reactors] [threads_per_reactor] [qpairs] [trid]
+    qpairs 預設 = reactors (同一 reactor 的 thread 共用一個 qpair)；給比 reactors 小的值時一組會跨 reactor
+
+輸出 IOPS、latency 分位數，以及每個 IO 花掉的 CPU (所有 thread 的 busy tsc / IO 數，來自 spdk_thread_get_stats)，
+同樣 thread 數下 exclusive 和 shared 比，差值就是 staging ring 多一跳的成本；結果 append 到 shared_qpair_result.csv
+
+結束前印 hugepage 用量 (spdk_dma_account.h)：IO buffer 和 qpair (依 io_queue_size / io_queue_requests 估算)
+
+編譯：gcc -o nvme_shared_qpair_mpsc nvme_shared_qpair_mpsc.c spdk_nvme_attach.c spdk_bench_preflight.c spdk_dma_account.c \
+        $(pkg-config --cflags --libs spdk_nvme spdk_env_dpdk spdk_thread spdk_event)
+*/
+#include "spdk/stdinc.h"
+#include "spdk/env.h"
+#include "spdk/event.h"
+#include "spdk/nvme.h"
+#include "spdk/thread.h"
+#include "spdk/util.h"
+#include "spdk_bench_preflight.h"
+#include "spdk_bench_util.h"
+#include "spdk_dma_account.h"
+#include "spdk_nvme_attach.h"
+
+#define DEFAULT_TRADDR      "0000:01:00.0"
+#define NAMESPACE_ID        1
+#define MAX_REACTORS        32
+#define MAX_THREADS         256
+#define IO_QD               16          // 每個 thread 的 queue depth
+#define IO_SIZE             4096
+#define RAMP_SEC            2
+#define RUN_SEC             10
+#define OWNER_BURST         64          // owner 每輪最多從 sq 拿多少個 request
+#define RESULT_CSV          "shared_qpair_result.csv"
+#define CACHE_LINE          64
+
+/* ---------------- lock-free MPSC ring (Vyukov bounded queue，consumer 只有一個) ---------------- */
+struct mpsc_cell {
+    uint64_t seq;
+    void    *obj;
+};
+
+struct mpsc_ring {
+    uint64_t head __attribute__((aligned(CACHE_LINE)));     // producers 用 CAS 推進
+    uint64_t tail __attribute__((aligned(CACHE_LINE)));     // 只有 consumer 寫
+    uint64_t mask __attribute__((aligned(CACHE_LINE)));
+    struct mpsc_cell *cells;
+};
+
+static int
+mpsc_init(struct mpsc_ring *r, uint32_t size)
+{
+    r->head = r->tail = 0;
+    r->mask = size - 1;
+    r->cells = calloc(size, sizeof(*r->cells));
+    if (!r->cells) {
+        return -ENOMEM;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        r->cells[i].seq = i;
+    }
+    return 0;
+}
+
+static inline int
+mpsc_enqueue(struct mpsc_ring *r, void *obj)
+{
+    uint64_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    struct mpsc_cell *cell;
+
+    for (;;) {
+        int64_t diff;
+
+        cell = &r->cells[pos & r->mask];
+        diff = (int64_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (int64_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -ENOSPC;
+        } else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        }
+    }
+    cell->obj = obj;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static inline void *
+mpsc_dequeue(struct mpsc_ring *r)
+{
+    struct mpsc_cell *cell = &r->cells[r->tail & r->mask];
+    void *obj;
+
+    /* producer 搶到位置但還沒寫完時 seq 還是舊的，當作空的，下一輪再拿 */
+    if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != r->tail + 1) {
+        return NULL;
+    }
+    obj = cell->obj;
+    __atomic_store_n(&cell->seq, r->tail + r->mask + 1, __ATOMIC_RELEASE);
+    r->tail++;
+    return obj;
+}
+
+/* ---------------- 資料結構 ---------------- */
+struct lat_stats {
+    uint64_t ios;
+    uint64_t errors;
+    uint64_t lat_sum_ns;
+    uint64_t lat_max_ns;
+    uint64_t hist[LAT_BUCKETS];
+};
+
+struct io_worker;
+
+struct io_req {
+    struct io_worker *w;
+    void     *buf;
+    uint64_t  lba;
+    uint64_t  submit_tsc;
+    bool      success;
+};
+
+struct shared_qp {
+    struct spdk_nvme_qpair  *qpair;
+    struct io_worker        *owner;
+    struct mpsc_ring         sq;
+    struct io_req           *held;          // 上一輪 -ENOMEM 沒送出去的
+    uint32_t                 nproducers;
+    uint64_t                 submitted;
+    uint64_t                 enomem;
+};
+
+struct io_worker {
+    int                      idx;
+    int                      core;
+    char                     name[32];
+    struct spdk_thread      *th;
+    struct spdk_poller      *poller;
+    struct spdk_nvme_qpair  *qpair;         // exclusive：自己的；shared：只有 owner 有
+    uint32_t                 qpair_size;    // alloc 時的 io_queue_size / io_queue_requests，記帳用
+    uint32_t                 qpair_requests;
+    struct shared_qp        *sqp;           // shared：所屬的組
+    struct spsc_ring         cq;            // shared：owner 送回來的 completion
+    struct io_req            reqs[IO_QD];
+    struct io_req           *free_reqs[IO_QD];
+    uint32_t                 nfree;
+    uint32_t                 outstanding;
+    bool                     stopping;
+    uint64_t                 rng;
+    uint64_t                 stats_tsc;
+    uint64_t                 end_tsc;
+    uint64_t                 busy_start;
+    uint64_t                 busy_tsc;
+    struct lat_stats         stats;
+};
+
+static bool g_shared;
+static int g_nreactors = 2;
+static int g_threads_per_reactor = 4;
+static int g_nqpairs;
+static int g_nworkers;
+static char g_reactor_mask[32];
+static struct spdk_nvme_transport_id g_trid;
+
+static struct spdk_nvme_ctrlr *g_ctrlr;
+static struct spdk_nvme_ns *g_ns;
+static uint32_t g_sector_size;
+static uint64_t g_io_slots;
+static struct io_worker g_workers[MAX_THREADS];
+static struct shared_qp g_sqps[MAX_THREADS];
+static struct spdk_poller *g_timer;
+static int g_pending;
+static int g_rc;
+
+/* ---------------- latency histogram (bucket 在 spdk_bench_util.h) ---------------- */
+static double
+lat_percentile_us(const struct lat_stats *s, double p)
+{
+    return lat_hist_percentile_us(s->hist, s->ios, s->lat_max_ns, p);
+}
+
+static uint64_t
+thread_busy_tsc(void)
+{
+    struct spdk_thread_stats st;
+
+    if (spdk_thread_get_stats(&st) != 0) {
+        return 0;
+    }
+    return st.busy_tsc;
+}
+
+/* ---------------- IO path ---------------- */
+static void worker_exited(void *arg);
+static void worker_fill(struct io_worker *w);
+
+/* request 回到 producer thread：記錄 latency，送下一個 */
+static void
+req_finish(struct io_worker *w, struct io_req *req)
+{
+    uint64_t ns = (spdk_get_ticks() - req->submit_tsc) * SPDK_SEC_TO_NSEC / spdk_get_ticks_hz();
+    struct lat_stats *s = &w->stats;
+
+    s->ios++;
+    s->lat_sum_ns += ns;
+    if (ns > s->lat_max_ns) {
+        s->lat_max_ns = ns;
+    }
+    s->hist[lat_bucket(ns)]++;
+    if (!req->success) {
+        s->errors++;
+    }
+    w->outstanding--;
+    w->free_reqs[w->nfree++] = req;
+    if (!w->stopping) {
+        worker_fill(w);
+    }
+}
+
+/* 跑在擁有 qpair 的 thread 上 (exclusive：自己；shared：owner) */
+static void
+io_complete(void *arg, const struct spdk_nvme_cpl *cpl)
+{
+    struct io_req *req = arg;
+    struct io_worker *w = req->w;
+    int rc;
+
+    req->success = !spdk_nvme_cpl_is_error(cpl);
+    if (w->qpair) {
+        req_finish(w, req);
+        return;
+    }
+    rc = spsc_enqueue(&w->cq, req);
+    assert(rc == 0);    // cq 容量 >= IO_QD
+    (void)rc;
+}
+
+static inline int
+req_submit(struct spdk_nvme_qpair *qpair, struct io_req *req)
+{
+    return spdk_nvme_ns_cmd_read(g_ns, qpair, req->buf, req->lba, IO_SIZE / g_sector_size, io_complete, req, 0);
+}
+
+static int
+worker_submit_one(struct io_worker *w)
+{
+    struct io_req *req = w->free_reqs[w->nfree - 1];
+    int rc;
+
+    req->lba = (xorshift64(&w->rng) % g_io_slots) * (IO_SIZE / g_sector_size);
+    req->submit_tsc = spdk_get_ticks();
+    if (w->qpair) {
+        rc = req_submit(w->qpair, req);
+    } else {
+        rc = mpsc_enqueue(&w->sqp->sq, req);
+    }
+    if (rc != 0) {
+        /* -ENOMEM：qpair 的 request 用完，等 completion 或下一輪 poller 再補 */
+        if (rc != -ENOMEM && rc != -ENOSPC) {
+            fprintf(stderr, "[%s] submit rc=%d\n", w->name, rc);
+            w->stats.errors++;
+        }
+        return rc;
+    }
+    w->nfree--;
+    w->outstanding++;
+    return 0;
+}
+
+static void
+worker_fill(struct io_worker *w)
+{
+    while (!w->stopping && w->nfree > 0) {
+        if (worker_submit_one(w) != 0) {
+            break;
+        }
+    }
+}
+
+/* owner：把 sq 裡別的 thread 的 request 送進 qpair */
+static uint32_t
+owner_drain(struct shared_qp *sqp)
+{
+    uint32_t n = 0;
+
+    while (n < OWNER_BURST) {
+        struct io_req *req = sqp->held ? sqp->held : mpsc_dequeue(&sqp->sq);
+        int rc;
+
+        if (!req) {
+            break;
+        }
+        rc = req_submit(sqp->qpair, req);
+        if (rc == -ENOMEM) {
+            sqp->held = req;
+            sqp->enomem++;
+            break;
+        }
+        sqp->held = NULL;
+        if (rc != 0) {
+            req->success = false;
+            spsc_enqueue(&req->w->cq, req);
+        }
+        sqp->submitted++;
+        n++;
+    }
+    return n;
+}
+
+static int
+worker_poll(void *arg)
+{
+    struct io_worker *w = arg;
+    void *done[IO_QD];
+    int64_t events = 0;
+    uint32_t n;
+
+    if (w->sqp && w->sqp->owner == w) {
+        events += owner_drain(w->sqp);
+    }
+    if (w->qpair) {
+        int32_t rc = spdk_nvme_qpair_process_completions(w->qpair, 0);
+
+        events += rc > 0 ? rc : 0;
+    }
+    if (w->sqp && !w->qpair) {
+        n = spsc_dequeue(&w->cq, done, IO_QD);
+        for (uint32_t i = 0; i < n; i++) {
+            req_finish(w, done[i]);
+        }
+        events += n;
+    }
+    if (!w->stopping && w->nfree > 0) {
+        worker_fill(w);
+    }
+
+    if (w->stopping && w->outstanding == 0 && w->end_tsc == 0) {
+        w->end_tsc = spdk_get_ticks();
+        w->busy_tsc = thread_busy_tsc() - w->busy_start;
+        spdk_thread_send_msg(spdk_thread_get_app_thread(), worker_exited, w);
+    }
+    return events ? SPDK_POLLER_BUSY : SPDK_POLLER_IDLE;
+}
+
+/* ---------------- thread 生命週期 ---------------- */
+static void
+worker_init(void *arg)
+{
+    struct io_worker *w = arg;
+
+    for (int i = 0; i < IO_QD; i++) {
+        w->reqs[i].w = w;
+        w->reqs[i].buf = spdk_dma_account_zmalloc(DMA_ACCT_IO_BUF, IO_SIZE, 0x1000, SPDK_ENV_SOCKET_ID_ANY);
+        if (!w->reqs[i].buf) {
+            g_rc = -1;
+        }
+        w->free_reqs[w->nfree++] = &w->reqs[i];
+    }
+    if (w->sqp && spsc_init(&w->cq, pow2_roundup(IO_QD)) != 0) {
+        g_rc = -1;
+    }
+
+    if (!g_shared || w->sqp->owner == w) {
+        struct spdk_nvme_io_qpair_opts qopts;
+
+        spdk_nvme_ctrlr_get_default_io_qpair_opts(g_ctrlr, &qopts, sizeof(qopts));
+        if (g_shared) {
+            /* 組內所有 thread 的 QD 都會進這條 qpair；controller 的 MQES 不夠時 driver 會自己 clamp */
+            qopts.io_queue_size = spdk_max(qopts.io_queue_size, IO_QD * w->sqp->nproducers + 1);
+            qopts.io_queue_requests = spdk_max(qopts.io_queue_requests, qopts.io_queue_size * 2);
+        }
+        w->qpair = spdk_nvme_ctrlr_alloc_io_qpair(g_ctrlr, &qopts, sizeof(qopts));
+        if (!w->qpair) {
+            fprintf(stderr, "[%s] alloc io qpair failed (controller has too few IO queues? try shared)\n",
+                    w->name);
+            g_rc = -1;
+        } else {
+            w->qpair_size = qopts.io_queue_size;
+            w->qpair_requests = qopts.io_queue_requests;
+            spdk_dma_account_note_nvme_qpair(w->qpair_size, w->qpair_requests,
+                                             spdk_env_get_socket_id(spdk_env_get_current_core()), 1);
+        }
+        if (w->sqp) {
+            w->sqp->qpair = w->qpair;
+        }
+    }
+    spdk_thread_send_msg(spdk_thread_get_app_thread(), worker_exited, w);
+}
+
+static void
+worker_start(void *arg)
+{
+    struct io_worker *w = arg;
+
+    w->poller = SPDK_POLLER_REGISTER(worker_poll, w, 0);
+    worker_fill(w);
+}
+
+static void
+worker_reset(void *arg)
+{
+    struct io_worker *w = arg;
+
+    memset(&w->stats, 0, sizeof(w->stats));
+    w->stats_tsc = spdk_get_ticks();
+    w->busy_start = thread_busy_tsc();
+}
+
+static void
+worker_stop(void *arg)
+{
+    struct io_worker *w = arg;
+
+    /* 實際結束 (outstanding 歸零) 由 worker_poll 判斷；沒起 poller 的 (初始化失敗) 直接回報 */
+    w->stopping = true;
+    if (!w->poller) {
+        w->end_tsc = spdk_get_ticks();
+        spdk_thread_send_msg(spdk_thread_get_app_thread(), worker_exited, w);
+    }
+}
+
+static void
+worker_fini(void *arg)
+{
+    struct io_worker *w = arg;
+
+    spdk_poller_unregister(&w->poller);
+    if (w->qpair) {
+        spdk_nvme_ctrlr_free_io_qpair(w->qpair);
+        spdk_dma_account_note_nvme_qpair(w->qpair_size, w->qpair_requests,
+                                         spdk_env_get_socket_id(spdk_env_get_current_core()), -1);
+    }
+    for (int i = 0; i < IO_QD; i++) {
+        spdk_dma_account_free(w->reqs[i].buf);
+    }
+    spsc_fini(&w->cq);
+    spdk_thread_send_msg(spdk_thread_get_app_thread(), worker_exited, w);
+    spdk_thread_exit(w->th);
+}
+
+/* ---------------- app thread ---------------- */
+enum app_state {
+    APP_INIT,       // 等 thread 建好 qpair / ring
+    APP_RUN,        // ramp + 量測
+    APP_DRAIN,      // 等所有 thread 收完在飛的 IO (owner 的 qpair 要一直 poll 到最後)
+    APP_FINI,       // 等 thread 釋放 qpair 並結束
+};
+
+static enum app_state g_state = APP_INIT;
+
+static void
+report(void)
+{
+    static struct lat_stats sum;
+    double sec = 0, iops, busy_ticks = 0;
+    uint64_t enomem = 0;
+    FILE *f;
+
+    memset(&sum, 0, sizeof(sum));
+    for (int i = 0; i < g_nworkers; i++) {
+        struct io_worker *w = &g_workers[i];
+
+        sum.ios += w->stats.ios;
+        sum.errors += w->stats.errors;
+        sum.lat_sum_ns += w->stats.lat_sum_ns;
+        sum.lat_max_ns = spdk_max(sum.lat_max_ns, w->stats.lat_max_ns);
+        for (uint32_t b = 0; b < LAT_BUCKETS; b++) {
+            sum.hist[b] += w->stats.hist[b];
+        }
+        sec = spdk_max(sec, (double)(w->end_tsc - w->stats_tsc) / spdk_get_ticks_hz());
+        busy_ticks += w->busy_tsc;
+    }
+    for (int q = 0; g_shared && q < g_nqpairs; q++) {
+        enomem += g_sqps[q].enomem;
+    }
+    if (sum.ios == 0 || sec <= 0) {
+        fprintf(stderr, "no IO completed\n");
+        return;
+    }
+    iops = sum.ios / sec;
+
+    printf("mode=%s reactors=%d threads=%d qpairs=%d qd/thread=%d bs=%d\n", g_shared ? "shared" : "exclusive",
+           g_nreactors, g_nworkers, g_nqpairs, IO_QD, IO_SIZE);
+    printf("  %10.0f IOPS  avg %8.1f  p50 %8.1f  p99 %8.1f  p999 %8.1f  max %8.1f us  err %lu\n", iops,
+           sum.lat_sum_ns / 1000.0 / sum.ios, lat_percentile_us(&sum, 50), lat_percentile_us(&sum, 99),
+           lat_percentile_us(&sum, 99.9), sum.lat_max_ns / 1000.0, sum.errors);
+    printf("  cpu %.0f busy ticks/IO (%.3f us/IO)  qpair ENOMEM %lu\n", busy_ticks / sum.ios,
+           busy_ticks / sum.ios * 1e6 / spdk_get_ticks_hz(), enomem);
+    for (int q = 0; g_shared && q < g_nqpairs; q++) {
+        printf("  qpair %2d owner %-10s producers %3u  submitted via ring %10lu\n", q, g_sqps[q].owner->name,
+               g_sqps[q].nproducers, g_sqps[q].submitted);
+    }
+
+    f = fopen(RESULT_CSV, "a");
+    if (!f) {
+        perror(RESULT_CSV);
+        return;
+    }
+    if (ftell(f) == 0) {
+        fprintf(f, "mode,reactors,threads,qpairs,qd,bs,sec,iops,avg_us,p50_us,p99_us,p999_us,max_us,"
+                   "busy_ticks_per_io,cpu_us_per_io,enomem,errors\n");
+    }
+    fprintf(f, "%s,%d,%d,%d,%d,%d,%.2f,%.0f,%.2f,%.2f,%.2f,%.2f,%.2f,%.0f,%.3f,%lu,%lu\n",
+            g_shared ? "shared" : "exclusive", g_nreactors, g_nworkers, g_nqpairs, IO_QD, IO_SIZE, sec, iops,
+            sum.lat_sum_ns / 1000.0 / sum.ios, lat_percentile_us(&sum, 50), lat_percentile_us(&sum, 99),
+            lat_percentile_us(&sum, 99.9), sum.lat_max_ns / 1000.0, busy_ticks / sum.ios,
+            busy_ticks / sum.ios * 1e6 / spdk_get_ticks_hz(), enomem, sum.errors);
+    fclose(f);
+}
+
+static int
+run_timer(void *arg)
+{
+    (void)arg;
+
+    spdk_poller_unregister(&g_timer);
+    g_state = APP_DRAIN;
+    g_pending = g_nworkers;
+    for (int i = 0; i < g_nworkers; i++) {
+        spdk_thread_send_msg(g_workers[i].th, worker_stop, &g_workers[i]);
+    }
+    return SPDK_POLLER_BUSY;
+}
+
+static int
+ramp_timer(void *arg)
+{
+    (void)arg;
+
+    spdk_poller_unregister(&g_timer);
+    for (int i = 0; i < g_nworkers; i++) {
+        spdk_thread_send_msg(g_workers[i].th, worker_reset, &g_workers[i]);
+    }
+    g_timer = SPDK_POLLER_REGISTER(run_timer, NULL, RUN_SEC * 1000000ULL);
+    return SPDK_POLLER_BUSY;
+}
+
+/* worker_init / 收完 IO / worker_fini 都回這裡，靠 g_state 分辨 */
+static void
+worker_exited(void *arg)
+{
+    (void)arg;
+
+    if (--g_pending > 0) {
+        return;
+    }
+    g_pending = g_nworkers;
+    switch (g_state) {
+    case APP_INIT:
+        if (g_rc != 0) {
+            g_state = APP_RUN;
+            run_timer(NULL);
+            return;
+        }
+        g_state = APP_RUN;
+        for (int i = 0; i < g_nworkers; i++) {
+            spdk_thread_send_msg(g_workers[i].th, worker_start, &g_workers[i]);
+        }
+        g_timer = SPDK_POLLER_REGISTER(ramp_timer, NULL, RAMP_SEC * 1000000ULL);
+        break;
+    case APP_DRAIN:
+        /* 所有 producer 都收完了，owner 的 qpair 上不會再有 IO，可以釋放；釋放前先印 hugepage 用量 */
+        spdk_dma_account_print(g_shared ? "shared" : "exclusive");
+        g_state = APP_FINI;
+        for (int i = 0; i < g_nworkers; i++) {
+            spdk_thread_send_msg(g_workers[i].th, worker_fini, &g_workers[i]);
+        }
+        break;
+    default:
+        if (g_rc == 0) {
+            report();
+        }
+        spdk_nvme_detach(g_ctrlr);
+        spdk_app_stop(g_rc);
+        break;
+    }
+}
+
+static void
+app_start(void *arg)
+{
+    struct nvme_attach_ctrlr attach;
+    struct spdk_cpuset cpumask;
+
+    (void)arg;
+    spdk_nvme_attach_init(&attach, &g_trid);
+    if (spdk_nvme_attach_all(&attach, 1, NULL, NULL, NULL) != 0) {
+        fprintf(stderr, "connect NVMe ctrlr %s failed\n", g_trid.traddr);
+        spdk_app_stop(-1);
+        return;
+    }
+    g_ctrlr = attach.ctrlr;
+    g_ns = spdk_nvme_ctrlr_get_ns(g_ctrlr, NAMESPACE_ID);
+    if (!g_ns || !spdk_nvme_ns_is_active(g_ns)) {
+        fprintf(stderr, "namespace %d not active\n", NAMESPACE_ID);
+        spdk_nvme_detach(g_ctrlr);
+        spdk_app_stop(-1);
+        return;
+    }
+    g_sector_size = spdk_nvme_ns_get_sector_size(g_ns);
+    g_io_slots = spdk_nvme_ns_get_num_sectors(g_ns) / (IO_SIZE / g_sector_size);
+
+    /* thread 依 reactor-major 編號，第 i 個 thread 屬於第 i * qpairs / threads 組 → 組是連續的，
+       qpairs == reactors 時剛好一個 reactor 一組 */
+    for (int i = 0; i < g_nworkers; i++) {
+        struct io_worker *w = &g_workers[i];
+
+        w->idx = i;
+        w->core = i / g_threads_per_reactor;
+        w->rng = 0x9E3779B97F4A7C15ULL ^ (uint64_t)(i + 1);
+        snprintf(w->name, sizeof(w->name), "r%d_t%d", w->core, i % g_threads_per_reactor);
+        if (g_shared) {
+            struct shared_qp *sqp = &g_sqps[(int64_t)i * g_nqpairs / g_nworkers];
+
+            if (!sqp->owner) {
+                sqp->owner = w;
+            }
+            sqp->nproducers++;
+            w->sqp = sqp;
+        }
+        spdk_cpuset_zero(&cpumask);
+        spdk_cpuset_set_cpu(&cpumask, w->core, true);
+        w->th = spdk_thread_create(w->name, &cpumask);
+    }
+    for (int q = 0; g_shared && q < g_nqpairs; q++) {
+        if (mpsc_init(&g_sqps[q].sq, pow2_roundup(IO_QD * g_sqps[q].nproducers)) != 0) {
+            g_rc = -1;
+        }
+    }
+
+    g_pending = g_nworkers;
+    for (int i = 0; i < g_nworkers; i++) {
+        spdk_thread_send_msg(g_workers[i].th, worker_init, &g_workers[i]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct spdk_app_opts opts;
+    int rc;
+
+    if (argc < 2 || (strcmp(argv[1], "exclusive") != 0 && strcmp(argv[1], "shared") != 0)) {
+        fprintf(stderr, "usage: %s <exclusive|shared> [reactors] [threads_per_reactor] [qpairs] [trid]\n",
+                argv[0]);
+        return -1;
+    }
+    g_shared = strcmp(argv[1], "shared") == 0;
+    if (argc > 2) {
+        g_nreactors = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        g_threads_per_reactor = atoi(argv[3]);
+    }
+    g_nworkers = g_nreactors * g_threads_per_reactor;
+    g_nqpairs = argc > 4 ? atoi(argv[4]) : g_nreactors;
+    if (!g_shared) {
+        g_nqpairs = g_nworkers;
+    }
+    if (g_nreactors < 1 || g_nreactors > MAX_REACTORS || g_threads_per_reactor < 1 ||
+        g_nworkers > MAX_THREADS || g_nqpairs < 1 || g_nqpairs > g_nworkers) {
+        fprintf(stderr, "need 1..%d reactors, 1..%d threads in total, 1..threads qpairs\n", MAX_REACTORS,
+                MAX_THREADS);
+        return -1;
+    }
+
+    // argv[5] 可給完整 trid，例如 "trtype:TCP adrfam:IPv4 traddr:127.0.0.1 trsvcid:4420 subnqn:..."
+    if (argc > 5) {
+        if (spdk_nvme_transport_id_parse(&g_trid, argv[5]) != 0) {
+            fprintf(stderr, "invalid trid: %s\n", argv[5]);
+            return -1;
+        }
+    } else {
+        spdk_nvme_trid_populate_transport(&g_trid, SPDK_NVME_TRANSPORT_PCIE);
+        snprintf(g_trid.traddr, sizeof(g_trid.traddr), "%s", DEFAULT_TRADDR);
+    }
+
+    snprintf(g_reactor_mask, sizeof(g_reactor_mask), "0x%llx",
+             g_nreactors == 64 ? ~0ULL : (1ULL << g_nreactors) - 1);
+    spdk_app_opts_init(&opts, sizeof(opts));
+    opts.name = "nvme_shared_qpair_mpsc";
+    opts.reactor_mask = g_reactor_mask;
+    if (spdk_bench_preflight_run(opts.name, opts.reactor_mask, NULL) != 0) {
+        return -1;
+    }
+
+    rc = spdk_app_start(&opts, app_start, NULL);
+    if (rc) {
+        fprintf(stderr, "spdk_app_start rc=%d\n", rc);
+    }
+    spdk_app_fini();
+    return rc;
+}
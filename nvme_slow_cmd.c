@@ -0,0 +1,239 @@
+/*
+NVMe slow command tracker：見 nvme_slow_cmd.h
+*/
+#include "spdk/stdinc.h"
+#include "spdk/env.h"
+#include "spdk/nvme.h"
+#include "spdk/util.h"
+
+#include "nvme_slow_cmd.h"
+
+#define DEFAULT_SLOW_US     1000
+#define MAX_TRACKED_QPAIRS  256
+#define REPORT_TOP          5
+
+static const char *g_cause_name[] = { "device", "host", "mixed" };
+
+static uint64_t g_thresh_us = DEFAULT_SLOW_US;
+static uint64_t g_timeout_us = DEFAULT_SLOW_US;
+static const char *g_csv;
+static bool g_env_read;
+
+/* timeout callback 只拿得到 qpair 指標，用這張表找回 tracker */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct nvme_slow_qpair *g_tracked[MAX_TRACKED_QPAIRS];
+static uint64_t g_admin_timeouts;
+
+static uint64_t env_u64(const char *name, uint64_t def)
+{
+    const char *s = getenv(name);
+
+    return s && s[0] ? strtoull(s, NULL, 10) : def;
+}
+
+static void read_env(void)
+{
+    pthread_mutex_lock(&g_lock);
+    if (!g_env_read) {
+        g_thresh_us = env_u64("NVME_SLOW_US", DEFAULT_SLOW_US);
+        g_timeout_us = env_u64("NVME_SLOW_TIMEOUT_US", g_thresh_us);
+        g_csv = getenv("NVME_SLOW_CSV");
+        g_env_read = true;
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+static double tsc_to_us(uint64_t tsc)
+{
+    return (double)tsc * 1000000 / spdk_get_ticks_hz();
+}
+
+static void timeout_cb(void *cb_arg, struct spdk_nvme_ctrlr *ctrlr, struct spdk_nvme_qpair *qpair, uint16_t cid)
+{
+    struct nvme_slow_qpair *sq = NULL;
+    struct nvme_slow_timeout *t;
+
+    (void)cb_arg;
+    (void)ctrlr;
+    if (qpair == NULL) {
+        /* admin command，很少見，直接印 */
+        __atomic_fetch_add(&g_admin_timeouts, 1, __ATOMIC_RELAXED);
+        fprintf(stderr, "SLOW admin cid %u exceeded %" PRIu64 " us\n", cid, g_timeout_us);
+        return;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    for (int i = 0; i < MAX_TRACKED_QPAIRS; i++) {
+        if (g_tracked[i] && g_tracked[i]->qpair == qpair) {
+            sq = g_tracked[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    if (sq == NULL) {
+        return;
+    }
+
+    /* callback 在 poll 這個 qpair 的 thread 上跑，和 submit / complete 是同一個 thread */
+    sq->timeouts++;
+    if (sq->ntimeout < NVME_SLOW_MAX_TIMEOUTS) {
+        t = &sq->tmo[sq->ntimeout++];
+        t->cid = cid;
+        t->outstanding = sq->outstanding > UINT16_MAX ? UINT16_MAX : (uint16_t)sq->outstanding;
+    }
+}
+
+void nvme_slow_ctrlr_init(struct spdk_nvme_ctrlr *ctrlr)
+{
+    read_env();
+    printf("SLOW threshold %" PRIu64 " us, timeout callback %" PRIu64 " us%s%s\n",
+           g_thresh_us, g_timeout_us, g_csv ? ", csv " : "", g_csv ? g_csv : "");
+    if (g_timeout_us != 0) {
+        /* admin 也用同一個時間；SPDK 只在 poll 時檢查，所以 host 不 poll 就不會觸發 */
+        spdk_nvme_ctrlr_register_timeout_callback(ctrlr, g_timeout_us, g_timeout_us, timeout_cb, NULL);
+    }
+}
+
+void nvme_slow_qpair_init(struct nvme_slow_qpair *sq, struct spdk_nvme_qpair *qpair, const char *name)
+{
+    read_env();
+    memset(sq, 0, sizeof(*sq));
+    sq->qpair = qpair;
+    snprintf(sq->name, sizeof(sq->name), "%s", name);
+    sq->thresh_tsc = g_thresh_us * spdk_get_ticks_hz() / 1000000;
+
+    pthread_mutex_lock(&g_lock);
+    for (int i = 0; i < MAX_TRACKED_QPAIRS; i++) {
+        if (g_tracked[i] == NULL) {
+            g_tracked[i] = sq;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+void nvme_slow_qpair_fini(struct nvme_slow_qpair *sq)
+{
+    pthread_mutex_lock(&g_lock);
+    for (int i = 0; i < MAX_TRACKED_QPAIRS; i++) {
+        if (g_tracked[i] == sq) {
+            g_tracked[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+void nvme_slow_record_outlier(struct nvme_slow_qpair *sq, const struct nvme_slow_cmd *cmd,
+                              const struct spdk_nvme_cpl *cpl, uint64_t now)
+{
+    uint64_t window_start = spdk_max(sq->prev_poll_tsc, cmd->submit_tsc);
+    uint64_t device_min = window_start - cmd->submit_tsc;
+    uint64_t poll_delay_max = now - window_start;
+    enum nvme_slow_cause cause;
+    struct nvme_slow_record *r;
+
+    if (device_min >= sq->thresh_tsc) {
+        cause = NVME_SLOW_DEVICE;
+    } else if (poll_delay_max >= sq->thresh_tsc) {
+        cause = NVME_SLOW_HOST;
+    } else {
+        cause = NVME_SLOW_MIXED;
+    }
+    sq->slow++;
+    sq->cause_cnt[cause]++;
+
+    if (sq->nrec >= NVME_SLOW_MAX_RECORDS) {
+        return;
+    }
+    r = &sq->rec[sq->nrec++];
+    r->submit_tsc = cmd->submit_tsc;
+    r->lat_tsc = now - cmd->submit_tsc;
+    r->device_min_tsc = device_min;
+    r->poll_delay_max_tsc = poll_delay_max;
+    r->lba = cmd->lba;
+    r->nlb = cmd->nlb;
+    r->qd = cmd->qd;
+    r->status = (uint16_t)(cpl->status.sct << 8 | cpl->status.sc);
+    r->opc = cmd->opc;
+    r->cause = cause;
+}
+
+static int cmp_lat_desc(const void *a, const void *b)
+{
+    const struct nvme_slow_record *x = a, *y = b;
+
+    return x->lat_tsc < y->lat_tsc ? 1 : x->lat_tsc > y->lat_tsc ? -1 : 0;
+}
+
+static void write_csv(const struct nvme_slow_qpair *sq, const char *tag)
+{
+    static pthread_mutex_t csv_lock = PTHREAD_MUTEX_INITIALIZER;
+    FILE *f;
+
+    pthread_mutex_lock(&csv_lock);
+    f = fopen(g_csv, "a");
+    if (!f) {
+        perror("nvme_slow csv");
+        pthread_mutex_unlock(&csv_lock);
+        return;
+    }
+    if (ftell(f) == 0) {
+        fprintf(f, "time,qpair,tag,opc,lba,nlb,qd,status,submit_tsc,lat_us,device_min_us,poll_delay_max_us,cause\n");
+    }
+    for (uint32_t i = 0; i < sq->nrec; i++) {
+        const struct nvme_slow_record *r = &sq->rec[i];
+
+        fprintf(f, "%ld,%s,%s,0x%02x,%" PRIu64 ",%u,%u,0x%04x,%" PRIu64 ",%.1f,%.1f,%.1f,%s\n",
+                (long)time(NULL), sq->name, tag, r->opc, r->lba, r->nlb, r->qd, r->status, r->submit_tsc,
+                tsc_to_us(r->lat_tsc), tsc_to_us(r->device_min_tsc), tsc_to_us(r->poll_delay_max_tsc),
+                g_cause_name[r->cause]);
+    }
+    fclose(f);
+    pthread_mutex_unlock(&csv_lock);
+}
+
+void nvme_slow_qpair_report(struct nvme_slow_qpair *sq, const char *tag)
+{
+    const char *verdict = "none";
+    uint64_t top = 0;
+
+    for (int c = NVME_SLOW_DEVICE; c <= NVME_SLOW_MIXED; c++) {
+        if (sq->cause_cnt[c] > top) {
+            top = sq->cause_cnt[c];
+            verdict = g_cause_name[c];
+        }
+    }
+
+    printf("SLOW %s %s: %" PRIu64 " cmds, %" PRIu64 " >= %" PRIu64 " us (%.3f%%), device %" PRIu64
+           " host %" PRIu64 " mixed %" PRIu64 ", max lat %.1f us, max poll gap %.1f us, timeouts %" PRIu64
+           ", mostly %s\n",
+           sq->name, tag, sq->cmds, sq->slow, g_thresh_us, sq->cmds ? sq->slow * 100.0 / sq->cmds : 0.0,
+           sq->cause_cnt[NVME_SLOW_DEVICE], sq->cause_cnt[NVME_SLOW_HOST], sq->cause_cnt[NVME_SLOW_MIXED],
+           tsc_to_us(sq->max_lat_tsc), tsc_to_us(sq->max_poll_gap_tsc), sq->timeouts, verdict);
+
+    if (g_csv && g_csv[0] && sq->nrec > 0) {
+        write_csv(sq, tag);
+    }
+
+    qsort(sq->rec, sq->nrec, sizeof(sq->rec[0]), cmp_lat_desc);
+    for (uint32_t i = 0; i < sq->nrec && i < REPORT_TOP; i++) {
+        const struct nvme_slow_record *r = &sq->rec[i];
+
+        printf("SLOW %s %s:   opc 0x%02x lba %" PRIu64 " nlb %u qd %u status 0x%04x lat %.1f us "
+               "(device >= %.1f, poll delay <= %.1f) %s\n",
+               sq->name, tag, r->opc, r->lba, r->nlb, r->qd, r->status, tsc_to_us(r->lat_tsc),
+               tsc_to_us(r->device_min_tsc), tsc_to_us(r->poll_delay_max_tsc), g_cause_name[r->cause]);
+    }
+    for (uint32_t i = 0; i < sq->ntimeout && i < REPORT_TOP; i++) {
+        printf("SLOW %s %s:   timeout cid %u, %u outstanding\n",
+               sq->name, tag, sq->tmo[i].cid, sq->tmo[i].outstanding);
+    }
+    if (g_admin_timeouts > 0) {
+        printf("SLOW admin timeouts %" PRIu64 "\n", g_admin_timeouts);
+    }
+
+    sq->cmds = sq->slow = sq->timeouts = 0;
+    sq->max_lat_tsc = sq->max_poll_gap_tsc = 0;
+    memset(sq->cause_cnt, 0, sizeof(sq->cause_cnt));
+    sq->nrec = sq->ntimeout = 0;
+}
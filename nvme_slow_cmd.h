@@ -0,0 +1,161 @@
+/*
+NVMe slow command tracker：每個 qpair 一份，把超過門檻的 command 一筆一筆記下來，分辨 tail 是 device 慢還是 host 晚 poll
+
+平常只看得到 p99 變胖，看不到是哪一個 command、在 qpair 上排第幾個、host 那時候是不是在忙別的。
+engine 在自己的 request ctx (cb_arg) 裡放一個 struct nvme_slow_cmd，submit / poll / complete 各呼叫一次 inline 函式，
+fast path 只有幾個加減和比較 (tsc 由 engine 傳進來，不多讀一次)，超過門檻才進 .c 記一筆。
+
+device 還是 host：
+  每次 poll 前呼叫 nvme_slow_poll_begin 記下時間。callback 是在這一輪 poll 裡跑的，
+  代表上一輪 poll (prev_poll_tsc) 檢查 CQ 時 command 還沒完成，這一輪 (poll_tsc) 才看到，所以
+      device 時間  >= prev_poll_tsc - submit_tsc           (device_min)
+      poll 延遲    <= complete_tsc - max(prev_poll_tsc, submit_tsc)  (poll_delay_max，包含 device 在這段窗口裡的部分)
+  分類 (T = 門檻)：
+      device  device_min >= T         host 一直有在 poll，command 過了 T 還在 device 裡
+      host    poll_delay_max >= T     host 有一段 >= T 的時間沒 poll 這個 qpair
+      mixed   兩者都 < T              兩段加起來才超過
+  submit_tsc 是呼叫 spdk_nvme_ns_cmd_* 之前的時間，SPDK 自己排隊 (qpair 滿、-EAGAIN) 的時間算在 device_min 裡
+
+timeout callback：
+  nvme_slow_ctrlr_init 會註冊 spdk_nvme_ctrlr_register_timeout_callback，超過 timeout 還沒完成的 command
+  在 poll 時被 SPDK 回報 (qpair, cid)。能被回報就表示 host 有在 poll、command 還在 device 裡，是 device 端的直接證據；
+  一直沒完成 (hang) 的 command 也只有這裡看得到。callback 只記錄，不 abort、不 reset。
+
+環境變數：
+  NVME_SLOW_US=<us>          門檻，預設 1000；0 = 關掉 (submit / complete 仍然計數，不記錄)
+  NVME_SLOW_TIMEOUT_US=<us>  timeout callback 的時間，預設等於 NVME_SLOW_US；0 = 不註冊
+  NVME_SLOW_CSV=<path>       每筆 outlier append 一列 CSV (檔案不存在時先寫 header)
+
+用法：
+  nvme_slow_ctrlr_init(ctrlr);                          connect 之後
+  nvme_slow_qpair_init(&sq, qpair, "c1q0");             alloc qpair 之後
+  nvme_slow_cmd_submit(&sq, &req->slow, opc, lba, nlb, tsc);   spdk_nvme_ns_cmd_* 回傳 0 之後，tsc 是送之前讀的
+  nvme_slow_poll_begin(&sq, spdk_get_ticks());          每次 process_completions 之前 (poll group 就每個 qpair 各呼叫一次)
+  nvme_slow_cmd_complete(&sq, &req->slow, cpl, now);    completion callback 裡
+  nvme_slow_qpair_report(&sq, "high");                  印 summary、寫 CSV、清掉計數
+  nvme_slow_qpair_fini(&sq);                            free qpair 之前
+*/
+#ifndef NVME_SLOW_CMD_H
+#define NVME_SLOW_CMD_H
+
+#include <stdint.h>
+
+#include "spdk/nvme.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NVME_SLOW_MAX_RECORDS   256     // 每個 qpair 最多留幾筆 outlier，滿了只計數
+#define NVME_SLOW_MAX_TIMEOUTS  32      // 每個 qpair 最多留幾筆 timeout callback
+
+enum nvme_slow_cause {
+    NVME_SLOW_DEVICE,
+    NVME_SLOW_HOST,
+    NVME_SLOW_MIXED,
+};
+
+/* engine 的 request ctx 裡一份 */
+struct nvme_slow_cmd {
+    uint64_t submit_tsc;
+    uint64_t lba;
+    uint32_t nlb;
+    uint16_t qd;            // submit 時這個 qpair 上已經在飛的 command 數 (不含自己)
+    uint8_t  opc;
+};
+
+struct nvme_slow_record {
+    uint64_t submit_tsc;
+    uint64_t lat_tsc;
+    uint64_t device_min_tsc;
+    uint64_t poll_delay_max_tsc;
+    uint64_t lba;
+    uint32_t nlb;
+    uint16_t qd;
+    uint16_t status;        // sct << 8 | sc
+    uint8_t  opc;
+    uint8_t  cause;
+};
+
+struct nvme_slow_timeout {
+    uint16_t cid;
+    uint16_t outstanding;
+};
+
+struct nvme_slow_qpair {
+    struct spdk_nvme_qpair *qpair;
+    char     name[32];
+    uint64_t thresh_tsc;
+    uint64_t poll_tsc;          // 這一輪 poll 開始
+    uint64_t prev_poll_tsc;     // 上一輪 poll 開始
+    uint32_t outstanding;
+
+    uint64_t cmds;
+    uint64_t slow;
+    uint64_t cause_cnt[3];      // enum nvme_slow_cause
+    uint64_t max_lat_tsc;
+    uint64_t max_poll_gap_tsc;
+    uint64_t timeouts;
+
+    uint32_t nrec;
+    uint32_t ntimeout;
+    struct nvme_slow_record rec[NVME_SLOW_MAX_RECORDS];
+    struct nvme_slow_timeout tmo[NVME_SLOW_MAX_TIMEOUTS];
+};
+
+/* 讀環境變數、註冊 timeout callback；每個 ctrlr 呼叫一次 */
+void nvme_slow_ctrlr_init(struct spdk_nvme_ctrlr *ctrlr);
+
+void nvme_slow_qpair_init(struct nvme_slow_qpair *sq, struct spdk_nvme_qpair *qpair, const char *name);
+void nvme_slow_qpair_fini(struct nvme_slow_qpair *sq);
+
+/* 印一行 summary 和最慢的幾筆，寫 CSV，然後清掉計數 (tag 會出現在輸出和 CSV 裡，例如負載名稱) */
+void nvme_slow_qpair_report(struct nvme_slow_qpair *sq, const char *tag);
+
+/* 超過門檻時記一筆，只給 nvme_slow_cmd_complete 用 */
+void nvme_slow_record_outlier(struct nvme_slow_qpair *sq, const struct nvme_slow_cmd *cmd,
+                              const struct spdk_nvme_cpl *cpl, uint64_t now);
+
+static inline void nvme_slow_cmd_submit(struct nvme_slow_qpair *sq, struct nvme_slow_cmd *cmd,
+                                        uint8_t opc, uint64_t lba, uint32_t nlb, uint64_t submit_tsc)
+{
+    cmd->submit_tsc = submit_tsc;
+    cmd->lba = lba;
+    cmd->nlb = nlb;
+    cmd->opc = opc;
+    cmd->qd = sq->outstanding > UINT16_MAX ? UINT16_MAX : (uint16_t)sq->outstanding;
+    sq->outstanding++;
+}
+
+static inline void nvme_slow_poll_begin(struct nvme_slow_qpair *sq, uint64_t now)
+{
+    uint64_t gap = now - sq->poll_tsc;
+
+    /* 沒有 command 在飛時的空檔不算 poll 間隔 */
+    if (sq->outstanding > 0 && sq->poll_tsc != 0 && gap > sq->max_poll_gap_tsc) {
+        sq->max_poll_gap_tsc = gap;
+    }
+    sq->prev_poll_tsc = sq->poll_tsc;
+    sq->poll_tsc = now;
+}
+
+static inline void nvme_slow_cmd_complete(struct nvme_slow_qpair *sq, const struct nvme_slow_cmd *cmd,
+                                          const struct spdk_nvme_cpl *cpl, uint64_t now)
+{
+    uint64_t lat = now - cmd->submit_tsc;
+
+    sq->outstanding--;
+    sq->cmds++;
+    if (lat > sq->max_lat_tsc) {
+        sq->max_lat_tsc = lat;
+    }
+    if (sq->thresh_tsc != 0 && lat >= sq->thresh_tsc) {
+        nvme_slow_record_outlier(sq, cmd, cpl, now);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NVME_SLOW_CMD_H */
@@ -0,0 +1,441 @@
+/*
+benchmark preflight：見 spdk_bench_preflight.h
+*/
+#include <ctype.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spdk_bench_preflight.h"
+
+#define CSTATE_MAX_LATENCY_US   10      // exit latency 大於這個的 C-state 算「深層」
+#define DEFAULT_MIN_HUGE_MB     1024
+#define IRQ_REPORT_MAX          8
+
+typedef struct {
+    uint8_t bit[PREFLIGHT_MAX_CPUS];
+} cpu_set_small;
+
+static int read_line(const char *path, char *buf, size_t len)
+{
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        return -1;
+    }
+    if (!fgets(buf, len, f)) {
+        buf[0] = '\0';
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static long read_long(const char *path, long def)
+{
+    char buf[64];
+
+    if (read_line(path, buf, sizeof(buf)) != 0 || buf[0] == '\0') {
+        return def;
+    }
+    return strtol(buf, NULL, 10);
+}
+
+/* "0-3,8,10-11" → set；空字串 / 讀不到 → 空集合 */
+static void parse_cpulist(const char *s, cpu_set_small *set)
+{
+    memset(set, 0, sizeof(*set));
+    while (s && *s) {
+        char *end;
+        long a, b;
+
+        while (*s == ',' || *s == ' ' || *s == '[') {
+            s++;
+        }
+        if (!isdigit((unsigned char)*s)) {
+            break;
+        }
+        a = strtol(s, &end, 10);
+        b = a;
+        if (*end == '-') {
+            b = strtol(end + 1, &end, 10);
+        }
+        for (long i = a; i <= b && i < PREFLIGHT_MAX_CPUS; i++) {
+            set->bit[i] = 1;
+        }
+        s = end;
+    }
+}
+
+static void read_cpulist(const char *path, cpu_set_small *set)
+{
+    char buf[4096];
+
+    if (read_line(path, buf, sizeof(buf)) != 0) {
+        buf[0] = '\0';
+    }
+    parse_cpulist(buf, set);
+}
+
+/* SPDK 的 core mask："0x3" / "3" (hex) 或 "[0,2-3]" (list) */
+static void parse_core_mask(const char *mask, cpu_set_small *set)
+{
+    size_t len;
+    int cpu = 0;
+
+    memset(set, 0, sizeof(*set));
+    if (!mask) {
+        return;
+    }
+    if (mask[0] == '[') {
+        parse_cpulist(mask, set);
+        return;
+    }
+    if (mask[0] == '0' && (mask[1] == 'x' || mask[1] == 'X')) {
+        mask += 2;
+    }
+    len = strlen(mask);
+    for (size_t i = len; i > 0; i--, cpu += 4) {
+        char c = mask[i - 1];
+        int v = isdigit((unsigned char)c) ? c - '0' : (tolower((unsigned char)c) - 'a' + 10);
+
+        for (int b = 0; b < 4 && cpu + b < PREFLIGHT_MAX_CPUS; b++) {
+            if (v & (1 << b)) {
+                set->bit[cpu + b] = 1;
+            }
+        }
+    }
+}
+
+/* "always [madvise] never" → "madvise" */
+static void read_bracket_choice(const char *path, char *out, size_t len)
+{
+    char buf[128];
+    char *l, *r;
+
+    snprintf(out, len, "?");
+    if (read_line(path, buf, sizeof(buf)) != 0) {
+        return;
+    }
+    l = strchr(buf, '[');
+    r = l ? strchr(l, ']') : NULL;
+    if (l && r) {
+        *r = '\0';
+        snprintf(out, len, "%s", l + 1);
+    }
+}
+
+static int cpu_node(int cpu)
+{
+    char path[128];
+    cpu_set_small set;
+
+    for (int n = 0; n < PREFLIGHT_MAX_NODES; n++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        if (access(path, R_OK) != 0) {
+            continue;
+        }
+        read_cpulist(path, &set);
+        if (set.bit[cpu]) {
+            return n;
+        }
+    }
+    return 0;
+}
+
+static uint64_t node_free_huge_mb(int node)
+{
+    static const struct { const char *dir; uint64_t mb; } sizes[] = {
+        { "hugepages-2048kB", 2 },
+        { "hugepages-1048576kB", 1024 },
+    };
+    char path[160];
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        long n;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/hugepages/%s/free_hugepages",
+                 node, sizes[i].dir);
+        n = read_long(path, 0);
+        total += (uint64_t)(n > 0 ? n : 0) * sizes[i].mb;
+    }
+    return total;
+}
+
+static void check_cpu(struct spdk_bench_preflight *pf, const cpu_set_small *mask)
+{
+    cpu_set_small isolated, nohz;
+    char path[160], buf[32];
+
+    read_cpulist("/sys/devices/system/cpu/isolated", &isolated);
+    read_cpulist("/sys/devices/system/cpu/nohz_full", &nohz);
+
+    for (int i = 0; i < pf->ncores; i++) {
+        int cpu = pf->cores[i];
+        cpu_set_small sib;
+
+        if (!isolated.bit[cpu]) {
+            pf->not_isolated++;
+        }
+        if (!nohz.bit[cpu]) {
+            pf->not_nohz_full++;
+        }
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+        if (read_line(path, buf, sizeof(buf)) == 0) {
+            if (pf->governor[0] == '\0') {
+                snprintf(pf->governor, sizeof(pf->governor), "%s", buf);
+            }
+            if (strcmp(buf, "performance") != 0) {
+                pf->bad_governor++;
+            }
+        }
+
+        /* state0 是 POLL，從 state1 開始看 exit latency */
+        for (int s = 1;; s++) {
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/latency", cpu, s);
+            if (access(path, R_OK) != 0) {
+                break;
+            }
+            if (read_long(path, 0) <= CSTATE_MAX_LATENCY_US) {
+                continue;
+            }
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/disable", cpu, s);
+            if (read_long(path, 0) == 0) {
+                pf->deep_cstates++;
+            }
+        }
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        read_cpulist(path, &sib);
+        for (int s = 0; s < PREFLIGHT_MAX_CPUS; s++) {
+            if (!sib.bit[s] || s == cpu) {
+                continue;
+            }
+            if (mask->bit[s]) {
+                pf->smt_shared++;       // 兩邊各算一次
+            } else if (!isolated.bit[s]) {
+                pf->smt_sibling_busy++;
+            }
+        }
+
+        pf->node_mask |= 1u << cpu_node(cpu);
+    }
+    pf->smt_shared /= 2;
+
+    /* intel_pstate: no_turbo=1 表示關；acpi-cpufreq: boost=0 表示關 */
+    pf->turbo = -1;
+    if (access("/sys/devices/system/cpu/intel_pstate/no_turbo", R_OK) == 0) {
+        pf->turbo = read_long("/sys/devices/system/cpu/intel_pstate/no_turbo", 0) ? 0 : 1;
+    } else if (access("/sys/devices/system/cpu/cpufreq/boost", R_OK) == 0) {
+        pf->turbo = read_long("/sys/devices/system/cpu/cpufreq/boost", 0) ? 1 : 0;
+    }
+}
+
+static void check_irq(struct spdk_bench_preflight *pf)
+{
+    DIR *d = opendir("/proc/irq");
+    struct dirent *de;
+    char path[300];
+    int reported = 0;
+
+    if (!d) {
+        return;
+    }
+    while ((de = readdir(d)) != NULL) {
+        cpu_set_small aff;
+
+        if (!isdigit((unsigned char)de->d_name[0])) {
+            continue;
+        }
+        /* effective_affinity_list 是 IRQ 實際送去的 CPU；舊 kernel 沒有時退回 smp_affinity_list */
+        snprintf(path, sizeof(path), "/proc/irq/%s/effective_affinity_list", de->d_name);
+        if (access(path, R_OK) != 0) {
+            snprintf(path, sizeof(path), "/proc/irq/%s/smp_affinity_list", de->d_name);
+        }
+        read_cpulist(path, &aff);
+        for (int i = 0; i < pf->ncores; i++) {
+            if (aff.bit[pf->cores[i]]) {
+                pf->irqs_on_reactors++;
+                if (reported++ < IRQ_REPORT_MAX) {
+                    fprintf(stderr, "[preflight] irq %s -> cpu %d\n", de->d_name, pf->cores[i]);
+                }
+                break;
+            }
+        }
+    }
+    closedir(d);
+}
+
+/* "n0:12345;n1:678"：reactor 所在每個 node 的 free hugepage (MB) */
+static void format_huge(const struct spdk_bench_preflight *pf, char *huge, size_t len)
+{
+    size_t off = 0;
+
+    huge[0] = '\0';
+    for (int n = 0; n < PREFLIGHT_MAX_NODES && off < len; n++) {
+        if (pf->node_mask & (1u << n)) {
+            off += snprintf(huge + off, len - off, "%sn%d:%lu", off ? ";" : "", n,
+                            (unsigned long)pf->huge_free_mb[n]);
+        }
+    }
+}
+
+static const char *mode_name(const struct spdk_bench_preflight *pf)
+{
+    switch (pf->mode) {
+    case PREFLIGHT_OFF:
+        return "off";
+    case PREFLIGHT_STRICT:
+        return "strict";
+    default:
+        return "warn";
+    }
+}
+
+static void write_csv(const struct spdk_bench_preflight *pf, const char *app_name, const char *path)
+{
+    FILE *f;
+    bool new_file = access(path, F_OK) != 0;
+    char huge[128];
+
+    format_huge(pf, huge, sizeof(huge));
+    f = fopen(path, "a");
+    if (!f) {
+        perror("preflight csv");
+        return;
+    }
+    if (new_file) {
+        fprintf(f, "time,app,mask,mode,violations,not_isolated,not_nohz_full,governor,bad_governor,turbo,"
+                   "deep_cstates,thp_enabled,thp_defrag,huge_free_mb,irqs_on_reactors,smt_shared,smt_sibling_busy\n");
+    }
+    fprintf(f, "%ld,%s,%s,%s,0x%x,%d,%d,%s,%d,%d,%d,%s,%s,%s,%d,%d,%d\n",
+            (long)time(NULL), app_name, pf->mask, mode_name(pf), pf->violations,
+            pf->not_isolated, pf->not_nohz_full, pf->governor[0] ? pf->governor : "?", pf->bad_governor,
+            pf->turbo, pf->deep_cstates, pf->thp_enabled, pf->thp_defrag, huge,
+            pf->irqs_on_reactors, pf->smt_shared, pf->smt_sibling_busy);
+    fclose(f);
+}
+
+void spdk_bench_preflight_csv_header(FILE *f)
+{
+    fprintf(f, ",pf_mode,pf_violations,pf_not_isolated,pf_not_nohz_full,pf_governor,pf_turbo,pf_deep_cstates,"
+               "pf_thp_enabled,pf_thp_defrag,pf_huge_free_mb,pf_irqs_on_reactors,pf_smt_shared,pf_smt_sibling_busy");
+}
+
+void spdk_bench_preflight_csv_row(FILE *f, const struct spdk_bench_preflight *pf)
+{
+    char huge[128];
+
+    if (pf->mode == PREFLIGHT_OFF) {
+        /* 沒檢查：除了 mode 全部留空，免得 0 被當成「沒違規」 */
+        fprintf(f, ",off,,,,,,,,,,,,");
+        return;
+    }
+    format_huge(pf, huge, sizeof(huge));
+    fprintf(f, ",%s,0x%x,%d,%d,%s,%d,%d,%s,%s,%s,%d,%d,%d",
+            mode_name(pf), pf->violations, pf->not_isolated, pf->not_nohz_full,
+            pf->governor[0] ? pf->governor : "?", pf->turbo, pf->deep_cstates,
+            pf->thp_enabled, pf->thp_defrag, huge, pf->irqs_on_reactors, pf->smt_shared, pf->smt_sibling_busy);
+}
+
+int spdk_bench_preflight_run(const char *app_name, const char *core_mask, struct spdk_bench_preflight *out)
+{
+    struct spdk_bench_preflight local, *pf = out ? out : &local;
+    const char *env_mode = getenv("SPDK_PREFLIGHT");
+    const char *env_csv = getenv("SPDK_PREFLIGHT_CSV");
+    const char *env_huge = getenv("SPDK_PREFLIGHT_MIN_HUGE_MB");
+    uint64_t min_huge_mb = env_huge ? strtoull(env_huge, NULL, 10) : DEFAULT_MIN_HUGE_MB;
+    cpu_set_small mask;
+
+    memset(pf, 0, sizeof(*pf));
+    pf->mode = PREFLIGHT_WARN;
+    if (env_mode && strcmp(env_mode, "off") == 0) {
+        pf->mode = PREFLIGHT_OFF;
+        return 0;
+    }
+    if (env_mode && strcmp(env_mode, "strict") == 0) {
+        pf->mode = PREFLIGHT_STRICT;
+    }
+
+    snprintf(pf->mask, sizeof(pf->mask), "%s", core_mask ? core_mask : "0x1");
+    parse_core_mask(pf->mask, &mask);
+    for (int c = 0; c < PREFLIGHT_MAX_CPUS; c++) {
+        if (mask.bit[c]) {
+            pf->cores[pf->ncores++] = c;
+        }
+    }
+
+    check_cpu(pf, &mask);
+    check_irq(pf);
+
+    read_bracket_choice("/sys/kernel/mm/transparent_hugepage/enabled", pf->thp_enabled, sizeof(pf->thp_enabled));
+    read_bracket_choice("/sys/kernel/mm/transparent_hugepage/defrag", pf->thp_defrag, sizeof(pf->thp_defrag));
+
+    for (int n = 0; n < PREFLIGHT_MAX_NODES; n++) {
+        if (!(pf->node_mask & (1u << n))) {
+            continue;
+        }
+        pf->huge_free_mb[n] = node_free_huge_mb(n);
+        /* 本地 node 不夠時 DPDK 會從別的 socket 拿 → remote memory access */
+        if (pf->huge_free_mb[n] < min_huge_mb) {
+            pf->violations |= PF_HUGEPAGE;
+        }
+    }
+
+    if (pf->not_isolated) {
+        pf->violations |= PF_NOT_ISOLATED;
+    }
+    if (pf->not_nohz_full) {
+        pf->violations |= PF_NOT_NOHZ_FULL;
+    }
+    if (pf->bad_governor) {
+        pf->violations |= PF_GOVERNOR;
+    }
+    if (pf->turbo == 1) {
+        pf->violations |= PF_TURBO;
+    }
+    if (pf->deep_cstates) {
+        pf->violations |= PF_CSTATE;
+    }
+    if (strcmp(pf->thp_enabled, "always") == 0 || strcmp(pf->thp_defrag, "always") == 0) {
+        pf->violations |= PF_THP;
+    }
+    if (pf->irqs_on_reactors) {
+        pf->violations |= PF_IRQ;
+    }
+    if (pf->smt_shared) {
+        pf->violations |= PF_SMT_SHARED;
+    }
+    if (pf->smt_sibling_busy) {
+        pf->violations |= PF_SMT_SIBLING;
+    }
+
+    printf("PREFLIGHT app=%s mask=%s cores=%d violations=0x%x not_isolated=%d not_nohz_full=%d governor=%s "
+           "turbo=%d deep_cstates=%d thp=%s/%s irqs_on_reactors=%d smt_shared=%d smt_sibling_busy=%d",
+           app_name, pf->mask, pf->ncores, pf->violations, pf->not_isolated, pf->not_nohz_full,
+           pf->governor[0] ? pf->governor : "?", pf->turbo, pf->deep_cstates,
+           pf->thp_enabled, pf->thp_defrag, pf->irqs_on_reactors, pf->smt_shared, pf->smt_sibling_busy);
+    for (int n = 0; n < PREFLIGHT_MAX_NODES; n++) {
+        if (pf->node_mask & (1u << n)) {
+            printf(" huge_free_mb_n%d=%lu", n, (unsigned long)pf->huge_free_mb[n]);
+        }
+    }
+    printf("\n");
+
+    if (env_csv && env_csv[0]) {
+        write_csv(pf, app_name, env_csv);
+    }
+
+    if (pf->violations && pf->mode == PREFLIGHT_STRICT) {
+        fprintf(stderr, "[preflight] strict profile violated (0x%x), refusing to run %s\n",
+                pf->violations, app_name);
+        return -1;
+    }
+    return 0;
+}
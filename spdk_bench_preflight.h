@@ -0,0 +1,93 @@
+/*
+benchmark 開跑前的環境檢查 (preflight)，所有 engine 共用
+
+在 spdk_env_init / spdk_app_start 之前呼叫，只讀 /sys 與 /proc，不依賴 SPDK：
+  - reactor core 是否在 isolcpus / nohz_full 裡
+  - cpufreq governor、turbo、深層 C-state
+  - THP (transparent hugepage) 設定
+  - reactor 所在 NUMA node 的 free hugepages
+  - 有沒有 IRQ 落在 reactor core 上
+  - SMT sibling：兩個 reactor 共用一顆實體 core，或 sibling 沒被隔離
+
+環境變數：
+  SPDK_PREFLIGHT=off|warn|strict   預設 warn；strict 時有任何違規就拒跑 (回傳 -1)
+  SPDK_PREFLIGHT_CSV=<path>        把結果 append 成一列 CSV (檔案不存在時先寫 header)
+  SPDK_PREFLIGHT_MIN_HUGE_MB=<mb>  每個 reactor node 至少要有多少 free hugepage，預設 1024
+
+不論模式 (off 除外)，結果都會印成一行 "PREFLIGHT key=value ..."，跟著 engine 的輸出進 log 留底。
+要跟 benchmark 結果放在同一張表的話，engine 自己用 spdk_bench_preflight_csv_header / _row
+把欄位接在結果 CSV 後面 (spdk_job_engine 的 result.csv 有接)
+*/
+#ifndef SPDK_BENCH_PREFLIGHT_H
+#define SPDK_BENCH_PREFLIGHT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PREFLIGHT_MAX_CPUS  1024
+#define PREFLIGHT_MAX_NODES 8
+
+/* violations bitmask */
+#define PF_NOT_ISOLATED     (1u << 0)   // reactor core 不在 isolcpus
+#define PF_NOT_NOHZ_FULL    (1u << 1)   // reactor core 不在 nohz_full
+#define PF_GOVERNOR         (1u << 2)   // governor 不是 performance
+#define PF_TURBO            (1u << 3)   // turbo / boost 開著
+#define PF_CSTATE           (1u << 4)   // reactor core 有 exit latency 過大的 C-state 沒關
+#define PF_THP              (1u << 5)   // THP enabled=always 或 defrag=always
+#define PF_HUGEPAGE         (1u << 6)   // reactor node 上 free hugepage 不足
+#define PF_IRQ              (1u << 7)   // 有 IRQ 的 effective affinity 落在 reactor core
+#define PF_SMT_SHARED       (1u << 8)   // 兩個 reactor 是同一顆實體 core 的 sibling
+#define PF_SMT_SIBLING      (1u << 9)   // reactor 的 sibling 沒被隔離 (會被別的工作吃掉 pipeline)
+
+enum preflight_mode {
+    PREFLIGHT_OFF,
+    PREFLIGHT_WARN,
+    PREFLIGHT_STRICT,
+};
+
+struct spdk_bench_preflight {
+    enum preflight_mode mode;
+    char        mask[64];           // 原始 core mask 字串
+    int         ncores;
+    int         cores[PREFLIGHT_MAX_CPUS];
+
+    int         not_isolated;       // 以下皆為「有問題的 reactor core 數」或個數
+    int         not_nohz_full;
+    int         bad_governor;
+    char        governor[32];       // 第一個 reactor core 的 governor
+    int         turbo;              // 1: on, 0: off, -1: 不知道
+    int         deep_cstates;       // reactor core 上仍 enable 的深層 C-state 總數
+    char        thp_enabled[16];
+    char        thp_defrag[16];
+    uint64_t    huge_free_mb[PREFLIGHT_MAX_NODES];
+    uint32_t    node_mask;          // reactor 所在的 NUMA node
+    int         irqs_on_reactors;
+    int         smt_shared;
+    int         smt_sibling_busy;
+
+    uint32_t    violations;
+};
+
+/*
+ * 檢查 core_mask (SPDK 的 "0x3" hex mask 或 "[0,2-3]" list) 上的環境，印出結果。
+ * mode 為 strict 且有違規時回傳 -1，呼叫端應直接結束；其他情況回傳 0。
+ * pf 可為 NULL。
+ */
+int spdk_bench_preflight_run(const char *app_name, const char *core_mask, struct spdk_bench_preflight *pf);
+
+/*
+CSV 欄位 pf_mode ... pf_smt_sibling_busy (同 SPDK_PREFLIGHT_CSV 的欄位，加 pf_ 前綴)，
+header 和 row 都以 ',' 開頭，接在原本的欄位後面；mode 為 off 時除了 pf_mode 都留空
+*/
+void spdk_bench_preflight_csv_header(FILE *f);
+void spdk_bench_preflight_csv_row(FILE *f, const struct spdk_bench_preflight *pf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPDK_BENCH_PREFLIGHT_H */
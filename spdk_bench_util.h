@@ -0,0 +1,149 @@
+/*
+benchmark 共用的小工具，header only (全部 static inline，不用多編一個 .c)
+
+  latency histogram   每個 2 的冪次切 16 格，相對誤差 < 6.25%；0 ~ 2^40 ns，超過的都進最後一格
+                      各程式的 struct lat_stats 自己放 uint64_t hist[LAT_BUCKETS]，分位數用 lat_hist_percentile_us
+  xorshift64          每個 thread 一個 state 的 PRNG，選 LBA 用
+  pow2_roundup        ring 容量取 2 的冪次
+  spsc_ring           lock-free single-producer / single-consumer ring，head / tail 各佔一個 cache line；
+                      size 要是 2 的冪次，滿了 enqueue 回 -ENOSPC
+
+用的地方：spdk_job_engine.c、bdev_offload_pool.c、nvme_shared_qpair_mpsc.c、bdev_reactor_multi_threads.c
+*/
+#ifndef SPDK_BENCH_UTIL_H
+#define SPDK_BENCH_UTIL_H
+
+#include "spdk/stdinc.h"
+
+#define LAT_SUB_BITS        4
+#define LAT_SUB             (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS         (41 * LAT_SUB)
+
+#define BENCH_CACHE_LINE    64
+
+/* ---------------- latency histogram ---------------- */
+static inline uint32_t
+lat_bucket(uint64_t ns)
+{
+    uint32_t e;
+
+    if (ns < LAT_SUB) {
+        return (uint32_t)ns;
+    }
+    e = 63 - __builtin_clzll(ns);
+    if (e > 40 + LAT_SUB_BITS - 1) {
+        return LAT_BUCKETS - 1;
+    }
+    return (e - LAT_SUB_BITS + 1) * LAT_SUB + (uint32_t)((ns >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+static inline uint64_t
+lat_bucket_ns(uint32_t b)
+{
+    uint32_t e, sub;
+
+    if (b < LAT_SUB) {
+        return b;
+    }
+    e = b / LAT_SUB + LAT_SUB_BITS - 1;
+    sub = b % LAT_SUB;
+    /* 取該格的中點 */
+    return ((uint64_t)(LAT_SUB + sub) << (e - LAT_SUB_BITS)) + (1ULL << (e - LAT_SUB_BITS)) / 2;
+}
+
+/* hist 的第 p 百分位 (us)；ios 是 hist 的總數，走完還不到就回 max_ns */
+static inline double
+lat_hist_percentile_us(const uint64_t *hist, uint64_t ios, uint64_t max_ns, double p)
+{
+    uint64_t want = (uint64_t)(ios * p / 100.0);
+    uint64_t acc = 0;
+
+    if (ios == 0) {
+        return 0;
+    }
+    for (uint32_t b = 0; b < LAT_BUCKETS; b++) {
+        acc += hist[b];
+        if (acc > want) {
+            return lat_bucket_ns(b) / 1000.0;
+        }
+    }
+    return max_ns / 1000.0;
+}
+
+/* ---------------- PRNG / 雜項 ---------------- */
+static inline uint64_t
+xorshift64(uint64_t *s)
+{
+    uint64_t x = *s;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+static inline uint32_t
+pow2_roundup(uint32_t n)
+{
+    uint32_t p = 1;
+
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+/* ---------------- lock-free SPSC ring ---------------- */
+struct spsc_ring {
+    uint32_t head __attribute__((aligned(BENCH_CACHE_LINE)));   // producer 寫
+    uint32_t tail __attribute__((aligned(BENCH_CACHE_LINE)));   // consumer 寫
+    uint32_t mask __attribute__((aligned(BENCH_CACHE_LINE)));
+    void   **slots;
+};
+
+static inline int
+spsc_init(struct spsc_ring *r, uint32_t size)
+{
+    r->head = r->tail = 0;
+    r->mask = size - 1;
+    r->slots = calloc(size, sizeof(void *));
+    return r->slots ? 0 : -ENOMEM;
+}
+
+static inline void
+spsc_fini(struct spsc_ring *r)
+{
+    free(r->slots);
+    r->slots = NULL;
+}
+
+static inline int
+spsc_enqueue(struct spsc_ring *r, void *obj)
+{
+    uint32_t h = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+    if (h - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->mask) {
+        return -ENOSPC;
+    }
+    r->slots[h & r->mask] = obj;
+    __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static inline uint32_t
+spsc_dequeue(struct spsc_ring *r, void **objs, uint32_t max)
+{
+    uint32_t t = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    uint32_t n = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - t;
+
+    if (n > max) {
+        n = max;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        objs[i] = r->slots[(t + i) & r->mask];
+    }
+    __atomic_store_n(&r->tail, t + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+#endif
@@ -0,0 +1,418 @@
+/*
+SPDK 的 C++20 coroutine 介面 (header-only)
+把 submit → callback → resubmit 的 callback 鏈改寫成循序的 co_await：
+
+    spdk_coro::task<void> worker(spdk_coro::bdev &bdev, void *buf) {
+        int rc = co_await bdev.read(buf, 0, 4096);
+        rc = co_await bdev.write(buf, 4096, 4096);
+        if (co_await spdk_coro::yield_to(other_thread) != 0) { ... }   // 投遞失敗：仍在原 thread
+        ...
+    }
+    spdk_coro::spawn(worker(bdev, buf));
+
+設計重點：
+- coroutine frame 由每個 reactor (OS thread) 的 frame_arena 配置，free-list 重複使用，steady state 下每個 IO 不做 malloc
+  （同一 reactor 上的多個 SPDK thread 是協作式輪詢，共用同一個 arena 不需要 lock）
+- IO 完成時直接在 completion callback 裡 resume coroutine (inline)，不多經過一次 spdk_thread_send_msg
+- 只有 yield_to() 會跨 thread，用 spdk_thread_send_msg 把 resume 投遞到目標 thread；
+  投遞失敗 (-ENOMEM 等) 時不掛起，在原 thread 繼續，co_await 回傳該錯誤碼
+*/
+#ifndef SPDK_CORO_HPP
+#define SPDK_CORO_HPP
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <utility>
+
+#include "spdk/stdinc.h"
+#include "spdk/bdev.h"
+#include "spdk/nvme.h"
+#include "spdk/thread.h"
+
+namespace spdk_coro {
+
+/* ---------------------------------------------------------------------------------- */
+/* frame arena：依 64B 分級的 free-list，超過 MAX_FRAME 的 frame 直接走 ::operator new   */
+/* ---------------------------------------------------------------------------------- */
+class frame_arena {
+public:
+    static constexpr size_t GRANULE = 64;
+    static constexpr size_t MAX_FRAME = 1024;
+    static constexpr size_t NUM_CLASSES = MAX_FRAME / GRANULE;
+
+    static frame_arena &local() {
+        static thread_local frame_arena arena;
+        return arena;
+    }
+
+    void *alloc(size_t size) {
+        size_t cls = size_class(size);
+
+        if (cls >= NUM_CLASSES) {
+            return ::operator new(size);
+        }
+        if (node *n = free_[cls]) {
+            free_[cls] = n->next;
+            return n;
+        }
+        misses_++;
+        return ::operator new((cls + 1) * GRANULE);
+    }
+
+    /* frame 可能在別的 reactor 被釋放 (yield_to 之後)，掛回「釋放端」的 free-list 即可 */
+    void free(void *p, size_t size) {
+        size_t cls = size_class(size);
+
+        if (cls >= NUM_CLASSES) {
+            ::operator delete(p);
+            return;
+        }
+        node *n = static_cast<node *>(p);
+        n->next = free_[cls];
+        free_[cls] = n;
+    }
+
+    /* 曾經 fallback 到 ::operator new 的次數；warm-up 後應該不再增加 */
+    uint64_t misses() const {
+        return misses_;
+    }
+
+    ~frame_arena() {
+        for (node *&head : free_) {
+            while (head) {
+                node *n = head;
+                head = n->next;
+                ::operator delete(n);
+            }
+        }
+    }
+
+private:
+    struct node {
+        node *next;
+    };
+
+    static size_t size_class(size_t size) {
+        return (size + GRANULE - 1) / GRANULE - 1;
+    }
+
+    node *free_[NUM_CLASSES] = {};
+    uint64_t misses_ = 0;
+};
+
+struct arena_allocated {
+    static void *operator new(size_t size) {
+        return frame_arena::local().alloc(size);
+    }
+    static void operator delete(void *p, size_t size) {
+        frame_arena::local().free(p, size);
+    }
+};
+
+/* ---------------------------------------------------------------------------------- */
+/* task<T>：lazy start，co_await 時才開始跑，結束時 symmetric transfer 回到 awaiting 端    */
+/* ---------------------------------------------------------------------------------- */
+template <typename T> class task;
+
+namespace detail {
+
+struct final_awaiter {
+    bool await_ready() const noexcept {
+        return false;
+    }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+        if (h.promise().continuation) {
+            return h.promise().continuation;
+        }
+        /* spawn() 出去、沒人等的 task：自己結束自己 */
+        if (h.promise().detached) {
+            h.destroy();
+        }
+        return std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+};
+
+struct promise_base : arena_allocated {
+    std::coroutine_handle<> continuation;
+    bool detached = false;
+
+    std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+    final_awaiter final_suspend() const noexcept {
+        return {};
+    }
+    /* SPDK 的 callback 環境不能丟 exception 出去 */
+    void unhandled_exception() const noexcept {
+        std::terminate();
+    }
+};
+
+} // namespace detail
+
+template <typename T>
+class task {
+public:
+    struct promise_type : detail::promise_base {
+        T value{};
+
+        task get_return_object() {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        void return_value(T v) {
+            value = std::move(v);
+        }
+    };
+
+    task(task &&o) noexcept : h_(std::exchange(o.h_, nullptr)) {}
+    task(const task &) = delete;
+    ~task() {
+        if (h_) {
+            h_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        h_.promise().continuation = awaiting;
+        return h_;
+    }
+    T await_resume() {
+        return std::move(h_.promise().value);
+    }
+
+    std::coroutine_handle<promise_type> release() {
+        return std::exchange(h_, nullptr);
+    }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> h) : h_(h) {}
+    std::coroutine_handle<promise_type> h_;
+};
+
+template <>
+class task<void> {
+public:
+    struct promise_type : detail::promise_base {
+        task get_return_object() {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        void return_void() const noexcept {}
+    };
+
+    task(task &&o) noexcept : h_(std::exchange(o.h_, nullptr)) {}
+    task(const task &) = delete;
+    ~task() {
+        if (h_) {
+            h_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        h_.promise().continuation = awaiting;
+        return h_;
+    }
+    void await_resume() const noexcept {}
+
+    std::coroutine_handle<promise_type> release() {
+        return std::exchange(h_, nullptr);
+    }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> h) : h_(h) {}
+    std::coroutine_handle<promise_type> h_;
+};
+
+/* 在目前的 SPDK thread 上開始跑一個 task，跑完自動釋放 frame */
+inline void spawn(task<void> t) {
+    auto h = t.release();
+    h.promise().detached = true;
+    h.resume();
+}
+
+/* ---------------------------------------------------------------------------------- */
+/* bdev awaiter：co_await 回傳 0 表示成功，-EIO 表示 IO 失敗，其他負值為 submit 的 rc     */
+/* ---------------------------------------------------------------------------------- */
+class bdev_io_awaiter {
+public:
+    enum class op { read, write };
+
+    bdev_io_awaiter(spdk_bdev_desc *desc, spdk_io_channel *ch, op o, void *buf,
+                    uint64_t offset, uint64_t nbytes)
+        : desc_(desc), ch_(ch), op_(o), buf_(buf), offset_(offset), nbytes_(nbytes) {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+        int rc;
+
+        h_ = h;
+        if (op_ == op::read) {
+            rc = spdk_bdev_read(desc_, ch_, buf_, offset_, nbytes_, complete, this);
+        } else {
+            rc = spdk_bdev_write(desc_, ch_, buf_, offset_, nbytes_, complete, this);
+        }
+        if (rc != 0) {
+            /* submit 失敗 (例如 -ENOMEM)：不 suspend，直接把 rc 交回 coroutine */
+            result_ = rc;
+            return false;
+        }
+        /* 成功送出後不能再碰 this：completion 可能已經 resume 並銷毀了這個 awaiter */
+        return true;
+    }
+
+    int await_resume() const noexcept {
+        return result_;
+    }
+
+private:
+    static void complete(spdk_bdev_io *bdev_io, bool success, void *cb_arg) {
+        auto *self = static_cast<bdev_io_awaiter *>(cb_arg);
+
+        spdk_bdev_free_io(bdev_io);
+        self->result_ = success ? 0 : -EIO;
+        self->h_.resume();
+    }
+
+    spdk_bdev_desc *desc_;
+    spdk_io_channel *ch_;
+    op op_;
+    void *buf_;
+    uint64_t offset_;
+    uint64_t nbytes_;
+    int result_ = 0;
+    std::coroutine_handle<> h_;
+};
+
+/* 綁定在某個 SPDK thread 的 io_channel 上，只能在該 thread 上 co_await */
+class bdev {
+public:
+    bdev(spdk_bdev_desc *desc, spdk_io_channel *ch) : desc_(desc), ch_(ch) {}
+
+    bdev_io_awaiter read(void *buf, uint64_t offset, uint64_t nbytes) const {
+        return {desc_, ch_, bdev_io_awaiter::op::read, buf, offset, nbytes};
+    }
+    bdev_io_awaiter write(void *buf, uint64_t offset, uint64_t nbytes) const {
+        return {desc_, ch_, bdev_io_awaiter::op::write, buf, offset, nbytes};
+    }
+
+private:
+    spdk_bdev_desc *desc_;
+    spdk_io_channel *ch_;
+};
+
+/* ---------------------------------------------------------------------------------- */
+/* NVMe qpair awaiter：co_await 回傳 0 表示成功，-EIO 表示 NVMe status 錯誤              */
+/* completion 仍需要有人呼叫 spdk_nvme_qpair_process_completions (例如該 thread 的 poller) */
+/* ---------------------------------------------------------------------------------- */
+class nvme_io_awaiter {
+public:
+    enum class op { read, write };
+
+    nvme_io_awaiter(spdk_nvme_ns *ns, spdk_nvme_qpair *qpair, op o, void *buf,
+                    uint64_t lba, uint32_t lba_count)
+        : ns_(ns), qpair_(qpair), op_(o), buf_(buf), lba_(lba), lba_count_(lba_count) {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+        int rc;
+
+        h_ = h;
+        if (op_ == op::read) {
+            rc = spdk_nvme_ns_cmd_read(ns_, qpair_, buf_, lba_, lba_count_, complete, this, 0);
+        } else {
+            rc = spdk_nvme_ns_cmd_write(ns_, qpair_, buf_, lba_, lba_count_, complete, this, 0);
+        }
+        if (rc != 0) {
+            result_ = rc;
+            return false;
+        }
+        return true;
+    }
+
+    int await_resume() const noexcept {
+        return result_;
+    }
+
+private:
+    static void complete(void *cb_arg, const spdk_nvme_cpl *cpl) {
+        auto *self = static_cast<nvme_io_awaiter *>(cb_arg);
+
+        self->result_ = spdk_nvme_cpl_is_error(cpl) ? -EIO : 0;
+        self->h_.resume();
+    }
+
+    spdk_nvme_ns *ns_;
+    spdk_nvme_qpair *qpair_;
+    op op_;
+    void *buf_;
+    uint64_t lba_;
+    uint32_t lba_count_;
+    int result_ = 0;
+    std::coroutine_handle<> h_;
+};
+
+class nvme_qpair {
+public:
+    nvme_qpair(spdk_nvme_ns *ns, spdk_nvme_qpair *qpair) : ns_(ns), qpair_(qpair) {}
+
+    nvme_io_awaiter read(void *buf, uint64_t lba, uint32_t lba_count) const {
+        return {ns_, qpair_, nvme_io_awaiter::op::read, buf, lba, lba_count};
+    }
+    nvme_io_awaiter write(void *buf, uint64_t lba, uint32_t lba_count) const {
+        return {ns_, qpair_, nvme_io_awaiter::op::write, buf, lba, lba_count};
+    }
+
+private:
+    spdk_nvme_ns *ns_;
+    spdk_nvme_qpair *qpair_;
+};
+
+/* ---------------------------------------------------------------------------------- */
+/* yield_to(thread)：把 coroutine 的後續搬到另一個 SPDK thread 上執行                    */
+/* co_await 回傳 0 表示已在目標 thread；非 0 是 spdk_thread_send_msg 的錯誤，仍在原 thread */
+/* ---------------------------------------------------------------------------------- */
+class yield_to {
+public:
+    explicit yield_to(spdk_thread *thread) : thread_(thread) {}
+
+    bool await_ready() const noexcept {
+        return thread_ == spdk_get_thread();
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+        result_ = spdk_thread_send_msg(thread_, resume, h.address());
+        return result_ == 0;
+    }
+
+    int await_resume() const noexcept {
+        return result_;
+    }
+
+private:
+    static void resume(void *arg) {
+        std::coroutine_handle<>::from_address(arg).resume();
+    }
+
+    spdk_thread *thread_;
+    int result_ = 0;
+};
+
+} // namespace spdk_coro
+
+#endif /* SPDK_CORO_HPP */
@@ -0,0 +1,458 @@
+/*
+hugepage (DMA) 記憶體記帳：見 spdk_dma_account.h
+*/
+#include "spdk/stdinc.h"
+#include "spdk/env.h"
+#include "spdk/thread.h"
+#include "spdk/util.h"
+#ifndef SPDK_DMA_ACCOUNT_NO_RPC
+#include "spdk/json.h"
+#include "spdk/jsonrpc.h"
+#include "spdk/rpc.h"
+#endif
+
+#include <rte_malloc.h>
+#include <rte_memory.h>
+
+#include "spdk_dma_account.h"
+
+#define HASH_BUCKETS        4096
+#define NODE_ANY            DMA_ACCT_MAX_NODES
+#define NVME_SQE_BYTES      64
+#define NVME_CQE_BYTES      16
+#define NVME_TRACKER_BYTES  4096    // struct nvme_tracker (PCIe)，含 PRP list
+#define NVME_MAX_TRACKERS   128     // NVME_IO_TRACKERS
+#define NVME_REQUEST_BYTES  384     // struct nvme_request 約略大小 (含 cache line padding)
+#define HUGE_2M             (UINT64_C(2) << 20)
+#define MIB                 (UINT64_C(1) << 20)
+
+static const char *g_comp_name[] = { "io_buf", "nvme_qpair", "iobuf", "other" };
+
+struct acct_entry {
+    void *buf;
+    size_t size;
+    uint8_t comp;
+    uint8_t node;
+    struct acct_entry *next;
+};
+
+struct acct_counter {
+    uint64_t cur;
+    uint64_t peak;
+    uint64_t allocs;
+};
+
+struct node_stats {
+    bool     valid;
+    uint64_t heap_total;
+    uint64_t heap_used;
+    uint64_t heap_free;
+    uint64_t largest_free;
+    uint64_t huge_total;
+    uint64_t huge_free;
+};
+
+struct acct_snapshot {
+    struct acct_counter c[DMA_ACCT_NUM][DMA_ACCT_MAX_NODES + 1];
+    struct node_stats node[DMA_ACCT_MAX_NODES];
+    uint64_t tracked_cur;
+    uint64_t untracked;
+    int ndev;
+    uint64_t small_pool_count, large_pool_count;
+};
+
+struct acct_recommend {
+    int devices;
+    uint64_t per_dev;
+    uint64_t shared;
+    uint64_t need;
+    uint64_t have;
+    bool fits;
+    uint64_t small_pool_count;      // 0：不用改
+    uint64_t large_pool_count;
+};
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct acct_entry *g_hash[HASH_BUCKETS];
+static struct acct_counter g_cnt[DMA_ACCT_NUM][DMA_ACCT_MAX_NODES + 1];
+static int g_ndev = 1;
+static uint64_t g_small_pool_count, g_large_pool_count;
+static bool g_iobuf_noted;
+
+static uint32_t hash_ptr(const void *p)
+{
+    uint64_t x = (uintptr_t)p >> 6;
+
+    x *= 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(x >> 52) & (HASH_BUCKETS - 1);
+}
+
+static int node_slot(int node)
+{
+    return node >= 0 && node < DMA_ACCT_MAX_NODES ? node : NODE_ANY;
+}
+
+static const char *node_name(int slot, char *buf, size_t len)
+{
+    if (slot == NODE_ANY) {
+        return "any";
+    }
+    snprintf(buf, len, "%d", slot);
+    return buf;
+}
+
+/* 呼叫端持有 g_lock */
+static void counter_add(enum dma_acct_comp comp, int slot, int64_t bytes)
+{
+    struct acct_counter *c = &g_cnt[comp][slot];
+
+    if (bytes < 0 && (uint64_t)-bytes > c->cur) {
+        c->cur = 0;
+        return;
+    }
+    c->cur += bytes;
+    if (bytes > 0) {
+        c->allocs++;
+        c->peak = spdk_max(c->peak, c->cur);
+    }
+}
+
+void *spdk_dma_account_zmalloc(enum dma_acct_comp comp, size_t size, size_t align, int socket_id)
+{
+    void *buf = spdk_zmalloc(size, align, NULL, socket_id, SPDK_MALLOC_DMA);
+    const struct rte_memseg_list *msl;
+    struct acct_entry *e;
+    uint32_t h;
+
+    if (!buf) {
+        return NULL;
+    }
+    e = calloc(1, sizeof(*e));
+    if (!e) {
+        /* 記不到帳也不影響配置本身 */
+        return buf;
+    }
+    msl = rte_mem_virt2memseg_list(buf);
+    e->buf = buf;
+    e->size = size;
+    e->comp = comp;
+    e->node = node_slot(msl ? msl->socket_id : -1);
+
+    h = hash_ptr(buf);
+    pthread_mutex_lock(&g_lock);
+    e->next = g_hash[h];
+    g_hash[h] = e;
+    counter_add(comp, e->node, size);
+    pthread_mutex_unlock(&g_lock);
+    return buf;
+}
+
+void spdk_dma_account_free(void *buf)
+{
+    struct acct_entry **pp, *e = NULL;
+
+    if (!buf) {
+        return;
+    }
+    pthread_mutex_lock(&g_lock);
+    for (pp = &g_hash[hash_ptr(buf)]; *pp; pp = &(*pp)->next) {
+        if ((*pp)->buf == buf) {
+            e = *pp;
+            *pp = e->next;
+            counter_add(e->comp, e->node, -(int64_t)e->size);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    free(e);
+    spdk_free(buf);
+}
+
+void spdk_dma_account_note(enum dma_acct_comp comp, int node, int64_t bytes)
+{
+    pthread_mutex_lock(&g_lock);
+    counter_add(comp, node_slot(node), bytes);
+    pthread_mutex_unlock(&g_lock);
+}
+
+void spdk_dma_account_note_iobuf(void)
+{
+    struct spdk_iobuf_opts opts;
+
+    spdk_iobuf_get_opts(&opts, sizeof(opts));
+    pthread_mutex_lock(&g_lock);
+    if (!g_iobuf_noted) {
+        g_small_pool_count = opts.small_pool_count;
+        g_large_pool_count = opts.large_pool_count;
+        counter_add(DMA_ACCT_IOBUF, NODE_ANY,
+                    (int64_t)(opts.small_pool_count * opts.small_bufsize + opts.large_pool_count * opts.large_bufsize));
+        g_iobuf_noted = true;
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+void spdk_dma_account_note_nvme_qpair(uint32_t io_queue_size, uint32_t io_queue_requests, int node, int count)
+{
+    uint64_t ring = SPDK_ALIGN_CEIL((uint64_t)io_queue_size * NVME_SQE_BYTES, 4096) +
+                    SPDK_ALIGN_CEIL((uint64_t)io_queue_size * NVME_CQE_BYTES, 4096);
+    uint64_t trackers = (uint64_t)spdk_min(NVME_MAX_TRACKERS, io_queue_size - 1) * NVME_TRACKER_BYTES;
+    uint64_t reqs = (uint64_t)io_queue_requests * NVME_REQUEST_BYTES;
+
+    spdk_dma_account_note(DMA_ACCT_NVME_QPAIR, node, (int64_t)(ring + trackers + reqs) * count);
+}
+
+void spdk_dma_account_set_devices(int ndev)
+{
+    g_ndev = ndev > 0 ? ndev : 1;
+}
+
+/* /sys/devices/system/node/nodeN/hugepages/hugepages-<size>kB/{nr,free}_hugepages，所有 size 加總 */
+static void read_hugepages(int node, uint64_t *total, uint64_t *free_bytes)
+{
+    char path[256];
+    DIR *d;
+    struct dirent *de;
+
+    *total = *free_bytes = 0;
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/hugepages", node);
+    d = opendir(path);
+    if (!d) {
+        return;
+    }
+    while ((de = readdir(d)) != NULL) {
+        unsigned long kb;
+        char file[512];
+        FILE *f;
+        unsigned long nr = 0, fr = 0;
+
+        if (sscanf(de->d_name, "hugepages-%lukB", &kb) != 1) {
+            continue;
+        }
+        snprintf(file, sizeof(file), "%s/%s/nr_hugepages", path, de->d_name);
+        if ((f = fopen(file, "r")) != NULL) {
+            if (fscanf(f, "%lu", &nr) != 1) {
+                nr = 0;
+            }
+            fclose(f);
+        }
+        snprintf(file, sizeof(file), "%s/%s/free_hugepages", path, de->d_name);
+        if ((f = fopen(file, "r")) != NULL) {
+            if (fscanf(f, "%lu", &fr) != 1) {
+                fr = 0;
+            }
+            fclose(f);
+        }
+        *total += (uint64_t)nr * kb * 1024;
+        *free_bytes += (uint64_t)fr * kb * 1024;
+    }
+    closedir(d);
+}
+
+static void take_snapshot(struct acct_snapshot *s)
+{
+    uint64_t heap_used = 0;
+
+    memset(s, 0, sizeof(*s));
+    pthread_mutex_lock(&g_lock);
+    memcpy(s->c, g_cnt, sizeof(s->c));
+    s->ndev = g_ndev;
+    s->small_pool_count = g_small_pool_count;
+    s->large_pool_count = g_large_pool_count;
+    pthread_mutex_unlock(&g_lock);
+
+    for (int c = 0; c < DMA_ACCT_NUM; c++) {
+        for (int n = 0; n <= DMA_ACCT_MAX_NODES; n++) {
+            s->tracked_cur += s->c[c][n].cur;
+        }
+    }
+    for (int n = 0; n < DMA_ACCT_MAX_NODES; n++) {
+        struct node_stats *ns = &s->node[n];
+        struct rte_malloc_socket_stats st;
+
+        read_hugepages(n, &ns->huge_total, &ns->huge_free);
+        if (rte_malloc_get_socket_stats(n, &st) == 0 && st.heap_totalsz_bytes > 0) {
+            ns->heap_total = st.heap_totalsz_bytes;
+            ns->heap_used = st.heap_allocsz_bytes;
+            ns->heap_free = st.heap_freesz_bytes;
+            ns->largest_free = st.greatest_free_size;
+        }
+        ns->valid = ns->heap_total > 0 || ns->huge_total > 0;
+        heap_used += ns->heap_used;
+    }
+    s->untracked = heap_used > s->tracked_cur ? heap_used - s->tracked_cur : 0;
+}
+
+static double frag_pct(const struct node_stats *ns)
+{
+    return ns->heap_free ? (1.0 - (double)ns->largest_free / ns->heap_free) * 100 : 0.0;
+}
+
+static void recommend(const struct acct_snapshot *s, int devices, struct acct_recommend *r)
+{
+    uint64_t per_dev = 0, iobuf = 0, shared, budget;
+
+    memset(r, 0, sizeof(*r));
+    for (int n = 0; n <= DMA_ACCT_MAX_NODES; n++) {
+        per_dev += s->c[DMA_ACCT_IO_BUF][n].peak + s->c[DMA_ACCT_NVME_QPAIR][n].peak;
+        iobuf += s->c[DMA_ACCT_IOBUF][n].peak;
+    }
+    shared = iobuf + s->untracked;
+    for (int n = 0; n <= DMA_ACCT_MAX_NODES; n++) {
+        shared += s->c[DMA_ACCT_OTHER][n].peak;
+    }
+    for (int n = 0; n < DMA_ACCT_MAX_NODES; n++) {
+        r->have += s->node[n].huge_total ? s->node[n].huge_total : s->node[n].heap_total;
+    }
+
+    r->devices = devices;
+    r->per_dev = per_dev / s->ndev;
+    r->shared = shared;
+    r->need = shared + (uint64_t)devices * r->per_dev;
+    r->fits = r->need <= r->have;
+    if (r->fits || iobuf == 0) {
+        return;
+    }
+    /* 放不下：iobuf 以外的都是硬需求，剩下的空間照目前比例分給 small / large pool */
+    budget = r->have > r->need - iobuf ? r->have - (r->need - iobuf) : 0;
+    r->small_pool_count = (uint64_t)((double)s->small_pool_count * budget / iobuf);
+    r->large_pool_count = (uint64_t)((double)s->large_pool_count * budget / iobuf);
+}
+
+void spdk_dma_account_print(const char *tag)
+{
+    static struct acct_snapshot s;
+    const char *env = getenv("SPDK_DMA_ACCOUNT_DEVICES");
+    struct acct_recommend r;
+    char nb[16];
+
+    take_snapshot(&s);
+    printf("DMA %s: %-10s %4s %12s %12s %10s\n", tag, "component", "node", "cur(KiB)", "peak(KiB)", "allocs");
+    for (int c = 0; c < DMA_ACCT_NUM; c++) {
+        for (int n = 0; n <= DMA_ACCT_MAX_NODES; n++) {
+            const struct acct_counter *ct = &s.c[c][n];
+
+            if (ct->allocs == 0) {
+                continue;
+            }
+            printf("DMA %s: %-10s %4s %12" PRIu64 " %12" PRIu64 " %10" PRIu64 "\n", tag, g_comp_name[c],
+                   node_name(n, nb, sizeof(nb)), ct->cur >> 10, ct->peak >> 10, ct->allocs);
+        }
+    }
+    printf("DMA %s: %-10s %4s %12" PRIu64 "\n", tag, "untracked", "-", s.untracked >> 10);
+
+    for (int n = 0; n < DMA_ACCT_MAX_NODES; n++) {
+        const struct node_stats *ns = &s.node[n];
+
+        if (!ns->valid) {
+            continue;
+        }
+        printf("DMA %s: node %d heap %" PRIu64 " MiB, used %" PRIu64 " MiB, free %" PRIu64 " MiB, "
+               "largest free %" PRIu64 " MiB, fragmentation %.1f%%; hugepages %" PRIu64 " MiB, free %" PRIu64 " MiB\n",
+               tag, n, ns->heap_total / MIB, ns->heap_used / MIB, ns->heap_free / MIB, ns->largest_free / MIB,
+               frag_pct(ns), ns->huge_total / MIB, ns->huge_free / MIB);
+    }
+
+    if (env && atoi(env) > 0) {
+        recommend(&s, atoi(env), &r);
+        printf("DMA %s: %d devices need %" PRIu64 " MiB (%" PRIu64 " MiB/device x %d + %" PRIu64 " MiB shared), "
+               "hugepages %" PRIu64 " MiB: %s\n", tag, r.devices, r.need / MIB, r.per_dev / MIB, r.devices,
+               r.shared / MIB, r.have / MIB, r.fits ? "fits" : "does not fit");
+        if (!r.fits) {
+            if (r.small_pool_count || r.large_pool_count) {
+                printf("DMA %s:   iobuf_set_options --small-pool-count %" PRIu64 " --large-pool-count %" PRIu64 "\n",
+                       tag, r.small_pool_count, r.large_pool_count);
+            }
+            printf("DMA %s:   or reserve >= %" PRIu64 " x 2MiB hugepages\n", tag, (r.need + HUGE_2M - 1) / HUGE_2M);
+        }
+    }
+}
+
+#ifndef SPDK_DMA_ACCOUNT_NO_RPC
+struct rpc_dma_account_get {
+    uint32_t devices;
+};
+
+static const struct spdk_json_object_decoder rpc_dma_account_get_decoders[] = {
+    {"devices", offsetof(struct rpc_dma_account_get, devices), spdk_json_decode_uint32, true},
+};
+
+static void rpc_dma_account_get(struct spdk_jsonrpc_request *request, const struct spdk_json_val *params)
+{
+    static struct acct_snapshot s;
+    struct rpc_dma_account_get req = {};
+    struct spdk_json_write_ctx *w;
+    struct acct_recommend r;
+    char nb[16];
+
+    if (params && spdk_json_decode_object(params, rpc_dma_account_get_decoders,
+                                          SPDK_COUNTOF(rpc_dma_account_get_decoders), &req)) {
+        spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INVALID_PARAMS, "invalid parameters");
+        return;
+    }
+
+    take_snapshot(&s);
+    w = spdk_jsonrpc_begin_result(request);
+    spdk_json_write_object_begin(w);
+
+    spdk_json_write_named_array_begin(w, "components");
+    for (int c = 0; c < DMA_ACCT_NUM; c++) {
+        for (int n = 0; n <= DMA_ACCT_MAX_NODES; n++) {
+            const struct acct_counter *ct = &s.c[c][n];
+
+            if (ct->allocs == 0) {
+                continue;
+            }
+            spdk_json_write_object_begin(w);
+            spdk_json_write_named_string(w, "name", g_comp_name[c]);
+            spdk_json_write_named_string(w, "node", node_name(n, nb, sizeof(nb)));
+            spdk_json_write_named_uint64(w, "current", ct->cur);
+            spdk_json_write_named_uint64(w, "peak", ct->peak);
+            spdk_json_write_named_uint64(w, "allocs", ct->allocs);
+            spdk_json_write_object_end(w);
+        }
+    }
+    spdk_json_write_array_end(w);
+    spdk_json_write_named_uint64(w, "untracked", s.untracked);
+
+    spdk_json_write_named_array_begin(w, "nodes");
+    for (int n = 0; n < DMA_ACCT_MAX_NODES; n++) {
+        const struct node_stats *ns = &s.node[n];
+
+        if (!ns->valid) {
+            continue;
+        }
+        spdk_json_write_object_begin(w);
+        spdk_json_write_named_int32(w, "node", n);
+        spdk_json_write_named_uint64(w, "heap_total", ns->heap_total);
+        spdk_json_write_named_uint64(w, "heap_used", ns->heap_used);
+        spdk_json_write_named_uint64(w, "heap_free", ns->heap_free);
+        spdk_json_write_named_uint64(w, "largest_free", ns->largest_free);
+        spdk_json_write_named_double(w, "fragmentation_pct", frag_pct(ns));
+        spdk_json_write_named_uint64(w, "hugepages_total", ns->huge_total);
+        spdk_json_write_named_uint64(w, "hugepages_free", ns->huge_free);
+        spdk_json_write_object_end(w);
+    }
+    spdk_json_write_array_end(w);
+
+    if (req.devices > 0) {
+        recommend(&s, req.devices, &r);
+        spdk_json_write_named_object_begin(w, "recommend");
+        spdk_json_write_named_int32(w, "devices", r.devices);
+        spdk_json_write_named_uint64(w, "per_device", r.per_dev);
+        spdk_json_write_named_uint64(w, "shared", r.shared);
+        spdk_json_write_named_uint64(w, "need", r.need);
+        spdk_json_write_named_uint64(w, "hugepages", r.have);
+        spdk_json_write_named_bool(w, "fits", r.fits);
+        if (!r.fits) {
+            spdk_json_write_named_uint64(w, "iobuf_small_pool_count", r.small_pool_count);
+            spdk_json_write_named_uint64(w, "iobuf_large_pool_count", r.large_pool_count);
+            spdk_json_write_named_uint64(w, "hugepages_2m_needed", (r.need + HUGE_2M - 1) / HUGE_2M);
+        }
+        spdk_json_write_object_end(w);
+    }
+
+    spdk_json_write_object_end(w);
+    spdk_jsonrpc_end_result(request, w);
+}
+SPDK_RPC_REGISTER("dma_account_get", rpc_dma_account_get, SPDK_RPC_RUNTIME)
+#endif
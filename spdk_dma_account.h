@@ -0,0 +1,71 @@
+/*
+hugepage (DMA) 記憶體記帳：依 component 和 NUMA node 分開算 current / peak，看 hugepage 被誰吃掉
+
+密集的機器上 hugepage 常常不夠，但 DPDK heap 只知道總共用了多少。這裡分成：
+  io_buf      engine 自己每個 IO 的 buffer (原本的 spdk_zmalloc / spdk_dma_zmalloc 改用 spdk_dma_account_zmalloc)
+  nvme_qpair  raw NVMe engine 的 IO qpair：SQ / CQ ring、tracker (每個 4 KiB，含 PRP list)、nvme_request，
+              SPDK 內部配置拿不到指標，用 qpair opts 估算 (spdk_dma_account_note_nvme_qpair)
+  iobuf       SPDK iobuf 的 small / large pool (spdk_iobuf_get_opts 算出來)；ublk 的 payload 和 bdev 的 bounce buffer 都從這裡拿
+  other       engine 其他的 DMA 配置
+  untracked   DPDK heap 實際用量減掉上面全部：bdev_nvme 的 qpair、accel、DPDK 自己的 memzone ...
+SPDK trace 的 buffer 在 /dev/shm (tmpfs)，不佔 hugepage，不列入。
+
+每個 node 另外列 DPDK heap (rte_malloc_get_socket_stats) 的 total / used / free / 最大連續 free，
+fragmentation = 1 - 最大連續 free / free：free 很多但切碎了，大的配置 (iobuf large pool、128K buffer) 還是會失敗。
+
+建議值：engine 用 spdk_dma_account_set_devices 告訴這裡現在驅動幾台 device，
+io_buf + nvme_qpair 的 peak 視為「每台 device」的量，iobuf + other + untracked 視為共用，
+  need(N) = 共用 + N x 每台
+和機器上的 hugepage 總量比；放不下時把剩下的空間按目前 small / large 的比例分給 iobuf，建議新的 pool count。
+
+輸出：
+  spdk_dma_account_print(tag)  印 "DMA ..." 開頭的表，engine 結束前呼叫
+  RPC dma_account_get          {"devices": N} 可選，回傳同樣內容的 JSON (spdk_app 的 RPC socket)
+環境變數：
+  SPDK_DMA_ACCOUNT_DEVICES=<N>  print 時也印 N 台 device 的建議值
+
+RPC 要 link spdk_rpc / spdk_json (spdk_event 會帶進來)；只用 env 的 engine 編譯時加 -DSPDK_DMA_ACCOUNT_NO_RPC。
+記帳用一把 mutex，只適合 setup / teardown 時的配置，不要放在每個 IO 的 path 上。
+*/
+#ifndef SPDK_DMA_ACCOUNT_H
+#define SPDK_DMA_ACCOUNT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DMA_ACCT_MAX_NODES  8       // node 編號 >= 這個或不知道的都算在 "any"
+
+enum dma_acct_comp {
+    DMA_ACCT_IO_BUF,
+    DMA_ACCT_NVME_QPAIR,
+    DMA_ACCT_IOBUF,
+    DMA_ACCT_OTHER,
+    DMA_ACCT_NUM,
+};
+
+/* 同 spdk_zmalloc(size, align, NULL, socket_id, SPDK_MALLOC_DMA)，多記一筆帳 */
+void *spdk_dma_account_zmalloc(enum dma_acct_comp comp, size_t size, size_t align, int socket_id);
+void spdk_dma_account_free(void *buf);
+
+/* 不是經過上面配置的 (SPDK 內部)：直接加減 bytes，node < 0 表示不知道 */
+void spdk_dma_account_note(enum dma_acct_comp comp, int node, int64_t bytes);
+
+/* 依目前的 iobuf opts 記一次 iobuf pool (spdk_app_start 之後呼叫) */
+void spdk_dma_account_note_iobuf(void);
+
+/* 記 count 個 IO qpair (count < 0 表示釋放)，用 alloc 時的 io_queue_size / io_queue_requests 估算 */
+void spdk_dma_account_note_nvme_qpair(uint32_t io_queue_size, uint32_t io_queue_requests, int node, int count);
+
+void spdk_dma_account_set_devices(int ndev);
+
+void spdk_dma_account_print(const char *tag);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPDK_DMA_ACCOUNT_H */
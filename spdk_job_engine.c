@@ -0,0 +1,1612 @@
+/*
+fio 風格的 job file engine：topology 與 workload 都寫在 INI (或 JSON) 裡，不用再改巨集重編
+
+  sudo ./spdk_job_engine jobs/mixed_rw.ini [bdev.json]
+  sudo ./spdk_job_engine jobs/mixed_rw.json [bdev.json]     # 副檔名 .json 用 JSON 格式，key 和 INI 相同
+
+JSON：{ "global": { key: value, ... }, "jobs": [ { "name": "randread", key: value, ... }, ... ] }
+值可以是字串、數字或 true/false (例：jobs/mixed_rw.json)
+
+一個 job file 可有多個 [job]，全部同時跑 (各自佔一組 core)，用來看 mixed workload 的互相干擾
+[global] 裡的 key 會當作每個 job 的預設值，job 區段裡同名 key 會覆蓋
+
+[global] 專用：
+  reactor_mask = 0xF          spdk_app 的 reactor mask，所有 job 的 cores 都要在裡面
+  json_config  = bdev.json    bdev 設定檔 (bdev_nvme_attach_controller / malloc ...)；argv[2] 可覆蓋
+  csv          = result.csv   每個 job 每個 phase 一列結果
+  ss_csv       = rounds.csv   precondition 和 steady state 每一輪的紀錄 (有 job 開 precondition / steady_state 才寫)
+  perf_counters = 1           每個 reactor 開 perf_event_open counter (spdk_perf_counters.h)，0 = 不開
+
+job key：
+  bdev             = Nvme0n1      目標 bdev；NVMe controller 由 json_config attach 後以 bdev 形式使用
+  cores            = 1,2 | 1-3    job 使用的 reactor core
+  threads_per_core = 1            每個 core 上建立的 SPDK thread 數，每個 thread 一條 io_channel
+                                  (bdev_nvme：每條 channel 對應 poll group 裡的一個 qpair)
+  share_cores      = 0            1: 允許和別的 job 共用 core (預設要求 disjoint)
+  colocate         = victim       不建自己的 thread，第 i 個 worker 跑在 [victim] 第 i % N 個 worker 的 thread 上
+                                  (同 bdev 時共用同一條 io_channel，bdev_nvme 就是同一個 poll group 和 qpair)；
+                                  cores / threads_per_core / share_cores 忽略，對象要寫在這個 job 前面
+  rw               = randread | randwrite | read | write | randrw
+  rwmixread        = 70           randrw 時 read 的比例 (%)
+  bs               = 4096
+  qd               = 32           每個 thread 的 queue depth
+  rate_iops        = 0            整個 job 的 IOPS 上限 (平均分給各 thread)，0 = 不限
+  offset / size    = 0 / 0        job 使用的 bdev 區段 (bytes)，size=0 表示到結尾；區段再平均切給各 thread
+  ramp             = 2            秒，不計入結果的暖身
+  runtime          = 10           秒，量測的 steady phase
+  sweep            = qd:1,4,16,64 | bs:4096,16384   每個值各跑一輪 ramp + steady
+
+preconditioning (SNIA PTS 的 FOB -> steady state)：開跑前先把 job 的區段寫滿，每 5 秒印進度
+  precondition       = none | seq | rand   seq：依序寫過整個區段；rand：隨機寫，量一樣但不保證每塊都寫到
+  precondition_loops = 2              寫幾倍區段大小
+  precondition_bs    = 0              0：seq 用 131072、rand 用 4096
+  precondition_qd    = 32
+steady state 偵測：steady phase 改成一輪 round_sec 秒重複跑，最近 ss_window 輪同時符合
+  (max - min) <= ss_excursion% x 平均  以及  |最小平方法斜率| x (ss_window - 1) <= ss_slope% x 平均
+  才算進入 steady state，只把這 ss_window 輪合起來寫成 steady 列；到 max_rounds 還沒收斂就寫 unsteady 列
+  steady_state = 0 | 1    round_sec = 60    max_rounds = 25
+  ss_window = 5           ss_excursion = 20  ss_slope = 10    ss_metric = iops | mibps | avg_us | p99_us
+  每一輪和 precondition 的結果另外寫到 [global] 的 ss_csv (預設 <csv 去掉 .csv>_rounds.csv)，留作收斂的紀錄
+
+硬體 counter：每個 core 由第一個 worker 在 reactor 上開一組，每段結算時把 cycles / instructions / LLC miss /
+branch miss / dTLB miss 除以 IO 數，和 IPC 一起接在 CSV 後面 (cycles_per_io ... ipc)，console 也印一段。
+counter 是整個 reactor 的，job 的 core 和別的 job 共用 (share_cores / colocate) 時分不開，兩邊的欄位都留空。
+開跑前 preflight (spdk_bench_preflight.h) 的結果接在每一列最後 (pf_mode ... pf_smt_sibling_busy)，
+換機器、換 kernel 參數跑出來的列放在一起比時，看得出哪些是在沒隔離 / 有 turbo 的環境下量的。
+
+結束時印 hugepage 用量 (spdk_dma_account.h)：IO buffer、iobuf pool、其他 (bdev_nvme qpair 等) 的 current / peak，
+跑的時候也可以 RPC dma_account_get 查；SPDK_DMA_ACCOUNT_DEVICES=N 另外印 N 台 device 時建議的 pool 大小
+
+編譯：gcc -o spdk_job_engine spdk_job_engine.c spdk_bench_preflight.c spdk_dma_account.c spdk_perf_counters.c \
+        $(pkg-config --cflags --libs spdk_bdev spdk_env_dpdk spdk_thread spdk_event spdk_event_bdev spdk_json spdk_util)
+*/
+#include "spdk/stdinc.h"
+#include "spdk/env.h"
+#include "spdk/event.h"
+#include "spdk/bdev.h"
+#include "spdk/file.h"
+#include "spdk/json.h"
+#include "spdk/thread.h"
+#include "spdk/util.h"
+#include "spdk_bench_preflight.h"
+#include "spdk_bench_util.h"
+#include "spdk_dma_account.h"
+#include "spdk_perf_counters.h"
+
+#define MAX_JOBS            16
+#define MAX_WORKERS         64          // 每個 job 的 thread 數上限
+#define MAX_CORES           128
+#define MAX_SWEEP           16
+#define MAX_PHASES          (2 * MAX_SWEEP + 1)
+#define MAX_SS_WINDOW       16
+#define RATE_POLL_US        100
+#define PRECOND_PROGRESS_US (5 * 1000000ULL)
+
+enum rw_mode {
+    RW_READ,
+    RW_WRITE,
+    RW_RANDREAD,
+    RW_RANDWRITE,
+    RW_RANDRW,
+};
+
+static const char *g_rw_name[] = { "read", "write", "randread", "randwrite", "randrw" };
+
+enum precond_mode {
+    PRECOND_NONE,
+    PRECOND_SEQ,
+    PRECOND_RAND,
+};
+
+static const char *g_precond_name[] = { "none", "seq", "rand" };
+
+enum ss_metric {
+    SS_IOPS,
+    SS_MIBPS,
+    SS_AVG_US,
+    SS_P99_US,
+};
+
+static const char *g_ss_metric_name[] = { "iops", "mibps", "avg_us", "p99_us" };
+
+enum phase_kind {
+    PH_PRECOND,             // 寫滿區段就結束，不看時間
+    PH_RAMP,
+    PH_STEADY,
+    PH_ROUND,               // steady_state=1 的 steady：重複到收斂
+};
+
+struct phase {
+    const char *name;       // "precondition" / "ramp" / "steady" / "round"
+    enum phase_kind kind;
+    enum rw_mode rw;
+    uint32_t sec;
+    uint32_t qd;
+    uint32_t bs;
+    int sweep_idx;          // -1: 沒有 sweep
+};
+
+struct lat_stats {
+    uint64_t ios;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t lat_sum_ns;
+    uint64_t lat_max_ns;
+    uint64_t hist[LAT_BUCKETS];
+    uint64_t perf[PERF_CTR_NUM];    // 這段期間 reactor 的硬體 counter，只有 ctr_owner 的 worker 有值
+};
+
+struct job;
+struct worker;
+
+struct job_task {
+    struct worker *w;
+    void *buf;
+    uint64_t submit_tsc;
+    uint32_t bytes;         // 送出時的大小；bs sweep 切換時還在飛的 IO 照舊的 bs 算
+    bool is_read;
+};
+
+struct worker {
+    struct job              *job;
+    int                      core;
+    char                     name[48];
+    struct spdk_thread      *th;
+    struct worker           *host;          // colocate：thread 的主人，NULL 表示 thread 是自己建的
+    int                      th_refs;       // 主人才用：還沒結束的 worker 數 (自己 + 寄住的)
+    struct spdk_io_channel  *ch;
+    struct spdk_poller      *poller;
+    struct job_task         *tasks;
+    struct job_task        **free_tasks;
+    uint32_t                 nfree;
+    uint32_t                 qd;
+    uint32_t                 bs;
+    uint32_t                 outstanding;
+    bool                     stopping;
+    enum rw_mode             rw;             // 目前 phase 的 rw (precondition 時是 write / randwrite)
+    bool                     filling;        // precondition 中
+    uint64_t                 fill_left;      // precondition 還要送的 IO 數
+    uint64_t                 region_start;   // blocks
+    uint64_t                 region_blocks;
+    uint64_t                 seq_off;        // blocks，相對 region_start
+    uint64_t                 rng;
+    double                   rate_per_tick;  // 0: 不限速
+    double                   tokens;
+    uint64_t                 last_refill_tsc;
+    struct lat_stats         cur;            // 只有 worker thread 寫
+    struct lat_stats         snap;           // phase 切換時交給 app thread
+    bool                     ctr_owner;      // 這個 core 的 perf counter 由這個 worker 開和讀
+    struct perf_ctr_set      ctr;
+    uint64_t                 ctr_prev[PERF_CTR_NUM];
+};
+
+struct job {
+    char                     name[32];
+    char                     bdev_name[64];
+    char                     colocate[32];
+    struct job              *host;
+    int                      cores[MAX_CORES];
+    int                      ncores;
+    int                      threads_per_core;
+    bool                     share_cores;
+    enum rw_mode             rw;
+    int                      rwmixread;
+    uint32_t                 bs;
+    uint32_t                 qd;
+    uint64_t                 rate_iops;
+    uint64_t                 offset;
+    uint64_t                 size;
+    uint32_t                 ramp_sec;
+    uint32_t                 runtime_sec;
+    char                     sweep_key[8];
+    uint32_t                 sweep_vals[MAX_SWEEP];
+    int                      nsweep;
+    enum precond_mode        precond;
+    uint32_t                 precond_loops;
+    uint32_t                 precond_bs;
+    uint32_t                 precond_qd;
+    bool                     steady_state;
+    uint32_t                 round_sec;
+    uint32_t                 max_rounds;
+    uint32_t                 ss_window;
+    double                   ss_excursion;   // %
+    double                   ss_slope;       // %
+    enum ss_metric           ss_metric;
+
+    struct phase             phases[MAX_PHASES];
+    int                      nphases;
+    int                      cur_phase;      // 目前在跑的 phase；-1: 還沒開始
+    int                      ended;          // 這次切換要結算的 phase；-1: 不結算
+    uint64_t                 phase_tsc;
+    uint32_t                 max_qd;
+    uint32_t                 max_bs;
+
+    struct spdk_bdev_desc   *desc;
+    uint32_t                 block_size;
+    uint64_t                 num_blocks;
+    struct worker            workers[MAX_WORKERS];
+    int                      nworkers;
+    int                      pending;        // 還沒回覆的 worker 數
+    int                      exited;
+    struct spdk_poller      *timer;
+    bool                     perf_shared;    // 有 core 和別的 job 共用，counter 分不開
+
+    int                      fill_pending;   // precondition 還沒寫完的 worker 數
+    uint64_t                 fill_total;     // precondition 全部 worker 的 IO 數
+    uint32_t                 ss_rounds;      // 這個 sweep 點跑完的 round 數
+    struct lat_stats         ss_win[MAX_SS_WINDOW];  // 最近 ss_window 輪，依 ss_rounds % ss_window 放
+    double                   ss_sec[MAX_SS_WINDOW];
+    double                   ss_val[MAX_SS_WINDOW];
+};
+
+static struct job g_jobs[MAX_JOBS];
+static int g_njobs;
+static char g_reactor_mask[64] = "0x1";
+static char g_json_config[256];
+static char g_csv_path[256] = "job_result.csv";
+static char g_ss_csv_path[256];
+static FILE *g_csv;
+static FILE *g_ss_csv;
+static struct spdk_bench_preflight g_preflight;   /* 每一列 result.csv 後面都接這份 */
+static bool g_perf = true;
+static uint32_t g_perf_mask = PERF_CTR_ALL;     // 每個 reactor 都開得起來的 counter
+static struct worker *g_core_owner[MAX_CORES];
+static int g_jobs_done;
+static int g_rc;
+
+/* ---------------- latency histogram (bucket 在 spdk_bench_util.h) ---------------- */
+static double
+lat_percentile_us(const struct lat_stats *s, double p)
+{
+    return lat_hist_percentile_us(s->hist, s->ios, s->lat_max_ns, p);
+}
+
+static void
+lat_merge(struct lat_stats *dst, const struct lat_stats *src)
+{
+    dst->ios += src->ios;
+    dst->bytes += src->bytes;
+    dst->errors += src->errors;
+    dst->lat_sum_ns += src->lat_sum_ns;
+    if (src->lat_max_ns > dst->lat_max_ns) {
+        dst->lat_max_ns = src->lat_max_ns;
+    }
+    for (uint32_t b = 0; b < LAT_BUCKETS; b++) {
+        dst->hist[b] += src->hist[b];
+    }
+    for (int c = 0; c < PERF_CTR_NUM; c++) {
+        dst->perf[c] += src->perf[c];
+    }
+}
+
+/* ---------------- worker (跑在自己的 SPDK thread 上) ---------------- */
+static void job_switched(void *arg);
+static void job_precond_done(void *arg);
+static void worker_exited(void *arg);
+static void worker_fill(struct worker *w);
+static void worker_check_filled(struct worker *w);
+
+static void
+worker_fini(struct worker *w)
+{
+    spdk_poller_unregister(&w->poller);
+    for (uint32_t i = 0; w->tasks && i < w->job->max_qd; i++) {
+        spdk_dma_account_free(w->tasks[i].buf);
+    }
+    free(w->tasks);
+    free(w->free_tasks);
+    if (w->ctr_owner) {
+        spdk_perf_ctr_close(&w->ctr);
+    }
+    if (w->ch) {
+        spdk_put_io_channel(w->ch);
+    }
+    spdk_thread_send_msg(spdk_thread_get_app_thread(), worker_exited, w->job);
+    /* 同一條 thread 上的 worker 都結束了才 exit；th_refs 只在這條 thread 上改 */
+    if (--(w->host ? w->host : w)->th_refs == 0) {
+        spdk_thread_exit(w->th);
+    }
+}
+
+static void
+io_done(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct job_task *task = cb_arg;
+    struct worker *w = task->w;
+    uint64_t ns = (spdk_get_ticks() - task->submit_tsc) * SPDK_SEC_TO_NSEC / spdk_get_ticks_hz();
+
+    spdk_bdev_free_io(bdev_io);
+    w->outstanding--;
+    w->free_tasks[w->nfree++] = task;
+
+    w->cur.ios++;
+    w->cur.bytes += task->bytes;
+    w->cur.lat_sum_ns += ns;
+    if (ns > w->cur.lat_max_ns) {
+        w->cur.lat_max_ns = ns;
+    }
+    w->cur.hist[lat_bucket(ns)]++;
+    if (!success) {
+        w->cur.errors++;
+    }
+
+    if (w->stopping) {
+        if (w->outstanding == 0) {
+            worker_fini(w);
+        }
+        return;
+    }
+    worker_fill(w);
+    worker_check_filled(w);
+}
+
+static uint64_t
+worker_next_block(struct worker *w, uint64_t io_blocks)
+{
+    uint64_t slots = w->region_blocks / io_blocks;
+    uint64_t off;
+
+    if (slots == 0) {
+        return w->region_start;
+    }
+    if (w->rw == RW_READ || w->rw == RW_WRITE) {
+        off = w->seq_off;
+        w->seq_off += io_blocks;
+        if (w->seq_off + io_blocks > slots * io_blocks) {
+            w->seq_off = 0;
+        }
+    } else {
+        off = (xorshift64(&w->rng) % slots) * io_blocks;
+    }
+    return w->region_start + off;
+}
+
+static int
+worker_submit_one(struct worker *w)
+{
+    struct job *job = w->job;
+    struct job_task *task = w->free_tasks[w->nfree - 1];
+    uint64_t io_blocks = w->bs / job->block_size;
+    uint64_t blk = worker_next_block(w, io_blocks);
+    int rc;
+
+    switch (w->rw) {
+    case RW_READ:
+    case RW_RANDREAD:
+        task->is_read = true;
+        break;
+    case RW_WRITE:
+    case RW_RANDWRITE:
+        task->is_read = false;
+        break;
+    default:
+        task->is_read = (int)(xorshift64(&w->rng) % 100) < job->rwmixread;
+        break;
+    }
+
+    task->bytes = (uint32_t)(io_blocks * job->block_size);
+    task->submit_tsc = spdk_get_ticks();
+    if (task->is_read) {
+        rc = spdk_bdev_read_blocks(job->desc, w->ch, task->buf, blk, io_blocks, io_done, task);
+    } else {
+        rc = spdk_bdev_write_blocks(job->desc, w->ch, task->buf, blk, io_blocks, io_done, task);
+    }
+    if (rc != 0) {
+        /* -ENOMEM：bdev_io pool 用完，等下一次 completion 或 poller 再補 */
+        if (rc != -ENOMEM) {
+            fprintf(stderr, "[%s] submit rc=%d\n", w->name, rc);
+            w->cur.errors++;
+        }
+        return rc;
+    }
+    w->nfree--;
+    w->outstanding++;
+    return 0;
+}
+
+static void
+worker_fill(struct worker *w)
+{
+    while (!w->stopping && w->outstanding < w->qd && w->nfree > 0) {
+        if (w->filling) {
+            /* precondition 不限速，送完指定的量就停 */
+            if (w->fill_left == 0) {
+                break;
+            }
+        } else if (w->rate_per_tick > 0) {
+            if (w->tokens < 1.0) {
+                break;
+            }
+            w->tokens -= 1.0;
+        }
+        if (worker_submit_one(w) != 0) {
+            break;
+        }
+        if (w->filling) {
+            w->fill_left--;
+        }
+    }
+}
+
+/* precondition 的 IO 都送完也都回來了：通知 app thread，之後等 phase 切換 */
+static void
+worker_check_filled(struct worker *w)
+{
+    if (w->filling && w->fill_left == 0 && w->outstanding == 0) {
+        w->filling = false;
+        spdk_thread_send_msg(spdk_thread_get_app_thread(), job_precond_done, w->job);
+    }
+}
+
+/* 補 rate limit 的 token，也順便把 -ENOMEM 之後停下來的 queue 補滿 */
+static int
+worker_poll(void *arg)
+{
+    struct worker *w = arg;
+    uint64_t now = spdk_get_ticks();
+    uint32_t before = w->outstanding;
+
+    if (w->rate_per_tick > 0) {
+        w->tokens += (now - w->last_refill_tsc) * w->rate_per_tick;
+        /* 最多累積一個 qd 的量，避免閒置後一次爆發 */
+        if (w->tokens > w->qd) {
+            w->tokens = w->qd;
+        }
+    }
+    w->last_refill_tsc = now;
+    worker_fill(w);
+    return w->outstanding != before ? SPDK_POLLER_BUSY : SPDK_POLLER_IDLE;
+}
+
+static void
+worker_init(void *arg)
+{
+    struct worker *w = arg;
+    struct job *job = w->job;
+
+    w->ch = spdk_bdev_get_io_channel(job->desc);
+    w->tasks = calloc(job->max_qd, sizeof(*w->tasks));
+    w->free_tasks = calloc(job->max_qd, sizeof(*w->free_tasks));
+    if (!w->ch || !w->tasks || !w->free_tasks) {
+        goto err;
+    }
+    for (uint32_t i = 0; i < job->max_qd; i++) {
+        w->tasks[i].w = w;
+        w->tasks[i].buf = spdk_dma_account_zmalloc(DMA_ACCT_IO_BUF, job->max_bs, 0x1000, SPDK_ENV_SOCKET_ID_ANY);
+        if (!w->tasks[i].buf) {
+            goto err;
+        }
+        w->free_tasks[w->nfree++] = &w->tasks[i];
+    }
+    if (w->ctr_owner) {
+        __atomic_fetch_and(&g_perf_mask, spdk_perf_ctr_open(&w->ctr), __ATOMIC_RELAXED);
+        spdk_perf_ctr_read(&w->ctr, w->ctr_prev);
+    }
+    w->last_refill_tsc = spdk_get_ticks();
+    w->poller = SPDK_POLLER_REGISTER(worker_poll, w, RATE_POLL_US);
+    spdk_thread_send_msg(spdk_thread_get_app_thread(), job_switched, job);
+    return;
+
+err:
+    /* 不送 IO；job_switched 看到 g_rc 直接跳到結尾，worker_switch -> worker_fini 收掉已經配到的 */
+    fprintf(stderr, "[%s] init failed (io_channel / task / %u-byte buffer)\n", w->name, job->max_bs);
+    g_rc = -1;
+    w->nfree = 0;
+    w->ctr_owner = false;
+    spdk_thread_send_msg(spdk_thread_get_app_thread(), job_switched, job);
+}
+
+/* phase 切換：把上一段的統計交出去，換上新 phase 的 qd/bs；沒有下一段就開始收尾 */
+static void
+worker_switch(void *arg)
+{
+    struct worker *w = arg;
+    struct job *job = w->job;
+    struct phase *ph = job->cur_phase < job->nphases ? &job->phases[job->cur_phase] : NULL;
+
+    w->snap = w->cur;
+    memset(&w->cur, 0, sizeof(w->cur));
+    if (w->ctr_owner) {
+        uint64_t now[PERF_CTR_NUM];
+
+        spdk_perf_ctr_read(&w->ctr, now);
+        for (int c = 0; c < PERF_CTR_NUM; c++) {
+            w->snap.perf[c] = now[c] - w->ctr_prev[c];
+            w->ctr_prev[c] = now[c];
+        }
+    }
+
+    if (ph) {
+        w->qd = ph->qd;
+        w->bs = ph->bs;
+        w->rw = ph->rw;
+        w->filling = ph->kind == PH_PRECOND;
+        if (w->filling) {
+            w->seq_off = 0;
+            w->fill_left = job->precond_loops * (w->region_blocks / (ph->bs / job->block_size));
+        }
+        if (job->rate_iops) {
+            w->rate_per_tick = (double)job->rate_iops / job->nworkers / spdk_get_ticks_hz();
+        }
+        spdk_thread_send_msg(spdk_thread_get_app_thread(), job_switched, job);
+        worker_fill(w);
+        worker_check_filled(w);
+        return;
+    }
+
+    w->stopping = true;
+    spdk_thread_send_msg(spdk_thread_get_app_thread(), job_switched, job);
+    if (w->outstanding == 0) {
+        worker_fini(w);
+    }
+}
+
+/* ---------------- job 控制 (app thread) ---------------- */
+static void
+job_merge_snaps(struct job *job, struct lat_stats *sum)
+{
+    memset(sum, 0, sizeof(*sum));
+    for (int i = 0; i < job->nworkers; i++) {
+        lat_merge(sum, &job->workers[i].snap);
+    }
+}
+
+static void
+job_sweep_label(const struct job *job, const struct phase *ph, char *buf, size_t len)
+{
+    buf[0] = '\0';
+    if (ph->sweep_idx >= 0) {
+        snprintf(buf, len, "%s=%u", job->sweep_key, job->sweep_vals[ph->sweep_idx]);
+    }
+}
+
+/* name：CSV 的 phase 欄，一般就是 ph->name；steady state 合併的列是 "steady" / "unsteady" */
+static void
+job_write_row(struct job *job, const char *name, const struct phase *ph, double sec, const struct lat_stats *sum)
+{
+    double iops, avg_us;
+    char sweep[32], perf[128];
+    uint32_t perf_mask = g_perf && !job->perf_shared ? g_perf_mask : 0;
+
+    iops = sum->ios / sec;
+    avg_us = sum->ios ? sum->lat_sum_ns / 1000.0 / sum->ios : 0;
+    job_sweep_label(job, ph, sweep, sizeof(sweep));
+    spdk_perf_ctr_format(perf, sizeof(perf), sum->perf, sum->ios, perf_mask);
+
+    printf("[%-10s] %-6s %-12s qd=%-3u bs=%-6u %10.0f IOPS %8.1f MiB/s  avg %8.1f  p50 %8.1f  p99 %8.1f  "
+           "p999 %8.1f  max %8.1f us  err %lu%s\n",
+           job->name, name, sweep, ph->qd, ph->bs, iops, sum->bytes / sec / (1024 * 1024), avg_us,
+           lat_percentile_us(sum, 50), lat_percentile_us(sum, 99), lat_percentile_us(sum, 99.9),
+           sum->lat_max_ns / 1000.0, sum->errors, perf);
+
+    if (g_csv) {
+        fprintf(g_csv, "%s,%s,%s,%s,%s,%d,%d,%u,%u,%.3f,%.0f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%lu",
+                job->name, name, sweep, job->bdev_name, g_rw_name[job->rw], job->ncores, job->nworkers,
+                ph->qd, ph->bs, sec, iops, sum->bytes / sec / (1024 * 1024), avg_us,
+                lat_percentile_us(sum, 50), lat_percentile_us(sum, 99), lat_percentile_us(sum, 99.9),
+                sum->lat_max_ns / 1000.0, sum->errors);
+        spdk_perf_ctr_csv_row(g_csv, sum->perf, sum->ios, perf_mask);
+        spdk_bench_preflight_csv_row(g_csv, &g_preflight);
+        fprintf(g_csv, "\n");
+        fflush(g_csv);
+    }
+}
+
+/* precondition 和每一輪 round 的紀錄；round < 0 表示 precondition，win_* < 0 表示 window 還沒滿 */
+static void
+job_write_ss_row(struct job *job, const struct phase *ph, int round, double sec, const struct lat_stats *sum,
+                 double val, double win_avg, double exc_pct, double slope_pct, bool steady)
+{
+    char sweep[32];
+
+    if (!g_ss_csv) {
+        return;
+    }
+    job_sweep_label(job, ph, sweep, sizeof(sweep));
+    fprintf(g_ss_csv, "%s,%s,%s,%d,%u,%u,%.3f,%.0f,%.2f,%.2f,%.2f,%s,%.3f,%.3f,%.2f,%.2f,%d\n",
+            job->name, sweep, ph->name, round, ph->qd, ph->bs, sec, sum->ios / sec,
+            sum->bytes / sec / (1024 * 1024), sum->ios ? sum->lat_sum_ns / 1000.0 / sum->ios : 0,
+            lat_percentile_us(sum, 99), g_ss_metric_name[job->ss_metric], val, win_avg, exc_pct, slope_pct,
+            steady);
+    fflush(g_ss_csv);
+}
+
+static double
+job_ss_value(const struct job *job, const struct lat_stats *sum, double sec)
+{
+    switch (job->ss_metric) {
+    case SS_MIBPS:
+        return sum->bytes / sec / (1024 * 1024);
+    case SS_AVG_US:
+        return sum->ios ? sum->lat_sum_ns / 1000.0 / sum->ios : 0;
+    case SS_P99_US:
+        return lat_percentile_us(sum, 99);
+    default:
+        return sum->ios / sec;
+    }
+}
+
+/*
+ * 一輪 round 結束：放進 window，window 滿了就用 SNIA PTS 的兩個條件判斷 steady state
+ *   excursion：window 內 max - min <= ss_excursion% x 平均
+ *   slope    ：最小平方法直線在 window 兩端的差 |slope| x (W - 1) <= ss_slope% x 平均
+ * 收斂或到 max_rounds 時把 window 合起來寫一列，回傳 true 表示這個 sweep 點結束
+ */
+static bool
+job_round_done(struct job *job, const struct phase *ph, double sec)
+{
+    static struct lat_stats sum;
+    uint32_t w = job->ss_window, idx = job->ss_rounds % w;
+    double val, avg = -1, exc_pct = -1, slope_pct = -1, total_sec = 0;
+    bool steady = false;
+
+    job_merge_snaps(job, &job->ss_win[idx]);
+    job->ss_sec[idx] = sec;
+    val = job->ss_val[idx] = job_ss_value(job, &job->ss_win[idx], sec);
+    job->ss_rounds++;
+
+    if (job->ss_rounds >= w) {
+        double lo = val, hi = val, sx = 0, sy = 0, sxy = 0, sxx = 0, slope;
+
+        /* x = 0 .. W-1 依時間順序 */
+        for (uint32_t i = 0; i < w; i++) {
+            double y = job->ss_val[(job->ss_rounds - w + i) % w];
+
+            lo = spdk_min(lo, y);
+            hi = spdk_max(hi, y);
+            sx += i;
+            sy += y;
+            sxy += i * y;
+            sxx += (double)i * i;
+        }
+        avg = sy / w;
+        slope = (w * sxy - sx * sy) / (w * sxx - sx * sx);
+        if (avg > 0) {
+            exc_pct = (hi - lo) / avg * 100;
+            slope_pct = fabs(slope) * (w - 1) / avg * 100;
+            steady = exc_pct <= job->ss_excursion && slope_pct <= job->ss_slope;
+        }
+    }
+    job_write_ss_row(job, ph, (int)job->ss_rounds, sec, &job->ss_win[idx], val, avg, exc_pct, slope_pct, steady);
+    printf("[%-10s] round %-3u %s %.1f", job->name, job->ss_rounds, g_ss_metric_name[job->ss_metric], val);
+    if (avg >= 0) {
+        printf("  window avg %.1f excursion %.1f%% slope %.1f%%%s", avg, exc_pct, slope_pct,
+               steady ? "  -> steady state" : "");
+    }
+    printf("\n");
+
+    if (!steady && job->ss_rounds < job->max_rounds) {
+        return false;
+    }
+    if (!steady) {
+        printf("[%-10s] no steady state after %u rounds, reporting the last %u as unsteady\n",
+               job->name, job->ss_rounds, w);
+    }
+    memset(&sum, 0, sizeof(sum));
+    for (uint32_t i = 0; i < w; i++) {
+        lat_merge(&sum, &job->ss_win[i]);
+        total_sec += job->ss_sec[i];
+    }
+    job_write_row(job, steady ? "steady" : "unsteady", ph, total_sec, &sum);
+    job->ss_rounds = 0;
+    return true;
+}
+
+static void job_switch(struct job *job);
+
+/* 結算目前的 phase；round 先照原樣再跑一輪，收斂了 job_switched 再往下走 */
+static void
+job_advance(struct job *job)
+{
+    job->ended = job->cur_phase;
+    if (job->phases[job->cur_phase].kind != PH_ROUND) {
+        job->cur_phase++;
+    }
+    job_switch(job);
+}
+
+static int
+job_timer(void *arg)
+{
+    struct job *job = arg;
+
+    spdk_poller_unregister(&job->timer);
+    job_advance(job);
+    return SPDK_POLLER_BUSY;
+}
+
+static int
+job_precond_tick(void *arg)
+{
+    struct job *job = arg;
+    uint64_t left = 0, done;
+    double sec = (double)(spdk_get_ticks() - job->phase_tsc) / spdk_get_ticks_hz();
+    const struct phase *ph = &job->phases[job->cur_phase];
+
+    /* 別的 thread 在改 fill_left，這裡只是印進度 */
+    for (int i = 0; i < job->nworkers; i++) {
+        left += *(volatile uint64_t *)&job->workers[i].fill_left;
+    }
+    done = job->fill_total - spdk_min(left, job->fill_total);
+    printf("[%-10s] precondition %5.1f%%  %.1f GiB in %.0f s (%.1f MiB/s)\n", job->name,
+           job->fill_total ? done * 100.0 / job->fill_total : 100.0,
+           (double)done * ph->bs / (1 << 30), sec, sec > 0 ? done * ph->bs / sec / (1024 * 1024) : 0);
+    return SPDK_POLLER_BUSY;
+}
+
+static void
+job_precond_done(void *arg)
+{
+    struct job *job = arg;
+
+    /* 切換還沒完成時由 job_switched 接手 */
+    if (--job->fill_pending > 0 || job->pending > 0) {
+        return;
+    }
+    spdk_poller_unregister(&job->timer);
+    job_advance(job);
+}
+
+static void
+job_switch(struct job *job)
+{
+    if (job->cur_phase >= 0 && job->cur_phase < job->nphases && job->phases[job->cur_phase].kind == PH_PRECOND) {
+        job->fill_pending = job->nworkers;
+    }
+    job->pending = job->nworkers;
+    for (int i = 0; i < job->nworkers; i++) {
+        spdk_thread_send_msg(job->workers[i].th, worker_switch, &job->workers[i]);
+    }
+}
+
+/* 所有 worker 都回覆後：結算上一段 (job->ended)，開始計時下一段 */
+static void
+job_switched(void *arg)
+{
+    static struct lat_stats sum;
+    struct job *job = arg;
+    uint64_t now = spdk_get_ticks();
+    double sec = (double)(now - job->phase_tsc) / spdk_get_ticks_hz();
+    int ended = job->ended;
+    const struct phase *ph;
+
+    if (--job->pending > 0) {
+        return;
+    }
+    if (job->cur_phase < 0) {
+        /* worker_init 全部完成 */
+        if (g_rc != 0) {
+            job->cur_phase = job->nphases;
+        } else {
+            job->cur_phase = 0;
+        }
+        job_switch(job);
+        return;
+    }
+
+    job->ended = -1;
+    if (ended >= 0 && g_rc == 0) {
+        ph = &job->phases[ended];
+        if (ph->kind == PH_ROUND) {
+            if (job_round_done(job, ph, sec)) {
+                /* 已經多跑的那一小段不結算 */
+                job->cur_phase = ended + 1;
+                job_switch(job);
+                return;
+            }
+        } else {
+            job_merge_snaps(job, &sum);
+            if (ph->kind == PH_PRECOND) {
+                printf("[%-10s] precondition %s x%u done: %.1f GiB in %.1f s (%.1f MiB/s), err %lu\n",
+                       job->name, g_precond_name[job->precond], job->precond_loops,
+                       (double)sum.bytes / (1 << 30), sec, sum.bytes / sec / (1024 * 1024), sum.errors);
+                job_write_ss_row(job, ph, -1, sec, &sum, 0, -1, -1, -1, false);
+            } else {
+                job_write_row(job, ph->name, ph, sec, &sum);
+            }
+        }
+    }
+
+    job->phase_tsc = now;
+    if (job->cur_phase >= job->nphases) {
+        return;
+    }
+    ph = &job->phases[job->cur_phase];
+    if (ph->kind == PH_PRECOND) {
+        if (job->fill_pending == 0) {
+            job_advance(job);
+            return;
+        }
+        job->timer = SPDK_POLLER_REGISTER(job_precond_tick, job, PRECOND_PROGRESS_US);
+    } else {
+        job->timer = SPDK_POLLER_REGISTER(job_timer, job, ph->sec * 1000000ULL);
+    }
+}
+
+static void
+worker_exited(void *arg)
+{
+    struct job *job = arg;
+
+    if (++job->exited < job->nworkers) {
+        return;
+    }
+    spdk_bdev_close(job->desc);
+    printf("[%-10s] done\n", job->name);
+    if (++g_jobs_done == g_njobs) {
+        spdk_dma_account_print("spdk_job_engine");
+        spdk_app_stop(g_rc);
+    }
+}
+
+/* 每個 core 的第一個 worker 負責 perf counter；core 被別的 job 先拿走時兩邊都標成分不開 */
+static void
+job_claim_cores(struct job *job)
+{
+    for (int i = 0; g_perf && i < job->nworkers; i++) {
+        struct worker *w = &job->workers[i];
+        struct worker *owner = g_core_owner[w->core];
+
+        if (owner == NULL) {
+            g_core_owner[w->core] = w;
+            w->ctr_owner = true;
+        } else if (owner->job != job && !job->perf_shared) {
+            printf("[%-10s] core %d shared with [%s], perf counter columns left empty for both\n",
+                   job->name, w->core, owner->job->name);
+            job->perf_shared = true;
+            owner->job->perf_shared = true;
+        }
+    }
+}
+
+/* 寄住在 host job 的 thread 上：一個 host worker 配一個 */
+static void
+job_setup_colocated(struct job *job, uint64_t start_blk, uint64_t region_blks)
+{
+    struct job *host = job->host;
+    uint64_t per_worker = region_blks / host->nworkers;
+
+    for (int n = 0; n < host->nworkers; n++) {
+        struct worker *w = &job->workers[n];
+
+        w->job = job;
+        w->host = &host->workers[n];
+        w->host->th_refs++;
+        w->core = w->host->core;
+        w->th = w->host->th;
+        w->region_start = start_blk + per_worker * n;
+        w->region_blocks = per_worker;
+        w->rng = 0x9E3779B97F4A7C15ULL ^ ((uint64_t)(job - g_jobs) << 32) ^ (uint64_t)(n + 1);
+        snprintf(w->name, sizeof(w->name), "%s@%s", job->name, w->host->name);
+    }
+    job->nworkers = host->nworkers;
+}
+
+/* 建 worker 和 thread；worker_init 等全部 job 都建好才送，th_refs 才不會和 worker thread 搶 */
+static void
+job_setup(struct job *job)
+{
+    struct spdk_cpuset cpumask;
+    uint64_t start_blk, region_blks, per_worker;
+    int n = 0;
+
+    start_blk = job->offset / job->block_size;
+    region_blks = job->size ? job->size / job->block_size : job->num_blocks - start_blk;
+    job->cur_phase = -1;
+    job->ended = -1;
+    if (job->host) {
+        job_setup_colocated(job, start_blk, region_blks);
+        job->pending = job->nworkers;
+        job_claim_cores(job);
+        return;
+    }
+    per_worker = region_blks / (job->ncores * job->threads_per_core);
+
+    for (int c = 0; c < job->ncores; c++) {
+        for (int t = 0; t < job->threads_per_core; t++, n++) {
+            struct worker *w = &job->workers[n];
+
+            w->job = job;
+            w->core = job->cores[c];
+            w->region_start = start_blk + per_worker * n;
+            w->region_blocks = per_worker;
+            w->rng = 0x9E3779B97F4A7C15ULL ^ ((uint64_t)(job - g_jobs) << 32) ^ (uint64_t)(n + 1);
+            snprintf(w->name, sizeof(w->name), "%s.c%d.t%d", job->name, w->core, t);
+            spdk_cpuset_zero(&cpumask);
+            spdk_cpuset_set_cpu(&cpumask, w->core, true);
+            w->th = spdk_thread_create(w->name, &cpumask);
+            w->th_refs = 1;
+        }
+    }
+    job->nworkers = n;
+    job->pending = n;
+    job_claim_cores(job);
+}
+
+static void
+job_start(struct job *job)
+{
+    uint64_t io_blocks = job->precond_bs / job->block_size;
+
+    job->fill_total = 0;
+    for (int i = 0; job->precond != PRECOND_NONE && i < job->nworkers; i++) {
+        job->fill_total += job->precond_loops * (job->workers[i].region_blocks / io_blocks);
+    }
+    for (int i = 0; i < job->nworkers; i++) {
+        spdk_thread_send_msg(job->workers[i].th, worker_init, &job->workers[i]);
+    }
+}
+
+static void
+job_bdev_event_cb(enum spdk_bdev_event_type type, struct spdk_bdev *bdev, void *event_ctx)
+{
+    struct job *job = event_ctx;
+
+    switch (type) {
+    case SPDK_BDEV_EVENT_REMOVE:
+        /* desc 還被 worker 用著，來不及一個個收，直接結束 */
+        fprintf(stderr, "[%s] bdev %s removed, stopping\n", job->name, spdk_bdev_get_name(bdev));
+        g_rc = -1;
+        spdk_app_stop(-1);
+        break;
+    default:
+        printf("[%-10s] bdev %s event %d ignored\n", job->name, spdk_bdev_get_name(bdev), type);
+        break;
+    }
+}
+
+static void
+app_start(void *arg)
+{
+    int ndev = 0;
+
+    (void)arg;
+    for (int j = 0; j < g_njobs; j++) {
+        int k = 0;
+
+        while (k < j && strcmp(g_jobs[k].bdev_name, g_jobs[j].bdev_name) != 0) {
+            k++;
+        }
+        ndev += (k == j);
+    }
+    spdk_dma_account_note_iobuf();
+    spdk_dma_account_set_devices(ndev);
+
+    for (int j = 0; j < g_njobs; j++) {
+        struct job *job = &g_jobs[j];
+        struct spdk_bdev *bdev;
+        int rc = spdk_bdev_open_ext(job->bdev_name, true, job_bdev_event_cb, job, &job->desc);
+
+        if (rc != 0) {
+            fprintf(stderr, "[%s] open bdev %s failed rc=%d\n", job->name, job->bdev_name, rc);
+            spdk_app_stop(-1);
+            return;
+        }
+        bdev = spdk_bdev_desc_get_bdev(job->desc);
+        job->block_size = spdk_bdev_get_block_size(bdev);
+        job->num_blocks = spdk_bdev_get_num_blocks(bdev);
+        /* 每個 phase 的 bs 都要檢查 (precond_bs、bs sweep 的每個點)，不然 io_blocks 會是 0 或截掉尾巴 */
+        for (int p = 0; p < job->nphases; p++) {
+            if (job->phases[p].bs == 0 || job->phases[p].bs % job->block_size) {
+                fprintf(stderr, "[%s] %s bs %u must be a non-zero multiple of block size %u\n",
+                        job->name, job->phases[p].name, job->phases[p].bs, job->block_size);
+                spdk_app_stop(-1);
+                return;
+            }
+        }
+        if (job->offset % job->block_size || job->size % job->block_size ||
+            job->offset / job->block_size >= job->num_blocks ||
+            job->size / job->block_size > job->num_blocks - job->offset / job->block_size) {
+            fprintf(stderr, "[%s] offset/size must be multiples of block size %u and inside the bdev (%lu blocks)\n",
+                    job->name, job->block_size, job->num_blocks);
+            spdk_app_stop(-1);
+            return;
+        }
+    }
+    for (int j = 0; j < g_njobs; j++) {
+        job_setup(&g_jobs[j]);
+    }
+    for (int j = 0; j < g_njobs; j++) {
+        job_start(&g_jobs[j]);
+    }
+}
+
+/* ---------------- job file ---------------- */
+static int
+parse_cores(const char *s, int *cores, int *ncores)
+{
+    *ncores = 0;
+    while (*s) {
+        char *end;
+        long a = strtol(s, &end, 10), b = a;
+
+        if (end == s) {
+            return -1;
+        }
+        if (*end == '-') {
+            b = strtol(end + 1, &end, 10);
+        }
+        for (long c = a; c <= b; c++) {
+            if (*ncores >= MAX_CORES || c >= MAX_CORES) {
+                return -1;
+            }
+            cores[(*ncores)++] = (int)c;
+        }
+        s = end;
+        while (*s == ',' || *s == ' ') {
+            s++;
+        }
+    }
+    return *ncores > 0 ? 0 : -1;
+}
+
+static int
+job_set(struct job *job, const char *key, const char *val)
+{
+    if (!strcmp(key, "bdev")) {
+        snprintf(job->bdev_name, sizeof(job->bdev_name), "%s", val);
+    } else if (!strcmp(key, "cores")) {
+        return parse_cores(val, job->cores, &job->ncores);
+    } else if (!strcmp(key, "threads_per_core")) {
+        job->threads_per_core = atoi(val);
+    } else if (!strcmp(key, "colocate")) {
+        snprintf(job->colocate, sizeof(job->colocate), "%s", val);
+    } else if (!strcmp(key, "share_cores")) {
+        job->share_cores = atoi(val) != 0;
+    } else if (!strcmp(key, "rw")) {
+        for (size_t i = 0; i < SPDK_COUNTOF(g_rw_name); i++) {
+            if (!strcmp(val, g_rw_name[i])) {
+                job->rw = (enum rw_mode)i;
+                return 0;
+            }
+        }
+        return -1;
+    } else if (!strcmp(key, "rwmixread")) {
+        job->rwmixread = atoi(val);
+    } else if (!strcmp(key, "bs")) {
+        job->bs = (uint32_t)strtoul(val, NULL, 0);
+    } else if (!strcmp(key, "qd")) {
+        job->qd = (uint32_t)strtoul(val, NULL, 0);
+    } else if (!strcmp(key, "rate_iops")) {
+        job->rate_iops = strtoull(val, NULL, 0);
+    } else if (!strcmp(key, "offset")) {
+        job->offset = strtoull(val, NULL, 0);
+    } else if (!strcmp(key, "size")) {
+        job->size = strtoull(val, NULL, 0);
+    } else if (!strcmp(key, "ramp")) {
+        job->ramp_sec = (uint32_t)atoi(val);
+    } else if (!strcmp(key, "runtime")) {
+        job->runtime_sec = (uint32_t)atoi(val);
+    } else if (!strcmp(key, "precondition")) {
+        for (size_t i = 0; i < SPDK_COUNTOF(g_precond_name); i++) {
+            if (!strcmp(val, g_precond_name[i])) {
+                job->precond = (enum precond_mode)i;
+                return 0;
+            }
+        }
+        return -1;
+    } else if (!strcmp(key, "precondition_loops")) {
+        job->precond_loops = (uint32_t)atoi(val);
+    } else if (!strcmp(key, "precondition_bs")) {
+        job->precond_bs = (uint32_t)strtoul(val, NULL, 0);
+    } else if (!strcmp(key, "precondition_qd")) {
+        job->precond_qd = (uint32_t)strtoul(val, NULL, 0);
+    } else if (!strcmp(key, "steady_state")) {
+        job->steady_state = atoi(val) != 0;
+    } else if (!strcmp(key, "round_sec")) {
+        job->round_sec = (uint32_t)atoi(val);
+    } else if (!strcmp(key, "max_rounds")) {
+        job->max_rounds = (uint32_t)atoi(val);
+    } else if (!strcmp(key, "ss_window")) {
+        job->ss_window = (uint32_t)atoi(val);
+    } else if (!strcmp(key, "ss_excursion")) {
+        job->ss_excursion = atof(val);
+    } else if (!strcmp(key, "ss_slope")) {
+        job->ss_slope = atof(val);
+    } else if (!strcmp(key, "ss_metric")) {
+        for (size_t i = 0; i < SPDK_COUNTOF(g_ss_metric_name); i++) {
+            if (!strcmp(val, g_ss_metric_name[i])) {
+                job->ss_metric = (enum ss_metric)i;
+                return 0;
+            }
+        }
+        return -1;
+    } else if (!strcmp(key, "sweep")) {
+        const char *colon = strchr(val, ':');
+        const char *p;
+
+        if (!colon || colon - val >= (long)sizeof(job->sweep_key)) {
+            return -1;
+        }
+        snprintf(job->sweep_key, sizeof(job->sweep_key), "%.*s", (int)(colon - val), val);
+        if (strcmp(job->sweep_key, "qd") && strcmp(job->sweep_key, "bs")) {
+            return -1;
+        }
+        job->nsweep = 0;
+        for (p = colon + 1; *p && job->nsweep < MAX_SWEEP;) {
+            char *end;
+
+            job->sweep_vals[job->nsweep++] = (uint32_t)strtoul(p, &end, 0);
+            p = end;
+            while (*p == ',' || *p == ' ') {
+                p++;
+            }
+        }
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static void
+job_defaults(struct job *job)
+{
+    memset(job, 0, sizeof(*job));
+    snprintf(job->bdev_name, sizeof(job->bdev_name), "Nvme0n1");
+    job->cores[0] = 0;
+    job->ncores = 1;
+    job->threads_per_core = 1;
+    job->rw = RW_RANDREAD;
+    job->rwmixread = 70;
+    job->bs = 4096;
+    job->qd = 32;
+    job->ramp_sec = 2;
+    job->runtime_sec = 10;
+    job->precond_loops = 2;
+    job->precond_qd = 32;
+    job->round_sec = 60;
+    job->max_rounds = 25;
+    job->ss_window = 5;
+    job->ss_excursion = 20;
+    job->ss_slope = 10;
+}
+
+/* sweep 展開成 phase 清單：precondition (若有，只在最前面一次)，每個點各一段 ramp (若有) + steady / round */
+static void
+job_build_phases(struct job *job)
+{
+    int points = job->nsweep ? job->nsweep : 1;
+
+    job->nphases = 0;
+    job->max_qd = job->qd;
+    job->max_bs = job->bs;
+    if (job->precond != PRECOND_NONE) {
+        struct phase ph = {
+            .name = "precondition", .kind = PH_PRECOND, .qd = job->precond_qd, .sweep_idx = -1,
+            .rw = job->precond == PRECOND_SEQ ? RW_WRITE : RW_RANDWRITE,
+        };
+
+        if (!job->precond_bs) {
+            job->precond_bs = job->precond == PRECOND_SEQ ? 131072 : 4096;
+        }
+        ph.bs = job->precond_bs;
+        job->max_qd = spdk_max(job->max_qd, ph.qd);
+        job->max_bs = spdk_max(job->max_bs, ph.bs);
+        job->phases[job->nphases++] = ph;
+    }
+    for (int i = 0; i < points; i++) {
+        struct phase ph = { .rw = job->rw, .qd = job->qd, .bs = job->bs, .sweep_idx = job->nsweep ? i : -1 };
+
+        if (job->nsweep && !strcmp(job->sweep_key, "qd")) {
+            ph.qd = job->sweep_vals[i];
+        } else if (job->nsweep) {
+            ph.bs = job->sweep_vals[i];
+        }
+        job->max_qd = spdk_max(job->max_qd, ph.qd);
+        job->max_bs = spdk_max(job->max_bs, ph.bs);
+        if (job->ramp_sec) {
+            ph.name = "ramp";
+            ph.kind = PH_RAMP;
+            ph.sec = job->ramp_sec;
+            job->phases[job->nphases++] = ph;
+        }
+        if (job->steady_state) {
+            ph.name = "round";
+            ph.kind = PH_ROUND;
+            ph.sec = job->round_sec;
+        } else {
+            ph.name = "steady";
+            ph.kind = PH_STEADY;
+            ph.sec = job->runtime_sec;
+        }
+        job->phases[job->nphases++] = ph;
+    }
+}
+
+static char *
+trim(char *s)
+{
+    char *e;
+
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    e = s + strlen(s);
+    while (e > s && isspace((unsigned char)e[-1])) {
+        *--e = '\0';
+    }
+    return s;
+}
+
+/* [global] 的 job key 先存起來，每個 job 開頭套用 */
+static char g_gkeys[64][2][128];
+static int g_ngkeys;
+
+/* [global] 專用的 key 直接設；其他當作 job key 的預設值，先用一個 job 試 parse 確認合法 */
+static int
+global_set(const char *key, const char *val)
+{
+    if (!strcmp(key, "reactor_mask")) {
+        snprintf(g_reactor_mask, sizeof(g_reactor_mask), "%s", val);
+    } else if (!strcmp(key, "json_config")) {
+        snprintf(g_json_config, sizeof(g_json_config), "%s", val);
+    } else if (!strcmp(key, "csv")) {
+        snprintf(g_csv_path, sizeof(g_csv_path), "%s", val);
+    } else if (!strcmp(key, "ss_csv")) {
+        snprintf(g_ss_csv_path, sizeof(g_ss_csv_path), "%s", val);
+    } else if (!strcmp(key, "perf_counters")) {
+        g_perf = atoi(val) != 0;
+    } else if (g_ngkeys < 64) {
+        struct job probe;
+
+        job_defaults(&probe);
+        if (job_set(&probe, key, val) != 0) {
+            return -1;
+        }
+        snprintf(g_gkeys[g_ngkeys][0], sizeof(g_gkeys[0][0]), "%s", key);
+        snprintf(g_gkeys[g_ngkeys][1], sizeof(g_gkeys[0][1]), "%s", val);
+        g_ngkeys++;
+    }
+    return 0;
+}
+
+static struct job *
+job_new(const char *path, const char *name)
+{
+    struct job *job;
+
+    if (g_njobs >= MAX_JOBS) {
+        fprintf(stderr, "%s: too many jobs (max %d)\n", path, MAX_JOBS);
+        return NULL;
+    }
+    job = &g_jobs[g_njobs++];
+    job_defaults(job);
+    snprintf(job->name, sizeof(job->name), "%s", name);
+    for (int i = 0; i < g_ngkeys; i++) {
+        job_set(job, g_gkeys[i][0], g_gkeys[i][1]);
+    }
+    return job;
+}
+
+static int
+parse_job_ini(const char *path)
+{
+    char line[512];
+    struct job *job = NULL;
+    bool in_global = false;
+    int lineno = 0;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char *s = trim(line), *eq, *key, *val;
+
+        lineno++;
+        if (*s == '\0' || *s == '#' || *s == ';') {
+            continue;
+        }
+        if (*s == '[') {
+            char *end = strchr(s, ']');
+
+            if (!end) {
+                goto bad;
+            }
+            *end = '\0';
+            in_global = !strcmp(s + 1, "global");
+            if (in_global) {
+                continue;
+            }
+            job = job_new(path, s + 1);
+            if (!job) {
+                goto err;
+            }
+            continue;
+        }
+
+        eq = strchr(s, '=');
+        if (!eq) {
+            goto bad;
+        }
+        *eq = '\0';
+        key = trim(s);
+        val = trim(eq + 1);
+        if (in_global) {
+            if (global_set(key, val) != 0) {
+                goto bad;
+            }
+        } else if (!job || job_set(job, key, val) != 0) {
+            goto bad;
+        }
+    }
+    fclose(f);
+    return 0;
+
+bad:
+    fprintf(stderr, "%s:%d: cannot parse '%s'\n", path, lineno, line);
+err:
+    fclose(f);
+    return -1;
+}
+
+/*
+ * JSON 版，key 和 INI 一樣，值可以是字串、數字或 true/false：
+ *   { "global": { "reactor_mask": "0x6", "runtime": 30 },
+ *     "jobs": [ { "name": "randread", "cores": "1", "rw": "randread", "qd": 4 }, ... ] }
+ * global 不論寫在前後都先套用
+ */
+static struct spdk_json_val *
+json_member(struct spdk_json_val *obj, const char *name)
+{
+    for (uint32_t i = 0; i < obj->len; i += 1 + spdk_json_val_len(&obj[i + 2])) {
+        if (spdk_json_strequal(&obj[i + 1], name)) {
+            return &obj[i + 2];
+        }
+    }
+    return NULL;
+}
+
+static int
+json_scalar(const struct spdk_json_val *v, char *buf, size_t len)
+{
+    switch (v->type) {
+    case SPDK_JSON_VAL_STRING:
+    case SPDK_JSON_VAL_NUMBER:
+        snprintf(buf, len, "%.*s", (int)v->len, (const char *)v->start);
+        return 0;
+    case SPDK_JSON_VAL_TRUE:
+    case SPDK_JSON_VAL_FALSE:
+        snprintf(buf, len, "%d", v->type == SPDK_JSON_VAL_TRUE);
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/* job == NULL：global */
+static int
+json_apply(const char *path, struct spdk_json_val *obj, struct job *job)
+{
+    char key[64], val[128];
+
+    for (uint32_t i = 0; i < obj->len; i += 1 + spdk_json_val_len(&obj[i + 2])) {
+        struct spdk_json_val *v = &obj[i + 2];
+
+        snprintf(key, sizeof(key), "%.*s", (int)obj[i + 1].len, (const char *)obj[i + 1].start);
+        if (job && !strcmp(key, "name")) {
+            continue;
+        }
+        if (json_scalar(v, val, sizeof(val)) != 0 || (job ? job_set(job, key, val) : global_set(key, val)) != 0) {
+            fprintf(stderr, "%s: %s: cannot parse \"%s\"\n", path, job ? job->name : "global", key);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+parse_job_json(const char *path)
+{
+    struct spdk_json_val *values = NULL, *global, *jobs, *it;
+    void *end;
+    size_t size;
+    ssize_t n;
+    char *buf = NULL;
+    int rc = -1;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    buf = spdk_posix_file_load(f, &size);
+    fclose(f);
+    if (!buf) {
+        fprintf(stderr, "%s: read failed\n", path);
+        return -1;
+    }
+    n = spdk_json_parse(buf, size, NULL, 0, &end, SPDK_JSON_PARSE_FLAG_ALLOW_COMMENTS);
+    if (n <= 0) {
+        fprintf(stderr, "%s: invalid JSON (rc=%zd)\n", path, n);
+        goto out;
+    }
+    values = calloc(n, sizeof(*values));
+    if (!values) {
+        goto out;
+    }
+    if (spdk_json_parse(buf, size, values, n, &end,
+                        SPDK_JSON_PARSE_FLAG_DECODE_IN_PLACE | SPDK_JSON_PARSE_FLAG_ALLOW_COMMENTS) != n ||
+        values[0].type != SPDK_JSON_VAL_OBJECT_BEGIN) {
+        fprintf(stderr, "%s: top level must be an object\n", path);
+        goto out;
+    }
+
+    global = json_member(values, "global");
+    if (global && (global->type != SPDK_JSON_VAL_OBJECT_BEGIN || json_apply(path, global, NULL) != 0)) {
+        goto out;
+    }
+    jobs = json_member(values, "jobs");
+    if (!jobs || jobs->type != SPDK_JSON_VAL_ARRAY_BEGIN) {
+        fprintf(stderr, "%s: need a \"jobs\" array\n", path);
+        goto out;
+    }
+    for (it = spdk_json_array_first(jobs); it; it = spdk_json_next(it)) {
+        struct spdk_json_val *name = it->type == SPDK_JSON_VAL_OBJECT_BEGIN ? json_member(it, "name") : NULL;
+        struct job *job;
+        char jname[32];
+
+        if (!name || json_scalar(name, jname, sizeof(jname)) != 0) {
+            fprintf(stderr, "%s: job #%d needs a \"name\"\n", path, g_njobs);
+            goto out;
+        }
+        job = job_new(path, jname);
+        if (!job || json_apply(path, it, job) != 0) {
+            goto out;
+        }
+    }
+    rc = 0;
+out:
+    free(values);
+    free(buf);
+    return rc;
+}
+
+static int
+parse_job_file(const char *path)
+{
+    size_t len = strlen(path);
+
+    if (len > 5 && !strcmp(path + len - 5, ".json")) {
+        return parse_job_json(path);
+    }
+    return parse_job_ini(path);
+}
+
+/* 檢查 core 在 reactor mask 內、job 之間不重疊 (除非 share_cores)、參數合理 */
+static int
+validate_jobs(void)
+{
+    struct spdk_cpuset mask;
+    int owner[MAX_CORES];
+
+    if (g_njobs == 0) {
+        fprintf(stderr, "no [job] section\n");
+        return -1;
+    }
+    if (spdk_cpuset_parse(&mask, g_reactor_mask) != 0) {
+        fprintf(stderr, "invalid reactor_mask %s\n", g_reactor_mask);
+        return -1;
+    }
+    for (int c = 0; c < MAX_CORES; c++) {
+        owner[c] = -1;
+    }
+    for (int j = 0; j < g_njobs; j++) {
+        struct job *job = &g_jobs[j];
+
+        if (job->ncores * job->threads_per_core > MAX_WORKERS || job->threads_per_core < 1 || job->qd == 0 ||
+            job->bs == 0 || job->runtime_sec == 0) {
+            fprintf(stderr, "[%s] bad threads/qd/bs/runtime\n", job->name);
+            return -1;
+        }
+        if (job->precond != PRECOND_NONE && (job->precond_loops == 0 || job->precond_qd == 0)) {
+            fprintf(stderr, "[%s] precondition_loops / precondition_qd must be > 0\n", job->name);
+            return -1;
+        }
+        if (job->steady_state && (job->ss_window < 2 || job->ss_window > MAX_SS_WINDOW ||
+                                  job->max_rounds < job->ss_window || job->round_sec == 0)) {
+            fprintf(stderr, "[%s] need 2 <= ss_window <= %d, max_rounds >= ss_window, round_sec > 0\n",
+                    job->name, MAX_SS_WINDOW);
+            return -1;
+        }
+        job_build_phases(job);
+        if (job->colocate[0]) {
+            for (int k = 0; k < j; k++) {
+                if (!strcmp(g_jobs[k].name, job->colocate) && !g_jobs[k].colocate[0]) {
+                    job->host = &g_jobs[k];
+                }
+            }
+            if (!job->host) {
+                fprintf(stderr, "[%s] colocate=%s must name an earlier job that is not colocated itself\n",
+                        job->name, job->colocate);
+                return -1;
+            }
+            continue;
+        }
+        for (int i = 0; i < job->ncores; i++) {
+            int c = job->cores[i];
+
+            if (!spdk_cpuset_get_cpu(&mask, c)) {
+                fprintf(stderr, "[%s] core %d not in reactor_mask %s\n", job->name, c, g_reactor_mask);
+                return -1;
+            }
+            if (owner[c] >= 0 && owner[c] != j && !(job->share_cores && g_jobs[owner[c]].share_cores)) {
+                fprintf(stderr, "[%s] core %d already used by [%s]; set share_cores=1 on both to allow it\n",
+                        job->name, c, g_jobs[owner[c]].name);
+                return -1;
+            }
+            owner[c] = j;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct spdk_app_opts opts;
+    int rc;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <job.ini|job.json> [bdev.json]\n", argv[0]);
+        return -1;
+    }
+    if (parse_job_file(argv[1]) != 0 || validate_jobs() != 0) {
+        return -1;
+    }
+    if (argc > 2) {
+        snprintf(g_json_config, sizeof(g_json_config), "%s", argv[2]);
+    }
+
+    spdk_app_opts_init(&opts, sizeof(opts));
+    opts.name = "spdk_job_engine";
+    opts.reactor_mask = g_reactor_mask;
+    if (spdk_bench_preflight_run(opts.name, opts.reactor_mask, &g_preflight) != 0) {
+        return -1;
+    }
+    if (g_json_config[0]) {
+        opts.json_config_file = g_json_config;
+    }
+
+    g_csv = fopen(g_csv_path, "w");
+    if (!g_csv) {
+        perror(g_csv_path);
+        return -1;
+    }
+    fprintf(g_csv, "job,phase,sweep,bdev,rw,cores,threads,qd,bs,sec,iops,mibps,avg_us,p50_us,p99_us,p999_us,"
+                   "max_us,errors");
+    spdk_perf_ctr_csv_header(g_csv);
+    spdk_bench_preflight_csv_header(g_csv);
+    fprintf(g_csv, "\n");
+    for (int j = 0; j < g_njobs; j++) {
+        if (g_jobs[j].precond != PRECOND_NONE || g_jobs[j].steady_state) {
+            if (!g_ss_csv_path[0]) {
+                size_t len = strlen(g_csv_path);
+
+                if (len > 4 && !strcmp(g_csv_path + len - 4, ".csv")) {
+                    len -= 4;
+                }
+                snprintf(g_ss_csv_path, sizeof(g_ss_csv_path), "%.*s_rounds.csv", (int)len, g_csv_path);
+            }
+            g_ss_csv = fopen(g_ss_csv_path, "w");
+            if (!g_ss_csv) {
+                perror(g_ss_csv_path);
+                return -1;
+            }
+            fprintf(g_ss_csv, "job,sweep,phase,round,qd,bs,sec,iops,mibps,avg_us,p99_us,metric,value,win_avg,"
+                              "win_excursion_pct,win_slope_pct,steady\n");
+            break;
+        }
+    }
+
+    rc = spdk_app_start(&opts, app_start, NULL);
+    if (rc) {
+        fprintf(stderr, "spdk_app_start rc=%d\n", rc);
+    }
+    spdk_app_fini();
+    fclose(g_csv);
+    if (g_ss_csv) {
+        fclose(g_ss_csv);
+    }
+    return rc;
+}
@@ -4,31 +4,179 @@
 #include "spdk/nvme_intel.h"
 #include "spdk/bdev.h"
 #include "spdk/log.h"
+#include "spdk_bench_preflight.h"
+#include "spdk_nvme_attach.h"
 
-static struct spdk_nvme_ctrlr *g_ctrlr = NULL;
+#define MAX_CTRLRS          32
+#define QPAIRS_PER_CTRLR    1
+#define DEFAULT_TRADDR      "0000:5e:00.0"
 
-/* 簡單的 NVMe 探測 callback */
-static bool probe_cb(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
-                     struct spdk_nvme_ctrlr_opts *opts) {
-    SPDK_NOTICELOG("Found NVMe controller at %s\n", trid->traddr);
-    return true;
+/* 每個 controller 的 qpair 狀態；trid / ctrlr / init 計時在同 index 的 g_attach[] */
+struct ctrlr_entry {
+    struct spdk_nvme_qpair          *qpairs[QPAIRS_PER_CTRLR];
+    int                             qpairs_pending;     /* 已送出 connect、還沒連上的 qpair 數 */
+    uint64_t                        qpair_done_tsc;
+};
+
+static struct nvme_attach_ctrlr g_attach[MAX_CTRLRS];
+static struct ctrlr_entry g_ctrlrs[MAX_CTRLRS];
+static int g_num_ctrlrs = 0;
+static bool g_serial = false;   /* -s: 一台接一台 spdk_nvme_connect, 當對照組 */
+
+static double tsc_to_ms(uint64_t tsc) {
+    return (double)tsc * 1000.0 / spdk_get_ticks_hz();
+}
+
+/*
+ * 推進 c 還在 connect 的 qpair，回傳剩下幾條沒連上。
+ * 連線失敗的 qpair 直接釋放 (qpairs[i] 設 NULL)，report 裡就少算那一條。
+ */
+static int poll_qpairs(struct nvme_attach_ctrlr *c, void *arg) {
+    struct ctrlr_entry *e = &g_ctrlrs[c - g_attach];
+
+    (void)arg;
+    for (int i = 0; i < QPAIRS_PER_CTRLR && e->qpairs_pending > 0; i++) {
+        struct spdk_nvme_qpair *qp = e->qpairs[i];
+
+        if (!qp || spdk_nvme_qpair_is_connected(qp)) {
+            continue;
+        }
+        if (spdk_nvme_qpair_process_completions(qp, 0) < 0) {
+            SPDK_ERRLOG("IO qpair %d on %s failed to connect, reason %d\n", i, c->trid.traddr,
+                        (int)spdk_nvme_qpair_get_failure_reason(qp));
+            spdk_nvme_ctrlr_free_io_qpair(qp);
+            e->qpairs[i] = NULL;
+            e->qpairs_pending--;
+        } else if (spdk_nvme_qpair_is_connected(qp)) {
+            e->qpairs_pending--;
+        }
+    }
+    if (e->qpairs_pending == 0) {
+        e->qpair_done_tsc = spdk_get_ticks();
+    }
+    return e->qpairs_pending;
+}
+
+/*
+ * attach 時就送出該 controller 所有 I/O qpair 的 connect (create_only + async_mode，不等完成)，
+ * 之後 spdk_nvme_attach_all 每輪呼叫 poll_qpairs，和其他 controller 的 init state machine 一起推進 (overlap)
+ */
+static void start_qpairs(struct nvme_attach_ctrlr *c, void *arg) {
+    struct ctrlr_entry *e = &g_ctrlrs[c - g_attach];
+    struct spdk_nvme_io_qpair_opts qopts;
+
+    (void)arg;
+    spdk_nvme_ctrlr_get_default_io_qpair_opts(c->ctrlr, &qopts, sizeof(qopts));
+    qopts.create_only = true;
+    qopts.async_mode = true;
+    for (int i = 0; i < QPAIRS_PER_CTRLR; i++) {
+        e->qpairs[i] = spdk_nvme_ctrlr_alloc_io_qpair(c->ctrlr, &qopts, sizeof(qopts));
+        if (!e->qpairs[i]) {
+            SPDK_ERRLOG("Failed to alloc IO qpair %d on %s\n", i, c->trid.traddr);
+            continue;
+        }
+        if (spdk_nvme_ctrlr_connect_io_qpair(c->ctrlr, e->qpairs[i]) != 0) {
+            SPDK_ERRLOG("Failed to connect IO qpair %d on %s\n", i, c->trid.traddr);
+            spdk_nvme_ctrlr_free_io_qpair(e->qpairs[i]);
+            e->qpairs[i] = NULL;
+            continue;
+        }
+        e->qpairs_pending++;
+    }
+}
+
+static int connect_serial(void) {
+    for (int i = 0; i < g_num_ctrlrs; i++) {
+        struct nvme_attach_ctrlr *c = &g_attach[i];
+
+        c->start_tsc = spdk_get_ticks();
+        c->ctrlr = spdk_nvme_connect(&c->trid, &c->opts, sizeof(c->opts));
+        if (!c->ctrlr) {
+            SPDK_ERRLOG("spdk_nvme_connect() %s failed\n", c->trid.traddr);
+            return -1;
+        }
+        c->attach_tsc = spdk_get_ticks();
+        start_qpairs(c, NULL);
+        while (poll_qpairs(c, NULL) > 0) {
+            /* 對照組：等這台的 qpair 全部連上才接下一台 */
+        }
+    }
+    return 0;
 }
 
-/* attach 時把 controller 存起來 */
-static void attach_cb(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
-                      struct spdk_nvme_ctrlr *ctrlr,
-                      const struct spdk_nvme_ctrlr_opts *opts) {
-    SPDK_NOTICELOG("Attached to NVMe controller at %s\n", trid->traddr);
-    g_ctrlr = ctrlr;
+/* 所有 controller 同時 connect_async (spdk_nvme_attach.c)，qpair connect 也在同一個 poll loop 裡推進 */
+static int connect_parallel(void) {
+    spdk_nvme_attach_all(g_attach, g_num_ctrlrs, start_qpairs, poll_qpairs, NULL);
+    return 0;
+}
+
+static void report(uint64_t begin_tsc, uint64_t end_tsc) {
+    double sum_ms = 0;
+
+    printf("%-48s %12s %12s\n", "controller", "init(ms)", "qpair(ms)");
+    for (int i = 0; i < g_num_ctrlrs; i++) {
+        struct nvme_attach_ctrlr *c = &g_attach[i];
+        struct ctrlr_entry *e = &g_ctrlrs[i];
+
+        if (!c->ctrlr) {
+            printf("%-48s %12s %12s\n", c->trid.traddr, "FAILED", "-");
+            continue;
+        }
+        printf("%-48s %12.3f %12.3f\n", c->trid.traddr,
+               tsc_to_ms(c->attach_tsc - c->start_tsc),
+               tsc_to_ms(e->qpair_done_tsc - c->attach_tsc));
+        sum_ms += tsc_to_ms(e->qpair_done_tsc - c->start_tsc);
+    }
+    printf("mode=%s ctrlrs=%d wall=%.3f ms sum_of_ctrlr=%.3f ms\n",
+           g_serial ? "serial" : "parallel", g_num_ctrlrs,
+           tsc_to_ms(end_tsc - begin_tsc), sum_ms);
+}
+
+/*
+ * 用法: spdk_nvme_app [-s] [trid ...]
+ *   trid 例: "trtype:PCIe traddr:0000:5e:00.0"
+ *           "trtype:TCP adrfam:IPv4 traddr:127.0.0.1 trsvcid:4420 subnqn:nqn.2016-06.io.spdk:cnode1"
+ *   沒給 trid 時使用 DEFAULT_TRADDR
+ */
+static int parse_args(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0) {
+            g_serial = true;
+            continue;
+        }
+        if (g_num_ctrlrs == MAX_CTRLRS) {
+            SPDK_ERRLOG("too many controllers (max %d)\n", MAX_CTRLRS);
+            return -1;
+        }
+        if (spdk_nvme_transport_id_parse(&g_attach[g_num_ctrlrs].trid, argv[i]) != 0) {
+            SPDK_ERRLOG("invalid trid: %s\n", argv[i]);
+            return -1;
+        }
+        g_num_ctrlrs++;
+    }
+
+    if (g_num_ctrlrs == 0) {
+        spdk_nvme_trid_populate_transport(&g_attach[0].trid, SPDK_NVME_TRANSPORT_PCIE);
+        snprintf(g_attach[0].trid.traddr, sizeof(g_attach[0].trid.traddr), "%s", DEFAULT_TRADDR);
+        g_num_ctrlrs = 1;
+    }
+    return 0;
 }
 
 int main(int argc, char **argv) {
     struct spdk_env_opts opts;
+
+    if (parse_args(argc, argv) != 0) {
+        return -1;
+    }
     spdk_env_opts_init(&opts);
 
     /* 設定允許使用的 cores，例如 1,2,3 */
     opts.reactor_mask = "0x0E";   // binary 1110 → cores 1,2,3
     opts.name = "spdk_nvme_app";
+    if (spdk_bench_preflight_run(opts.name, opts.reactor_mask, NULL) != 0) {
+        return -1;
+    }
 
     if (spdk_env_init(&opts) < 0) {
         SPDK_ERRLOG("Unable to initialize SPDK env\n");
@@ -50,29 +198,28 @@ int main(int argc, char **argv) {
         SPDK_NOTICELOG("Created SPDK thread bound to core %d\n", core);
     }
 
-    /* 掃描並 attach NVMe controller */
-    struct spdk_nvme_transport_id trid = {};
-    spdk_nvme_trid_populate_transport(&trid, SPDK_NVME_TRANSPORT_PCIE);
-    snprintf(trid.traddr, sizeof(trid.traddr), "%s", "0000:5e:00.0");
+    /* 所有 controller 的 attach + 每個 controller 的 I/O qpair 建立 */
+    for (int i = 0; i < g_num_ctrlrs; i++) {
+        struct spdk_nvme_transport_id trid = g_attach[i].trid;
 
-    if (spdk_nvme_probe(&trid, NULL, probe_cb, attach_cb, NULL) != 0) {
-        SPDK_ERRLOG("spdk_nvme_probe() failed\n");
+        spdk_nvme_attach_init(&g_attach[i], &trid);
+    }
+    uint64_t begin_tsc = spdk_get_ticks();
+    if ((g_serial ? connect_serial() : connect_parallel()) != 0) {
         return -1;
     }
+    report(begin_tsc, spdk_get_ticks());
 
-    if (g_ctrlr) {
-        /* 為每個 SPDK thread 建立一個 queue pair */
-        struct spdk_nvme_qpair *qp;
-        struct spdk_thread *thread = spdk_get_thread();
-
-        qp = spdk_nvme_ctrlr_alloc_io_qpair(g_ctrlr, NULL, 0);
-        if (!qp) {
-            SPDK_ERRLOG("Failed to alloc IO qpair\n");
-        } else {
-            SPDK_NOTICELOG("Created IO qpair for thread %s on NVMe %s\n",
-                           spdk_thread_get_name(thread),
-                           spdk_nvme_ctrlr_get_transport_id(g_ctrlr)->traddr);
+    for (int i = 0; i < g_num_ctrlrs; i++) {
+        if (!g_attach[i].ctrlr) {
+            continue;
+        }
+        for (int q = 0; q < QPAIRS_PER_CTRLR; q++) {
+            if (g_ctrlrs[i].qpairs[q]) {
+                spdk_nvme_ctrlr_free_io_qpair(g_ctrlrs[i].qpairs[q]);
+            }
         }
+        spdk_nvme_detach(g_attach[i].ctrlr);
     }
 
     spdk_env_fini();
@@ -0,0 +1,129 @@
+/*
+NVMe controller attach：見 spdk_nvme_attach.h
+*/
+#include "spdk/stdinc.h"
+#include "spdk/env.h"
+#include "spdk/nvme.h"
+
+#include "spdk_nvme_attach.h"
+
+/*
+ * connect_async 的 attach_cb 拿不到呼叫端的 context，
+ * 每次 connect_async / probe_poll_async 之前把正在推進的 entry 放這裡
+ */
+static struct nvme_attach_ctrlr *g_attach_cur;
+
+static double tsc_to_ms(uint64_t tsc)
+{
+    return (double)tsc * 1000.0 / spdk_get_ticks_hz();
+}
+
+static void attach_cb(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
+                      struct spdk_nvme_ctrlr *ctrlr, const struct spdk_nvme_ctrlr_opts *opts)
+{
+    struct nvme_attach_ctrlr *c = g_attach_cur;
+
+    (void)cb_ctx;
+    (void)opts;
+    if (!c || c->ctrlr) {
+        fprintf(stderr, "NVME_ATTACH: unexpected controller %s, detaching\n", trid->traddr);
+        spdk_nvme_detach(ctrlr);
+        return;
+    }
+    c->attach_tsc = spdk_get_ticks();
+    c->ctrlr = ctrlr;
+}
+
+void spdk_nvme_attach_init(struct nvme_attach_ctrlr *c, const struct spdk_nvme_transport_id *trid)
+{
+    memset(c, 0, sizeof(*c));
+    c->trid = *trid;
+    spdk_nvme_ctrlr_get_default_ctrlr_opts(&c->opts, sizeof(c->opts));
+}
+
+double spdk_nvme_attach_init_ms(const struct nvme_attach_ctrlr *c)
+{
+    return c->ctrlr ? tsc_to_ms(c->attach_tsc - c->start_tsc) : -1;
+}
+
+static void report(const struct nvme_attach_ctrlr *c, int n, int failed, uint64_t wall_tsc)
+{
+    double sum_ms = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (!c[i].ctrlr) {
+            printf("NVME_ATTACH %s init=FAILED\n", c[i].trid.traddr);
+            continue;
+        }
+        printf("NVME_ATTACH %s init=%.3f ms\n", c[i].trid.traddr, spdk_nvme_attach_init_ms(&c[i]));
+        sum_ms += spdk_nvme_attach_init_ms(&c[i]);
+    }
+    printf("NVME_ATTACH ctrlrs=%d failed=%d wall=%.3f ms sum=%.3f ms\n",
+           n, failed, tsc_to_ms(wall_tsc), sum_ms);
+}
+
+int spdk_nvme_attach_all(struct nvme_attach_ctrlr *c, int n,
+                         nvme_attach_fn attached, nvme_attach_poll_fn poll, void *arg)
+{
+    uint64_t begin_tsc = spdk_get_ticks();
+    int pending = 0, failed = 0;
+
+    for (int i = 0; i < n; i++) {
+        c[i].ctrlr = NULL;
+        c[i].polling = false;
+        c[i].start_tsc = spdk_get_ticks();
+        g_attach_cur = &c[i];
+        /* opts 要活到 probe 結束 (SPDK 只存指標)，所以放在 entry 裡 */
+        c[i].probe_ctx = spdk_nvme_connect_async(&c[i].trid, &c[i].opts, attach_cb);
+        if (!c[i].probe_ctx) {
+            fprintf(stderr, "NVME_ATTACH: spdk_nvme_connect_async() %s failed\n", c[i].trid.traddr);
+            failed++;
+            continue;
+        }
+        pending++;
+    }
+
+    while (pending > 0) {
+        for (int i = 0; i < n; i++) {
+            struct nvme_attach_ctrlr *e = &c[i];
+            int rc;
+
+            if (e->polling) {
+                /* 已 attach：只剩呼叫端的工作 (例如 qpair connect) 要推進 */
+                if (poll(e, arg) == 0) {
+                    e->polling = false;
+                    pending--;
+                }
+                continue;
+            }
+            if (!e->probe_ctx) {
+                continue;
+            }
+            g_attach_cur = e;
+            rc = spdk_nvme_probe_poll_async(e->probe_ctx);
+            if (rc == -EAGAIN) {
+                continue;
+            }
+            /* probe_ctx 在 poll 完成後已被釋放 */
+            e->probe_ctx = NULL;
+            if (rc != 0 || !e->ctrlr) {
+                fprintf(stderr, "NVME_ATTACH: init of %s failed rc=%d\n", e->trid.traddr, rc);
+                failed++;
+                pending--;
+                continue;
+            }
+            if (attached) {
+                attached(e, arg);
+            }
+            if (poll && poll(e, arg) > 0) {
+                e->polling = true;
+            } else {
+                pending--;
+            }
+        }
+    }
+    g_attach_cur = NULL;
+
+    report(c, n, failed, spdk_get_ticks() - begin_tsc);
+    return failed;
+}
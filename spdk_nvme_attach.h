@@ -0,0 +1,70 @@
+/*
+NVMe controller attach，raw engine 共用
+
+spdk_nvme_connect 是 blocking 的：一台 controller 的 init state machine (CC.EN -> CSTS.RDY -> identify ...)
+跑完才回來，好幾台就一台接一台等。這裡改成每台都先 spdk_nvme_connect_async，
+再在同一個 poll loop 裡一起推進所有 probe context，總時間接近最慢那台而不是加總。
+
+每台 controller 的 init 時間 (connect_async -> attach) 都會印成一行
+  NVME_ATTACH <traddr> init=<ms> ms
+最後一行 "NVME_ATTACH ctrlrs=N failed=F wall=W ms sum=S ms" 是整體 wall time 和各台 init 加總，
+兩者差多少就是 overlap 省下的時間。
+
+用法：
+  struct nvme_attach_ctrlr c[N];
+  for (i...) spdk_nvme_attach_init(&c[i], &trid[i]);   // 要改 ctrlr opts 就改 c[i].opts
+  if (spdk_nvme_attach_all(c, N, NULL, NULL, NULL) != 0) ... // c[i].ctrlr 為 NULL 的就是失敗的
+
+attached / poll 可選：attached 在某台 attach 完時呼叫 (例如送出 async qpair connect)，
+之後每輪 poll loop 呼叫 poll 直到它回傳 0，讓 qpair connect 也跟其他台的 init 重疊。
+
+非 reentrant：同一時間只能有一個 spdk_nvme_attach_all 在跑。
+*/
+#ifndef SPDK_NVME_ATTACH_H
+#define SPDK_NVME_ATTACH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "spdk/nvme.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct nvme_attach_ctrlr {
+    struct spdk_nvme_transport_id   trid;       // 呼叫前填
+    struct spdk_nvme_ctrlr_opts     opts;       // spdk_nvme_attach_init 填預設值，呼叫前可改
+    struct spdk_nvme_ctrlr          *ctrlr;     // 結果；attach 失敗為 NULL
+    uint64_t                        start_tsc;  // spdk_nvme_connect_async 的時間
+    uint64_t                        attach_tsc; // attach 完成的時間
+
+    /* 以下 spdk_nvme_attach_all 內部用 */
+    struct spdk_nvme_probe_ctx      *probe_ctx;
+    bool                            polling;    // 已 attach、poll callback 還沒回 0
+};
+
+/* 某台 attach 完成時呼叫 (在 poll loop 裡，不是在 SPDK 的 attach_cb 裡) */
+typedef void (*nvme_attach_fn)(struct nvme_attach_ctrlr *c, void *arg);
+/* attach 之後每輪呼叫，回傳還沒做完的工作數，0 表示這台結束 */
+typedef int (*nvme_attach_poll_fn)(struct nvme_attach_ctrlr *c, void *arg);
+
+/* 填 trid 和預設 ctrlr opts，其餘清零 */
+void spdk_nvme_attach_init(struct nvme_attach_ctrlr *c, const struct spdk_nvme_transport_id *trid);
+
+/*
+ * 所有 controller 同時 connect_async，一起輪詢到全部 attach (和 poll 回 0) 或失敗，然後印出每台的 init 時間。
+ * attached / poll / arg 可為 NULL。回傳 attach 失敗的台數，0 表示全部成功；
+ * 失敗時已經 attach 的 controller 不會自動 detach，由呼叫端處理。
+ */
+int spdk_nvme_attach_all(struct nvme_attach_ctrlr *c, int n,
+                         nvme_attach_fn attached, nvme_attach_poll_fn poll, void *arg);
+
+/* init 時間 (ms)；沒 attach 成功回傳 -1 */
+double spdk_nvme_attach_init_ms(const struct nvme_attach_ctrlr *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,9 +8,12 @@
 #include "spdk/env.h"
 #include "spdk/nvme.h"
 #include "spdk/nvme_intel.h"
+#include "spdk_bench_preflight.h"
+#include "spdk_nvme_attach.h"
 
 #define REACTOR_CORES 2  // Reactor thread 數
 #define QUEUE_PER_CORE 1 // 每個 reactor 對應的 qp 數
+#define DEFAULT_TRADDR "0000:01:00.0"
 
 struct app_context {
     struct spdk_nvme_ctrlr *ctrlr;
@@ -63,18 +66,33 @@ int main(int argc, char **argv)
 {
     struct spdk_env_opts opts;
     struct app_context ctx;
+    struct spdk_nvme_transport_id trid = {};
+    struct nvme_attach_ctrlr attach;
 
     spdk_env_opts_init(&opts);
     opts.name = "spdk_multi_core_example";
     opts.core_mask = "0x3"; // Core 0 和 Core 1
+    if (spdk_bench_preflight_run(opts.name, opts.core_mask, NULL) != 0) {
+        return -1;
+    }
     spdk_env_init(&opts);
 
-    // 探測 NVMe 控制器
-    ctx.ctrlr = spdk_nvme_connect(NULL, 0, 0, NULL);
-    if (!ctx.ctrlr) {
+    // 探測 NVMe 控制器；argv[1] 可給完整 trid，沒給用 DEFAULT_TRADDR
+    if (argc > 1) {
+        if (spdk_nvme_transport_id_parse(&trid, argv[1]) != 0) {
+            fprintf(stderr, "invalid trid: %s\n", argv[1]);
+            return -1;
+        }
+    } else {
+        spdk_nvme_trid_populate_transport(&trid, SPDK_NVME_TRANSPORT_PCIE);
+        snprintf(trid.traddr, sizeof(trid.traddr), "%s", DEFAULT_TRADDR);
+    }
+    spdk_nvme_attach_init(&attach, &trid);
+    if (spdk_nvme_attach_all(&attach, 1, NULL, NULL, NULL) != 0) {
         fprintf(stderr, "Failed to connect NVMe controller\n");
         return -1;
     }
+    ctx.ctrlr = attach.ctrlr;
 
     // 啟動 reactor thread
     for (int i = 0; i < REACTOR_CORES; i++) {
@@ -3,122 +3,410 @@
 創建多個 reactor thread （每個cpu core各一)
 為每個 reactor thread: 建立多個 IO channel (io channel: 即 NVMe queue pair)
 做簡單讀寫操作
+
+polling 模式 (argv[1])：
+  busy  : 一直 spin 呼叫 process_completions
+  sleep : 舊行為，每輪 usleep(1000)，每個 completion 最多多等 1ms
+  intr  : interrupt mode，spdk_interrupt_mode_enable() + controller 的 enable_interrupts，
+          qpair 掛到 nvme poll group，poll group 的 spdk_fd_group (PCIe 的 MSI-X eventfd / TCP 的 socket)
+          nest 進每個 reactor 自己的 spdk_fd_group，在 spdk_fd_group_wait 上睡，有 completion 就被叫醒；
+          think time 和這一輪的結束時間用同一個 fd_group 裡的 timerfd 叫醒 (ns 精度)，沒有週期性的 timeout
+每個 reactor 依序跑 low / medium / high 三種負載，輸出 IOPS、latency 與該 core 實際耗用的 CPU%
+每種負載結束時每個 qpair 印一行 SLOW summary (nvme_slow_cmd.h)：超過 NVME_SLOW_US 的 command 是 device 慢還是 host 晚 poll
 */
 #include "spdk/stdinc.h"
 #include "spdk/env.h"
 #include "spdk/nvme.h"
 #include "spdk/nvme_intel.h"
+#include "spdk/fd_group.h"
+#include "spdk/thread.h"
+#include "spdk_bench_preflight.h"
+#include "nvme_slow_cmd.h"
+#include "spdk_nvme_attach.h"
+
+#include <sys/timerfd.h>
 
 #define NUM_REACTORS 2     // Reactor thread 數量
 #define QP_PER_REACTOR 1   // 每個 reactor 的 queue pair 數
 #define TEST_IO_SIZE 4096  // 每次 IO 大小
+#define MAX_QD 32          // 每個 reactor 最多同時在飛的 IO
+#define RUN_SEC 5          // 每種負載跑幾秒
+#define MAX_LAT_SAMPLES (1 << 20)
+
+enum poll_mode {
+    POLL_BUSY,
+    POLL_SLEEP,
+    POLL_INTR,
+};
+
+static const char *g_mode_name[] = { "busy", "sleep", "intr" };
+static enum poll_mode g_mode = POLL_BUSY;
+
+/* 負載等級：同時在飛的 IO 數，與每個 IO 完成後到下一次送出的間隔 */
+struct load_level {
+    const char *name;
+    int qd;
+    uint32_t think_us;
+};
+
+static const struct load_level g_loads[] = {
+    { "low",    1, 1000 },
+    { "medium", 4, 100 },
+    { "high",   MAX_QD, 0 },
+};
+#define NUM_LOADS (sizeof(g_loads) / sizeof(g_loads[0]))
+
+struct load_result {
+    double iops;
+    double avg_us;
+    double p99_us;
+    double cpu_pct;
+};
+
+struct io_slot {
+    struct reactor_context *ctx;
+    void *buf;
+    int qp_idx;
+    struct nvme_slow_cmd slow;
+    uint64_t submit_tsc;
+    uint64_t next_submit_tsc;   // think time 結束的時間, 0 表示不在等待
+    bool busy;
+};
 
 struct reactor_context {
     struct spdk_nvme_ctrlr *ctrlr;
     struct spdk_nvme_qpair *qpair[QP_PER_REACTOR];
+    struct nvme_slow_qpair slow[QP_PER_REACTOR];
+    struct spdk_nvme_poll_group *group;
+    struct spdk_fd_group *fgrp;  // intr：nest 了 poll group 的 fd_group，加上 tfd
+    int tfd;                    // intr：下一個 slot 的 think time 結束或這一輪結束時叫醒
+    struct io_slot slots[MAX_QD];
+    uint64_t *lat;
+    uint64_t lat_cnt;
     uint64_t io_submitted;
     uint64_t io_completed;
+    uint64_t think_tsc;
+    struct load_result result[NUM_LOADS];
 };
 
 static void io_complete(void *arg, const struct spdk_nvme_cpl *cpl)
 {
-    struct reactor_context *ctx = arg;
+    struct io_slot *slot = arg;
+    struct reactor_context *ctx = slot->ctx;
+    uint64_t now = spdk_get_ticks();
+
+    nvme_slow_cmd_complete(&ctx->slow[slot->qp_idx], &slot->slow, cpl, now);
     ctx->io_completed++;
+    if (ctx->lat_cnt < MAX_LAT_SAMPLES) {
+        ctx->lat[ctx->lat_cnt++] = now - slot->submit_tsc;
+    }
+    slot->busy = false;
+    slot->next_submit_tsc = now + ctx->think_tsc;
 }
 
-static void submit_io(struct reactor_context *ctx)
+static void submit_io(struct reactor_context *ctx, struct io_slot *slot, int idx)
 {
-    void *buf = spdk_zmalloc(TEST_IO_SIZE, 0x1000, NULL, SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
-    if (!buf) {
-        fprintf(stderr, "Failed to allocate buffer\n");
-        return;
+    struct spdk_nvme_qpair *qp = ctx->qpair[idx % QP_PER_REACTOR];
+    uint64_t lba = idx;
+
+    slot->qp_idx = idx % QP_PER_REACTOR;
+    slot->submit_tsc = spdk_get_ticks();
+    int rc = spdk_nvme_ns_cmd_read(spdk_nvme_ctrlr_get_ns(ctx->ctrlr, 1),
+                                   qp, slot->buf, lba, 1, io_complete, slot, 0);
+    if (rc == 0) {
+        nvme_slow_cmd_submit(&ctx->slow[slot->qp_idx], &slot->slow, SPDK_NVME_OPC_READ, lba, 1,
+                             slot->submit_tsc);
+        slot->busy = true;
+        ctx->io_submitted++;
+    } else {
+        fprintf(stderr, "Failed to submit IO\n");
     }
+}
+
+static void disconnected_qpair_cb(struct spdk_nvme_qpair *qpair, void *poll_group_ctx)
+{
+    fprintf(stderr, "qpair disconnected\n");
+}
+
+/* 送出所有 think time 已結束的 slot，回傳距離下一個 slot 可送出還有多少 ticks */
+static uint64_t kick_slots(struct reactor_context *ctx, int qd, uint64_t now)
+{
+    uint64_t wait = UINT64_MAX;
 
-    for (int q = 0; q < QP_PER_REACTOR; q++) {
-        struct spdk_nvme_qpair *qp = ctx->qpair[q];
-        uint64_t lba = 0;
+    for (int i = 0; i < qd; i++) {
+        struct io_slot *slot = &ctx->slots[i];
 
-        int rc = spdk_nvme_ns_cmd_read(spdk_nvme_ctrlr_get_ns(ctx->ctrlr, 1),
-                                       qp, buf, lba, 1, io_complete, ctx, 0);
-        if (rc == 0) {
-            ctx->io_submitted++;
+        if (slot->busy) {
+            continue;
+        }
+        if (slot->next_submit_tsc <= now) {
+            submit_io(ctx, slot, i);
         } else {
-            fprintf(stderr, "Failed to submit IO\n");
+            wait = spdk_min(wait, slot->next_submit_tsc - now);
         }
     }
+    return wait;
+}
+
+/* poll group 一次 poll 所有 qpair，每個 qpair 的 tracker 都記下這一輪的開始時間 */
+static int poll_group(struct reactor_context *ctx)
+{
+    uint64_t now = spdk_get_ticks();
+
+    for (int i = 0; i < QP_PER_REACTOR; i++) {
+        nvme_slow_poll_begin(&ctx->slow[i], now);
+    }
+    return spdk_nvme_poll_group_process_completions(ctx->group, 0, disconnected_qpair_cb);
+}
+
+/* intr：timerfd 到期，清掉計數就好，醒來之後 run_load 會送出到期的 slot */
+static int think_timer_fn(void *arg)
+{
+    struct reactor_context *ctx = arg;
+    uint64_t expired;
+
+    (void)!read(ctx->tfd, &expired, sizeof(expired));
+    return 0;
+}
+
+/* wait_tsc：到下一個 slot 可送出或這一輪結束還有多少 ticks */
+static int poll_once(struct reactor_context *ctx, uint64_t wait_tsc)
+{
+    struct itimerspec its = {};
+    uint64_t ns;
+
+    switch (g_mode) {
+    case POLL_SLEEP:
+        usleep(1000); // 簡單 poll
+        break;
+    case POLL_INTR:
+        /*
+         * 睡到 completion (poll group 的 fd 有事件時 nvme 自己的 handler 會處理 completion)
+         * 或 timerfd 到期；epoll 的 ms timeout 不夠細，所以時間全交給 timerfd
+         */
+        ns = wait_tsc * 1000000000ULL / spdk_get_ticks_hz();
+        its.it_value.tv_sec = ns / 1000000000ULL;
+        its.it_value.tv_nsec = spdk_max(ns % 1000000000ULL, 1);
+        timerfd_settime(ctx->tfd, 0, &its, NULL);
+        spdk_fd_group_wait(ctx->fgrp, -1);
+        break;
+    default:
+        break;
+    }
+    return poll_group(ctx);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void run_load(struct reactor_context *ctx, int level)
+{
+    const struct load_level *load = &g_loads[level];
+    struct load_result *res = &ctx->result[level];
+    uint64_t hz = spdk_get_ticks_hz();
+    uint64_t start, end, now, wait, cpu_us;
+    struct rusage ru0, ru1;
+
+    ctx->think_tsc = (uint64_t)load->think_us * hz / 1000000;
+    ctx->lat_cnt = 0;
+    ctx->io_completed = ctx->io_submitted = 0;
+    for (int i = 0; i < MAX_QD; i++) {
+        ctx->slots[i].next_submit_tsc = 0;
+    }
+
+    getrusage(RUSAGE_THREAD, &ru0);
+    start = spdk_get_ticks();
+    end = start + RUN_SEC * hz;
+    now = start;
+    while (now < end) {
+        wait = kick_slots(ctx, load->qd, now);
+        poll_once(ctx, spdk_min(wait, end - now));
+        now = spdk_get_ticks();
+    }
+    while (ctx->io_completed < ctx->io_submitted) {
+        poll_group(ctx);
+    }
+    now = spdk_get_ticks();
+    getrusage(RUSAGE_THREAD, &ru1);
+
+    cpu_us = (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec + ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) * 1000000ULL +
+             ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec + ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec;
+
+    res->iops = (double)ctx->io_completed * hz / (now - start);
+    res->cpu_pct = cpu_us * 100.0 / ((double)(now - start) * 1000000 / hz);
+    res->avg_us = res->p99_us = 0;
+    if (ctx->lat_cnt > 0) {
+        uint64_t sum = 0;
+
+        for (uint64_t i = 0; i < ctx->lat_cnt; i++) {
+            sum += ctx->lat[i];
+        }
+        res->avg_us = (double)sum * 1000000 / hz / ctx->lat_cnt;
+        qsort(ctx->lat, ctx->lat_cnt, sizeof(uint64_t), cmp_u64);
+        res->p99_us = (double)ctx->lat[ctx->lat_cnt * 99 / 100] * 1000000 / hz;
+    }
+    for (int i = 0; i < QP_PER_REACTOR; i++) {
+        nvme_slow_qpair_report(&ctx->slow[i], load->name);
+    }
 }
 
 static int reactor_thread(void *arg)
 {
     struct reactor_context *ctx = arg;
     int core = spdk_env_get_current_core();
+    struct spdk_nvme_io_qpair_opts qopts;
+    struct spdk_fd_group *nvme_fgrp;
+    char name[32];
 
-    printf("Reactor thread started on core %d\n", core);
+    printf("Reactor thread started on core %d, mode %s\n", core, g_mode_name[g_mode]);
 
-    // 創建每個 reactor 的 queue pair
+    ctx->group = spdk_nvme_poll_group_create(ctx, NULL);
+    if (!ctx->group) {
+        fprintf(stderr, "Failed to create poll group for core %d\n", core);
+        return -1;
+    }
+
+    // 創建每個 reactor 的 queue pair，先加入 poll group 再 connect
+    spdk_nvme_ctrlr_get_default_io_qpair_opts(ctx->ctrlr, &qopts, sizeof(qopts));
+    qopts.create_only = true;
     for (int i = 0; i < QP_PER_REACTOR; i++) {
-        ctx->qpair[i] = spdk_nvme_ctrlr_alloc_io_qpair(ctx->ctrlr, NULL, 0);
-        if (!ctx->qpair[i]) {
+        ctx->qpair[i] = spdk_nvme_ctrlr_alloc_io_qpair(ctx->ctrlr, &qopts, sizeof(qopts));
+        if (!ctx->qpair[i] ||
+            spdk_nvme_poll_group_add(ctx->group, ctx->qpair[i]) != 0 ||
+            spdk_nvme_ctrlr_connect_io_qpair(ctx->ctrlr, ctx->qpair[i]) != 0) {
             fprintf(stderr, "Failed to allocate qpair for core %d\n", core);
             return -1;
         }
+        snprintf(name, sizeof(name), "c%dq%d", core, i);
+        nvme_slow_qpair_init(&ctx->slow[i], ctx->qpair[i], name);
     }
 
-    // 發送初始 IO
-    submit_io(ctx);
+    if (g_mode == POLL_INTR) {
+        /* 只有 interrupt mode 開著時 poll group 才會建 fd_group，qpair 的 fd 都在裡面 */
+        nvme_fgrp = spdk_nvme_poll_group_get_fd_group(ctx->group);
+        ctx->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (!nvme_fgrp || ctx->tfd < 0 || spdk_fd_group_create(&ctx->fgrp) != 0 ||
+            spdk_fd_group_nest(ctx->fgrp, nvme_fgrp) != 0 ||
+            SPDK_FD_GROUP_ADD(ctx->fgrp, ctx->tfd, think_timer_fn, ctx) != 0) {
+            fprintf(stderr, "Failed to set up fd_group on poll group / timerfd for core %d\n", core);
+            return -1;
+        }
+    }
 
-    // Reactor loop: 處理完成事件
-    while (true) {
-        for (int i = 0; i < QP_PER_REACTOR; i++) {
-            spdk_nvme_qpair_process_completions(ctx->qpair[i], 0);
+    ctx->lat = calloc(MAX_LAT_SAMPLES, sizeof(uint64_t));
+    if (!ctx->lat) {
+        fprintf(stderr, "Failed to allocate latency samples for core %d\n", core);
+        return -1;
+    }
+    for (int i = 0; i < MAX_QD; i++) {
+        ctx->slots[i].ctx = ctx;
+        ctx->slots[i].buf = spdk_zmalloc(TEST_IO_SIZE, 0x1000, NULL, SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
+        if (!ctx->slots[i].buf) {
+            fprintf(stderr, "Failed to allocate buffer\n");
+            return -1;
         }
-        usleep(1000); // 簡單 poll
     }
 
+    for (size_t l = 0; l < NUM_LOADS; l++) {
+        run_load(ctx, l);
+    }
+
+    for (int i = 0; i < MAX_QD; i++) {
+        spdk_free(ctx->slots[i].buf);
+    }
+    free(ctx->lat);
+    for (int i = 0; i < QP_PER_REACTOR; i++) {
+        nvme_slow_qpair_fini(&ctx->slow[i]);
+        spdk_nvme_poll_group_remove(ctx->group, ctx->qpair[i]);
+        spdk_nvme_ctrlr_free_io_qpair(ctx->qpair[i]);
+    }
+    if (g_mode == POLL_INTR) {
+        spdk_fd_group_remove(ctx->fgrp, ctx->tfd);
+        spdk_fd_group_unnest(ctx->fgrp, spdk_nvme_poll_group_get_fd_group(ctx->group));
+        spdk_fd_group_destroy(ctx->fgrp);
+        close(ctx->tfd);
+    }
+    spdk_nvme_poll_group_destroy(ctx->group);
     return 0;
 }
 
 int main(int argc, char **argv)
 {
     struct spdk_env_opts opts;
-    struct reactor_context ctx[NUM_REACTORS];
+    struct nvme_attach_ctrlr attach;
+    struct spdk_nvme_transport_id trid = {};
+    static struct reactor_context ctx[NUM_REACTORS];
+
+    if (argc > 1) {
+        for (int m = POLL_BUSY; m <= POLL_INTR; m++) {
+            if (strcmp(argv[1], g_mode_name[m]) == 0) {
+                g_mode = m;
+            }
+        }
+    }
 
+    if (g_mode == POLL_INTR) {
+        /* nvme poll group 看這個決定要不要建 fd_group；要在建 poll group 之前開 */
+        spdk_interrupt_mode_enable();
+    }
     spdk_env_opts_init(&opts);
     opts.name = "spdk_multi_core_example";
     opts.core_mask = "0x3"; // Core 0 和 Core 1
+    if (spdk_bench_preflight_run(opts.name, opts.core_mask, NULL) != 0) {
+        return -1;
+    }
     if (spdk_env_init(&opts) < 0) {
         fprintf(stderr, "Unable to initialize SPDK env\n");
         return -1;
     }
 
-    // 探測 NVMe 控制器
-    ctx[0].ctrlr = spdk_nvme_connect(NULL, 0, 0, NULL);
-    if (!ctx[0].ctrlr) {
+    // 探測 NVMe 控制器；argv[2] 可給完整 trid (例如 NVMe-oF TCP)
+    if (argc > 2) {
+        if (spdk_nvme_transport_id_parse(&trid, argv[2]) != 0) {
+            fprintf(stderr, "invalid trid: %s\n", argv[2]);
+            return -1;
+        }
+    } else {
+        spdk_nvme_trid_populate_transport(&trid, SPDK_NVME_TRANSPORT_PCIE);
+        snprintf(trid.traddr, sizeof(trid.traddr), "%s", "0000:01:00.0");
+    }
+    spdk_nvme_attach_init(&attach, &trid);
+    // interrupt mode 要在 controller attach 時就開，IO qpair 才會有可等待的 fd
+    attach.opts.enable_interrupts = (g_mode == POLL_INTR);
+    if (spdk_nvme_attach_all(&attach, 1, NULL, NULL, NULL) != 0) {
         fprintf(stderr, "Failed to connect NVMe controller\n");
         return -1;
     }
+    ctx[0].ctrlr = attach.ctrlr;
+    nvme_slow_ctrlr_init(ctx[0].ctrlr);
 
     // 所有 reactor 使用同一個 ctrlr
     for (int i = 1; i < NUM_REACTORS; i++) {
         ctx[i].ctrlr = ctx[0].ctrlr;
-        ctx[i].io_submitted = 0;
-        ctx[i].io_completed = 0;
     }
 
-    // 啟動 reactor threads
-    for (int i = 0; i < NUM_REACTORS; i++) {
+    // 啟動 reactor threads (core 0 由 main thread 自己跑)
+    for (int i = 1; i < NUM_REACTORS; i++) {
         spdk_env_thread_launch_pinned(i, reactor_thread, &ctx[i]);
     }
+    reactor_thread(&ctx[0]);
+    spdk_env_thread_wait_all();
 
-    // 主 thread 也可以監控 IO 完成數
-    while (true) {
+    printf("%-6s %-7s %5s %12s %10s %10s %8s\n", "mode", "load", "core", "IOPS", "avg(us)", "p99(us)", "cpu%");
+    for (size_t l = 0; l < NUM_LOADS; l++) {
         for (int i = 0; i < NUM_REACTORS; i++) {
-            printf("Core %d: submitted=%lu completed=%lu\n",
-                   i, ctx[i].io_submitted, ctx[i].io_completed);
+            struct load_result *res = &ctx[i].result[l];
+
+            printf("%-6s %-7s %5d %12.0f %10.1f %10.1f %8.1f\n", g_mode_name[g_mode], g_loads[l].name,
+                   i, res->iops, res->avg_us, res->p99_us, res->cpu_pct);
         }
-        sleep(1);
     }
 
+    spdk_nvme_detach(ctx[0].ctrlr);
+    spdk_env_fini();
     return 0;
 }
-
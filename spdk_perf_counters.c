@@ -0,0 +1,186 @@
+/*
+硬體 performance counter：見 spdk_perf_counters.h
+*/
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "spdk_perf_counters.h"
+
+static const char *g_ctr_name[PERF_CTR_NUM] = { "cycles", "instr", "llc_miss", "br_miss", "dtlb_miss" };
+
+static int g_warned;
+
+struct read_value {
+    uint64_t value;
+    uint64_t time_enabled;
+    uint64_t time_running;
+};
+
+static void
+ctr_attr(enum perf_ctr c, struct perf_event_attr *attr)
+{
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->type = PERF_TYPE_HARDWARE;
+    attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+
+    switch (c) {
+    case PERF_CTR_CYCLES:
+        attr->config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PERF_CTR_INSTRUCTIONS:
+        attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PERF_CTR_LLC_MISS:
+        attr->config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case PERF_CTR_BR_MISS:
+        attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    default:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    }
+}
+
+static void
+warn_once(enum perf_ctr c, int err)
+{
+    FILE *f;
+    int paranoid = -100;
+
+    /* reactor 會同時開，印兩次也無所謂 */
+    if (__atomic_exchange_n(&g_warned, 1, __ATOMIC_RELAXED)) {
+        return;
+    }
+    f = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+    if (f) {
+        if (fscanf(f, "%d", &paranoid) != 1) {
+            paranoid = -100;
+        }
+        fclose(f);
+    }
+    fprintf(stderr, "perf counter %s: perf_event_open failed: %s (perf_event_paranoid=%d)，該欄留空\n",
+            g_ctr_name[c], strerror(err), paranoid);
+}
+
+uint32_t
+spdk_perf_ctr_open(struct perf_ctr_set *s)
+{
+    const char *env = getenv("SPDK_PERF_COUNTERS");
+    struct perf_event_attr attr;
+    uint32_t mask = 0;
+
+    for (int c = 0; c < PERF_CTR_NUM; c++) {
+        s->fd[c] = -1;
+    }
+    if (env && !strcmp(env, "0")) {
+        return 0;
+    }
+    for (int c = 0; c < PERF_CTR_NUM; c++) {
+        ctr_attr((enum perf_ctr)c, &attr);
+        s->fd[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (s->fd[c] < 0) {
+            warn_once((enum perf_ctr)c, errno);
+            s->fd[c] = -1;
+            continue;
+        }
+        mask |= 1u << c;
+    }
+    return mask;
+}
+
+void
+spdk_perf_ctr_read(const struct perf_ctr_set *s, uint64_t vals[PERF_CTR_NUM])
+{
+    struct read_value rv;
+
+    for (int c = 0; c < PERF_CTR_NUM; c++) {
+        vals[c] = 0;
+        if (s->fd[c] < 0 || read(s->fd[c], &rv, sizeof(rv)) != sizeof(rv)) {
+            continue;
+        }
+        if (rv.time_running == 0) {
+            continue;
+        }
+        vals[c] = rv.time_running < rv.time_enabled ?
+                  (uint64_t)((double)rv.value * rv.time_enabled / rv.time_running) : rv.value;
+    }
+}
+
+void
+spdk_perf_ctr_close(struct perf_ctr_set *s)
+{
+    for (int c = 0; c < PERF_CTR_NUM; c++) {
+        if (s->fd[c] >= 0) {
+            close(s->fd[c]);
+            s->fd[c] = -1;
+        }
+    }
+}
+
+void
+spdk_perf_ctr_csv_header(FILE *f)
+{
+    for (int c = 0; c < PERF_CTR_NUM; c++) {
+        fprintf(f, ",%s_per_io", g_ctr_name[c]);
+    }
+    fprintf(f, ",ipc");
+}
+
+void
+spdk_perf_ctr_csv_row(FILE *f, const uint64_t vals[PERF_CTR_NUM], uint64_t ios, uint32_t mask)
+{
+    uint32_t ipc_mask = (1u << PERF_CTR_CYCLES) | (1u << PERF_CTR_INSTRUCTIONS);
+
+    for (int c = 0; c < PERF_CTR_NUM; c++) {
+        if ((mask & (1u << c)) && ios) {
+            fprintf(f, ",%.2f", (double)vals[c] / ios);
+        } else {
+            fprintf(f, ",");
+        }
+    }
+    if ((mask & ipc_mask) == ipc_mask && vals[PERF_CTR_CYCLES]) {
+        fprintf(f, ",%.3f", (double)vals[PERF_CTR_INSTRUCTIONS] / vals[PERF_CTR_CYCLES]);
+    } else {
+        fprintf(f, ",");
+    }
+}
+
+void
+spdk_perf_ctr_format(char *buf, size_t len, const uint64_t vals[PERF_CTR_NUM], uint64_t ios, uint32_t mask)
+{
+    size_t off = 0;
+
+    buf[0] = '\0';
+    if (!mask || !ios) {
+        return;
+    }
+    if (mask & (1u << PERF_CTR_CYCLES)) {
+        off += snprintf(buf + off, len - off, " cyc/IO %.0f", (double)vals[PERF_CTR_CYCLES] / ios);
+    }
+    if ((mask & (1u << PERF_CTR_INSTRUCTIONS)) && (mask & (1u << PERF_CTR_CYCLES)) && vals[PERF_CTR_CYCLES] &&
+        off < len) {
+        off += snprintf(buf + off, len - off, " IPC %.2f",
+                        (double)vals[PERF_CTR_INSTRUCTIONS] / vals[PERF_CTR_CYCLES]);
+    }
+    if ((mask & (1u << PERF_CTR_LLC_MISS)) && off < len) {
+        off += snprintf(buf + off, len - off, " LLC/IO %.2f", (double)vals[PERF_CTR_LLC_MISS] / ios);
+    }
+    if ((mask & (1u << PERF_CTR_BR_MISS)) && off < len) {
+        off += snprintf(buf + off, len - off, " br/IO %.2f", (double)vals[PERF_CTR_BR_MISS] / ios);
+    }
+    if ((mask & (1u << PERF_CTR_DTLB_MISS)) && off < len) {
+        snprintf(buf + off, len - off, " dTLB/IO %.2f", (double)vals[PERF_CTR_DTLB_MISS] / ios);
+    }
+}
@@ -0,0 +1,65 @@
+/*
+硬體 performance counter (perf_event_open)：每個 reactor 一組，讓 IOPS 的差異能對到 cache / TLB / branch
+
+  cycles        PERF_COUNT_HW_CPU_CYCLES
+  instructions  PERF_COUNT_HW_INSTRUCTIONS
+  llc_miss      PERF_COUNT_HW_CACHE_MISSES (x86 上就是 LLC miss)
+  br_miss       PERF_COUNT_HW_BRANCH_MISSES
+  dtlb_miss     dTLB read miss (PERF_TYPE_HW_CACHE)
+
+counter 跟著「開它的 OS thread」(pid = 0, cpu = -1)，所以要在 reactor 上開：同一個 reactor 上的 SPDK thread
+全部算在一起，分不出哪條 SPDK thread 花的。只算 user space (exclude_kernel)，perf_event_paranoid <= 2 就能開；
+VM 或 PMU 不夠時個別 counter 會開不起來，回傳的 mask 少那一位，輸出留空。
+counter 比 PMU 多時 kernel 會輪流上 (multiplexing)，讀值已經照 time_enabled / time_running 放大。
+
+環境變數：
+  SPDK_PERF_COUNTERS=0    全部不開 (spdk_perf_ctr_open 回傳 0)
+*/
+#ifndef SPDK_PERF_COUNTERS_H
+#define SPDK_PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum perf_ctr {
+    PERF_CTR_CYCLES,
+    PERF_CTR_INSTRUCTIONS,
+    PERF_CTR_LLC_MISS,
+    PERF_CTR_BR_MISS,
+    PERF_CTR_DTLB_MISS,
+    PERF_CTR_NUM,
+};
+
+#define PERF_CTR_ALL        ((1u << PERF_CTR_NUM) - 1)
+
+struct perf_ctr_set {
+    int fd[PERF_CTR_NUM];           // -1：沒開
+};
+
+/* 在呼叫的 thread 上開全部 counter，回傳開成功的 bitmask；第一次失敗時印一次原因 */
+uint32_t spdk_perf_ctr_open(struct perf_ctr_set *s);
+
+/* 累計值 (已做 multiplexing 放大)；沒開的填 0 */
+void spdk_perf_ctr_read(const struct perf_ctr_set *s, uint64_t vals[PERF_CTR_NUM]);
+
+void spdk_perf_ctr_close(struct perf_ctr_set *s);
+
+/*
+CSV 欄位：每個 IO 的 cycles / instructions / llc_miss / br_miss / dtlb_miss 和 ipc，
+header 和 row 都以 ',' 開頭，接在原本的欄位後面；mask 沒有的欄位或 ios == 0 時留空
+*/
+void spdk_perf_ctr_csv_header(FILE *f);
+void spdk_perf_ctr_csv_row(FILE *f, const uint64_t vals[PERF_CTR_NUM], uint64_t ios, uint32_t mask);
+
+/* 給 console 的一小段 "cyc/IO 12345 IPC 1.23 LLC/IO 1.2 ..."，mask 為 0 時是空字串 */
+void spdk_perf_ctr_format(char *buf, size_t len, const uint64_t vals[PERF_CTR_NUM], uint64_t ios, uint32_t mask);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPDK_PERF_COUNTERS_H */
@@ -0,0 +1,419 @@
+#!/usr/bin/env python3
+"""
+Latency-over-time heatmap：時間 bucket × log-latency bucket，每個 IO stage 一張。
+percentile 表 (spdk_trace_latency_noDuplicate.py) 看不到的週期性 stall (GC / poller 餓死 / iobuf 用光)
+在這裡會變成一條條直線。
+
+stage 定義 (與 latency_plus.py 的 t0..t5 相同)：
+  RAID stack:
+    step1  t0 root BDEV_IO_START      → t1 BDEV_RAID_IO_START   (R 的 link == root id)
+    step2  t1 BDEV_RAID_IO_START      → t2 child BDEV_IO_START  (child 的 link == R)
+    step3  t2 child BDEV_IO_START     → t3 child BDEV_IO_DONE   (同 id)
+    step4  t3 最後一個 child DONE      → t4 BDEV_RAID_IO_DONE
+    step5  t4 BDEV_RAID_IO_DONE       → t5 root BDEV_IO_DONE
+  ublk (依 qid/tag 配對)：
+    ublk_ready_submit   UBLK_REQ_READY    → UBLK_BDEV_SUBMIT
+    ublk_bdev           UBLK_BDEV_SUBMIT  → UBLK_BDEV_DONE
+    ublk_done_commit    UBLK_BDEV_DONE    → UBLK_COMMIT_SUBMIT (batched，同 queue 已 prep 的 tag 一起結算)
+    ublk_ready_commit   UBLK_REQ_READY    → UBLK_COMMIT_SUBMIT
+
+記憶體上限：
+  - in-flight 狀態在配對完就刪掉，超過 --max-gap-us 還沒配到的會被定期清掉
+  - 時間 bucket 超過 --max-time-buckets 時，相鄰兩欄合併、bucket 寬度加倍
+"""
+import argparse
+import base64
+import csv
+import html
+import io
+import math
+import re
+from collections import defaultdict
+from typing import Dict, List, Optional, Tuple
+
+E_BDEV_START = "BDEV_IO_START"
+E_BDEV_DONE  = "BDEV_IO_DONE"
+E_RAID_START = "BDEV_RAID_IO_START"
+E_RAID_DONE  = "BDEV_RAID_IO_DONE"
+
+E_UBLK_READY       = "UBLK_REQ_READY"
+E_UBLK_BDEV_SUBMIT = "UBLK_BDEV_SUBMIT"
+E_UBLK_BDEV_DONE   = "UBLK_BDEV_DONE"
+E_UBLK_COMMIT_PREP = "UBLK_COMMIT_PREP"
+E_UBLK_COMMIT_SUB  = "UBLK_COMMIT_SUBMIT"
+
+STAGE_ORDER = ["step1_t1_minus_t0", "step2_t2_minus_t1", "step3_t3_minus_t2",
+               "step4_t4_minus_t3", "step5_t5_minus_t4",
+               "ublk_ready_submit", "ublk_bdev", "ublk_done_commit", "ublk_ready_commit"]
+
+# 與 latency_plus.py 相同：允許一次括號 "i232 (R73)"
+ID_RE = re.compile(r"^\s*(\S+)(?:\s*\(\s*([^)]+)\s*\)\s*)?$")
+
+
+def parse_id(value: str) -> Tuple[str, Optional[str]]:
+    v = (value or "").strip()
+    m = ID_RE.match(v)
+    if not m:
+        return v, None
+    return m.group(1), (m.group(2).strip() if m.group(2) else None)
+
+
+def ffloat(x: Optional[str]) -> Optional[float]:
+    try:
+        return float(x)
+    except Exception:
+        return None
+
+
+def fint(x: Optional[str]) -> Optional[int]:
+    try:
+        return int(float(x))
+    except Exception:
+        return None
+
+
+def warn(msg: str):
+    print(f"[WARN] {msg}")
+
+
+def info(msg: str):
+    print(f"[INFO] {msg}")
+
+
+class Heatmap:
+    """一個 stage 的 2D histogram；欄 = 時間 bucket，列 = log10 latency bucket。"""
+
+    def __init__(self, t0: float, bucket_us: float, max_cols: int, lat_min: float, lat_max: float, per_decade: int):
+        self.t0 = t0
+        self.bucket_us = bucket_us
+        self.max_cols = max_cols
+        self.lat_min = lat_min
+        self.per_decade = per_decade
+        self.nrows = int(math.ceil(math.log10(lat_max / lat_min) * per_decade)) + 1
+        self.cols: List[List[int]] = []
+        self.n = 0
+
+    def lat_row(self, lat: float) -> int:
+        if lat <= self.lat_min:
+            return 0
+        r = int(math.log10(lat / self.lat_min) * self.per_decade)
+        return min(r, self.nrows - 1)
+
+    def row_lower_us(self, r: int) -> float:
+        return self.lat_min * 10 ** (r / self.per_decade)
+
+    def _coarsen(self):
+        merged = []
+        for i in range(0, len(self.cols), 2):
+            a = self.cols[i]
+            b = self.cols[i + 1] if i + 1 < len(self.cols) else None
+            merged.append([x + y for x, y in zip(a, b)] if b else a)
+        self.cols = merged
+        self.bucket_us *= 2
+
+    def add(self, ts: float, lat: float):
+        c = int((ts - self.t0) / self.bucket_us)
+        while c >= self.max_cols:
+            self._coarsen()
+            c = int((ts - self.t0) / self.bucket_us)
+        while len(self.cols) <= c:
+            self.cols.append([0] * self.nrows)
+        self.cols[c][self.lat_row(lat)] += 1
+        self.n += 1
+
+    def col_percentile(self, col: List[int], p: float) -> Optional[float]:
+        total = sum(col)
+        if total == 0:
+            return None
+        want = total * p / 100.0
+        acc = 0
+        for r, v in enumerate(col):
+            acc += v
+            if acc >= want:
+                return self.row_lower_us(r + 1)     # bucket 上緣，保守估計
+        return self.row_lower_us(self.nrows)
+
+
+class Builder:
+    def __init__(self, args):
+        self.a = args
+        self.t0: Optional[float] = None
+        self.maps: Dict[str, Heatmap] = {}
+        # RAID 狀態
+        self.root_start: Dict[str, float] = {}          # root i -> t0
+        self.raid_start: Dict[str, float] = {}          # R -> t1
+        self.raid_root: Dict[str, str] = {}             # R -> root i
+        self.child_start: Dict[str, Tuple[float, str]] = {}   # child i -> (t2, R)
+        self.raid_last_child_done: Dict[str, float] = {}      # R -> max t3
+        self.root_raid_done: Dict[str, float] = {}      # root i -> t4
+        # ublk 狀態
+        self.ublk: Dict[Tuple[int, int], Dict[str, float]] = defaultdict(dict)
+        self.ublk_prepped: Dict[int, List[int]] = defaultdict(list)
+        self.purged = 0
+        self.next_purge = None
+
+    def emit(self, stage: str, ts_end: float, lat: float):
+        if lat < 0:
+            return
+        hm = self.maps.get(stage)
+        if hm is None:
+            hm = Heatmap(self.t0, self.a.time_bucket_us, self.a.max_time_buckets,
+                         self.a.lat_min_us, self.a.lat_max_us, self.a.per_decade)
+            self.maps[stage] = hm
+        hm.add(ts_end, lat)
+
+    def purge(self, now: float):
+        """丟掉超過 max_gap 還沒配到的 in-flight 狀態 (trace 頭尾截斷 / 漏事件)。"""
+        limit = now - self.a.max_gap_us
+        for d in (self.root_start, self.raid_start, self.raid_last_child_done, self.root_raid_done):
+            old = [k for k, v in d.items() if v < limit]
+            for k in old:
+                del d[k]
+            self.purged += len(old)
+        old = [k for k, v in self.child_start.items() if v[0] < limit]
+        for k in old:
+            del self.child_start[k]
+        self.purged += len(old)
+        for r in [r for r in self.raid_root if r not in self.raid_start and r not in self.raid_last_child_done]:
+            del self.raid_root[r]
+        old = [k for k, v in self.ublk.items() if v.get("ready", now) < limit]
+        for k in old:
+            del self.ublk[k]
+        self.purged += len(old)
+
+    def feed(self, row: Dict[str, str]):
+        evt = (row.get("event_type") or "").strip()
+        ts = ffloat(row.get("ts"))
+        if ts is None or not evt:
+            return
+        if self.t0 is None:
+            self.t0 = ts
+            self.next_purge = ts + self.a.max_gap_us
+        if ts >= self.next_purge:
+            self.purge(ts)
+            self.next_purge = ts + self.a.max_gap_us
+
+        main = (row.get("id_main") or "").strip()
+        link = (row.get("id_link") or "").strip()
+        if not main:
+            main, link = parse_id(row.get("id", ""))
+            link = link or ""
+
+        if evt == E_BDEV_START:
+            if link.startswith("R"):
+                # child：B.link == A.id
+                t1 = self.raid_start.get(link)
+                if t1 is not None:
+                    self.emit("step2_t2_minus_t1", ts, ts - t1)
+                self.child_start[main] = (ts, link)
+            elif not link or link.startswith("u"):
+                self.root_start[main] = ts
+        elif evt == E_BDEV_DONE:
+            ent = self.child_start.pop(main, None)
+            if ent is not None:
+                t2, r = ent
+                self.emit("step3_t3_minus_t2", ts, ts - t2)
+                if ts > self.raid_last_child_done.get(r, -1.0):
+                    self.raid_last_child_done[r] = ts
+                return
+            t4 = self.root_raid_done.pop(main, None)
+            if t4 is not None:
+                self.emit("step5_t5_minus_t4", ts, ts - t4)
+            self.root_start.pop(main, None)
+        elif evt == E_RAID_START:
+            # R 的 link 是 root：A.link == B.id
+            t0 = self.root_start.get(link)
+            if t0 is not None:
+                self.emit("step1_t1_minus_t0", ts, ts - t0)
+            self.raid_start[main] = ts
+            self.raid_root[main] = link
+        elif evt == E_RAID_DONE:
+            t3 = self.raid_last_child_done.pop(main, None)
+            if t3 is not None:
+                self.emit("step4_t4_minus_t3", ts, ts - t3)
+            self.raid_start.pop(main, None)
+            root = self.raid_root.pop(main, None) or link
+            if root:
+                self.root_raid_done[root] = ts
+        elif evt.startswith("UBLK_"):
+            qid = fint(row.get("qid"))
+            tag = fint(row.get("tag"))
+            if qid is None:
+                return
+            if evt == E_UBLK_COMMIT_SUB:
+                for t in self.ublk_prepped.pop(qid, []):
+                    st = self.ublk.pop((qid, t), {})
+                    if "bdev_done" in st:
+                        self.emit("ublk_done_commit", ts, ts - st["bdev_done"])
+                    if "ready" in st:
+                        self.emit("ublk_ready_commit", ts, ts - st["ready"])
+                return
+            if tag is None:
+                return
+            st = self.ublk[(qid, tag)]
+            if evt == E_UBLK_READY:
+                st.clear()
+                st["ready"] = ts
+            elif evt == E_UBLK_BDEV_SUBMIT:
+                if "ready" in st:
+                    self.emit("ublk_ready_submit", ts, ts - st["ready"])
+                st["submit"] = ts
+            elif evt == E_UBLK_BDEV_DONE:
+                if "submit" in st:
+                    self.emit("ublk_bdev", ts, ts - st["submit"])
+                st["bdev_done"] = ts
+            elif evt == E_UBLK_COMMIT_PREP:
+                self.ublk_prepped[qid].append(tag)
+
+
+def find_spikes(hm: Heatmap, factor: float) -> Tuple[List[Tuple[int, float]], Optional[float]]:
+    """回傳 p99 超過該 stage p99 中位數 factor 倍的時間 bucket，以及 spike 之間的中位間隔 (週期估計)。"""
+    p99 = [(i, hm.col_percentile(c, 99)) for i, c in enumerate(hm.cols)]
+    p99 = [(i, v) for i, v in p99 if v is not None]
+    if not p99:
+        return [], None
+    vals = sorted(v for _, v in p99)
+    med = vals[len(vals) // 2]
+    spikes = [(i, v) for i, v in p99 if v > med * factor]
+    # 連續的 spike bucket 只算一次
+    starts = [i for k, (i, _) in enumerate(spikes) if k == 0 or spikes[k - 1][0] != i - 1]
+    period = None
+    if len(starts) >= 3:
+        gaps = sorted(b - a for a, b in zip(starts, starts[1:]))
+        period = gaps[len(gaps) // 2] * hm.bucket_us
+    return spikes, period
+
+
+def render_png(maps: Dict[str, Heatmap], stages: List[str], path: str):
+    import matplotlib
+    matplotlib.use("Agg")
+    import matplotlib.pyplot as plt
+    from matplotlib.colors import LogNorm
+
+    fig, axes = plt.subplots(len(stages), 1, figsize=(14, 2.8 * len(stages)), squeeze=False)
+    for ax, st in zip(axes[:, 0], stages):
+        hm = maps[st]
+        grid = [[hm.cols[c][r] for c in range(len(hm.cols))] for r in range(hm.nrows)]
+        extent = [hm.t0, hm.t0 + len(hm.cols) * hm.bucket_us, 0, hm.nrows]
+        im = ax.imshow(grid, aspect="auto", origin="lower", extent=extent, interpolation="nearest",
+                       norm=LogNorm(vmin=1), cmap="inferno")
+        ticks = list(range(0, hm.nrows, hm.per_decade))
+        ax.set_yticks(ticks)
+        ax.set_yticklabels([f"{hm.row_lower_us(r):g}" for r in ticks])
+        ax.set_ylabel("latency (us)")
+        ax.set_title(f"{st}  (n={hm.n}, bucket={hm.bucket_us:g}us)")
+        fig.colorbar(im, ax=ax, pad=0.01)
+    axes[-1, 0].set_xlabel("ts (us)")
+    fig.tight_layout()
+    buf = io.BytesIO()
+    fig.savefig(buf, format="png", dpi=110)
+    with open(path, "wb") as f:
+        f.write(buf.getvalue())
+    print(f"[OK] Wrote {path}")
+    return buf.getvalue()
+
+
+def render_html(maps: Dict[str, Heatmap], stages: List[str], path: str, factor: float, png: Optional[bytes]):
+    """不依賴 matplotlib：每個 stage 畫成一張 <table>，顏色用 log(count)。"""
+    out = ["<!DOCTYPE html><html><head><meta charset='utf-8'><title>latency heatmap</title>",
+           "<style>body{font-family:sans-serif} table.hm{border-collapse:collapse}"
+           " table.hm td{width:4px;height:6px;padding:0} td.lbl{font-size:9px;padding-right:4px;width:auto}"
+           " .spk{color:#c00}</style></head><body>"]
+    if png:
+        out.append(f"<img src='data:image/png;base64,{base64.b64encode(png).decode()}'/>")
+    for st in stages:
+        hm = maps[st]
+        peak = max((max(c) for c in hm.cols if c), default=1) or 1
+        spikes, period = find_spikes(hm, factor)
+        out.append(f"<h3>{html.escape(st)}</h3><p>n={hm.n}, time bucket={hm.bucket_us:g}us, "
+                   f"{len(spikes)} buckets with p99 &gt; {factor:g}x median p99")
+        if period:
+            out.append(f", <span class='spk'>spikes repeat every ~{period:g}us</span>")
+        out.append("</p><table class='hm'>")
+        for r in range(hm.nrows - 1, -1, -1):
+            out.append("<tr>")
+            lbl = f"{hm.row_lower_us(r):g}" if r % hm.per_decade == 0 else ""
+            out.append(f"<td class='lbl'>{lbl}</td>")
+            for c in hm.cols:
+                v = c[r]
+                if v == 0:
+                    out.append("<td></td>")
+                    continue
+                k = math.log1p(v) / math.log1p(peak)
+                out.append(f"<td style='background:rgb({int(255 * k)},{int(80 * k)},{int(255 * (1 - k) * 0.6)})' "
+                           f"title='{v}'></td>")
+            out.append("</tr>")
+        out.append("</table>")
+        if spikes:
+            out.append("<p class='spk'>spike buckets (ts_us: p99_us): " + ", ".join(
+                f"{hm.t0 + i * hm.bucket_us:.0f}: {v:.1f}" for i, v in spikes[:50]) + "</p>")
+    out.append("</body></html>")
+    with open(path, "w", encoding="utf-8") as f:
+        f.write("".join(out))
+    print(f"[OK] Wrote {path}")
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Per-stage latency-over-time heatmaps from an SPDK trace CSV "
+                                             "(single pass, bounded memory).")
+    ap.add_argument("csv_in", help="Input CSV produced by parser_new.py")
+    ap.add_argument("--png", default="latency_heatmap.png", help="Output PNG (needs matplotlib; '' to skip)")
+    ap.add_argument("--html", default="latency_heatmap.html", help="Output HTML ('' to skip)")
+    ap.add_argument("--csv", default=None, help="Optional long-format CSV: stage,time_bucket_us,lat_bucket_us,count")
+    ap.add_argument("--time-bucket-us", type=float, default=1000.0, help="Initial time bucket width (default 1000us)")
+    ap.add_argument("--max-time-buckets", type=int, default=600,
+                    help="Merge neighbouring time buckets when more than this (default 600)")
+    ap.add_argument("--lat-min-us", type=float, default=0.1)
+    ap.add_argument("--lat-max-us", type=float, default=100000.0)
+    ap.add_argument("--per-decade", type=int, default=10, help="Latency buckets per decade (default 10)")
+    ap.add_argument("--max-gap-us", type=float, default=5000.0,
+                    help="Drop unmatched in-flight state older than this (default 5000us, same as latency_plus.py)")
+    ap.add_argument("--spike-factor", type=float, default=3.0,
+                    help="Flag time buckets whose p99 exceeds this multiple of the stage's median p99 (default 3)")
+    args = ap.parse_args()
+
+    b = Builder(args)
+    rows = 0
+    with open(args.csv_in, "r", encoding="utf-8", errors="replace") as f:
+        for row in csv.DictReader(f):
+            rows += 1
+            b.feed(row)
+
+    stages = [s for s in STAGE_ORDER if s in b.maps]
+    if not stages:
+        warn("no stage pairs matched; check that RAID or UBLK tpoints are enabled")
+        return
+    info(f"rows={rows} stages={len(stages)} dropped_unmatched={b.purged}")
+
+    for st in stages:
+        hm = b.maps[st]
+        spikes, period = find_spikes(hm, args.spike_factor)
+        msg = f"{st:<20} n={hm.n:<9} spike_buckets={len(spikes)}"
+        if period:
+            msg += f" period~{period:g}us"
+        print(msg)
+
+    if args.csv:
+        with open(args.csv, "w", newline="", encoding="utf-8") as f:
+            w = csv.writer(f)
+            w.writerow(["stage", "time_bucket_us", "lat_bucket_us", "count"])
+            for st in stages:
+                hm = b.maps[st]
+                for c, col in enumerate(hm.cols):
+                    for r, v in enumerate(col):
+                        if v:
+                            w.writerow([st, f"{hm.t0 + c * hm.bucket_us:.3f}", f"{hm.row_lower_us(r):.4g}", v])
+        print(f"[OK] Wrote {args.csv}")
+
+    png = None
+    if args.png:
+        try:
+            png = render_png(b.maps, stages, args.png)
+        except ImportError:
+            warn("matplotlib not available, skip PNG")
+    if args.html:
+        render_html(b.maps, stages, args.html, args.spike_factor, png)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,408 @@
+#!/usr/bin/env python3
+"""
+從 parser_new.py 產生的 trace CSV，用「單次串流」重建 outstanding IO 的時間序列：
+
+  dev:<obj>        每個 bdev (trace 的 obj 欄) 上 BDEV_IO_START→BDEV_IO_DONE 的 outstanding 數
+  core:<core>      依送出 IO 的 core 分
+  ublk_q<qid>      ublk tag occupancy：tag 從 UBLK_REQ_READY 到被 COMMIT_SUBMIT 還給 kernel 之間算「在 SPDK 手上」
+  stage:<name>     每個 ublk IO 目前所在的階段
+                     kernel   : COMMIT_SUBMIT → 同一個 tag 的下一個 REQ_READY (kernel 來回 + 閒置)
+                     dispatch : REQ_READY → BDEV_SUBMIT (扣掉 buf_wait)
+                     buf_wait : UBLK_BUF_WAIT_BEGIN → DONE (iobuf 不足)
+                     bdev     : UBLK_BDEV_SUBMIT → UBLK_BDEV_DONE (含 device)
+                     device   : BDEV_NVME_IO_START → DONE (有開 bdev_nvme tpoint 才有)
+                     complete : UBLK_BDEV_DONE → UBLK_COMMIT_PREP
+                     commit   : UBLK_COMMIT_PREP → 該 queue 下一次 (batched) COMMIT_SUBMIT
+
+輸出：
+  --output        長表 CSV：bin_start_us, series, avg_outstanding (時間加權), max_outstanding
+  --summary       每條 series 的 Little's law 檢查：L(時間平均) vs λ·W，與 trace 自帶 qd 參數的平均
+  --png           (選用) 畫出 timeline，需要 pandas + matplotlib
+
+只保留 in-flight 的 IO 與每條 series 目前 bin 的累計值，記憶體跟 trace 長度無關。
+輸入需依 ts 排序 (spdk_trace 的輸出本來就是)；時間倒退的列會被丟掉並計數。
+"""
+import argparse
+import csv
+import re
+from collections import defaultdict
+from typing import Dict, List, Optional, Tuple
+
+E_BDEV_START = "BDEV_IO_START"
+E_BDEV_DONE  = "BDEV_IO_DONE"
+E_NVME_START = "BDEV_NVME_IO_START"
+E_NVME_DONE  = "BDEV_NVME_IO_DONE"
+
+E_UBLK_READY       = "UBLK_REQ_READY"
+E_UBLK_BUF_BEGIN   = "UBLK_BUF_WAIT_BEGIN"
+E_UBLK_BUF_DONE    = "UBLK_BUF_WAIT_DONE"
+E_UBLK_BDEV_SUBMIT = "UBLK_BDEV_SUBMIT"
+E_UBLK_BDEV_DONE   = "UBLK_BDEV_DONE"
+E_UBLK_COMMIT_PREP = "UBLK_COMMIT_PREP"
+E_UBLK_COMMIT_SUB  = "UBLK_COMMIT_SUBMIT"
+
+STAGES = ["kernel", "dispatch", "buf_wait", "bdev", "device", "complete", "commit"]
+
+# 與 latency_plus.py 相同：允許一次括號 "i232 (R73)"
+ID_RE = re.compile(r"^\s*(\S+)(?:\s*\(\s*([^)]+)\s*\)\s*)?$")
+
+
+def parse_id(value: str) -> Tuple[str, Optional[str]]:
+    v = (value or "").strip()
+    m = ID_RE.match(v)
+    if not m:
+        return v, None
+    return m.group(1), (m.group(2).strip() if m.group(2) else None)
+
+
+def ffloat(x: Optional[str]) -> Optional[float]:
+    try:
+        return float(x)
+    except Exception:
+        return None
+
+
+def fint(x: Optional[str]) -> Optional[int]:
+    try:
+        return int(float(x))
+    except Exception:
+        return None
+
+
+def warn(msg: str):
+    print(f"[WARN] {msg}")
+
+
+def info(msg: str):
+    print(f"[INFO] {msg}")
+
+
+class Series:
+    """
+    一條 outstanding 計數的時間序列。
+    只在數值改變時推進：把 [last_ts, ts) 的 count 累積進對應 bin，跨過的 bin 直接寫出。
+    """
+
+    def __init__(self, name: str, bin_us: float, t0: float, writer):
+        self.name = name
+        self.bin_us = bin_us
+        self.t0 = t0
+        self.w = writer
+        self.count = 0
+        self.last_ts = t0
+        self.bin_idx = 0
+        self.bin_area = 0.0
+        self.bin_max = 0
+        # Little's law 用的整段統計
+        self.area = 0.0
+        self.max = 0
+        self.done = 0
+        self.resid_sum = 0.0
+        self.qd_arg_sum = 0.0
+        self.qd_arg_cnt = 0
+        self.sat_us = 0.0           # count >= sat_level 的時間 (ublk tag 用)
+        self.sat_level = 0
+
+    def _flush_bin(self):
+        self.w.writerow([f"{self.t0 + self.bin_idx * self.bin_us:.3f}", self.name,
+                         f"{self.bin_area / self.bin_us:.4f}", self.bin_max])
+
+    def advance(self, ts: float):
+        if ts <= self.last_ts:
+            return
+        dt = ts - self.last_ts
+        self.area += self.count * dt
+        if self.sat_level and self.count >= self.sat_level:
+            self.sat_us += dt
+
+        t = self.last_ts
+        while True:
+            bin_end = self.t0 + (self.bin_idx + 1) * self.bin_us
+            if ts < bin_end:
+                self.bin_area += self.count * (ts - t)
+                break
+            self.bin_area += self.count * (bin_end - t)
+            self._flush_bin()
+            t = bin_end
+            self.bin_idx += 1
+            self.bin_area = 0.0
+            self.bin_max = self.count
+        self.last_ts = ts
+
+    def add(self, ts: float, delta: int):
+        self.advance(ts)
+        self.count += delta
+        if self.count < 0:
+            # 抓 trace 時 IO 已經在飛，DONE 比 START 先出現
+            self.count = 0
+        self.bin_max = max(self.bin_max, self.count)
+        self.max = max(self.max, self.count)
+
+    def finish(self, ts: float):
+        self.advance(ts)
+        if self.bin_area > 0 or self.bin_max > 0:
+            self._flush_bin()
+
+
+class Timeline:
+    def __init__(self, bin_us: float, writer, ublk_qdepth: int):
+        self.bin_us = bin_us
+        self.w = writer
+        self.ublk_qdepth = ublk_qdepth
+        self.t0: Optional[float] = None
+        self.series: Dict[str, Series] = {}
+
+    def get(self, name: str) -> Series:
+        s = self.series.get(name)
+        if s is None:
+            s = Series(name, self.bin_us, self.t0, self.w)
+            if name.startswith("ublk_q"):
+                s.sat_level = self.ublk_qdepth
+            self.series[name] = s
+        return s
+
+    def start(self, name: str, ts: float):
+        self.get(name).add(ts, +1)
+
+    def end(self, name: str, ts: float, t_begin: Optional[float]):
+        s = self.get(name)
+        s.add(ts, -1)
+        if t_begin is not None:
+            s.done += 1
+            s.resid_sum += ts - t_begin
+
+    def qd_arg(self, name: str, qd: Optional[int]):
+        if qd is None:
+            return
+        s = self.get(name)
+        s.qd_arg_sum += qd
+        s.qd_arg_cnt += 1
+
+
+class UblkIo:
+    __slots__ = ("stage", "stage_ts")
+
+    def __init__(self):
+        self.stage: Optional[str] = None
+        self.stage_ts = 0.0
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Reconstruct per-device/queue/core outstanding IO and ublk tag "
+                                             "occupancy timelines from an SPDK trace CSV (single pass).")
+    ap.add_argument("csv_in", help="Input CSV produced by parser_new.py")
+    ap.add_argument("--output", default="qd_timeline.csv", help="Timeline CSV (long format)")
+    ap.add_argument("--summary", default="qd_summary.csv", help="Per-series Little's law summary CSV")
+    ap.add_argument("--bin-us", type=float, default=100.0, help="Timeline bin width in us (default 100)")
+    ap.add_argument("--ublk-qdepth", type=int, default=128,
+                    help="ublk queue depth; time with all tags in SPDK counts as kernel-side queueing (default 128)")
+    ap.add_argument("--png", default=None, help="Optional PNG of the timelines (needs pandas + matplotlib)")
+    ap.add_argument("--series", default="dev:,core:,ublk_q,stage:",
+                    help="Comma separated series name prefixes to plot (default: all)")
+    args = ap.parse_args()
+
+    fout = open(args.output, "w", newline="", encoding="utf-8")
+    w = csv.writer(fout)
+    w.writerow(["bin_start_us", "series", "avg_outstanding", "max_outstanding"])
+    tl = Timeline(args.bin_us, w, args.ublk_qdepth)
+
+    # in-flight 狀態
+    bdev_inflight: Dict[str, Tuple[float, str, str]] = {}       # id_main -> (ts, dev series, core series)
+    nvme_inflight: Dict[str, float] = {}                        # id_main -> ts
+    ublk_io: Dict[Tuple[int, int], UblkIo] = defaultdict(UblkIo)
+    ublk_tag_ts: Dict[Tuple[int, int], float] = {}              # tag 進入 SPDK 的時間
+    ublk_prepped: Dict[int, List[int]] = defaultdict(list)      # qid -> 等 batched COMMIT_SUBMIT 的 tags
+
+    rows = 0
+    backwards = 0
+    orphan_done = 0
+    last_ts = None
+
+    def stage_to(io: UblkIo, stage: Optional[str], ts: float):
+        if io.stage is not None:
+            tl.end("stage:" + io.stage, ts, io.stage_ts)
+        io.stage = stage
+        io.stage_ts = ts
+        if stage is not None:
+            tl.start("stage:" + stage, ts)
+
+    with open(args.csv_in, "r", encoding="utf-8", errors="replace") as f:
+        for row in csv.DictReader(f):
+            rows += 1
+            evt = (row.get("event_type") or "").strip()
+            ts = ffloat(row.get("ts"))
+            if ts is None or not evt:
+                continue
+            if last_ts is not None and ts < last_ts:
+                backwards += 1
+                continue
+            last_ts = ts
+            if tl.t0 is None:
+                tl.t0 = ts
+
+            id_main = (row.get("id_main") or "").strip()
+            if not id_main:
+                id_main, _ = parse_id(row.get("id", ""))
+            core = (row.get("core") or "").strip()
+
+            if evt == E_BDEV_START:
+                dev = "dev:" + ((row.get("obj") or "").strip() or "?")
+                cs = "core:" + core
+                bdev_inflight[id_main] = (ts, dev, cs)
+                tl.start(dev, ts)
+                tl.start(cs, ts)
+                qd = fint(row.get("qd"))
+                tl.qd_arg(dev, qd)
+                tl.qd_arg(cs, qd)
+
+            elif evt == E_BDEV_DONE:
+                ent = bdev_inflight.pop(id_main, None)
+                if ent is None:
+                    orphan_done += 1
+                    continue
+                t_begin, dev, cs = ent
+                tl.end(dev, ts, t_begin)
+                tl.end(cs, ts, t_begin)
+
+            elif evt == E_NVME_START:
+                nvme_inflight[id_main] = ts
+                tl.start("stage:device", ts)
+
+            elif evt == E_NVME_DONE:
+                t_begin = nvme_inflight.pop(id_main, None)
+                if t_begin is None:
+                    orphan_done += 1
+                    continue
+                tl.end("stage:device", ts, t_begin)
+
+            elif evt.startswith("UBLK_"):
+                qid = fint(row.get("qid"))
+                tag = fint(row.get("tag"))
+                if qid is None:
+                    continue
+
+                if evt == E_UBLK_COMMIT_SUB:
+                    # batched：該 queue 所有已 prep 的 tag 一起還給 kernel
+                    qs = f"ublk_q{qid}"
+                    for t in ublk_prepped.pop(qid, []):
+                        key = (qid, t)
+                        io = ublk_io[key]
+                        stage_to(io, "kernel", ts)
+                        tl.end(qs, ts, ublk_tag_ts.pop(key, None))
+                    continue
+
+                if tag is None:
+                    continue
+                key = (qid, tag)
+                io = ublk_io[key]
+
+                if evt == E_UBLK_READY:
+                    if key in ublk_tag_ts:
+                        warn(f"ublk q{qid} tag {tag}: REQ_READY while still in SPDK at ts={ts}")
+                    else:
+                        ublk_tag_ts[key] = ts
+                        tl.start(f"ublk_q{qid}", ts)
+                    # 第一次看到的 tag 沒有 kernel stage 可結算 (之前在 kernel 待多久未知)
+                    stage_to(io, "dispatch", ts)
+                elif evt == E_UBLK_BUF_BEGIN:
+                    stage_to(io, "buf_wait", ts)
+                elif evt == E_UBLK_BUF_DONE:
+                    stage_to(io, "dispatch", ts)
+                elif evt == E_UBLK_BDEV_SUBMIT:
+                    stage_to(io, "bdev", ts)
+                elif evt == E_UBLK_BDEV_DONE:
+                    stage_to(io, "complete", ts)
+                elif evt == E_UBLK_COMMIT_PREP:
+                    stage_to(io, "commit", ts)
+                    ublk_prepped[qid].append(tag)
+
+    if tl.t0 is None:
+        warn("no usable rows")
+        fout.close()
+        return
+
+    t_end = last_ts
+    for s in tl.series.values():
+        s.finish(t_end)
+    fout.close()
+
+    info(f"rows={rows} backwards_dropped={backwards} done_without_start={orphan_done} "
+         f"still_inflight(bdev)={len(bdev_inflight)} span={t_end - tl.t0:.1f}us")
+
+    # ---- Little's law: L (時間平均 outstanding) vs λ·W ----
+    span_us = max(t_end - tl.t0, 1e-9)
+    summary_fields = ["series", "L_time_avg", "max_outstanding", "completed", "throughput_per_s",
+                      "W_mean_us", "lambda_x_W", "L_over_lambdaW", "qd_arg_avg", "saturated_pct"]
+    with open(args.summary, "w", newline="", encoding="utf-8") as f:
+        sw = csv.DictWriter(f, fieldnames=summary_fields)
+        sw.writeheader()
+        for name in sorted(tl.series):
+            s = tl.series[name]
+            L = s.area / span_us
+            lam = s.done / span_us                      # per us
+            W = s.resid_sum / s.done if s.done else 0.0
+            lw = lam * W
+            sw.writerow({
+                "series": name,
+                "L_time_avg": f"{L:.4f}",
+                "max_outstanding": s.max,
+                "completed": s.done,
+                "throughput_per_s": f"{lam * 1e6:.1f}",
+                "W_mean_us": f"{W:.3f}",
+                "lambda_x_W": f"{lw:.4f}",
+                "L_over_lambdaW": f"{L / lw:.3f}" if lw > 0 else "",
+                "qd_arg_avg": f"{s.qd_arg_sum / s.qd_arg_cnt:.2f}" if s.qd_arg_cnt else "",
+                "saturated_pct": f"{s.sat_us * 100.0 / span_us:.2f}" if s.sat_level else "",
+            })
+            # 比值偏離 1 表示 trace 沒涵蓋整段 (頭尾 IO 被截斷) 或 START/DONE 配錯
+            if lw > 0 and abs(L / lw - 1.0) > 0.1:
+                warn(f"{name}: Little's law mismatch L={L:.3f} vs lambda*W={lw:.3f}")
+
+    # ---- queueing 累積在哪一層 ----
+    print("stage      L_avg    W_mean_us")
+    for st in STAGES:
+        s = tl.series.get("stage:" + st)
+        if s is None:
+            continue
+        W = s.resid_sum / s.done if s.done else 0.0
+        print(f"{st:<9} {s.area / span_us:7.3f}  {W:10.3f}")
+    for name in sorted(n for n in tl.series if n.startswith("ublk_q")):
+        s = tl.series[name]
+        if s.sat_us > 0:
+            print(f"{name}: all {args.ublk_qdepth} tags held by SPDK for {s.sat_us * 100.0 / span_us:.2f}% "
+                  f"of the trace -> new requests queue in the kernel")
+
+    print(f"[OK] Wrote timeline to {args.output}, summary to {args.summary}")
+
+    if args.png:
+        plot_png(args.output, args.png, [p for p in args.series.split(",") if p])
+
+
+def plot_png(csv_path: str, png_path: str, prefixes: List[str]):
+    import pandas as pd
+    import matplotlib.pyplot as plt
+
+    df = pd.read_csv(csv_path)
+    groups = [(p, df[df["series"].str.startswith(p)]) for p in prefixes]
+    groups = [(p, g) for p, g in groups if not g.empty]
+    if not groups:
+        warn("nothing to plot")
+        return
+
+    fig, axes = plt.subplots(len(groups), 1, figsize=(14, 3.2 * len(groups)), sharex=True, squeeze=False)
+    for ax, (p, g) in zip(axes[:, 0], groups):
+        for name, sg in g.groupby("series"):
+            sg = sg.sort_values("bin_start_us")
+            ax.step(sg["bin_start_us"], sg["avg_outstanding"], where="post", label=name, linewidth=0.8)
+        ax.set_ylabel("outstanding")
+        ax.set_title(p.rstrip(":"))
+        ax.legend(loc="upper right", fontsize=7, ncol=4)
+        ax.grid(True, alpha=0.3)
+    axes[-1, 0].set_xlabel("ts (us)")
+    fig.tight_layout()
+    fig.savefig(png_path, dpi=120)
+    print(f"[OK] Wrote {png_path}")
+
+
+if __name__ == "__main__":
+    main()
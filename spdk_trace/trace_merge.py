@@ -0,0 +1,500 @@
+#!/usr/bin/env python3
+"""
+多個 process 的 SPDK trace 合併：對齊時鐘、跨 transport 把同一個 IO 接起來，拆成一條 latency breakdown
+
+tmp1.txt 的 virtio-user → vhost target、memo.txt 的 NVMe-oF TCP loopback (nvmf_tgt + spdk_tgt 的 bdev_nvme)
+都是兩個 process，各自有一份 trace，單一檔案的分析 (latency*.py / qd_timeline.py) 只看得到一半。這支把它們接起來：
+
+1) 輸入：每份 trace 一個名字，--trace host=host.csv --trace tgt=tgt.json
+     .csv   parser_new.py 的輸出 (ts 是相對該檔第一筆的 us，時鐘要靠下面的 offset 對齊)
+     .json  spdk_trace -j 的輸出 (帶原始 tsc，同一台機器的 process 共用 TSC，直接對齊)
+
+2) span：每個 process 裡的一段「start event → end event」，同一個 object (id_main) 配對，
+     --span host:nvme=NVME_TCP_SUBMIT,NVME_TCP_COMPLETE,cid
+   第三欄是 key (event 的 argument 名)，跨 process 時用它配對 (NVMe-oF 的 command id)；
+   span 依序由外 (initiator) 到內 (target bdev) 排，相鄰兩個 span：
+     同一個 process   同一個 core、內層的時間落在外層裡面，挑還沒被用過、前後留白最小的 (--any-core 不看 core)
+     不同 process     key 相同 + 時間落在外層裡面 (對齊後)；沒有 key 就只看時間 (QD>1 時會有 ambiguous)
+   --profile nvmf-tcp 等於
+     host:bdev=BDEV_IO_START,BDEV_IO_DONE
+     host:nvme=NVME_TCP_SUBMIT,NVME_TCP_COMPLETE,cid
+     tgt:tcp=TCP_REQ_NEW,TCP_REQ_COMPLETED,cid
+     tgt:bdev=BDEV_IO_START,BDEV_IO_DONE
+   --profile vhost-blk 等於
+     host:bdev=BDEV_IO_START,BDEV_IO_DONE,offset     (virtio-user 的 bdev，例如 VirtioUser0)
+     tgt:bdev=BDEV_IO_START,BDEV_IO_DONE,offset      (vhost target 後面的 bdev)
+   bdev_virtio 和 vhost-blk 都沒有 tracepoint，帶不出 virtio descriptor index；
+   virtio-blk 的 sector 原封不動傳到 target，兩邊 block size 也一樣，所以改用 BDEV_IO_START 的 offset (LBA) 當 key。
+   同一個 LBA 同時有兩個 IO 在飛時會 ambiguous；舊版 SPDK 的 BDEV_IO_START 沒有 offset，會退回只看時間
+   trace 裡沒有 event 的 span 會跳過 (例如沒開 bdev tpoint)；其他 transport 用 --span 指定
+
+3) 時鐘：
+     兩邊都是 .json             offset 0 (共用 TSC)
+     其他                       用有 key 的跨 process 配對估 offset：每一對 (外層 p, 內層 c) 要求
+                                  p.start <= c.start + off 且 c.end + off <= p.end
+                                即 off 在 [p.start - c.start, p.end - c.end]，所有候選區間重疊最多的地方取中點
+                                (真的配對都落在同一段，cid 重複用造成的假配對各自散開)
+     --offset tgt=123.4         手動 (us，加到該 trace 的時間上)，優先於上面兩種
+
+4) 輸出：
+     --output      每個接起來的 IO 一列：各 span 的 start / end (對齊後 us) 和各段時間
+                   段落：a->b (往下送) ... 最內層 span 本身 ... b->a_ret (完成往回)，加起來等於 total
+     --timeline    (可選) 所有 event 依對齊後時間排序，加 src 欄
+     stdout        各段 avg / p50 / p99 / 佔 total 的比例，沒接起來的數量
+"""
+import argparse
+import bisect
+import csv
+import json
+import random
+from collections import defaultdict
+from typing import Dict, List, Optional, Tuple
+
+PROFILES = {
+    "nvmf-tcp": [
+        "host:bdev=BDEV_IO_START,BDEV_IO_DONE",
+        "host:nvme=NVME_TCP_SUBMIT,NVME_TCP_COMPLETE,cid",
+        "tgt:tcp=TCP_REQ_NEW,TCP_REQ_COMPLETED,cid",
+        "tgt:bdev=BDEV_IO_START,BDEV_IO_DONE",
+    ],
+    "vhost-blk": [
+        "host:bdev=BDEV_IO_START,BDEV_IO_DONE,offset",
+        "tgt:bdev=BDEV_IO_START,BDEV_IO_DONE,offset",
+    ],
+}
+
+OFFSET_SAMPLE = 500     # 估 offset 時抽幾個內層 span
+
+
+def warn(msg: str):
+    print(f"[WARN] {msg}")
+
+
+def info(msg: str):
+    print(f"[INFO] {msg}")
+
+
+def ffloat(x) -> Optional[float]:
+    try:
+        return float(x)
+    except Exception:
+        return None
+
+
+def percentile(sorted_vals: List[float], p: float) -> Optional[float]:
+    # 與 spdk_trace_latency_noDuplicate.py 相同的線性內插
+    if not sorted_vals:
+        return None
+    k = (len(sorted_vals) - 1) * (p / 100.0)
+    f = int(k)
+    c = min(f + 1, len(sorted_vals) - 1)
+    if f == c:
+        return sorted_vals[f]
+    return sorted_vals[f] + (sorted_vals[c] - sorted_vals[f]) * (k - f)
+
+
+# ---------------------------------------------------------------------------
+# 讀 trace
+# ---------------------------------------------------------------------------
+class Trace:
+    def __init__(self, name: str, path: str):
+        self.name = name
+        self.path = path
+        self.absolute = False       # ts 是不是絕對 TSC 換算的 (json)
+        self.offset = 0.0
+        self.events: List[Dict[str, str]] = []
+
+
+def load_csv(tr: Trace):
+    with open(tr.path, "r", newline="") as f:
+        for row in csv.DictReader(f):
+            if ffloat(row.get("ts")) is None or not row.get("event_type"):
+                continue
+            tr.events.append(row)
+
+
+def load_json(tr: Trace):
+    """spdk_trace -j：header 有 tsc_rate 和 tpoint 定義 (名字、argument 名)，entries 帶原始 tsc"""
+    with open(tr.path, "r") as f:
+        doc = json.load(f)
+    tsc_rate = ffloat(doc.get("tsc_rate"))
+    if not tsc_rate:
+        raise SystemExit(f"ERROR: {tr.path}: no tsc_rate in json header")
+
+    tpoints: Dict[int, Tuple[str, List[str]]] = {}
+    defs = doc.get("tpoints", [])
+    if isinstance(defs, dict):
+        defs = [dict(v, name=k) if isinstance(v, dict) else {"name": k, "id": v} for k, v in defs.items()]
+    for d in defs:
+        args = [a.get("name", f"arg{i}") if isinstance(a, dict) else str(a) for i, a in enumerate(d.get("args", []))]
+        tpoints[int(d.get("id", -1))] = (d.get("name", ""), args)
+
+    for e in doc.get("entries", []):
+        tp = tpoints.get(int(e.get("tpoint", -1)))
+        if tp is None or "tsc" not in e:
+            continue
+        name, argnames = tp
+        row = {
+            "core": str(e.get("lcore", "")),
+            "ts": repr(int(e["tsc"]) * 1e6 / tsc_rate),
+            "event_type": name,
+            "obj": "",
+            "id_main": str(e.get("object_id", "")),
+            "id_link": str(e.get("related", "")) if e.get("related") is not None else "",
+        }
+        for i, v in enumerate(e.get("args", [])):
+            row[argnames[i] if i < len(argnames) else f"arg{i}"] = str(v)
+        tr.events.append(row)
+    tr.absolute = True
+
+
+def load_trace(spec: str) -> Trace:
+    if "=" not in spec:
+        raise SystemExit(f"ERROR: --trace wants name=path, got '{spec}'")
+    name, path = spec.split("=", 1)
+    tr = Trace(name, path)
+    if path.endswith(".json"):
+        load_json(tr)
+    else:
+        load_csv(tr)
+    tr.events.sort(key=lambda r: float(r["ts"]))
+    info(f"{name}: {len(tr.events)} events from {path}{' (absolute tsc)' if tr.absolute else ''}")
+    return tr
+
+
+# ---------------------------------------------------------------------------
+# span
+# ---------------------------------------------------------------------------
+class SpanDef:
+    def __init__(self, spec: str):
+        try:
+            head, body = spec.split("=", 1)
+            self.trace, self.name = head.split(":", 1)
+            parts = body.split(",")
+            self.start_ev, self.end_ev = parts[0], parts[1]
+            self.key = parts[2] if len(parts) > 2 and parts[2] else None
+        except (ValueError, IndexError):
+            raise SystemExit(f"ERROR: --span wants trace:name=START,END[,key], got '{spec}'")
+        self.label = f"{self.trace}.{self.name}"
+
+
+class Span:
+    __slots__ = ("start", "end", "core", "obj", "key", "used")
+
+    def __init__(self, start: float, end: float, core: str, obj: str, key: Optional[str]):
+        self.start = start
+        self.end = end
+        self.core = core
+        self.obj = obj
+        self.key = key
+        self.used = False
+
+
+def build_spans(tr: Trace, sd: SpanDef) -> List[Span]:
+    """同一個 id_main 的 start → end 配成一個 span；key 從 start 拿，start 沒有就從 end 拿"""
+    open_: Dict[str, Tuple[float, str, Optional[str]]] = {}
+    spans: List[Span] = []
+    dup = 0
+    for r in tr.events:
+        ev = r["event_type"]
+        if ev != sd.start_ev and ev != sd.end_ev:
+            continue
+        obj = r.get("id_main", "")
+        if not obj or obj.upper() == "N/A":
+            continue
+        ts = float(r["ts"])
+        key = (r.get(sd.key) or None) if sd.key else None
+        if ev == sd.start_ev:
+            if obj in open_:
+                dup += 1
+            open_[obj] = (ts, r.get("core", ""), key)
+        elif obj in open_:
+            st, core, k = open_.pop(obj)
+            spans.append(Span(st, ts, core, obj, k if k is not None else key))
+    if dup:
+        warn(f"{sd.label}: {dup} {sd.start_ev} without {sd.end_ev} (object reused)")
+    if sd.key and spans and all(s.key is None for s in spans):
+        warn(f"{sd.label}: no '{sd.key}' argument on {sd.start_ev}/{sd.end_ev}, joining by time only")
+        for s in spans:
+            s.key = None
+        # join_chain / offset 估計看的是 SpanDef.key，這裡也要清掉，不然會拿 None 去找 key 分組
+        sd.key = None
+    spans.sort(key=lambda s: s.start)
+    return spans
+
+
+# ---------------------------------------------------------------------------
+# 時鐘對齊
+# ---------------------------------------------------------------------------
+def estimate_offset(outer: List[Span], inner: List[Span], seed: int = 1) -> Optional[Tuple[float, int, int]]:
+    """回傳 (加到 inner 時間上的 offset, 支持的配對數, 抽樣數)；沒有 key 時估不出來"""
+    by_key: Dict[str, List[Span]] = defaultdict(list)
+    for p in outer:
+        if p.key is not None:
+            by_key[p.key].append(p)
+    cand = [c for c in inner if c.key is not None and c.key in by_key]
+    if not cand:
+        return None
+    if len(cand) > OFFSET_SAMPLE:
+        cand = random.Random(seed).sample(cand, OFFSET_SAMPLE)
+
+    pts: List[Tuple[float, int]] = []
+    for c in cand:
+        dur = c.end - c.start
+        for p in by_key[c.key]:
+            if p.end - p.start >= dur:
+                pts.append((p.start - c.start, 0))      # 0 = 進入，同一點先進後出
+                pts.append((p.end - c.end, 1))
+    if not pts:
+        return None
+    pts.sort()
+    best = cur = 0
+    lo = hi = 0.0
+    for i, (x, kind) in enumerate(pts):
+        if kind == 0:
+            cur += 1
+            if cur > best:
+                best = cur
+                lo = x
+                hi = next((y for y, k in pts[i + 1:] if k == 1), x)
+        else:
+            cur -= 1
+    return (lo + hi) / 2, best, len(cand)
+
+
+# ---------------------------------------------------------------------------
+# 配對
+# ---------------------------------------------------------------------------
+class Joiner:
+    """把 inner span 掛到 outer span 底下；outer 依 key (沒有 key 就全部一組) 分組，用 start 二分搜尋"""
+
+    def __init__(self, outer: List[Span], use_key: bool, same_core: bool):
+        self.use_key = use_key
+        self.same_core = same_core
+        self.groups: Dict[object, Tuple[List[float], List[Span]]] = {}
+        tmp: Dict[object, List[Span]] = defaultdict(list)
+        for p in outer:
+            tmp[self._gk(p)].append(p)
+        for k, lst in tmp.items():
+            self.groups[k] = ([p.start for p in lst], lst)
+        self.max_dur = max((p.end - p.start for p in outer), default=0.0)
+        self.ambiguous = 0
+
+    def _gk(self, s: Span):
+        k = s.key if self.use_key else None
+        return (k, s.core) if self.same_core else k
+
+    def find(self, c: Span, off: float) -> Optional[Span]:
+        g = self.groups.get(self._gk(c))
+        if g is None:
+            return None
+        starts, lst = g
+        cs, ce = c.start + off, c.end + off
+        i = bisect.bisect_right(starts, cs) - 1
+        hit = None
+        best = 0.0
+        n = 0
+        while i >= 0 and starts[i] >= cs - self.max_dur:
+            p = lst[i]
+            if not p.used and p.end >= ce:
+                # 前後留白加起來最小的 (QD>1 時後面開始的外層 span 也可能包住它)
+                slack = (cs - p.start) + (p.end - ce)
+                n += 1
+                if hit is None or slack < best:
+                    hit, best = p, slack
+            i -= 1
+        if n > 1:
+            self.ambiguous += 1
+        return hit
+
+
+def join_chain(defs: List[SpanDef], spans: Dict[str, List[Span]], offsets: Dict[str, float],
+               any_core: bool) -> List[List[Span]]:
+    """由最內層往外接，每個最內層 span 往上找到最外層才算一個完整的 IO"""
+    chains: List[List[Optional[Span]]] = [[s] for s in spans[defs[-1].label]]
+    for lvl in range(len(defs) - 2, -1, -1):
+        od, idf = defs[lvl], defs[lvl + 1]
+        cross = od.trace != idf.trace
+        use_key = cross and od.key is not None and idf.key is not None
+        # 同一個 process 裡外層 / 內層在同一個 thread 上 (nvmf poll group、bdev_nvme 的 channel)
+        j = Joiner(spans[od.label], use_key, same_core=not cross and not any_core)
+        off = offsets[idf.trace] - offsets[od.trace]
+        nxt = []
+        miss = 0
+        for ch in chains:
+            p = j.find(ch[0], off)
+            if p is None:
+                miss += 1
+                continue
+            p.used = True
+            nxt.append([p] + ch)
+        info(f"join {od.label} <- {idf.label}: {len(nxt)} matched, {miss} unmatched"
+             f"{f', {j.ambiguous} ambiguous' if j.ambiguous else ''}"
+             f"{' (by ' + od.key + ')' if use_key else ''}")
+        chains = nxt
+    return chains
+
+
+# ---------------------------------------------------------------------------
+# main
+# ---------------------------------------------------------------------------
+def segment_names(labels: List[str]) -> List[str]:
+    n = len(labels)
+    names = [f"{labels[i]}->{labels[i + 1]}" for i in range(n - 1)]
+    names.append(labels[-1])
+    names += [f"{labels[i + 1]}->{labels[i]}_ret" for i in range(n - 2, -1, -1)]
+    return names
+
+
+def segments(ch: List[Tuple[float, float]]) -> List[float]:
+    n = len(ch)
+    seg = [ch[i + 1][0] - ch[i][0] for i in range(n - 1)]
+    seg.append(ch[-1][1] - ch[-1][0])
+    seg += [ch[i][1] - ch[i + 1][1] for i in range(n - 2, -1, -1)]
+    return seg
+
+
+def write_timeline(path: str, traces: List[Trace], t0: float):
+    rows = []
+    extra = set()
+    for tr in traces:
+        for r in tr.events:
+            rows.append((float(r["ts"]) + tr.offset - t0, tr.name, r))
+            extra.update(k for k in r.keys() if k not in ("core", "ts", "event_type", "obj", "id_main", "id_link"))
+    rows.sort(key=lambda x: x[0])
+    fields = ["src", "core", "ts", "event_type", "obj", "id_main", "id_link"] + sorted(extra)
+    with open(path, "w", newline="") as f:
+        w = csv.DictWriter(f, fieldnames=fields, extrasaction="ignore")
+        w.writeheader()
+        for ts, src, r in rows:
+            out = dict(r)
+            out["src"] = src
+            out["ts"] = f"{ts:.3f}"
+            w.writerow(out)
+    info(f"wrote timeline {path} ({len(rows)} events)")
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Merge SPDK traces from several processes and join IOs across the transport.")
+    ap.add_argument("--trace", action="append", required=True,
+                    help="name=path, parser_new.py CSV or spdk_trace -j JSON (repeatable)")
+    ap.add_argument("--span", action="append", default=None,
+                    help="trace:name=START_EVENT,END_EVENT[,key_arg], outermost first (repeatable)")
+    ap.add_argument("--profile", choices=sorted(PROFILES), default=None,
+                    help="Predefined span chain (used when --span is not given)")
+    ap.add_argument("--offset", action="append", default=[],
+                    help="name=us added to that trace's timestamps (overrides TSC / estimated offset)")
+    ap.add_argument("--any-core", action="store_true",
+                    help="Join nested spans of the same process across cores (default: same core only)")
+    ap.add_argument("--output", default="trace_merge_io.csv", help="Per-IO breakdown CSV")
+    ap.add_argument("--timeline", default=None, help="Merged event timeline CSV (optional)")
+    args = ap.parse_args()
+
+    traces = [load_trace(s) for s in args.trace]
+    by_name = {t.name: t for t in traces}
+    if len(by_name) != len(traces):
+        raise SystemExit("ERROR: duplicate trace name")
+
+    specs = args.span or PROFILES.get(args.profile or "nvmf-tcp")
+    defs = []
+    spans: Dict[str, List[Span]] = {}
+    for s in specs:
+        sd = SpanDef(s)
+        if sd.trace not in by_name:
+            warn(f"span {sd.label}: no trace named '{sd.trace}', skipped")
+            continue
+        sp = build_spans(by_name[sd.trace], sd)
+        if not sp:
+            warn(f"span {sd.label}: no {sd.start_ev} -> {sd.end_ev} pairs, skipped")
+            continue
+        info(f"span {sd.label}: {len(sp)}")
+        defs.append(sd)
+        spans[sd.label] = sp
+    if len(defs) < 2:
+        raise SystemExit("ERROR: need at least two spans to join")
+
+    # 時鐘：第一個 span 的 trace 當基準，沿著 chain 往內推
+    manual = {}
+    for o in args.offset:
+        name, _, v = o.partition("=")
+        if name not in by_name or ffloat(v) is None:
+            raise SystemExit(f"ERROR: bad --offset '{o}'")
+        manual[name] = float(v)
+    ref = by_name[defs[0].trace]
+    ref.offset = manual.get(ref.name, 0.0)
+    done = {ref.name}
+    for lvl in range(len(defs) - 1):
+        od, idf = defs[lvl], defs[lvl + 1]
+        if idf.trace in done:
+            continue
+        tr = by_name[idf.trace]
+        if idf.trace in manual:
+            tr.offset = manual[idf.trace]
+            info(f"clock {tr.name}: manual offset {tr.offset:.3f} us")
+        elif tr.absolute and by_name[od.trace].absolute:
+            tr.offset = by_name[od.trace].offset
+            info(f"clock {tr.name}: shared TSC with {od.trace}")
+        else:
+            est = estimate_offset(spans[od.label], spans[idf.label])
+            if est is None:
+                raise SystemExit(f"ERROR: cannot align {tr.name} to {od.trace}: no key on {od.label}/{idf.label}, "
+                                 f"use --offset {tr.name}=<us>")
+            off, support, sampled = est
+            tr.offset = by_name[od.trace].offset + off
+            info(f"clock {tr.name}: estimated offset {tr.offset:.3f} us from {od.label}/{idf.label} "
+                 f"({support}/{sampled} sampled spans agree)")
+            if support < sampled * 0.5:
+                warn(f"clock {tr.name}: less than half of the spans agree, check --span keys or pass --offset")
+        done.add(idf.trace)
+    offsets = {t.name: t.offset for t in traces}
+
+    chains = join_chain(defs, spans, offsets, args.any_core)
+    if not chains:
+        raise SystemExit("ERROR: no IO could be joined across all spans")
+
+    labels = [d.label for d in defs]
+    segn = segment_names(labels)
+    t0 = min(float(t.events[0]["ts"]) + t.offset for t in traces if t.events)
+    per_seg: List[List[float]] = [[] for _ in segn]
+    totals: List[float] = []
+    neg = 0
+
+    fields = ["io"]
+    for lb in labels:
+        fields += [f"{lb}_start", f"{lb}_end"]
+    fields += segn + ["total"]
+    with open(args.output, "w", newline="") as f:
+        w = csv.writer(f)
+        w.writerow(fields)
+        for n, ch in enumerate(chains):
+            t = [(s.start + offsets[d.trace] - t0, s.end + offsets[d.trace] - t0) for s, d in zip(ch, defs)]
+            seg = segments(t)
+            total = t[0][1] - t[0][0]
+            if any(x < 0 for x in seg):
+                neg += 1
+            for i, x in enumerate(seg):
+                per_seg[i].append(x)
+            totals.append(total)
+            row = [n]
+            for a, b in t:
+                row += [f"{a:.3f}", f"{b:.3f}"]
+            row += [f"{x:.3f}" for x in seg] + [f"{total:.3f}"]
+            w.writerow(row)
+    info(f"wrote {args.output} ({len(chains)} IOs)")
+    if neg:
+        warn(f"{neg} IOs have a negative segment (clock offset off by a few us, or wrong join)")
+
+    tot_sum = sum(totals)
+    print(f"{'segment':<40} {'avg_us':>10} {'p50_us':>10} {'p99_us':>10} {'share':>7}")
+    for name, vals in list(zip(segn, per_seg)) + [("total", totals)]:
+        sv = sorted(vals)
+        share = sum(vals) / tot_sum * 100 if tot_sum > 0 else 0.0
+        print(f"{name:<40} {sum(vals) / len(vals):>10.2f} {percentile(sv, 50):>10.2f} "
+              f"{percentile(sv, 99):>10.2f} {share:>6.1f}%")
+
+    if args.timeline:
+        write_timeline(args.timeline, traces, t0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,1003 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   Copyright (C) 2022 Intel Corporation.
+ *   All rights reserved.
+ */
+
+/*
+ * Userspace ublk_drv emulator, see ublk_drv_emu.h for how it hooks into the target
+ * and for the UBLK_EMU workload options.
+ *
+ * Threads:
+ *   ctrl commands       app thread (ctrl ring), serialized by g_emu.lock
+ *   FETCH / COMMIT      the poll-group thread that owns the queue (one producer per queue)
+ *   generator           one pthread per device, the only writer of the iods
+ * Tags flow target -> generator through a per-queue SPSC ring; requests flow
+ * generator -> target as MSG_RING CQEs on the queue's own io_uring, so the target
+ * sees exactly the CQEs ublk_drv would have produced.
+ *
+ * Latency is measured from the generator filling the iod to the target's
+ * COMMIT_AND_FETCH, i.e. the part ublk_drv cannot see of a real request.  The
+ * per-IO CPU cost is the busy tsc of the poll-group threads divided by the IOs
+ * they completed; queues sharing a poll group are accounted once per thread.
+ */
+
+#define UBLK_DRV_EMU_IMPL
+
+#include "spdk/stdinc.h"
+#include "spdk/env.h"
+#include "spdk/log.h"
+#include "spdk/string.h"
+#include "spdk/thread.h"
+#include "spdk/util.h"
+
+#include "ublk_internal.h"
+#include "ublk_drv_emu.h"
+
+#ifdef SPDK_UBLK_DRV_EMU
+
+#include <sys/eventfd.h>
+
+#define UBLK_EMU_CTRL_DEV		"/dev/ublk-control"
+#define UBLK_EMU_CDEV			"/dev/ublkc"
+#define UBLK_EMU_MAX_DEVS		64
+#define UBLK_EMU_MAX_QUEUES		32
+#define UBLK_EMU_MAX_RINGS		(UBLK_EMU_MAX_DEVS * UBLK_EMU_MAX_QUEUES)
+#define UBLK_EMU_RING_DEPTH		256
+#define UBLK_EMU_BATCH			32
+#define UBLK_EMU_BUSY_SAMPLE		64
+#define UBLK_EMU_FEATURES		(UBLK_F_URING_CMD_COMP_IN_TASK | UBLK_F_NEED_GET_DATA)
+#define UBLK_EMU_SECTOR_SHIFT		9
+
+#define LAT_SUB_BITS			4
+#define LAT_SUB				(1 << LAT_SUB_BITS)
+#define LAT_BUCKETS			(41 * LAT_SUB)
+
+enum emu_rw {
+	EMU_RANDREAD,
+	EMU_RANDWRITE,
+	EMU_RANDRW,
+	EMU_READ,
+	EMU_WRITE,
+};
+
+static const char *g_emu_rw_name[] = { "randread", "randwrite", "randrw", "read", "write" };
+
+struct emu_opts {
+	enum emu_rw	rw;
+	uint32_t	rwmix;
+	uint32_t	bs;
+	uint32_t	qd;
+	uint64_t	rate;
+	uint64_t	ios;
+	bool		copy;
+	int		core;
+	uint64_t	seed;
+	char		csv[256];
+};
+
+struct emu_stats {
+	uint64_t	ios;
+	uint64_t	reads;
+	uint64_t	writes;
+	uint64_t	bytes;
+	uint64_t	errors;
+	uint64_t	lat_sum_ns;
+	uint64_t	lat_max_ns;
+	uint64_t	last_tsc;
+	uint64_t	hist[LAT_BUCKETS];
+};
+
+/* lock-free SPSC ring of tags, target thread -> generator */
+struct emu_tag_ring {
+	uint32_t	head __attribute__((aligned(64)));
+	uint32_t	tail __attribute__((aligned(64)));
+	uint32_t	mask __attribute__((aligned(64)));
+	uint16_t	*slots;
+};
+
+struct emu_tag {
+	/* user_data of the FETCH / COMMIT_AND_FETCH the next request completes */
+	uint64_t	user_data;
+	uint64_t	submit_tsc;
+	uint32_t	nbytes;
+	bool		is_read;
+	/* generator only: the tag carries a request we handed out */
+	bool		issued;
+};
+
+struct emu_dev;
+
+struct emu_queue {
+	struct emu_dev		*dev;
+	uint32_t		q_id;
+	struct ublksrv_io_desc	*iods;
+	size_t			iods_len;
+	struct emu_tag		*tags;
+	/* stands in for the bio pages the kernel would copy from/to */
+	void			*data;
+	struct emu_tag_ring	free;
+
+	/* written by the target thread at the first FETCH */
+	int			ring_fd;
+	struct spdk_thread	*thread;
+
+	/* target thread only */
+	struct emu_stats	st;
+	uint64_t		busy_first;
+	uint64_t		busy_last;
+	uint64_t		busy_ios_first;
+	uint64_t		busy_ios_last;
+
+	/* generator only */
+	uint16_t		*idle;
+	uint32_t		nr_idle;
+	uint32_t		inflight;
+	uint32_t		aborted;
+	uint64_t		issued;
+	uint64_t		next_tsc;
+	uint64_t		seq_sector;
+	uint64_t		rng;
+};
+
+struct emu_dev {
+	struct ublksrv_ctrl_dev_info	info;
+	struct ublk_params		params;
+	int				cdev_fd;
+	struct emu_queue		*queues;
+	pthread_t			thread;
+	bool				thread_started;
+	bool				stopping;
+	bool				exit;
+	uint64_t			first_tsc;
+};
+
+struct emu_ring_ent {
+	struct io_uring	*ring;
+	struct emu_dev	*dev;
+};
+
+static struct {
+	pthread_mutex_t		lock;
+	int			ctrl_fd;
+	bool			opts_parsed;
+	struct emu_opts		opts;
+	struct emu_dev		*devs[UBLK_EMU_MAX_DEVS];
+	struct emu_ring_ent	rings[UBLK_EMU_MAX_RINGS];
+	/* high-water mark of rings[], bounds the lookup on the IO path */
+	uint32_t		nr_rings;
+} g_emu = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.ctrl_fd = -1,
+};
+
+static uint32_t
+lat_bucket(uint64_t ns)
+{
+	uint32_t e;
+
+	if (ns < LAT_SUB) {
+		return (uint32_t)ns;
+	}
+	e = 63 - __builtin_clzll(ns);
+	if (e > 40 + LAT_SUB_BITS - 1) {
+		return LAT_BUCKETS - 1;
+	}
+	return (e - LAT_SUB_BITS + 1) * LAT_SUB + (uint32_t)((ns >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+static uint64_t
+lat_bucket_ns(uint32_t b)
+{
+	uint32_t e, sub;
+
+	if (b < LAT_SUB) {
+		return b;
+	}
+	e = b / LAT_SUB + LAT_SUB_BITS - 1;
+	sub = b % LAT_SUB;
+	return ((uint64_t)(LAT_SUB + sub) << (e - LAT_SUB_BITS)) + (1ULL << (e - LAT_SUB_BITS)) / 2;
+}
+
+static double
+lat_percentile_us(const struct emu_stats *s, double p)
+{
+	uint64_t want = (uint64_t)(s->ios * p / 100.0);
+	uint64_t acc = 0;
+	uint32_t b;
+
+	if (s->ios == 0) {
+		return 0;
+	}
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		acc += s->hist[b];
+		if (acc > want) {
+			return lat_bucket_ns(b) / 1000.0;
+		}
+	}
+	return s->lat_max_ns / 1000.0;
+}
+
+static int
+emu_tag_ring_init(struct emu_tag_ring *r, uint32_t entries)
+{
+	uint32_t size = spdk_align32pow2(entries);
+
+	r->head = r->tail = 0;
+	r->mask = size - 1;
+	r->slots = calloc(size, sizeof(*r->slots));
+	return r->slots ? 0 : -ENOMEM;
+}
+
+static inline void
+emu_tag_push(struct emu_tag_ring *r, uint16_t tag)
+{
+	uint32_t h = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+	/* a tag is in the ring at most once and the ring holds q_depth, so never full */
+	assert(h - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) <= r->mask);
+	r->slots[h & r->mask] = tag;
+	__atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t
+emu_tag_pop(struct emu_tag_ring *r, uint16_t *tags, uint32_t max)
+{
+	uint32_t t = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	uint32_t n = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - t;
+	uint32_t i;
+
+	n = spdk_min(n, max);
+	for (i = 0; i < n; i++) {
+		tags[i] = r->slots[(t + i) & r->mask];
+	}
+	__atomic_store_n(&r->tail, t + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+static inline uint64_t
+emu_rand(uint64_t *s)
+{
+	uint64_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*s = x;
+	return x;
+}
+
+static void
+emu_parse_opts(void)
+{
+	struct emu_opts *o = &g_emu.opts;
+	const char *env = getenv("UBLK_EMU");
+	char *buf, *tok, *save = NULL, *val;
+	uint32_t i;
+
+	o->rw = EMU_RANDREAD;
+	o->rwmix = 70;
+	o->bs = 4096;
+	o->qd = 32;
+	o->rate = 0;
+	o->ios = 0;
+	o->copy = true;
+	o->core = -1;
+	o->seed = 1;
+	snprintf(o->csv, sizeof(o->csv), "ublk_emu_result.csv");
+	g_emu.opts_parsed = true;
+
+	if (env == NULL || (buf = strdup(env)) == NULL) {
+		return;
+	}
+	for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+		val = strchr(tok, '=');
+		if (val == NULL) {
+			SPDK_ERRLOG("UBLK_EMU: ignoring '%s'\n", tok);
+			continue;
+		}
+		*val++ = '\0';
+		if (strcmp(tok, "rw") == 0) {
+			for (i = 0; i < SPDK_COUNTOF(g_emu_rw_name); i++) {
+				if (strcmp(val, g_emu_rw_name[i]) == 0) {
+					o->rw = (enum emu_rw)i;
+					break;
+				}
+			}
+			if (i == SPDK_COUNTOF(g_emu_rw_name)) {
+				SPDK_ERRLOG("UBLK_EMU: unknown rw=%s\n", val);
+			}
+		} else if (strcmp(tok, "rwmix") == 0) {
+			o->rwmix = spdk_min(strtoul(val, NULL, 0), 100);
+		} else if (strcmp(tok, "bs") == 0) {
+			o->bs = strtoul(val, NULL, 0);
+		} else if (strcmp(tok, "qd") == 0) {
+			o->qd = strtoul(val, NULL, 0);
+		} else if (strcmp(tok, "rate") == 0) {
+			o->rate = strtoull(val, NULL, 0);
+		} else if (strcmp(tok, "ios") == 0) {
+			o->ios = strtoull(val, NULL, 0);
+		} else if (strcmp(tok, "copy") == 0) {
+			o->copy = strtoul(val, NULL, 0) != 0;
+		} else if (strcmp(tok, "core") == 0) {
+			o->core = (int)strtol(val, NULL, 0);
+		} else if (strcmp(tok, "seed") == 0) {
+			o->seed = strtoull(val, NULL, 0);
+		} else if (strcmp(tok, "csv") == 0) {
+			snprintf(o->csv, sizeof(o->csv), "%s", val);
+		} else {
+			SPDK_ERRLOG("UBLK_EMU: unknown option %s\n", tok);
+		}
+	}
+	free(buf);
+
+	if (o->bs == 0 || (o->bs & ((1u << UBLK_EMU_SECTOR_SHIFT) - 1)) || o->qd == 0) {
+		SPDK_ERRLOG("UBLK_EMU: bs must be a multiple of 512 and qd > 0, using 4096/32\n");
+		o->bs = 4096;
+		o->qd = 32;
+	}
+	if (o->seed == 0) {
+		o->seed = 1;
+	}
+}
+
+static struct emu_dev *
+emu_dev_by_cdev_fd(int fd)
+{
+	uint32_t i;
+
+	for (i = 0; i < UBLK_EMU_MAX_DEVS; i++) {
+		if (g_emu.devs[i] != NULL && g_emu.devs[i]->cdev_fd == fd) {
+			return g_emu.devs[i];
+		}
+	}
+	return NULL;
+}
+
+static struct emu_dev *
+emu_dev_by_ring(struct io_uring *ring)
+{
+	uint32_t i, n;
+
+	/* entries are published with a release store of .ring, no lock on the IO path */
+	n = __atomic_load_n(&g_emu.nr_rings, __ATOMIC_ACQUIRE);
+	for (i = 0; i < n; i++) {
+		if (__atomic_load_n(&g_emu.rings[i].ring, __ATOMIC_ACQUIRE) == ring) {
+			return g_emu.rings[i].dev;
+		}
+	}
+	return NULL;
+}
+
+int
+ublk_drv_emu_open(const char *path, int flags)
+{
+	struct emu_dev *dev;
+	uint32_t dev_id;
+	int fd = -1;
+
+	if (strcmp(path, UBLK_EMU_CTRL_DEV) == 0) {
+		pthread_mutex_lock(&g_emu.lock);
+		if (!g_emu.opts_parsed) {
+			emu_parse_opts();
+		}
+		if (g_emu.ctrl_fd < 0) {
+			g_emu.ctrl_fd = eventfd(0, EFD_CLOEXEC);
+		}
+		/* the target closes its copy on shutdown, keep ours */
+		fd = g_emu.ctrl_fd < 0 ? -1 : dup(g_emu.ctrl_fd);
+		pthread_mutex_unlock(&g_emu.lock);
+		if (fd >= 0) {
+			SPDK_NOTICELOG("ublk_drv emulator: %s bs %u qd %u rate %" PRIu64 " copy %d\n",
+				       g_emu_rw_name[g_emu.opts.rw], g_emu.opts.bs, g_emu.opts.qd,
+				       g_emu.opts.rate, g_emu.opts.copy);
+		}
+		return fd;
+	}
+
+	if (strncmp(path, UBLK_EMU_CDEV, strlen(UBLK_EMU_CDEV)) != 0) {
+		return open(path, flags);
+	}
+
+	dev_id = strtoul(path + strlen(UBLK_EMU_CDEV), NULL, 10);
+	pthread_mutex_lock(&g_emu.lock);
+	dev = dev_id < UBLK_EMU_MAX_DEVS ? g_emu.devs[dev_id] : NULL;
+	if (dev != NULL) {
+		fd = eventfd(0, EFD_CLOEXEC);
+		dev->cdev_fd = fd;
+	}
+	pthread_mutex_unlock(&g_emu.lock);
+	if (dev == NULL) {
+		errno = ENOENT;
+	}
+	return fd;
+}
+
+void *
+ublk_drv_emu_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+	struct emu_dev *dev;
+	struct emu_queue *q;
+	uint32_t q_id;
+	void *p;
+
+	pthread_mutex_lock(&g_emu.lock);
+	dev = fd >= 0 ? emu_dev_by_cdev_fd(fd) : NULL;
+	pthread_mutex_unlock(&g_emu.lock);
+	if (dev == NULL) {
+		return mmap(addr, len, prot, flags, fd, off);
+	}
+
+	q_id = (off - UBLKSRV_CMD_BUF_OFFSET) / (UBLK_MAX_QUEUE_DEPTH * sizeof(struct ublksrv_io_desc));
+	if (off < UBLKSRV_CMD_BUF_OFFSET || q_id >= dev->info.nr_hw_queues) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+
+	/* the target maps it read-only, the generator writes it */
+	p = mmap(addr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (p != MAP_FAILED) {
+		q = &dev->queues[q_id];
+		q->iods = p;
+		q->iods_len = len;
+	}
+	return p;
+}
+
+int
+ublk_drv_emu_register_files(struct io_uring *ring, const int *files, unsigned nr_files)
+{
+	struct emu_dev *dev;
+	uint32_t i;
+	int rc = -ENOSPC;
+
+	pthread_mutex_lock(&g_emu.lock);
+	dev = nr_files == 1 ? emu_dev_by_cdev_fd(files[0]) : NULL;
+	if (dev == NULL) {
+		pthread_mutex_unlock(&g_emu.lock);
+		return io_uring_register_files(ring, files, nr_files);
+	}
+	for (i = 0; i < UBLK_EMU_MAX_RINGS; i++) {
+		if (g_emu.rings[i].ring == NULL) {
+			g_emu.rings[i].dev = dev;
+			__atomic_store_n(&g_emu.rings[i].ring, ring, __ATOMIC_RELEASE);
+			if (i >= g_emu.nr_rings) {
+				__atomic_store_n(&g_emu.nr_rings, i + 1, __ATOMIC_RELEASE);
+			}
+			rc = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&g_emu.lock);
+
+	/* nothing to register: every URING_CMD on this ring is rewritten before it reaches the kernel */
+	return rc;
+}
+
+static void
+emu_dev_free(struct emu_dev *dev)
+{
+	struct emu_queue *q;
+	uint32_t i;
+
+	for (i = 0; i < UBLK_EMU_MAX_RINGS; i++) {
+		if (g_emu.rings[i].dev == dev) {
+			__atomic_store_n(&g_emu.rings[i].ring, NULL, __ATOMIC_RELEASE);
+			g_emu.rings[i].dev = NULL;
+		}
+	}
+	if (dev->queues != NULL) {
+		for (i = 0; i < dev->info.nr_hw_queues; i++) {
+			q = &dev->queues[i];
+			free(q->tags);
+			free(q->idle);
+			free(q->free.slots);
+			free(q->data);
+		}
+		free(dev->queues);
+	}
+	free(dev);
+}
+
+static int
+emu_add_dev(struct ublksrv_ctrl_dev_info *info)
+{
+	struct emu_opts *o = &g_emu.opts;
+	struct emu_dev *dev;
+	struct emu_queue *q;
+	uint32_t i;
+
+	if (info->dev_id >= UBLK_EMU_MAX_DEVS || g_emu.devs[info->dev_id] != NULL) {
+		return -EEXIST;
+	}
+	if (info->nr_hw_queues == 0 || info->nr_hw_queues > UBLK_EMU_MAX_QUEUES ||
+	    info->queue_depth == 0 || info->queue_depth > UBLK_MAX_QUEUE_DEPTH) {
+		return -EINVAL;
+	}
+
+	dev = calloc(1, sizeof(*dev));
+	if (dev == NULL) {
+		return -ENOMEM;
+	}
+	dev->cdev_fd = -1;
+	dev->queues = calloc(info->nr_hw_queues, sizeof(*dev->queues));
+	if (dev->queues == NULL) {
+		free(dev);
+		return -ENOMEM;
+	}
+	/* emu_dev_free() walks nr_hw_queues */
+	dev->info.nr_hw_queues = info->nr_hw_queues;
+
+	for (i = 0; i < info->nr_hw_queues; i++) {
+		q = &dev->queues[i];
+		q->dev = dev;
+		q->q_id = i;
+		q->ring_fd = -1;
+		q->rng = o->seed * (i + 1) * 0x9e3779b97f4a7c15ULL;
+		q->tags = calloc(info->queue_depth, sizeof(*q->tags));
+		q->idle = calloc(info->queue_depth, sizeof(*q->idle));
+		q->data = malloc(o->bs);
+		if (q->tags == NULL || q->idle == NULL || q->data == NULL ||
+		    emu_tag_ring_init(&q->free, info->queue_depth) != 0) {
+			emu_dev_free(dev);
+			return -ENOMEM;
+		}
+	}
+
+	/* like ublk_drv: keep only the flags we support, device starts DEAD */
+	info->flags &= UBLK_EMU_FEATURES;
+	info->state = UBLK_S_DEV_DEAD;
+	dev->info = *info;
+	g_emu.devs[info->dev_id] = dev;
+	return 0;
+}
+
+static void
+emu_post(struct io_uring *ring, int fd, int32_t res, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = io_uring_get_sqe(ring);
+	if (sqe == NULL) {
+		io_uring_submit(ring);
+		sqe = io_uring_get_sqe(ring);
+		assert(sqe != NULL);
+	}
+	io_uring_prep_msg_ring(sqe, fd, (uint32_t)res, user_data, 0);
+	sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+}
+
+/* fill one iod and post the CQE that completes the tag's FETCH / COMMIT_AND_FETCH */
+static void
+emu_issue(struct emu_dev *dev, struct emu_queue *q, struct io_uring *ring, uint16_t tag)
+{
+	struct emu_opts *o = &g_emu.opts;
+	struct ublksrv_io_desc *iod = &q->iods[tag];
+	struct emu_tag *t = &q->tags[tag];
+	uint64_t nr_sectors = o->bs >> UBLK_EMU_SECTOR_SHIFT;
+	uint64_t slots = spdk_max(dev->params.basic.dev_sectors / nr_sectors, 1);
+	uint64_t sector;
+	bool is_read;
+
+	switch (o->rw) {
+	case EMU_RANDREAD:
+	case EMU_READ:
+		is_read = true;
+		break;
+	case EMU_RANDWRITE:
+	case EMU_WRITE:
+		is_read = false;
+		break;
+	default:
+		is_read = emu_rand(&q->rng) % 100 < o->rwmix;
+		break;
+	}
+
+	if (o->rw == EMU_READ || o->rw == EMU_WRITE) {
+		sector = q->seq_sector;
+		q->seq_sector += nr_sectors;
+		if (q->seq_sector + nr_sectors > slots * nr_sectors) {
+			q->seq_sector = 0;
+		}
+	} else {
+		sector = (emu_rand(&q->rng) % slots) * nr_sectors;
+	}
+
+	iod->op_flags = is_read ? UBLK_IO_OP_READ : UBLK_IO_OP_WRITE;
+	iod->nr_sectors = nr_sectors;
+	iod->start_sector = sector;
+	iod->addr = 0;
+
+	t->is_read = is_read;
+	t->nbytes = o->bs;
+	t->issued = true;
+	__atomic_store_n(&t->submit_tsc, spdk_get_ticks(), __ATOMIC_RELEASE);
+
+	/* writes go through NEED_GET_DATA first, reads are ready to be served */
+	emu_post(ring, q->ring_fd, is_read ? UBLK_IO_RES_OK : UBLK_IO_RES_NEED_GET_DATA, t->user_data);
+	q->inflight++;
+	q->issued++;
+}
+
+static uint32_t
+emu_queue_poll(struct emu_dev *dev, struct emu_queue *q, struct io_uring *ring, uint64_t now)
+{
+	struct emu_opts *o = &g_emu.opts;
+	uint64_t ticks_per_io = o->rate ? spdk_get_ticks_hz() / o->rate : 0;
+	uint16_t tags[UBLK_EMU_BATCH];
+	uint32_t i, n, count = 0;
+	struct emu_tag *t;
+
+	n = emu_tag_pop(&q->free, tags, UBLK_EMU_BATCH);
+	for (i = 0; i < n; i++) {
+		t = &q->tags[tags[i]];
+		if (t->issued) {
+			t->issued = false;
+			q->inflight--;
+		}
+		q->idle[q->nr_idle++] = tags[i];
+	}
+
+	if (__atomic_load_n(&dev->stopping, __ATOMIC_ACQUIRE)) {
+		/* STOP_DEV: every fetched tag completes with ABORT, as blk-mq quiesce would */
+		while (q->nr_idle > 0) {
+			t = &q->tags[q->idle[--q->nr_idle]];
+			emu_post(ring, q->ring_fd, UBLK_IO_RES_ABORT, t->user_data);
+			q->aborted++;
+			count++;
+		}
+		return count;
+	}
+
+	while (q->nr_idle > 0 && q->inflight < o->qd && count < UBLK_EMU_BATCH) {
+		if (o->ios && q->issued >= o->ios) {
+			break;
+		}
+		if (ticks_per_io) {
+			if (now < q->next_tsc) {
+				break;
+			}
+			/* don't burst to catch up after a stall longer than a second */
+			q->next_tsc = spdk_max(q->next_tsc, now - spdk_min(now, spdk_get_ticks_hz())) + ticks_per_io;
+		}
+		emu_issue(dev, q, ring, q->idle[--q->nr_idle]);
+		count++;
+	}
+	return count;
+}
+
+static void *
+emu_dev_thread(void *arg)
+{
+	struct emu_dev *dev = arg;
+	struct io_uring ring;
+	struct io_uring_cqe *cqe;
+	uint64_t now;
+	uint32_t i, n;
+	int rc;
+
+	if (g_emu.opts.core >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(g_emu.opts.core, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	rc = io_uring_queue_init(UBLK_EMU_RING_DEPTH, &ring, 0);
+	if (rc < 0) {
+		SPDK_ERRLOG("ublk emu %u: io_uring init: %s\n", dev->info.dev_id, spdk_strerror(-rc));
+		return NULL;
+	}
+
+	while (!__atomic_load_n(&dev->exit, __ATOMIC_ACQUIRE)) {
+		now = spdk_get_ticks();
+		n = 0;
+		for (i = 0; i < dev->info.nr_hw_queues; i++) {
+			n += emu_queue_poll(dev, &dev->queues[i], &ring, now);
+		}
+		if (n > 0) {
+			if (dev->first_tsc == 0) {
+				dev->first_tsc = now;
+			}
+			io_uring_submit(&ring);
+		}
+
+		/* successful MSG_RINGs post nothing here, only failures */
+		while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+			SPDK_ERRLOG("ublk emu %u: msg_ring failed: %s\n", dev->info.dev_id,
+				    spdk_strerror(-cqe->res));
+			io_uring_cqe_seen(&ring, cqe);
+		}
+
+		if (n == 0) {
+			sched_yield();
+		}
+	}
+
+	io_uring_queue_exit(&ring);
+	return NULL;
+}
+
+static void
+emu_report(struct emu_dev *dev)
+{
+	struct emu_opts *o = &g_emu.opts;
+	struct emu_stats *st, sum = {};
+	struct emu_queue *q, *q2;
+	uint64_t hz = spdk_get_ticks_hz(), busy = 0, busy_ios = 0, first, last;
+	double secs, ticks_per_io;
+	uint32_t i, j, b;
+	bool new_file;
+	FILE *f;
+
+	for (i = 0; i < dev->info.nr_hw_queues; i++) {
+		st = &dev->queues[i].st;
+		sum.ios += st->ios;
+		sum.reads += st->reads;
+		sum.writes += st->writes;
+		sum.bytes += st->bytes;
+		sum.errors += st->errors;
+		sum.lat_sum_ns += st->lat_sum_ns;
+		sum.lat_max_ns = spdk_max(sum.lat_max_ns, st->lat_max_ns);
+		sum.last_tsc = spdk_max(sum.last_tsc, st->last_tsc);
+		for (b = 0; b < LAT_BUCKETS; b++) {
+			sum.hist[b] += st->hist[b];
+		}
+	}
+
+	/* busy tsc once per poll-group thread, covering all of its queues */
+	for (i = 0; i < dev->info.nr_hw_queues; i++) {
+		q = &dev->queues[i];
+		if (q->thread == NULL || q->busy_ios_last == q->busy_ios_first) {
+			continue;
+		}
+		for (j = 0; j < i; j++) {
+			if (dev->queues[j].thread == q->thread) {
+				break;
+			}
+		}
+		if (j < i) {
+			continue;
+		}
+		first = q->busy_first;
+		last = q->busy_last;
+		for (j = i; j < dev->info.nr_hw_queues; j++) {
+			q2 = &dev->queues[j];
+			if (q2->thread == q->thread && q2->busy_ios_last != q2->busy_ios_first) {
+				first = spdk_min(first, q2->busy_first);
+				last = spdk_max(last, q2->busy_last);
+				busy_ios += q2->busy_ios_last - q2->busy_ios_first;
+			}
+		}
+		busy += last - first;
+	}
+
+	secs = (sum.last_tsc > dev->first_tsc && dev->first_tsc) ?
+	       (double)(sum.last_tsc - dev->first_tsc) / hz : 0;
+	ticks_per_io = busy_ios ? (double)busy / busy_ios : 0;
+
+	SPDK_NOTICELOG("ublk emu %u: %s bs %u qd %u x %u queues: %" PRIu64 " IOs (%" PRIu64 " r / %" PRIu64
+		       " w, %" PRIu64 " err) in %.2fs, %.1f KIOPS, lat avg %.2f p50 %.2f p99 %.2f p99.9 %.2f max %.2f us,"
+		       " target %.0f busy ticks/IO\n",
+		       dev->info.dev_id, g_emu_rw_name[o->rw], o->bs, o->qd, dev->info.nr_hw_queues,
+		       sum.ios, sum.reads, sum.writes, sum.errors, secs, secs ? sum.ios / secs / 1000.0 : 0,
+		       sum.ios ? sum.lat_sum_ns / 1000.0 / sum.ios : 0, lat_percentile_us(&sum, 50),
+		       lat_percentile_us(&sum, 99), lat_percentile_us(&sum, 99.9), sum.lat_max_ns / 1000.0,
+		       ticks_per_io);
+
+	f = fopen(o->csv, "a");
+	if (f == NULL) {
+		SPDK_ERRLOG("ublk emu: can't open %s: %s\n", o->csv, spdk_strerror(errno));
+		return;
+	}
+	new_file = ftell(f) == 0;
+	if (new_file) {
+		fprintf(f, "dev_id,queues,rw,rwmix,bs,qd,rate,copy,ios,reads,writes,errors,secs,kiops,"
+			"lat_avg_us,lat_p50_us,lat_p99_us,lat_p999_us,lat_max_us,busy_ticks_per_io,tsc_hz\n");
+	}
+	fprintf(f, "%u,%u,%s,%u,%u,%u,%" PRIu64 ",%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+		",%.3f,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f,%.0f,%" PRIu64 "\n",
+		dev->info.dev_id, dev->info.nr_hw_queues, g_emu_rw_name[o->rw], o->rwmix, o->bs, o->qd,
+		o->rate, o->copy, sum.ios, sum.reads, sum.writes, sum.errors, secs,
+		secs ? sum.ios / secs / 1000.0 : 0, sum.ios ? sum.lat_sum_ns / 1000.0 / sum.ios : 0,
+		lat_percentile_us(&sum, 50), lat_percentile_us(&sum, 99), lat_percentile_us(&sum, 99.9),
+		sum.lat_max_ns / 1000.0, ticks_per_io, hz);
+	fclose(f);
+}
+
+static int
+emu_ctrl_cmd(uint32_t cmd_op, struct ublksrv_ctrl_cmd *cmd)
+{
+	struct emu_dev *dev = cmd->dev_id < UBLK_EMU_MAX_DEVS ? g_emu.devs[cmd->dev_id] : NULL;
+	void *addr = (void *)(uintptr_t)cmd->addr;
+	int rc = 0;
+
+	switch (_IOC_NR(cmd_op)) {
+	case _IOC_NR(UBLK_U_CMD_GET_FEATURES):
+		*(uint64_t *)addr = UBLK_EMU_FEATURES;
+		return 0;
+	case UBLK_CMD_ADD_DEV:
+		if (cmd->len < sizeof(struct ublksrv_ctrl_dev_info)) {
+			return -EINVAL;
+		}
+		return emu_add_dev(addr);
+	default:
+		break;
+	}
+
+	if (dev == NULL) {
+		return -ENODEV;
+	}
+
+	switch (_IOC_NR(cmd_op)) {
+	case UBLK_CMD_SET_PARAMS:
+		memcpy(&dev->params, addr, spdk_min(cmd->len, sizeof(dev->params)));
+		break;
+	case UBLK_CMD_GET_DEV_INFO:
+		memcpy(addr, &dev->info, spdk_min(cmd->len, sizeof(dev->info)));
+		break;
+	case UBLK_CMD_START_DEV:
+		if (dev->thread_started) {
+			return -EBUSY;
+		}
+		dev->info.state = UBLK_S_DEV_LIVE;
+		dev->info.ublksrv_pid = cmd->data[0];
+		rc = pthread_create(&dev->thread, NULL, emu_dev_thread, dev);
+		if (rc != 0) {
+			return -rc;
+		}
+		dev->thread_started = true;
+		break;
+	case UBLK_CMD_STOP_DEV:
+		dev->info.state = UBLK_S_DEV_DEAD;
+		__atomic_store_n(&dev->stopping, true, __ATOMIC_RELEASE);
+		break;
+	case UBLK_CMD_DEL_DEV:
+		if (dev->thread_started) {
+			__atomic_store_n(&dev->stopping, true, __ATOMIC_RELEASE);
+			__atomic_store_n(&dev->exit, true, __ATOMIC_RELEASE);
+			pthread_join(dev->thread, NULL);
+			emu_report(dev);
+		}
+		g_emu.devs[cmd->dev_id] = NULL;
+		emu_dev_free(dev);
+		break;
+	default:
+		/* no UBLK_F_USER_RECOVERY advertised, so the recovery commands never come */
+		rc = -EOPNOTSUPP;
+		break;
+	}
+	return rc;
+}
+
+static inline void
+emu_io_account(struct emu_queue *q, struct emu_tag *t, int32_t result, void *buf)
+{
+	struct emu_stats *st = &q->st;
+	struct spdk_thread_stats ts;
+	uint64_t now = spdk_get_ticks();
+	uint64_t ns = (now - __atomic_load_n(&t->submit_tsc, __ATOMIC_ACQUIRE)) * 1000000000ULL /
+		      spdk_get_ticks_hz();
+
+	if (result < 0) {
+		st->errors++;
+	} else {
+		/* reads: this is the copy ublk_drv does into the bio pages during COMMIT */
+		if (t->is_read && g_emu.opts.copy && buf != NULL) {
+			memcpy(q->data, buf, spdk_min((uint32_t)result, t->nbytes));
+		}
+		st->bytes += result;
+	}
+	if (t->is_read) {
+		st->reads++;
+	} else {
+		st->writes++;
+	}
+	st->ios++;
+	st->lat_sum_ns += ns;
+	st->lat_max_ns = spdk_max(st->lat_max_ns, ns);
+	st->hist[lat_bucket(ns)]++;
+	st->last_tsc = now;
+
+	if (st->ios % UBLK_EMU_BUSY_SAMPLE == 1 && spdk_thread_get_stats(&ts) == 0) {
+		if (q->busy_ios_first == 0) {
+			q->busy_first = ts.busy_tsc;
+			q->busy_ios_first = st->ios;
+		}
+		q->busy_last = ts.busy_tsc;
+		q->busy_ios_last = st->ios;
+	}
+}
+
+static void
+emu_io_cmd(struct io_uring *ring, struct emu_dev *dev, struct io_uring_sqe *sqe, uint32_t cmd_op)
+{
+	const struct ublksrv_io_cmd *cmd = (const struct ublksrv_io_cmd *)&sqe->addr3;
+	void *buf = (void *)(uintptr_t)cmd->addr;
+	struct emu_queue *q;
+	struct emu_tag *t;
+
+	if (cmd->q_id >= dev->info.nr_hw_queues || cmd->tag >= dev->info.queue_depth) {
+		SPDK_ERRLOG("ublk emu %u: bad io cmd q %u tag %u\n", dev->info.dev_id, cmd->q_id, cmd->tag);
+		return;
+	}
+	q = &dev->queues[cmd->q_id];
+	t = &q->tags[cmd->tag];
+
+	switch (_IOC_NR(cmd_op)) {
+	case UBLK_IO_FETCH_REQ:
+		if (q->thread == NULL) {
+			q->ring_fd = ring->ring_fd;
+			q->thread = spdk_get_thread();
+		}
+		break;
+	case UBLK_IO_COMMIT_AND_FETCH_REQ:
+		emu_io_account(q, t, cmd->result, buf);
+		break;
+	case UBLK_IO_NEED_GET_DATA:
+		/* copy the write payload in; the NOP completes with 0 == UBLK_IO_RES_OK */
+		if (g_emu.opts.copy && buf != NULL) {
+			memcpy(buf, q->data, t->nbytes);
+		}
+		io_uring_prep_nop(sqe);
+		return;
+	default:
+		SPDK_ERRLOG("ublk emu %u: unknown io cmd %u\n", dev->info.dev_id, cmd_op);
+		return;
+	}
+
+	/* FETCH and COMMIT_AND_FETCH stay pending until the generator posts a request */
+	t->user_data = sqe->user_data;
+	emu_tag_push(&q->free, cmd->tag);
+	io_uring_prep_nop(sqe);
+	sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+}
+
+int
+ublk_drv_emu_submit(struct io_uring *ring)
+{
+	unsigned shift = (ring->flags & IORING_SETUP_SQE128) ? 1 : 0;
+	unsigned mask = *ring->sq.kring_mask;
+	unsigned head;
+	struct io_uring_sqe *sqe;
+	struct emu_dev *dev = NULL;
+	uint32_t cmd_op;
+	uint64_t user_data;
+	int rc;
+
+	/* SQEs between sqe_head and sqe_tail have not been handed to the kernel yet */
+	for (head = ring->sq.sqe_head; head != ring->sq.sqe_tail; head++) {
+		sqe = &ring->sq.sqes[(head & mask) << shift];
+		if (sqe->opcode != IORING_OP_URING_CMD) {
+			continue;
+		}
+		cmd_op = (uint32_t)sqe->off;
+
+		if (!(sqe->flags & IOSQE_FIXED_FILE)) {
+			pthread_mutex_lock(&g_emu.lock);
+			rc = emu_ctrl_cmd(cmd_op, (struct ublksrv_ctrl_cmd *)&sqe->addr3);
+			pthread_mutex_unlock(&g_emu.lock);
+			if (rc == 0) {
+				io_uring_prep_nop(sqe);
+			} else {
+				/* deliver the error as this SQE's own CQE */
+				user_data = sqe->user_data;
+				io_uring_prep_msg_ring(sqe, ring->ring_fd, (uint32_t)rc, user_data, 0);
+				sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+			}
+			continue;
+		}
+
+		if (dev == NULL) {
+			dev = emu_dev_by_ring(ring);
+			if (dev == NULL) {
+				continue;
+			}
+		}
+		emu_io_cmd(ring, dev, sqe, cmd_op);
+	}
+
+	return io_uring_submit(ring);
+}
+
+#endif /* SPDK_UBLK_DRV_EMU */
@@ -0,0 +1,57 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   Copyright (C) 2022 Intel Corporation.
+ *   All rights reserved.
+ */
+
+/*
+ * Userspace stand-in for ublk_drv, for machines that cannot load the kernel module.
+ *
+ * Build ublk_traced_v4.c together with ublk_drv_emu.c and -DSPDK_UBLK_DRV_EMU.
+ * The target code is unchanged: the macros below redirect the handful of calls
+ * that reach the driver (open of /dev/ublk-control and /dev/ublkcN, mmap of the
+ * iod array, io_uring_register_files and io_uring_submit) into the emulator.
+ *
+ * io_uring_submit() is the only place where the target hands commands to ublk_drv,
+ * so the emulator rewrites the pending URING_CMD SQEs in place before the real
+ * submit:
+ *   ctrl commands      served synchronously, SQE becomes a NOP (res 0)
+ *   FETCH_REQ          tag handed to the generator, SQE becomes a NOP whose CQE is skipped
+ *   COMMIT_AND_FETCH   result/latency accounted, data copied for reads, same as FETCH
+ *   NEED_GET_DATA      write data copied into cmd->addr, SQE becomes a NOP (res 0 = RES_OK)
+ * A per-device generator thread plays the block layer: it fills the iod and posts
+ * the CQE the target is waiting for with IORING_OP_MSG_RING (kernel 5.18+, no ublk needed).
+ *
+ * The workload comes from the UBLK_EMU environment variable, comma separated key=value:
+ *   rw=randread|randwrite|randrw|read|write  (randread)
+ *   rwmix=<read %> (70)   bs=<bytes> (4096)   qd=<per queue> (32)
+ *   rate=<IOPS per queue, 0 = unlimited> (0)  ios=<per queue, 0 = until stop> (0)
+ *   copy=0|1 (1)  core=<cpu for the generator thread, -1 = unpinned> (-1)
+ *   seed=<n> (1)  csv=<result file> (ublk_emu_result.csv)
+ * Results are printed and appended to the CSV when the device is deleted.
+ *
+ * Features reported to the target: URING_CMD_COMP_IN_TASK | NEED_GET_DATA, i.e. no
+ * user copy, no ioctl encoding and no user recovery.
+ */
+
+#ifndef SPDK_UBLK_DRV_EMU_H
+#define SPDK_UBLK_DRV_EMU_H
+
+#ifdef SPDK_UBLK_DRV_EMU
+
+#include <liburing.h>
+
+int ublk_drv_emu_open(const char *path, int flags);
+void *ublk_drv_emu_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off);
+int ublk_drv_emu_register_files(struct io_uring *ring, const int *files, unsigned nr_files);
+int ublk_drv_emu_submit(struct io_uring *ring);
+
+#ifndef UBLK_DRV_EMU_IMPL
+#define open(path, flags)			ublk_drv_emu_open(path, flags)
+#define mmap(a, l, p, f, fd, off)		ublk_drv_emu_mmap(a, l, p, f, fd, off)
+#define io_uring_register_files(r, f, n)	ublk_drv_emu_register_files(r, f, n)
+#define io_uring_submit(r)			ublk_drv_emu_submit(r)
+#endif
+
+#endif /* SPDK_UBLK_DRV_EMU */
+
+#endif /* SPDK_UBLK_DRV_EMU_H */
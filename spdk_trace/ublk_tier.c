@@ -0,0 +1,861 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   Copyright (C) 2022 Intel Corporation.
+ *   All rights reserved.
+ */
+
+/*
+ * Hot/cold tiering for ublk devices, see ublk_tier.h for the data path and the
+ * ublk_tier_create parameters.
+ *
+ * Everything here runs on the app thread: the RPCs, open/close (called from
+ * ublk_start_disk / ublk_free_dev) and the per-device poller that decays the
+ * heat table, keeps a short list of promotion / demotion candidates and copies
+ * one extent at a time through its own bdev descriptors and channels.
+ */
+
+#include "spdk/stdinc.h"
+#include "spdk/bdev.h"
+#include "spdk/env.h"
+#include "spdk/json.h"
+#include "spdk/jsonrpc.h"
+#include "spdk/log.h"
+#include "spdk/queue.h"
+#include "spdk/rpc.h"
+#include "spdk/string.h"
+#include "spdk/thread.h"
+#include "spdk/util.h"
+#include "spdk/uuid.h"
+
+#include "ublk_tier.h"
+
+#define UBLK_TIER_POLL_US		1000
+#define UBLK_TIER_CANDIDATES		32
+#define UBLK_TIER_MAP_MAGIC		"UBLKTIR2"
+
+#define UBLK_TIER_DEFAULT_EXTENT	(1024 * 1024)
+#define UBLK_TIER_DEFAULT_MBPS		200
+#define UBLK_TIER_DEFAULT_DECAY_MS	1000
+#define UBLK_TIER_DEFAULT_PROMOTE_MIN	4
+#define UBLK_TIER_DEFAULT_MAP_DIR	"/var/tmp"
+#define UBLK_TIER_MAX_EXTENT		(16 * 1024 * 1024)
+
+struct ublk_tier_cfg {
+	char			*bdev_name;
+	char			*fast_bdev_name;
+	uint32_t		extent_size;
+	uint32_t		migrate_mbps;	/* 0 = never migrate */
+	uint32_t		decay_ms;
+	uint32_t		promote_min;
+	char			*map_dir;
+
+	TAILQ_ENTRY(ublk_tier_cfg) link;
+};
+
+enum ublk_tier_state {
+	UBLK_TIER_IDLE,
+	UBLK_TIER_DRAIN,	/* 'migrating' set, waiting for WRITEs in flight */
+	UBLK_TIER_COPY,		/* read from the source or write to the destination in flight */
+	UBLK_TIER_RELEASE,	/* demoted, the slot waits for READs that looked it up */
+};
+
+struct ublk_tier_cand {
+	uint64_t		ext;	/* hot list: slow extent */
+	uint32_t		slot;	/* cold list: fast slot */
+	uint8_t			heat;	/* at the last decay */
+};
+
+struct ublk_tier_map_hdr {
+	char			magic[8];
+	uint32_t		block_size;
+	uint32_t		ext_shift;
+	uint64_t		slow_blocks;
+	uint64_t		fast_blocks;
+	char			slow_name[64];
+	char			fast_name[64];
+	/* a recreated bdev keeps its name but gets a new UUID */
+	struct spdk_uuid	slow_uuid;
+	struct spdk_uuid	fast_uuid;
+};
+
+struct ublk_tier_priv {
+	struct ublk_tier	*t;
+	uint32_t		ublk_id;
+	struct ublk_tier_cfg	cfg;
+	uint32_t		block_size;
+	uint64_t		ext_bytes;
+	uint64_t		full_extents;	/* a partial last extent never moves */
+
+	struct spdk_bdev_desc	*slow_desc;
+	struct spdk_io_channel	*slow_ch;
+	struct spdk_io_channel	*fast_ch;
+	struct spdk_poller	*poller;
+	void			*buf;
+	int			map_fd;
+	char			map_path[PATH_MAX];
+
+	uint32_t		num_slots;
+	uint64_t		*slot_ext;	/* UBLK_TIER_NO_EXT = free */
+	uint32_t		*free_fifo;
+	uint32_t		free_head;
+	uint32_t		free_cnt;
+
+	struct ublk_tier_cand	hot[UBLK_TIER_CANDIDATES];
+	uint32_t		nhot;
+	uint32_t		hot_pos;
+	struct ublk_tier_cand	cold[UBLK_TIER_CANDIDATES];
+	uint32_t		ncold;
+	uint32_t		cold_pos;
+
+	enum ublk_tier_state	state;
+	uint64_t		mig_ext;
+	uint32_t		mig_slot;
+	bool			mig_promote;
+	uint64_t		mig_start_tsc;
+	bool			closing;
+
+	uint64_t		tokens;
+	uint64_t		last_tsc;
+	uint64_t		next_decay_tsc;
+	uint64_t		decay_ticks;
+
+	uint64_t		promoted;
+	uint64_t		demoted;
+	uint64_t		failed;
+	uint64_t		mig_ticks;
+
+	TAILQ_ENTRY(ublk_tier_priv) link;
+};
+
+static TAILQ_HEAD(, ublk_tier_cfg) g_tier_cfgs = TAILQ_HEAD_INITIALIZER(g_tier_cfgs);
+static TAILQ_HEAD(, ublk_tier_priv) g_tiers = TAILQ_HEAD_INITIALIZER(g_tiers);
+
+static void ublk_tier_copy_start(struct ublk_tier_priv *p);
+
+static struct ublk_tier_cfg *
+ublk_tier_cfg_find(const char *bdev_name)
+{
+	struct ublk_tier_cfg *cfg;
+
+	TAILQ_FOREACH(cfg, &g_tier_cfgs, link) {
+		if (strcmp(cfg->bdev_name, bdev_name) == 0) {
+			return cfg;
+		}
+	}
+	return NULL;
+}
+
+static void
+ublk_tier_cfg_free(struct ublk_tier_cfg *cfg)
+{
+	free(cfg->bdev_name);
+	free(cfg->fast_bdev_name);
+	free(cfg->map_dir);
+	free(cfg);
+}
+
+/* --------------------------------------------------------------------- */
+/* Slots and the location map file                                       */
+/* --------------------------------------------------------------------- */
+static void
+ublk_tier_slot_put(struct ublk_tier_priv *p, uint32_t slot)
+{
+	p->free_fifo[(p->free_head + p->free_cnt) % p->num_slots] = slot;
+	p->free_cnt++;
+}
+
+static uint32_t
+ublk_tier_slot_get(struct ublk_tier_priv *p)
+{
+	uint32_t slot = p->free_fifo[p->free_head];
+
+	assert(p->free_cnt > 0);
+	p->free_head = (p->free_head + 1) % p->num_slots;
+	p->free_cnt--;
+	return slot;
+}
+
+static void
+ublk_tier_map_hdr_init(struct ublk_tier_priv *p, struct ublk_tier_map_hdr *hdr)
+{
+	struct spdk_bdev *slow = spdk_bdev_desc_get_bdev(p->slow_desc);
+	struct spdk_bdev *fast = spdk_bdev_desc_get_bdev(p->t->fast_desc);
+
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, UBLK_TIER_MAP_MAGIC, sizeof(hdr->magic));
+	hdr->block_size = p->block_size;
+	hdr->ext_shift = p->t->ext_shift;
+	hdr->slow_blocks = spdk_bdev_get_num_blocks(slow);
+	hdr->fast_blocks = spdk_bdev_get_num_blocks(fast);
+	snprintf(hdr->slow_name, sizeof(hdr->slow_name), "%s", spdk_bdev_get_name(slow));
+	snprintf(hdr->fast_name, sizeof(hdr->fast_name), "%s", spdk_bdev_get_name(fast));
+	spdk_uuid_copy(&hdr->slow_uuid, spdk_bdev_get_uuid(slow));
+	spdk_uuid_copy(&hdr->fast_uuid, spdk_bdev_get_uuid(fast));
+}
+
+/* header 'hdr' and every extent on the slow bdev, replacing whatever the file held */
+static int
+ublk_tier_map_reset(struct ublk_tier_priv *p, const struct ublk_tier_map_hdr *hdr)
+{
+	size_t len = p->t->num_extents * sizeof(uint32_t);
+
+	if (ftruncate(p->map_fd, 0) != 0 ||
+	    pwrite(p->map_fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+	    pwrite(p->map_fd, p->t->loc, len, sizeof(*hdr)) != (ssize_t)len || fsync(p->map_fd) != 0) {
+		SPDK_ERRLOG("ublk%u tier: could not create %s\n", p->ublk_id, p->map_path);
+		return -EIO;
+	}
+	return 0;
+}
+
+static int
+ublk_tier_map_store(struct ublk_tier_priv *p, uint64_t ext, uint32_t slot)
+{
+	off_t off = sizeof(struct ublk_tier_map_hdr) + ext * sizeof(uint32_t);
+
+	if (pwrite(p->map_fd, &slot, sizeof(slot), off) != sizeof(slot)) {
+		SPDK_ERRLOG("ublk%u tier: write %s failed: %s\n", p->ublk_id, p->map_path,
+			    spdk_strerror(errno));
+		return -EIO;
+	}
+	return 0;
+}
+
+/*
+ * Loads the map written by a previous run, or creates one with every extent on
+ * the slow bdev. A map whose bdev UUIDs differ (a bdev was recreated, as malloc
+ * bdevs are on every run) describes data that is gone: it is discarded and every
+ * extent starts on the slow bdev. A map for the same bdevs with another geometry
+ * is refused rather than ignored: the fast bdev may hold the only copy of some
+ * extents.
+ */
+static int
+ublk_tier_map_open(struct ublk_tier_priv *p)
+{
+	struct ublk_tier *t = p->t;
+	struct ublk_tier_map_hdr want, hdr;
+	size_t len = t->num_extents * sizeof(uint32_t);
+	uint64_t ext, on_fast = 0;
+	uint32_t slot;
+	ssize_t n;
+
+	snprintf(p->map_path, sizeof(p->map_path), "%s/ublk_tier_%s.map", p->cfg.map_dir,
+		 p->cfg.bdev_name);
+	p->map_fd = open(p->map_path, O_RDWR | O_CREAT, 0600);
+	if (p->map_fd < 0) {
+		SPDK_ERRLOG("ublk%u tier: open %s failed: %s\n", p->ublk_id, p->map_path,
+			    spdk_strerror(errno));
+		return -errno;
+	}
+
+	ublk_tier_map_hdr_init(p, &want);
+	n = pread(p->map_fd, &hdr, sizeof(hdr), 0);
+	if (n == 0) {
+		return ublk_tier_map_reset(p, &want);
+	}
+	if (n != sizeof(hdr) || memcmp(hdr.magic, want.magic, sizeof(hdr.magic)) != 0 ||
+	    spdk_uuid_compare(&hdr.slow_uuid, &want.slow_uuid) != 0 ||
+	    spdk_uuid_compare(&hdr.fast_uuid, &want.fast_uuid) != 0) {
+		SPDK_WARNLOG("ublk%u tier: %s was written for other bdev instances, discarding it\n",
+			     p->ublk_id, p->map_path);
+		return ublk_tier_map_reset(p, &want);
+	}
+	if (memcmp(&hdr, &want, sizeof(hdr)) != 0) {
+		SPDK_ERRLOG("ublk%u tier: %s was written with another extent size or bdev size, "
+			    "remove it to start over\n", p->ublk_id, p->map_path);
+		return -EEXIST;
+	}
+	if (pread(p->map_fd, t->loc, len, sizeof(hdr)) != (ssize_t)len) {
+		SPDK_ERRLOG("ublk%u tier: %s is truncated\n", p->ublk_id, p->map_path);
+		return -EIO;
+	}
+
+	for (ext = 0; ext < t->num_extents; ext++) {
+		slot = t->loc[ext];
+		if (slot == UBLK_TIER_SLOW) {
+			continue;
+		}
+		if (slot >= p->num_slots || p->slot_ext[slot] != UBLK_TIER_NO_EXT) {
+			SPDK_ERRLOG("ublk%u tier: %s: bad slot %u for extent %" PRIu64 "\n",
+				    p->ublk_id, p->map_path, slot, ext);
+			return -EINVAL;
+		}
+		p->slot_ext[slot] = ext;
+		on_fast++;
+	}
+	SPDK_NOTICELOG("ublk%u tier: loaded %s, %" PRIu64 " extents on %s\n", p->ublk_id,
+		       p->map_path, on_fast, p->cfg.fast_bdev_name);
+	return 0;
+}
+
+/* --------------------------------------------------------------------- */
+/* Heat and candidates                                                   */
+/* --------------------------------------------------------------------- */
+
+/* keeps the list sorted, hottest first (hot) or coldest first (cold) */
+static void
+ublk_tier_cand_insert(struct ublk_tier_cand *list, uint32_t *n, struct ublk_tier_cand c, bool hot)
+{
+	uint32_t i;
+
+	if (*n == UBLK_TIER_CANDIDATES) {
+		if (hot ? c.heat <= list[*n - 1].heat : c.heat >= list[*n - 1].heat) {
+			return;
+		}
+		(*n)--;
+	}
+	for (i = *n; i > 0 && (hot ? list[i - 1].heat < c.heat : list[i - 1].heat > c.heat); i--) {
+		list[i] = list[i - 1];
+	}
+	list[i] = c;
+	(*n)++;
+}
+
+static void
+ublk_tier_decay(struct ublk_tier_priv *p)
+{
+	struct ublk_tier *t = p->t;
+	struct ublk_tier_cand c = {};
+	uint64_t ext;
+	uint32_t slot;
+	uint8_t h;
+
+	p->nhot = p->hot_pos = 0;
+	p->ncold = p->cold_pos = 0;
+	for (ext = 0; ext < t->num_extents; ext++) {
+		h = __atomic_load_n(&t->heat[ext], __ATOMIC_RELAXED);
+		if (h != 0) {
+			__atomic_store_n(&t->heat[ext], h >> 1, __ATOMIC_RELAXED);
+		}
+		if (ext >= p->full_extents) {
+			continue;
+		}
+		slot = t->loc[ext];
+		c.heat = h;
+		if (slot == UBLK_TIER_SLOW) {
+			if (h >= p->cfg.promote_min) {
+				c.ext = ext;
+				ublk_tier_cand_insert(p->hot, &p->nhot, c, true);
+			}
+		} else {
+			c.slot = slot;
+			ublk_tier_cand_insert(p->cold, &p->ncold, c, false);
+		}
+	}
+}
+
+/* --------------------------------------------------------------------- */
+/* Migration                                                             */
+/* --------------------------------------------------------------------- */
+static void
+ublk_tier_free(struct ublk_tier_priv *p)
+{
+	struct ublk_tier *t = p->t;
+
+	if (p->slow_ch) {
+		spdk_put_io_channel(p->slow_ch);
+	}
+	if (p->fast_ch) {
+		spdk_put_io_channel(p->fast_ch);
+	}
+	if (p->slow_desc) {
+		spdk_bdev_close(p->slow_desc);
+	}
+	if (t->fast_desc) {
+		spdk_bdev_close(t->fast_desc);
+	}
+	if (p->map_fd >= 0) {
+		close(p->map_fd);
+	}
+	spdk_dma_free(p->buf);
+	free(t->loc);
+	free(t->heat);
+	free(t->slot_reads);
+	free(t->writes);
+	free(p->slot_ext);
+	free(p->free_fifo);
+	free(p->cfg.bdev_name);
+	free(p->cfg.fast_bdev_name);
+	free(p->cfg.map_dir);
+	free(p);
+	free(t);
+}
+
+static void
+ublk_tier_mig_end(struct ublk_tier_priv *p, bool success)
+{
+	struct ublk_tier *t = p->t;
+
+	/* the copy is complete: publish the new location, file first */
+	if (success) {
+		success = ublk_tier_map_store(p, p->mig_ext,
+					      p->mig_promote ? p->mig_slot : UBLK_TIER_SLOW) == 0;
+	}
+	if (success && p->mig_promote) {
+		p->slot_ext[p->mig_slot] = p->mig_ext;
+		__atomic_store_n(&t->loc[p->mig_ext], p->mig_slot, __ATOMIC_RELEASE);
+		p->promoted++;
+	} else if (success) {
+		/* pairs with ublk_tier_route() pinning the slot before it reads 'loc' again */
+		__atomic_store_n(&t->loc[p->mig_ext], UBLK_TIER_SLOW, __ATOMIC_SEQ_CST);
+		p->slot_ext[p->mig_slot] = UBLK_TIER_NO_EXT;
+		p->demoted++;
+	} else {
+		if (p->mig_promote) {
+			ublk_tier_slot_put(p, p->mig_slot);
+		}
+		p->failed++;
+	}
+	p->mig_ticks += spdk_get_ticks() - p->mig_start_tsc;
+
+	__atomic_store_n(&t->migrating, UBLK_TIER_NO_EXT, __ATOMIC_SEQ_CST);
+	/* the poller puts the demoted slot back once its READs drained */
+	p->state = success && !p->mig_promote ? UBLK_TIER_RELEASE : UBLK_TIER_IDLE;
+	if (p->closing) {
+		ublk_tier_free(p);
+	}
+}
+
+static void
+ublk_tier_copy_write_done(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+	struct ublk_tier_priv *p = cb_arg;
+
+	spdk_bdev_free_io(bdev_io);
+	if (!success) {
+		SPDK_ERRLOG("ublk%u tier: write of extent %" PRIu64 " failed\n", p->ublk_id, p->mig_ext);
+	}
+	ublk_tier_mig_end(p, success);
+}
+
+static void
+ublk_tier_copy_read_done(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+	struct ublk_tier_priv *p = cb_arg;
+	struct ublk_tier *t = p->t;
+	uint64_t dst;
+	int rc;
+
+	spdk_bdev_free_io(bdev_io);
+	if (!success) {
+		SPDK_ERRLOG("ublk%u tier: read of extent %" PRIu64 " failed\n", p->ublk_id, p->mig_ext);
+		ublk_tier_mig_end(p, false);
+		return;
+	}
+
+	if (p->mig_promote) {
+		dst = (uint64_t)p->mig_slot << t->ext_shift;
+		rc = spdk_bdev_write_blocks(t->fast_desc, p->fast_ch, p->buf, dst,
+					    ublk_tier_extent_blocks(t), ublk_tier_copy_write_done, p);
+	} else {
+		dst = p->mig_ext << t->ext_shift;
+		rc = spdk_bdev_write_blocks(p->slow_desc, p->slow_ch, p->buf, dst,
+					    ublk_tier_extent_blocks(t), ublk_tier_copy_write_done, p);
+	}
+	if (rc != 0) {
+		SPDK_ERRLOG("ublk%u tier: write of extent %" PRIu64 " not submitted, rc=%d\n",
+			    p->ublk_id, p->mig_ext, rc);
+		ublk_tier_mig_end(p, false);
+	}
+}
+
+static void
+ublk_tier_copy_start(struct ublk_tier_priv *p)
+{
+	struct ublk_tier *t = p->t;
+	int rc;
+
+	if (p->mig_promote) {
+		rc = spdk_bdev_read_blocks(p->slow_desc, p->slow_ch, p->buf, p->mig_ext << t->ext_shift,
+					   ublk_tier_extent_blocks(t), ublk_tier_copy_read_done, p);
+	} else {
+		rc = spdk_bdev_read_blocks(t->fast_desc, p->fast_ch, p->buf,
+					   (uint64_t)p->mig_slot << t->ext_shift,
+					   ublk_tier_extent_blocks(t), ublk_tier_copy_read_done, p);
+	}
+	if (rc == -ENOMEM) {
+		/* stay in DRAIN, the poller tries again */
+		return;
+	}
+	if (rc != 0) {
+		ublk_tier_mig_end(p, false);
+		return;
+	}
+	p->state = UBLK_TIER_COPY;
+}
+
+static void
+ublk_tier_mig_start(struct ublk_tier_priv *p, uint64_t ext, uint32_t slot, bool promote)
+{
+	p->mig_ext = ext;
+	p->mig_slot = slot;
+	p->mig_promote = promote;
+	p->mig_start_tsc = spdk_get_ticks();
+	p->tokens -= p->ext_bytes;
+	/* new WRITEs to ext now wait; the ones already counted in 'writes' drain first */
+	__atomic_store_n(&p->t->migrating, ext, __ATOMIC_SEQ_CST);
+	p->state = UBLK_TIER_DRAIN;
+}
+
+/*
+ * Promote the hottest slow extent into a free slot; with no free slot, demote
+ * the coldest fast extent first if the hot one beats it by promote_min.
+ */
+static bool
+ublk_tier_pick(struct ublk_tier_priv *p)
+{
+	struct ublk_tier *t = p->t;
+	struct ublk_tier_cand *c, *v;
+
+	while (p->hot_pos < p->nhot) {
+		c = &p->hot[p->hot_pos];
+		if (t->loc[c->ext] != UBLK_TIER_SLOW) {
+			p->hot_pos++;
+			continue;
+		}
+		if (p->free_cnt > 0) {
+			p->hot_pos++;
+			ublk_tier_mig_start(p, c->ext, ublk_tier_slot_get(p), true);
+			return true;
+		}
+
+		while (p->cold_pos < p->ncold && p->slot_ext[p->cold[p->cold_pos].slot] == UBLK_TIER_NO_EXT) {
+			p->cold_pos++;
+		}
+		if (p->cold_pos == p->ncold) {
+			return false;
+		}
+		v = &p->cold[p->cold_pos];
+		if (c->heat <= v->heat + p->cfg.promote_min) {
+			return false;
+		}
+		p->cold_pos++;
+		ublk_tier_mig_start(p, p->slot_ext[v->slot], v->slot, false);
+		return true;
+	}
+	return false;
+}
+
+static int
+ublk_tier_poll(void *arg)
+{
+	struct ublk_tier_priv *p = arg;
+	struct ublk_tier *t = p->t;
+	uint64_t now = spdk_get_ticks();
+	uint64_t hz = spdk_get_ticks_hz();
+	uint64_t delta = spdk_min(now - p->last_tsc, hz);
+
+	p->last_tsc = now;
+	if (now >= p->next_decay_tsc) {
+		ublk_tier_decay(p);
+		p->next_decay_tsc = now + p->decay_ticks;
+	}
+	if (p->cfg.migrate_mbps == 0) {
+		return SPDK_POLLER_IDLE;
+	}
+	/* at most two extents of burst */
+	p->tokens = spdk_min(p->tokens + delta * p->cfg.migrate_mbps * 1024 * 1024 / hz, 2 * p->ext_bytes);
+
+	switch (p->state) {
+	case UBLK_TIER_IDLE:
+		if (p->tokens >= p->ext_bytes && ublk_tier_pick(p)) {
+			return SPDK_POLLER_BUSY;
+		}
+		return SPDK_POLLER_IDLE;
+	case UBLK_TIER_DRAIN:
+		if (__atomic_load_n(&t->writes[p->mig_ext], __ATOMIC_SEQ_CST) == 0) {
+			ublk_tier_copy_start(p);
+			return SPDK_POLLER_BUSY;
+		}
+		return SPDK_POLLER_IDLE;
+	case UBLK_TIER_RELEASE:
+		/* READs after the flip go to the slow bdev; wait for the ones pinning the slot */
+		if (__atomic_load_n(&t->slot_reads[p->mig_slot], __ATOMIC_SEQ_CST) == 0) {
+			ublk_tier_slot_put(p, p->mig_slot);
+			p->state = UBLK_TIER_IDLE;
+			return SPDK_POLLER_BUSY;
+		}
+		return SPDK_POLLER_IDLE;
+	default:
+		return SPDK_POLLER_IDLE;
+	}
+}
+
+/* --------------------------------------------------------------------- */
+/* Open / close                                                          */
+/* --------------------------------------------------------------------- */
+static void
+ublk_tier_bdev_event_cb(enum spdk_bdev_event_type type, struct spdk_bdev *bdev, void *event_ctx)
+{
+	struct ublk_tier_priv *p = event_ctx;
+
+	if (type == SPDK_BDEV_EVENT_REMOVE) {
+		SPDK_ERRLOG("ublk%u tier: bdev %s removed while in use\n", p->ublk_id, spdk_bdev_get_name(bdev));
+	}
+}
+
+int
+ublk_tier_open(struct spdk_bdev_desc *slow_desc, uint32_t ublk_id, struct ublk_tier **tierp)
+{
+	struct spdk_bdev *slow = spdk_bdev_desc_get_bdev(slow_desc);
+	struct ublk_tier_cfg *cfg = ublk_tier_cfg_find(spdk_bdev_get_name(slow));
+	struct spdk_bdev *fast;
+	struct ublk_tier_priv *p;
+	struct ublk_tier *t;
+	uint64_t ext, slow_blocks;
+	uint32_t i;
+	int rc;
+
+	*tierp = NULL;
+	if (cfg == NULL) {
+		return 0;
+	}
+
+	t = calloc(1, sizeof(*t));
+	p = calloc(1, sizeof(*p));
+	if (t == NULL || p == NULL) {
+		free(t);
+		free(p);
+		return -ENOMEM;
+	}
+	t->priv = p;
+	t->migrating = UBLK_TIER_NO_EXT;
+	p->t = t;
+	p->map_fd = -1;
+	p->ublk_id = ublk_id;
+	p->cfg = *cfg;
+	p->cfg.bdev_name = strdup(cfg->bdev_name);
+	p->cfg.fast_bdev_name = strdup(cfg->fast_bdev_name);
+	p->cfg.map_dir = strdup(cfg->map_dir);
+	if (!p->cfg.bdev_name || !p->cfg.fast_bdev_name || !p->cfg.map_dir) {
+		rc = -ENOMEM;
+		goto err;
+	}
+
+	rc = spdk_bdev_open_ext(cfg->bdev_name, true, ublk_tier_bdev_event_cb, p, &p->slow_desc);
+	if (rc == 0) {
+		rc = spdk_bdev_open_ext(cfg->fast_bdev_name, true, ublk_tier_bdev_event_cb, p, &t->fast_desc);
+	}
+	if (rc != 0) {
+		SPDK_ERRLOG("ublk%u tier: could not open %s / %s, rc=%d\n", ublk_id, cfg->bdev_name,
+			    cfg->fast_bdev_name, rc);
+		goto err;
+	}
+	fast = spdk_bdev_desc_get_bdev(t->fast_desc);
+	p->block_size = spdk_bdev_get_data_block_size(slow);
+	if (spdk_bdev_get_data_block_size(fast) != p->block_size || cfg->extent_size < p->block_size) {
+		SPDK_ERRLOG("ublk%u tier: block size of %s and %s differ or exceed the extent size\n",
+			    ublk_id, cfg->bdev_name, cfg->fast_bdev_name);
+		rc = -EINVAL;
+		goto err;
+	}
+
+	p->ext_bytes = cfg->extent_size;
+	t->ext_shift = spdk_u32log2(cfg->extent_size / p->block_size);
+	slow_blocks = spdk_bdev_get_num_blocks(slow);
+	p->full_extents = slow_blocks >> t->ext_shift;
+	t->num_extents = spdk_divide_round_up(slow_blocks, ublk_tier_extent_blocks(t));
+	p->num_slots = spdk_min(spdk_bdev_get_num_blocks(fast) >> t->ext_shift, UINT32_MAX - 1);
+	if (p->num_slots == 0) {
+		SPDK_ERRLOG("ublk%u tier: %s is smaller than one extent\n", ublk_id, cfg->fast_bdev_name);
+		rc = -EINVAL;
+		goto err;
+	}
+
+	t->loc = malloc(t->num_extents * sizeof(uint32_t));
+	t->heat = calloc(t->num_extents, sizeof(uint8_t));
+	t->slot_reads = calloc(p->num_slots, sizeof(uint16_t));
+	t->writes = calloc(t->num_extents, sizeof(uint16_t));
+	p->slot_ext = malloc(p->num_slots * sizeof(uint64_t));
+	p->free_fifo = malloc(p->num_slots * sizeof(uint32_t));
+	p->buf = spdk_dma_zmalloc(p->ext_bytes, 4096, NULL);
+	if (!t->loc || !t->heat || !t->slot_reads || !t->writes || !p->slot_ext || !p->free_fifo || !p->buf) {
+		rc = -ENOMEM;
+		goto err;
+	}
+	for (ext = 0; ext < t->num_extents; ext++) {
+		t->loc[ext] = UBLK_TIER_SLOW;
+	}
+	for (i = 0; i < p->num_slots; i++) {
+		p->slot_ext[i] = UBLK_TIER_NO_EXT;
+	}
+
+	rc = ublk_tier_map_open(p);
+	if (rc != 0) {
+		goto err;
+	}
+	for (i = 0; i < p->num_slots; i++) {
+		if (p->slot_ext[i] == UBLK_TIER_NO_EXT) {
+			ublk_tier_slot_put(p, i);
+		}
+	}
+
+	p->slow_ch = spdk_bdev_get_io_channel(p->slow_desc);
+	p->fast_ch = spdk_bdev_get_io_channel(t->fast_desc);
+	if (!p->slow_ch || !p->fast_ch) {
+		rc = -ENOMEM;
+		goto err;
+	}
+	p->decay_ticks = spdk_get_ticks_hz() * cfg->decay_ms / 1000;
+	p->last_tsc = spdk_get_ticks();
+	p->next_decay_tsc = p->last_tsc + p->decay_ticks;
+	p->poller = SPDK_POLLER_REGISTER(ublk_tier_poll, p, UBLK_TIER_POLL_US);
+	TAILQ_INSERT_TAIL(&g_tiers, p, link);
+
+	SPDK_NOTICELOG("ublk%u tier: %s (%" PRIu64 " extents of %u KiB) + %s (%u slots), %u MiB/s migration\n",
+		       ublk_id, cfg->bdev_name, t->num_extents, cfg->extent_size >> 10,
+		       cfg->fast_bdev_name, p->num_slots, cfg->migrate_mbps);
+	*tierp = t;
+	return 0;
+
+err:
+	ublk_tier_free(p);
+	return rc;
+}
+
+static void
+ublk_tier_sum(struct ublk_tier *t, uint64_t *fast, uint64_t *slow, uint64_t *waits)
+{
+	uint32_t i;
+
+	*fast = *slow = *waits = 0;
+	for (i = 0; i < UBLK_TIER_MAX_QUEUES; i++) {
+		*fast += t->qstat[i].fast_ios;
+		*slow += t->qstat[i].slow_ios;
+		*waits += t->qstat[i].waits;
+	}
+}
+
+void
+ublk_tier_close(struct ublk_tier *t)
+{
+	struct ublk_tier_priv *p = t->priv;
+	uint64_t fast, slow, waits;
+
+	ublk_tier_sum(t, &fast, &slow, &waits);
+	SPDK_NOTICELOG("ublk%u tier: %" PRIu64 " fast / %" PRIu64 " slow IOs (%.1f%% fast), %" PRIu64
+		       " write waits; promoted %" PRIu64 " demoted %" PRIu64 " failed %" PRIu64
+		       ", %" PRIu64 " MiB moved, %u/%u slots used\n",
+		       p->ublk_id, fast, slow, fast + slow ? fast * 100.0 / (fast + slow) : 0.0, waits,
+		       p->promoted, p->demoted, p->failed, (p->promoted + p->demoted) * p->ext_bytes >> 20,
+		       p->num_slots - p->free_cnt, p->num_slots);
+
+	TAILQ_REMOVE(&g_tiers, p, link);
+	spdk_poller_unregister(&p->poller);
+	p->closing = true;
+	if (p->state == UBLK_TIER_COPY) {
+		/* freed by ublk_tier_mig_end() */
+		return;
+	}
+	if (p->state == UBLK_TIER_DRAIN) {
+		if (p->mig_promote) {
+			ublk_tier_slot_put(p, p->mig_slot);
+		}
+		__atomic_store_n(&t->migrating, UBLK_TIER_NO_EXT, __ATOMIC_SEQ_CST);
+	}
+	ublk_tier_free(p);
+}
+
+/* --------------------------------------------------------------------- */
+/* RPC                                                                   */
+/* --------------------------------------------------------------------- */
+static const struct spdk_json_object_decoder rpc_ublk_tier_create_decoders[] = {
+	{"bdev_name", offsetof(struct ublk_tier_cfg, bdev_name), spdk_json_decode_string},
+	{"fast_bdev_name", offsetof(struct ublk_tier_cfg, fast_bdev_name), spdk_json_decode_string},
+	{"extent_size", offsetof(struct ublk_tier_cfg, extent_size), spdk_json_decode_uint32, true},
+	{"migrate_mbps", offsetof(struct ublk_tier_cfg, migrate_mbps), spdk_json_decode_uint32, true},
+	{"decay_ms", offsetof(struct ublk_tier_cfg, decay_ms), spdk_json_decode_uint32, true},
+	{"promote_min", offsetof(struct ublk_tier_cfg, promote_min), spdk_json_decode_uint32, true},
+	{"map_dir", offsetof(struct ublk_tier_cfg, map_dir), spdk_json_decode_string, true},
+};
+
+/* Takes effect for the next ublk_start_disk on bdev_name */
+static void
+rpc_ublk_tier_create(struct spdk_jsonrpc_request *request, const struct spdk_json_val *params)
+{
+	struct ublk_tier_cfg *cfg, *old;
+
+	cfg = calloc(1, sizeof(*cfg));
+	if (cfg == NULL) {
+		spdk_jsonrpc_send_error_response(request, -ENOMEM, spdk_strerror(ENOMEM));
+		return;
+	}
+	cfg->extent_size = UBLK_TIER_DEFAULT_EXTENT;
+	cfg->migrate_mbps = UBLK_TIER_DEFAULT_MBPS;
+	cfg->decay_ms = UBLK_TIER_DEFAULT_DECAY_MS;
+	cfg->promote_min = UBLK_TIER_DEFAULT_PROMOTE_MIN;
+
+	if (spdk_json_decode_object(params, rpc_ublk_tier_create_decoders,
+				    SPDK_COUNTOF(rpc_ublk_tier_create_decoders), cfg)) {
+		spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INVALID_PARAMS,
+						 "spdk_json_decode_object failed");
+		goto err;
+	}
+	if (!spdk_u32_is_pow2(cfg->extent_size) || cfg->extent_size < 4096 ||
+	    cfg->extent_size > UBLK_TIER_MAX_EXTENT || cfg->decay_ms == 0 || cfg->promote_min > UINT8_MAX) {
+		spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INVALID_PARAMS,
+						 "extent_size must be a power of 2 in [4 KiB, 16 MiB], "
+						 "decay_ms > 0, promote_min <= 255");
+		goto err;
+	}
+	if (cfg->map_dir == NULL) {
+		cfg->map_dir = strdup(UBLK_TIER_DEFAULT_MAP_DIR);
+		if (cfg->map_dir == NULL) {
+			spdk_jsonrpc_send_error_response(request, -ENOMEM, spdk_strerror(ENOMEM));
+			goto err;
+		}
+	}
+
+	old = ublk_tier_cfg_find(cfg->bdev_name);
+	if (old != NULL) {
+		TAILQ_REMOVE(&g_tier_cfgs, old, link);
+		ublk_tier_cfg_free(old);
+	}
+	TAILQ_INSERT_TAIL(&g_tier_cfgs, cfg, link);
+	spdk_jsonrpc_send_bool_response(request, true);
+	return;
+
+err:
+	ublk_tier_cfg_free(cfg);
+}
+SPDK_RPC_REGISTER("ublk_tier_create", rpc_ublk_tier_create, SPDK_RPC_STARTUP | SPDK_RPC_RUNTIME)
+
+static void
+rpc_ublk_tier_get_stats(struct spdk_jsonrpc_request *request, const struct spdk_json_val *params)
+{
+	struct spdk_json_write_ctx *w;
+	struct ublk_tier_priv *p;
+	uint64_t fast, slow, waits, moves;
+
+	if (params != NULL) {
+		spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INVALID_PARAMS,
+						 "ublk_tier_get_stats requires no parameters");
+		return;
+	}
+
+	w = spdk_jsonrpc_begin_result(request);
+	spdk_json_write_array_begin(w);
+	TAILQ_FOREACH(p, &g_tiers, link) {
+		ublk_tier_sum(p->t, &fast, &slow, &waits);
+		moves = p->promoted + p->demoted + p->failed;
+
+		spdk_json_write_object_begin(w);
+		spdk_json_write_named_uint32(w, "ublk_id", p->ublk_id);
+		spdk_json_write_named_string(w, "bdev_name", p->cfg.bdev_name);
+		spdk_json_write_named_string(w, "fast_bdev_name", p->cfg.fast_bdev_name);
+		spdk_json_write_named_uint32(w, "extent_size", p->cfg.extent_size);
+		spdk_json_write_named_uint32(w, "slots", p->num_slots);
+		spdk_json_write_named_uint32(w, "slots_used", p->num_slots - p->free_cnt);
+		spdk_json_write_named_uint64(w, "fast_ios", fast);
+		spdk_json_write_named_uint64(w, "slow_ios", slow);
+		spdk_json_write_named_uint64(w, "write_waits", waits);
+		spdk_json_write_named_uint64(w, "promoted", p->promoted);
+		spdk_json_write_named_uint64(w, "demoted", p->demoted);
+		spdk_json_write_named_uint64(w, "failed", p->failed);
+		spdk_json_write_named_double(w, "avg_migrate_us",
+					     moves ? (double)p->mig_ticks * 1000000 / spdk_get_ticks_hz() / moves : 0.0);
+		spdk_json_write_object_end(w);
+	}
+	spdk_json_write_array_end(w);
+	spdk_jsonrpc_end_result(request, w);
+}
+SPDK_RPC_REGISTER("ublk_tier_get_stats", rpc_ublk_tier_get_stats, SPDK_RPC_RUNTIME)
@@ -0,0 +1,178 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   Copyright (C) 2022 Intel Corporation.
+ *   All rights reserved.
+ */
+
+/*
+ * Hot/cold tiering between two bdevs behind one ublk device.
+ *
+ * Build ublk_tier.c next to ublk_traced_v4.c. A device is tiered when the RPC
+ * ublk_tier_create named its bdev before ublk_start_disk:
+ *   {"bdev_name": "Slow0", "fast_bdev_name": "Fast0", "extent_size": 1048576,
+ *    "migrate_mbps": 200, "decay_ms": 1000, "promote_min": 4, "map_dir": "/var/tmp"}
+ * The ublk device has the size of the slow bdev; the fast bdev provides
+ * fast_size / extent_size slots. Every extent lives in exactly one tier.
+ *
+ * Data path (poll group threads, ublk_tier_route):
+ *   loc[ext]   fast slot of the extent, UBLK_TIER_SLOW = still on the slow bdev
+ *   heat[ext]  saturating 8-bit access counter, halved every decay_ms
+ *   slot_reads[slot] READs in flight to a fast slot, so a demoted slot can drain them
+ *   writes[ext] WRITEs in flight, so a migration can drain them
+ * The device advertises chunk_sectors = extent size, so the block layer never
+ * sends a READ/WRITE across an extent boundary.
+ *
+ * Migration (app thread poller), one extent at a time, rate limited to
+ * migrate_mbps:
+ *   promote  hottest slow extent with heat >= promote_min into a free slot
+ *   demote   coldest fast extent when no slot is free and a slow extent is
+ *            hotter by more than promote_min
+ * While an extent migrates, new WRITEs to it get UBLK_TIER_WAIT and are retried
+ * by the queue; READs keep going to the source, which stays valid until the map
+ * flips. A demoted slot is released only once slot_reads[slot] is back to zero,
+ * since the next promotion takes it right away and a READ that looked up the
+ * old location could otherwise return the new extent's data. READs after the
+ * flip go to the slow bdev and do not hold the slot.
+ *
+ * The map is written through to <map_dir>/ublk_tier_<slow>.map (one pwrite per
+ * flip, after the copy completed) and loaded on the next start, so the data on
+ * the fast bdev survives a restart or a crash of the target. The header holds
+ * both bdevs' UUIDs; after either bdev was recreated the map is discarded and
+ * every extent starts on the slow bdev again.
+ *
+ * DISCARD and WRITE_ZEROES are not advertised on tiered devices; FLUSH goes to
+ * both bdevs.
+ */
+
+#ifndef SPDK_UBLK_TIER_H
+#define SPDK_UBLK_TIER_H
+
+#include "spdk/stdinc.h"
+#include "spdk/bdev.h"
+#include "spdk/likely.h"
+
+#define UBLK_TIER_SLOW		UINT32_MAX
+#define UBLK_TIER_NO_EXT	UINT64_MAX
+#define UBLK_TIER_MAX_QUEUES	32
+
+enum ublk_tier_target {
+	UBLK_TIER_TO_SLOW,
+	UBLK_TIER_TO_FAST,
+	UBLK_TIER_TO_WAIT,	/* WRITE to an extent being migrated, retry later */
+	UBLK_TIER_TO_ERROR,	/* crosses an extent boundary, see chunk_sectors */
+};
+
+/* written only by the queue's own thread */
+struct ublk_tier_qstat {
+	uint64_t	fast_ios;
+	uint64_t	slow_ios;
+	uint64_t	waits;
+} __attribute__((aligned(64)));
+
+struct ublk_tier {
+	/* read on the data path */
+	struct spdk_bdev_desc	*fast_desc;
+	uint32_t		ext_shift;	/* extent size in blocks, log2 */
+	uint64_t		num_extents;
+	uint32_t		*loc;
+	uint8_t			*heat;
+	uint16_t		*slot_reads;
+	uint16_t		*writes;
+	uint64_t		migrating;	/* UBLK_TIER_NO_EXT when idle */
+	struct ublk_tier_qstat	qstat[UBLK_TIER_MAX_QUEUES];
+
+	/* the rest is private to ublk_tier.c (app thread) */
+	struct ublk_tier_priv	*priv;
+};
+
+/*
+ * App thread. Returns 0 with *tier == NULL when no tier is configured for the
+ * bdev behind slow_desc.
+ */
+int ublk_tier_open(struct spdk_bdev_desc *slow_desc, uint32_t ublk_id, struct ublk_tier **tier);
+
+/* App thread, after every queue has stopped. Frees the tier once a migration in flight ends. */
+void ublk_tier_close(struct ublk_tier *tier);
+
+static inline uint32_t
+ublk_tier_extent_blocks(const struct ublk_tier *t)
+{
+	return 1U << t->ext_shift;
+}
+
+/*
+ * READ/WRITE routing. For UBLK_TIER_TO_FAST *offset_blocks is rewritten to the
+ * fast bdev. An IO that gets TO_SLOW or TO_FAST must be followed by
+ * ublk_tier_io_done() with the original and the routed offset once it
+ * completes (or fails).
+ * 'retry' is set when the queue resubmits an IO that was already routed once
+ * (after TO_WAIT or -ENOMEM); it is not counted in heat[] and qstat again.
+ */
+static inline enum ublk_tier_target
+ublk_tier_route(struct ublk_tier *t, uint32_t q_id, bool is_write, bool retry,
+		uint64_t *offset_blocks, uint64_t num_blocks)
+{
+	uint64_t mask = (1ULL << t->ext_shift) - 1;
+	uint64_t ext = *offset_blocks >> t->ext_shift;
+	struct ublk_tier_qstat *qs = &t->qstat[q_id];
+	uint32_t slot, cur;
+	uint8_t h;
+
+	if (spdk_unlikely(ext >= t->num_extents || (*offset_blocks & mask) + num_blocks > mask + 1)) {
+		return UBLK_TIER_TO_ERROR;
+	}
+
+	/* racy increments across queues only lose a count now and then */
+	if (!retry) {
+		h = __atomic_load_n(&t->heat[ext], __ATOMIC_RELAXED);
+		if (h != UINT8_MAX) {
+			__atomic_store_n(&t->heat[ext], h + 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	if (is_write) {
+		/* pairs with the migrator storing 'migrating' before it reads 'writes' */
+		__atomic_fetch_add(&t->writes[ext], 1, __ATOMIC_SEQ_CST);
+		if (spdk_unlikely(__atomic_load_n(&t->migrating, __ATOMIC_SEQ_CST) == ext)) {
+			__atomic_fetch_sub(&t->writes[ext], 1, __ATOMIC_RELEASE);
+			if (!retry) {
+				qs->waits++;
+			}
+			return UBLK_TIER_TO_WAIT;
+		}
+	}
+
+	slot = __atomic_load_n(&t->loc[ext], __ATOMIC_SEQ_CST);
+	/*
+	 * A READ pins the fast slot, then checks the map did not flip meanwhile;
+	 * pairs with the migrator storing 'loc' before it reads 'slot_reads'.
+	 */
+	while (!is_write && slot != UBLK_TIER_SLOW) {
+		__atomic_fetch_add(&t->slot_reads[slot], 1, __ATOMIC_SEQ_CST);
+		cur = __atomic_load_n(&t->loc[ext], __ATOMIC_SEQ_CST);
+		if (spdk_likely(cur == slot)) {
+			break;
+		}
+		__atomic_fetch_sub(&t->slot_reads[slot], 1, __ATOMIC_RELEASE);
+		slot = cur;
+	}
+	if (slot == UBLK_TIER_SLOW) {
+		qs->slow_ios += !retry;
+		return UBLK_TIER_TO_SLOW;
+	}
+	*offset_blocks = ((uint64_t)slot << t->ext_shift) | (*offset_blocks & mask);
+	qs->fast_ios += !retry;
+	return UBLK_TIER_TO_FAST;
+}
+
+/* offset_blocks as the IO was sent, fast_offset what ublk_tier_route() made of it (or UINT64_MAX) */
+static inline void
+ublk_tier_io_done(struct ublk_tier *t, bool is_write, uint64_t offset_blocks, uint64_t fast_offset)
+{
+	if (is_write) {
+		__atomic_fetch_sub(&t->writes[offset_blocks >> t->ext_shift], 1, __ATOMIC_RELEASE);
+	} else if (fast_offset != UINT64_MAX) {
+		__atomic_fetch_sub(&t->slot_reads[fast_offset >> t->ext_shift], 1, __ATOMIC_RELEASE);
+	}
+}
+
+#endif /* SPDK_UBLK_TIER_H */
@@ -8,10 +8,12 @@
 #include "spdk/stdinc.h"
 #include "spdk/string.h"
 #include "spdk/bdev.h"
+#include "spdk/nvme.h"
 #include "spdk/endian.h"
 #include "spdk/env.h"
 #include "spdk/likely.h"
 #include "spdk/trace.h"
+#include "spdk/usdt.h"
 #include "spdk_internal/trace_defs.h"
 #include "spdk/log.h"
 #include "spdk/util.h"
@@ -22,6 +24,9 @@
 #include "spdk/file.h"
 
 #include "ublk_internal.h"
+/* -DSPDK_UBLK_DRV_EMU: talk to the userspace ublk_drv emulator instead of the kernel */
+#include "ublk_drv_emu.h"
+#include "ublk_tier.h"
 
 #define UBLK_CTRL_DEV					"/dev/ublk-control"
 #define UBLK_BLK_CDEV					"/dev/ublkc"
@@ -40,6 +45,11 @@
 #define UBLK_IOBUF_SMALL_CACHE_SIZE			128
 #define UBLK_IOBUF_LARGE_CACHE_SIZE			32
 
+/* nvme_bypass qpair reconnect: exponential backoff, give up after this many hard failures */
+#define UBLK_NVME_RECONNECT_MIN_US			1000
+#define UBLK_NVME_RECONNECT_MAX_US			1000000
+#define UBLK_NVME_RECONNECT_MAX_FAILS			10
+
 #define UBLK_DEBUGLOG(ublk, format, ...) \
 	SPDK_DEBUGLOG(ublk, "ublk%d: " format, ublk->ublk_id, ##__VA_ARGS__);
 
@@ -48,11 +58,24 @@ static uint32_t g_next_ublk_poll_group = 0;
 static uint32_t g_ublks_max = UBLK_DEFAULT_MAX_SUPPORTED_DEVS;
 static struct spdk_cpuset g_core_mask;
 static bool g_disable_user_copy = false;
+static bool g_nvme_bypass = false;
+static uint32_t g_zmap_chunk = 0;
+static char *g_zmap_dir = NULL;
+static bool g_zmap_trust = false;
+
+/* Exported by the bdev_nvme module (module/bdev/nvme/bdev_nvme.h). Only used when
+ * the target is created with nvme_bypass, to reach the controller behind an
+ * NVMe bdev without going through the generic bdev layer.
+ */
+struct spdk_nvme_ctrlr *bdev_nvme_get_ctrlr(struct spdk_bdev *bdev);
 
 struct ublk_queue;
 struct ublk_poll_group;
 struct ublk_io;
 static void _ublk_submit_bdev_io(struct ublk_queue *q, struct ublk_io *io);
+static void ublk_issue_bdev_io(struct ublk_queue *q, struct ublk_io *io);
+static void ublk_io_done(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg);
+static void ublk_queue_user_copy(struct ublk_io *io, bool is_write);
 static void ublk_dev_queue_fini(struct ublk_queue *q);
 static int ublk_poll(void *arg);
 
@@ -95,8 +118,15 @@ struct ublk_io {
 	/* for bdev io_wait */
 	struct spdk_bdev_io_wait_entry bdev_io_wait;
 	struct spdk_iobuf_entry	iobuf;
+	/* READ/WRITE counted in the tier's slot_reads[]/writes[], see ublk_tier_route() */
+	bool			tier_held;
+	/* where ublk_tier_route() sent it on the fast bdev, UINT64_MAX for the slow one */
+	uint64_t		tier_fast_offset;
+	/* requeued after UBLK_TIER_TO_WAIT or -ENOMEM, already routed once */
+	bool			tier_retry;
 
 	TAILQ_ENTRY(ublk_io)	tailq;
+	TAILQ_ENTRY(ublk_io)	wait_tailq;
 };
 
 struct ublk_queue {
@@ -113,13 +143,62 @@ struct ublk_queue {
 	struct spdk_ublk_dev	*dev;
 	struct ublk_poll_group	*poll_group;
 	struct spdk_io_channel	*bdev_ch;
+	/* dedicated NVMe IO qpair, only set in nvme_bypass mode */
+	struct spdk_nvme_qpair	*nvme_qpair;
+	/* qpair disconnected: READ/WRITE take the bdev path until a reconnect succeeds */
+	bool			nvme_down;
+	uint32_t		nvme_reconnect_fails;
+	uint64_t		nvme_reconnect_tsc;
+	/* submit-side cost of READ/WRITE, split by path */
+	uint64_t		nvme_submit_tsc;
+	uint64_t		nvme_submit_cnt;
+	uint64_t		bdev_submit_tsc;
+	uint64_t		bdev_submit_cnt;
+	/* zero map, only touched when the device has one */
+	uint64_t		zmap_read_hits;
+	uint64_t		zmap_read_miss;
+	uint64_t		zmap_hit_bytes;
+	uint64_t		zmap_chunks_set;
+	uint64_t		zmap_chunks_cleared;
+	/* tiered devices only: fast bdev channel and IOs to resubmit from ublk_poll() */
+	struct spdk_io_channel	*tier_fast_ch;
+	TAILQ_HEAD(, ublk_io)	tier_wait_list;
 
 	TAILQ_ENTRY(ublk_queue)	tailq;
 };
 
+/*
+ * Per-device map of chunks known to read back as zeros. A bit is set when a
+ * DISCARD or WRITE_ZEROES fully covering the chunk completes successfully and
+ * cleared when a WRITE touches the chunk, so READs fully covered by set bits
+ * complete from a shared zero buffer without a bdev IO. After DISCARD the block
+ * layer leaves the content unspecified, so zeros are a valid answer even when
+ * the bdev itself would return the old data.
+ *
+ * Queues of one device run on different poll group threads, so the words are
+ * updated with atomics. 'pending' closes the race between an in-flight DISCARD
+ * and a WRITE to the same chunk: the DISCARD marks its chunks pending at submit,
+ * a WRITE clears them, and only chunks still pending at completion become zero.
+ */
+struct ublk_zmap {
+	uint64_t		*zero;
+	uint64_t		*pending;
+	uint64_t		num_chunks;
+	uint32_t		chunk_shift;	/* in 512B sectors */
+	char			path[PATH_MAX];	/* empty: not persisted */
+	bool			started;	/* START_DEV / END_USER_RECOVERY done: save on stop */
+};
+
 struct spdk_ublk_dev {
 	struct spdk_bdev	*bdev;
 	struct spdk_bdev_desc	*bdev_desc;
+	/* set when READ/WRITE bypass the bdev layer, see ublk_nvme_bypass_init() */
+	struct spdk_nvme_ctrlr	*nvme_ctrlr;
+	struct spdk_nvme_ns	*nvme_ns;
+	/* NULL unless the target was created with zero_map_chunk */
+	struct ublk_zmap	*zmap;
+	/* NULL unless ublk_tier_create named this bdev */
+	struct ublk_tier	*tier;
 
 	int			cdev_fd;
 	struct ublk_params	dev_params;
@@ -151,6 +230,7 @@ struct ublk_poll_group {
 	struct spdk_poller		*ublk_poller;
 	struct spdk_iobuf_channel	iobuf_ch;
 	TAILQ_HEAD(, ublk_queue)	queue_list;
+	uint64_t			io_completed;
 };
 
 struct ublk_tgt {
@@ -184,6 +264,13 @@ struct ublk_tgt {
  *
  * If you later extend this module to capture the spdk_bdev_io* used in bdev tracing,
  * you can add spdk_trace_tpoint_register_relation() entries to OBJECT_BDEV_IO.
+ *
+ * Every tracepoint also has a USDT probe (provider "spdk", built with --with-usdt)
+ * named after it in lower case, e.g. ublk_req_ready.  Probe args are
+ * (tsc, ublk_id, qid, tag, x), where x is the start sector for ublk_req_ready and
+ * the same value as the tracepoint's last int arg for the others.  ublk_commit_submit
+ * and ublk_commit_submitted (after io_uring_submit returns) carry the batch count
+ * instead of a tag.  ublk_e2e.bt joins them with the block layer by (qid, tag).
  */
 #define TRACE_GROUP_UBLK            0x90  /* NOTE: adjust if this conflicts with your tree */
 #define TRACE_UBLK_REQ_READY        SPDK_TPOINT_ID(TRACE_GROUP_UBLK, 0x0)
@@ -193,6 +280,7 @@ struct ublk_tgt {
 #define TRACE_UBLK_BDEV_DONE        SPDK_TPOINT_ID(TRACE_GROUP_UBLK, 0x4)
 #define TRACE_UBLK_COMMIT_PREP      SPDK_TPOINT_ID(TRACE_GROUP_UBLK, 0x5)
 #define TRACE_UBLK_COMMIT_SUBMIT    SPDK_TPOINT_ID(TRACE_GROUP_UBLK, 0x6)
+#define TRACE_UBLK_ZERO_READ        SPDK_TPOINT_ID(TRACE_GROUP_UBLK, 0x7)
 
 #define OWNER_TYPE_UBLK             0x90
 #define OBJECT_UBLK_IO              0x90
@@ -285,6 +373,16 @@ ublk_trace_init(void)
 				{ "cnt",  SPDK_TRACE_ARG_TYPE_INT, 4 },
 			}
 		},
+		{
+			"UBLK_ZERO_READ", TRACE_UBLK_ZERO_READ,
+			OWNER_TYPE_UBLK, OBJECT_UBLK_IO, 0,
+			{
+				{ "qid",  SPDK_TRACE_ARG_TYPE_INT, 4 },
+				{ "tag",  SPDK_TRACE_ARG_TYPE_INT, 4 },
+				{ "lba",  SPDK_TRACE_ARG_TYPE_INT, 8 },
+				{ "secs", SPDK_TRACE_ARG_TYPE_INT, 4 },
+			}
+		},
 	};
 
 	spdk_trace_register_owner_type(OWNER_TYPE_UBLK, 'u');
@@ -500,6 +598,9 @@ ublk_ctrl_process_cqe(struct io_uring_cqe *cqe)
 		}
 		break;
 	case UBLK_CMD_START_DEV:
+		if (ublk->zmap != NULL) {
+			ublk->zmap->started = true;
+		}
 		goto cb_done;
 		break;
 	case UBLK_CMD_STOP_DEV:
@@ -542,6 +643,9 @@ ublk_ctrl_process_cqe(struct io_uring_cqe *cqe)
 	case UBLK_CMD_END_USER_RECOVERY:
 		SPDK_NOTICELOG("Ublk %u recover done successfully\n", ublk->ublk_id);
 		ublk->is_recovering = false;
+		if (ublk->zmap != NULL) {
+			ublk->zmap->started = true;
+		}
 		goto cb_done;
 		break;
 	default:
@@ -817,10 +921,18 @@ ublk_poller_register(void *args)
 
 struct rpc_create_target {
 	bool disable_user_copy;
+	bool nvme_bypass;
+	uint32_t zero_map_chunk;
+	char *zero_map_dir;
+	bool zero_map_trust;
 };
 
 static const struct spdk_json_object_decoder rpc_ublk_create_target[] = {
 	{"disable_user_copy", offsetof(struct rpc_create_target, disable_user_copy), spdk_json_decode_bool, true},
+	{"nvme_bypass", offsetof(struct rpc_create_target, nvme_bypass), spdk_json_decode_bool, true},
+	{"zero_map_chunk", offsetof(struct rpc_create_target, zero_map_chunk), spdk_json_decode_uint32, true},
+	{"zero_map_dir", offsetof(struct rpc_create_target, zero_map_dir), spdk_json_decode_string, true},
+	{"zero_map_trust", offsetof(struct rpc_create_target, zero_map_trust), spdk_json_decode_bool, true},
 };
 
 int
@@ -850,6 +962,17 @@ ublk_create_target(const char *cpumask_str, const struct spdk_json_val *params)
 			return -EINVAL;
 		}
 		g_disable_user_copy = req.disable_user_copy;
+		g_nvme_bypass = req.nvme_bypass;
+		if (req.zero_map_chunk != 0 &&
+		    (!spdk_u32_is_pow2(req.zero_map_chunk) || req.zero_map_chunk < 4096)) {
+			SPDK_ERRLOG("zero_map_chunk must be a power of 2 >= 4096\n");
+			free(req.zero_map_dir);
+			return -EINVAL;
+		}
+		g_zmap_chunk = req.zero_map_chunk;
+		free(g_zmap_dir);
+		g_zmap_dir = req.zero_map_dir;
+		g_zmap_trust = req.zero_map_trust;
 	}
 
 	assert(g_ublk_tgt.poll_groups == NULL);
@@ -903,6 +1026,11 @@ _ublk_fini_done(void *args)
 	g_ublk_tgt.ioctl_encode = false;
 	g_ublk_tgt.user_copy = false;
 	g_ublk_tgt.user_recovery = false;
+	g_nvme_bypass = false;
+	g_zmap_chunk = 0;
+	free(g_zmap_dir);
+	g_zmap_dir = NULL;
+	g_zmap_trust = false;
 
 	if (g_ublk_tgt.cb_fn) {
 		g_ublk_tgt.cb_fn(g_ublk_tgt.cb_arg);
@@ -921,10 +1049,21 @@ static void
 ublk_thread_exit(void *args)
 {
 	struct spdk_thread *ublk_thread = spdk_get_thread();
+	struct spdk_thread_stats stats;
 	uint32_t i;
 
 	for (i = 0; i < g_num_ublk_poll_groups; i++) {
 		if (g_ublk_tgt.poll_groups[i].ublk_thread == ublk_thread) {
+			/* Busy ticks per IO covers the whole per-IO cost on this core,
+			 * including the bdev_nvme poller when IOs take the bdev path.
+			 */
+			if (g_ublk_tgt.poll_groups[i].io_completed > 0 &&
+			    spdk_thread_get_stats(&stats) == 0) {
+				SPDK_NOTICELOG("%s: %" PRIu64 " IOs, %" PRIu64 " busy ticks/IO\n",
+					       spdk_thread_get_name(ublk_thread),
+					       g_ublk_tgt.poll_groups[i].io_completed,
+					       stats.busy_tsc / g_ublk_tgt.poll_groups[i].io_completed);
+			}
 			spdk_poller_unregister(&g_ublk_tgt.poll_groups[i].ublk_poller);
 			spdk_iobuf_channel_fini(&g_ublk_tgt.poll_groups[i].iobuf_ch);
 			spdk_thread_bind(ublk_thread, false);
@@ -1072,6 +1211,18 @@ spdk_ublk_write_config_json(struct spdk_json_write_ctx *w)
 		spdk_json_write_named_string(w, "method", "ublk_create_target");
 		spdk_json_write_named_object_begin(w, "params");
 		spdk_json_write_named_string(w, "cpumask", spdk_cpuset_fmt(&g_core_mask));
+		if (g_nvme_bypass) {
+			spdk_json_write_named_bool(w, "nvme_bypass", true);
+		}
+		if (g_zmap_chunk != 0) {
+			spdk_json_write_named_uint32(w, "zero_map_chunk", g_zmap_chunk);
+			if (g_zmap_dir != NULL) {
+				spdk_json_write_named_string(w, "zero_map_dir", g_zmap_dir);
+			}
+			if (g_zmap_trust) {
+				spdk_json_write_named_bool(w, "zero_map_trust", true);
+			}
+		}
 		spdk_json_write_object_end(w);
 
 		spdk_json_write_object_end(w);
@@ -1201,6 +1352,25 @@ ublk_try_close_queue(struct ublk_queue *q)
 	TAILQ_REMOVE(&q->poll_group->queue_list, q, tailq);
 	spdk_put_io_channel(q->bdev_ch);
 	q->bdev_ch = NULL;
+	if (q->tier_fast_ch) {
+		spdk_put_io_channel(q->tier_fast_ch);
+		q->tier_fast_ch = NULL;
+	}
+	if (q->nvme_qpair) {
+		spdk_nvme_ctrlr_free_io_qpair(q->nvme_qpair);
+		q->nvme_qpair = NULL;
+	}
+
+	if (q->nvme_submit_cnt > 0) {
+		SPDK_NOTICELOG("ublk%u q%u: nvme bypass %" PRIu64 " submits, %" PRIu64 " ticks/IO\n",
+			       ublk->ublk_id, q->q_id, q->nvme_submit_cnt,
+			       q->nvme_submit_tsc / q->nvme_submit_cnt);
+	}
+	if (q->bdev_submit_cnt > 0) {
+		SPDK_NOTICELOG("ublk%u q%u: bdev path %" PRIu64 " submits, %" PRIu64 " ticks/IO\n",
+			       ublk->ublk_id, q->q_id, q->bdev_submit_cnt,
+			       q->bdev_submit_tsc / q->bdev_submit_cnt);
+	}
 
 	spdk_thread_send_msg(spdk_thread_get_app_thread(), ublk_try_close_dev, ublk);
 }
@@ -1231,6 +1401,339 @@ ublk_stop_disk(uint32_t ublk_id, ublk_ctrl_cb ctrl_cb, void *cb_arg)
 	return ublk_close_dev(ublk);
 }
 
+/* --------------------------------------------------------------------- */
+/* Zero map                                                              */
+/* --------------------------------------------------------------------- */
+#define UBLK_ZMAP_MAGIC		"UBLKZMP1"
+
+struct ublk_zmap_hdr {
+	char		magic[8];
+	uint32_t	chunk_shift;
+	uint32_t	block_size;
+	uint64_t	num_blocks;
+	char		uuid[SPDK_UUID_STRING_LEN];
+};
+
+/* Never written: untouched BSS pages are backed by the kernel zero page */
+static uint8_t g_ublk_zero_buf[UBLK_IO_MAX_BYTES] __attribute__((aligned(4096)));
+
+enum ublk_zmap_op {
+	UBLK_ZMAP_TEST,		/* all bits in range set? */
+	UBLK_ZMAP_PEND,		/* DISCARD / WRITE_ZEROES submitted */
+	UBLK_ZMAP_COMMIT,	/* ... completed: pending -> zero */
+	UBLK_ZMAP_ABORT,	/* ... failed: drop pending */
+	UBLK_ZMAP_CLEAR,	/* WRITE: drop pending and zero */
+};
+
+/* Chunks [first, end). Returns 1/0 for TEST, else the number of zero bits changed. */
+static uint64_t
+ublk_zmap_apply(struct ublk_zmap *zm, uint64_t first, uint64_t end, enum ublk_zmap_op op)
+{
+	uint64_t w, mask, bits, n = 0;
+	uint32_t span;
+
+	if (end > zm->num_chunks) {
+		end = zm->num_chunks;
+	}
+	if (first >= end) {
+		return 0;
+	}
+	while (first < end) {
+		w = first >> 6;
+		span = spdk_min(end - first, 64 - (first & 63));
+		mask = (span == 64 ? UINT64_MAX : ((1ULL << span) - 1)) << (first & 63);
+
+		switch (op) {
+		case UBLK_ZMAP_TEST:
+			if ((__atomic_load_n(&zm->zero[w], __ATOMIC_RELAXED) & mask) != mask) {
+				return 0;
+			}
+			break;
+		case UBLK_ZMAP_PEND:
+			__atomic_fetch_or(&zm->pending[w], mask, __ATOMIC_RELAXED);
+			break;
+		case UBLK_ZMAP_COMMIT:
+			bits = __atomic_fetch_and(&zm->pending[w], ~mask, __ATOMIC_RELAXED) & mask;
+			if (bits != 0) {
+				n += __builtin_popcountll(bits & ~__atomic_fetch_or(&zm->zero[w], bits,
+							  __ATOMIC_RELAXED));
+			}
+			break;
+		case UBLK_ZMAP_ABORT:
+			__atomic_fetch_and(&zm->pending[w], ~mask, __ATOMIC_RELAXED);
+			break;
+		case UBLK_ZMAP_CLEAR:
+			/* plain loads first: the common case is a WRITE to a chunk that is not zero */
+			if (__atomic_load_n(&zm->pending[w], __ATOMIC_RELAXED) & mask) {
+				__atomic_fetch_and(&zm->pending[w], ~mask, __ATOMIC_RELAXED);
+			}
+			if (__atomic_load_n(&zm->zero[w], __ATOMIC_RELAXED) & mask) {
+				n += __builtin_popcountll(__atomic_fetch_and(&zm->zero[w], ~mask,
+							  __ATOMIC_RELAXED) & mask);
+			}
+			break;
+		}
+		first += span;
+	}
+
+	return op == UBLK_ZMAP_TEST ? 1 : n;
+}
+
+/* Chunks touched by the request */
+static inline uint64_t
+ublk_zmap_touch(struct ublk_zmap *zm, const struct ublksrv_io_desc *iod, enum ublk_zmap_op op)
+{
+	uint64_t first = iod->start_sector >> zm->chunk_shift;
+	uint64_t end = (iod->start_sector + iod->nr_sectors + (1ULL << zm->chunk_shift) - 1) >> zm->chunk_shift;
+
+	return ublk_zmap_apply(zm, first, end, op);
+}
+
+/* Chunks fully covered by the request */
+static inline uint64_t
+ublk_zmap_cover(struct ublk_zmap *zm, const struct ublksrv_io_desc *iod, enum ublk_zmap_op op)
+{
+	uint64_t first = (iod->start_sector + (1ULL << zm->chunk_shift) - 1) >> zm->chunk_shift;
+	uint64_t end = (iod->start_sector + iod->nr_sectors) >> zm->chunk_shift;
+
+	return ublk_zmap_apply(zm, first, end, op);
+}
+
+static void
+ublk_zmap_hdr_init(struct spdk_ublk_dev *ublk, struct ublk_zmap_hdr *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, UBLK_ZMAP_MAGIC, sizeof(hdr->magic));
+	hdr->chunk_shift = ublk->zmap->chunk_shift;
+	hdr->block_size = spdk_bdev_get_data_block_size(ublk->bdev);
+	hdr->num_blocks = spdk_bdev_get_num_blocks(ublk->bdev);
+	spdk_uuid_fmt_lower(hdr->uuid, sizeof(hdr->uuid), spdk_bdev_get_uuid(ublk->bdev));
+}
+
+/*
+ * The file is written on a clean stop of a started device and removed once
+ * read, so a crash leaves no map behind. Nothing in the file can prove that the
+ * bdev was not written through another path (nvmf, another app, a second ublk)
+ * between that stop and this start, and a stale map would return zeros for
+ * chunks that now hold data. So the map is only loaded when the target was
+ * created with zero_map_trust; otherwise the file is dropped and the device
+ * starts with an empty map.
+ */
+static void
+ublk_zmap_load(struct spdk_ublk_dev *ublk)
+{
+	struct ublk_zmap *zm = ublk->zmap;
+	struct ublk_zmap_hdr want, hdr;
+	size_t words = spdk_divide_round_up(zm->num_chunks, 64);
+	uint64_t set = 0, i;
+	FILE *f;
+
+	f = fopen(zm->path, "r");
+	if (f == NULL) {
+		return;
+	}
+	if (!g_zmap_trust) {
+		SPDK_NOTICELOG("ublk%u: zero map %s not loaded, zero_map_trust is not set\n",
+			       ublk->ublk_id, zm->path);
+		fclose(f);
+		unlink(zm->path);
+		return;
+	}
+	ublk_zmap_hdr_init(ublk, &want);
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(&hdr, &want, sizeof(hdr)) != 0) {
+		SPDK_WARNLOG("ublk%u: zero map %s does not match bdev %s, ignored\n",
+			     ublk->ublk_id, zm->path, spdk_bdev_get_name(ublk->bdev));
+	} else if (fread(zm->zero, sizeof(uint64_t), words, f) != words) {
+		SPDK_WARNLOG("ublk%u: zero map %s is truncated, ignored\n", ublk->ublk_id, zm->path);
+		memset(zm->zero, 0, words * sizeof(uint64_t));
+	} else {
+		for (i = 0; i < words; i++) {
+			set += __builtin_popcountll(zm->zero[i]);
+		}
+		SPDK_NOTICELOG("ublk%u: zero map loaded from %s, %" PRIu64 "/%" PRIu64 " chunks zero\n",
+			       ublk->ublk_id, zm->path, set, zm->num_chunks);
+	}
+	fclose(f);
+	unlink(zm->path);
+}
+
+static void
+ublk_zmap_save(struct spdk_ublk_dev *ublk)
+{
+	struct ublk_zmap *zm = ublk->zmap;
+	struct ublk_zmap_hdr hdr;
+	size_t words = spdk_divide_round_up(zm->num_chunks, 64);
+	char tmp[PATH_MAX + 8];
+	FILE *f;
+	int rc;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", zm->path);
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		SPDK_ERRLOG("ublk%u: could not write zero map %s: %s\n", ublk->ublk_id, tmp,
+			    spdk_strerror(errno));
+		return;
+	}
+	ublk_zmap_hdr_init(ublk, &hdr);
+	rc = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+	     fwrite(zm->zero, sizeof(uint64_t), words, f) == words ? 0 : -EIO;
+	if (fclose(f) != 0 || rc != 0 || rename(tmp, zm->path) != 0) {
+		SPDK_ERRLOG("ublk%u: could not write zero map %s\n", ublk->ublk_id, zm->path);
+		unlink(tmp);
+	}
+}
+
+static int
+ublk_zmap_init(struct spdk_ublk_dev *ublk)
+{
+	struct ublk_zmap *zm;
+	uint64_t sectors;
+	size_t words;
+
+	if (g_zmap_chunk == 0 || ublk->tier != NULL) {
+		return 0;
+	}
+	if (g_zmap_chunk < spdk_bdev_get_data_block_size(ublk->bdev)) {
+		SPDK_WARNLOG("ublk%u: zero_map_chunk smaller than the block size, no zero map\n",
+			     ublk->ublk_id);
+		return 0;
+	}
+
+	zm = calloc(1, sizeof(*zm));
+	if (zm == NULL) {
+		return -ENOMEM;
+	}
+	zm->chunk_shift = spdk_u32log2(g_zmap_chunk) - LINUX_SECTOR_SHIFT;
+	sectors = spdk_bdev_get_num_blocks(ublk->bdev) << ublk->sector_per_block_shift;
+	zm->num_chunks = (sectors + (1ULL << zm->chunk_shift) - 1) >> zm->chunk_shift;
+	words = spdk_divide_round_up(zm->num_chunks, 64);
+	zm->zero = calloc(words, sizeof(uint64_t));
+	zm->pending = calloc(words, sizeof(uint64_t));
+	if (zm->zero == NULL || zm->pending == NULL) {
+		free(zm->zero);
+		free(zm->pending);
+		free(zm);
+		return -ENOMEM;
+	}
+	ublk->zmap = zm;
+
+	if (g_zmap_dir != NULL) {
+		snprintf(zm->path, sizeof(zm->path), "%s/ublk%u.zmap", g_zmap_dir, ublk->ublk_id);
+		ublk_zmap_load(ublk);
+	}
+	SPDK_NOTICELOG("ublk%u: zero map %u KiB chunks, %" PRIu64 " chunks (%zu KiB)\n",
+		       ublk->ublk_id, g_zmap_chunk >> 10, zm->num_chunks, words * 2 * sizeof(uint64_t) >> 10);
+	return 0;
+}
+
+/* App thread, after every queue has stopped */
+static void
+ublk_zmap_fini(struct spdk_ublk_dev *ublk)
+{
+	struct ublk_zmap *zm = ublk->zmap;
+	uint64_t hits = 0, miss = 0, bytes = 0, set = 0, cleared = 0, zero = 0;
+	struct ublk_queue *q;
+	uint32_t i;
+
+	if (zm == NULL) {
+		return;
+	}
+	for (i = 0; i < ublk->num_queues; i++) {
+		q = &ublk->queues[i];
+		hits += q->zmap_read_hits;
+		miss += q->zmap_read_miss;
+		bytes += q->zmap_hit_bytes;
+		set += q->zmap_chunks_set;
+		cleared += q->zmap_chunks_cleared;
+	}
+	for (i = 0; i < spdk_divide_round_up(zm->num_chunks, 64); i++) {
+		zero += __builtin_popcountll(zm->zero[i]);
+	}
+	SPDK_NOTICELOG("ublk%u zero map: %" PRIu64 "/%" PRIu64 " reads (%.1f%%) served without bdev IO, "
+		       "%" PRIu64 " MiB; chunks set %" PRIu64 " cleared %" PRIu64 ", %" PRIu64 "/%" PRIu64 " zero\n",
+		       ublk->ublk_id, hits, hits + miss, hits + miss ? hits * 100.0 / (hits + miss) : 0.0,
+		       bytes >> 20, set, cleared, zero, zm->num_chunks);
+
+	/* a device that never started (start_disk failed) has nothing worth keeping */
+	if (zm->path[0] != '\0' && zm->started) {
+		ublk_zmap_save(ublk);
+	}
+	free(zm->zero);
+	free(zm->pending);
+	free(zm);
+	ublk->zmap = NULL;
+}
+
+static inline void
+ublk_zmap_submit(struct ublk_queue *q, struct ublk_io *io, uint8_t ublk_op)
+{
+	struct ublk_zmap *zm = q->dev->zmap;
+
+	switch (ublk_op) {
+	case UBLK_IO_OP_WRITE:
+		q->zmap_chunks_cleared += ublk_zmap_touch(zm, io->iod, UBLK_ZMAP_CLEAR);
+		break;
+	case UBLK_IO_OP_DISCARD:
+	case UBLK_IO_OP_WRITE_ZEROES:
+		ublk_zmap_cover(zm, io->iod, UBLK_ZMAP_PEND);
+		break;
+	default:
+		break;
+	}
+}
+
+static inline void
+ublk_zmap_io_done(struct ublk_queue *q, struct ublk_io *io, bool success)
+{
+	struct ublk_zmap *zm = q->dev->zmap;
+
+	switch (ublksrv_get_op(io->iod)) {
+	case UBLK_IO_OP_WRITE:
+		/* again at completion, in case a DISCARD of the same chunk completed in between;
+		 * a failed WRITE leaves the chunk content unknown, so clear it either way */
+		q->zmap_chunks_cleared += ublk_zmap_touch(zm, io->iod, UBLK_ZMAP_CLEAR);
+		break;
+	case UBLK_IO_OP_DISCARD:
+	case UBLK_IO_OP_WRITE_ZEROES:
+		q->zmap_chunks_set += ublk_zmap_cover(zm, io->iod,
+						      success ? UBLK_ZMAP_COMMIT : UBLK_ZMAP_ABORT);
+		break;
+	default:
+		break;
+	}
+}
+
+/* READ fully covered by zero chunks: answer from g_ublk_zero_buf, no iobuf, no bdev IO */
+static bool
+ublk_zmap_read(struct ublk_queue *q, struct ublk_io *io)
+{
+	const struct ublksrv_io_desc *iod = io->iod;
+
+	if (!ublk_zmap_touch(q->dev->zmap, iod, UBLK_ZMAP_TEST)) {
+		q->zmap_read_miss++;
+		return false;
+	}
+
+	q->zmap_read_hits++;
+	io->payload_size = iod->nr_sectors * (1ULL << LINUX_SECTOR_SHIFT);
+	q->zmap_hit_bytes += io->payload_size;
+	spdk_trace_record(TRACE_UBLK_ZERO_READ, OWNER_TYPE_UBLK, 0,
+			  ublk_trace_oid(q, io), q->q_id, io->tag,
+			  iod->start_sector, (uint32_t)iod->nr_sectors);
+	SPDK_DTRACE_PROBE4(ublk_zero_read, q->dev->ublk_id, q->q_id, io->tag, iod->nr_sectors);
+
+	/* read-only for the kernel (COMMIT copies out of cmd->addr) and for the user copy write */
+	assert(io->payload == NULL);
+	io->payload = g_ublk_zero_buf;
+	io->mpool_entry = NULL;
+	if (g_ublk_tgt.user_copy) {
+		ublk_queue_user_copy(io, false);
+	} else {
+		ublk_io_done(NULL, true, io);
+	}
+	return true;
+}
+
 static inline void
 ublk_mark_io_done(struct ublk_io *io, int res)
 {
@@ -1243,6 +1746,16 @@ ublk_mark_io_done(struct ublk_io *io, int res)
 	io->need_data = false;
 }
 
+static void
+ublk_tier_io_put(struct ublk_queue *q, struct ublk_io *io)
+{
+	if (io->tier_held) {
+		ublk_tier_io_done(q->dev->tier, ublksrv_get_op(io->iod) == UBLK_IO_OP_WRITE,
+				  io->iod->start_sector >> q->dev->sector_per_block_shift, io->tier_fast_offset);
+		io->tier_held = false;
+	}
+}
+
 static void
 ublk_io_done(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 {
@@ -1250,7 +1763,10 @@ ublk_io_done(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 	struct ublk_queue *q = io->q;
 	int res;
 
-
+	if (q->dev->zmap != NULL) {
+		ublk_zmap_io_done(q, io, success);
+	}
+	ublk_tier_io_put(q, io);
 
 	if (success) {
 		res = io->result;
@@ -1263,12 +1779,14 @@ ublk_io_done(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
 	spdk_trace_record(TRACE_UBLK_BDEV_DONE, OWNER_TYPE_UBLK, 0,
 			  ublk_trace_oid(q, io), q->q_id, io->tag,
 			  res, (uint32_t)UBLK_IO_COMMIT_AND_FETCH_REQ);
+	SPDK_DTRACE_PROBE4(ublk_bdev_done, q->dev->ublk_id, q->q_id, io->tag, res);
 
 
 	SPDK_DEBUGLOG(ublk_io, "(qid %d tag %d res %d)\n",
 		      q->q_id, io->tag, res);
 	TAILQ_REMOVE(&q->inflight_io_list, io, tailq);
 	TAILQ_INSERT_TAIL(&q->completed_io_list, io, tailq);
+	q->poll_group->io_completed++;
 
 	if (bdev_io != NULL) {
 		spdk_bdev_free_io(bdev_io);
@@ -1308,6 +1826,8 @@ ublk_user_copy_read_done(struct spdk_bdev_io *bdev_io, bool success, void *cb_ar
 	struct ublk_io	*io = cb_arg;
 
 	spdk_bdev_free_io(bdev_io);
+	/* the data is in io->payload, the tier slot may be reused */
+	ublk_tier_io_put(io->q, io);
 
 	if (success) {
 		ublk_queue_user_copy(io, false);
@@ -1322,7 +1842,7 @@ ublk_resubmit_io(void *arg)
 {
 	struct ublk_io *io = (struct ublk_io *)arg;
 
-	_ublk_submit_bdev_io(io->q, io);
+	ublk_issue_bdev_io(io->q, io);
 }
 
 static void
@@ -1346,10 +1866,11 @@ ublk_queue_io(struct ublk_io *io)
 static void
 ublk_io_get_buffer_cb(struct spdk_iobuf_entry *iobuf, void *buf)
 {
-	
+	struct ublk_io *io = SPDK_CONTAINEROF(iobuf, struct ublk_io, iobuf);
+
 	spdk_trace_record(TRACE_UBLK_BUF_WAIT_DONE, OWNER_TYPE_UBLK, 0,
 			  ublk_trace_oid(io->q, io), io->q->q_id, io->tag, io->payload_size);
-struct ublk_io *io = SPDK_CONTAINEROF(iobuf, struct ublk_io, iobuf);
+	SPDK_DTRACE_PROBE4(ublk_buf_wait_done, io->q->dev->ublk_id, io->q->q_id, io->tag, io->payload_size);
 
 	io->mpool_entry = buf;
 	assert(io->payload == NULL);
@@ -1365,9 +1886,10 @@ ublk_io_get_buffer(struct ublk_io *io, struct spdk_iobuf_channel *iobuf_ch,
 
 	io->payload_size = io->iod->nr_sectors * (1ULL << LINUX_SECTOR_SHIFT);
 	io->get_buf_cb = get_buf_cb;
-		spdk_trace_record(TRACE_UBLK_BUF_WAIT_BEGIN, OWNER_TYPE_UBLK, 0,
+	spdk_trace_record(TRACE_UBLK_BUF_WAIT_BEGIN, OWNER_TYPE_UBLK, 0,
 			  ublk_trace_oid(io->q, io), io->q->q_id, io->tag, io->payload_size);
-buf = spdk_iobuf_get(iobuf_ch, io->payload_size, &io->iobuf, ublk_io_get_buffer_cb);
+	SPDK_DTRACE_PROBE4(ublk_buf_wait_begin, io->q->dev->ublk_id, io->q->q_id, io->tag, io->payload_size);
+	buf = spdk_iobuf_get(iobuf_ch, io->payload_size, &io->iobuf, ublk_io_get_buffer_cb);
 
 	if (buf != NULL) {
 		ublk_io_get_buffer_cb(&io->iobuf, buf);
@@ -1378,14 +1900,101 @@ static void
 ublk_io_put_buffer(struct ublk_io *io, struct spdk_iobuf_channel *iobuf_ch)
 {
 	if (io->payload) {
-		spdk_iobuf_put(iobuf_ch, io->mpool_entry, io->payload_size);
+		/* zero map reads point payload at g_ublk_zero_buf, which is not from the pool */
+		if (io->mpool_entry != NULL) {
+			spdk_iobuf_put(iobuf_ch, io->mpool_entry, io->payload_size);
+		}
 		io->mpool_entry = NULL;
 		io->payload = NULL;
 	}
 }
 
 static void
-_ublk_submit_bdev_io(struct ublk_queue *q, struct ublk_io *io)
+ublk_nvme_io_done(void *cb_arg, const struct spdk_nvme_cpl *cpl)
+{
+	struct ublk_io *io = cb_arg;
+	bool success = !spdk_nvme_cpl_is_error(cpl);
+
+	if (spdk_unlikely(!success && cpl->status.sct == SPDK_NVME_SCT_GENERIC &&
+			  (cpl->status.sc == SPDK_NVME_SC_ABORTED_SQ_DELETION ||
+			   cpl->status.sc == SPDK_NVME_SC_ABORTED_BY_REQUEST))) {
+		/* aborted by a qpair disconnect, not by the device: retry on the bdev path,
+		 * bdev_nvme owns the controller reset and its retry policy */
+		io->q->nvme_down = true;
+		ublk_issue_bdev_io(io->q, io);
+		return;
+	}
+
+	if (success && g_ublk_tgt.user_copy &&
+	    ublksrv_get_op(io->iod) == UBLK_IO_OP_READ) {
+		ublk_queue_user_copy(io, false);
+		return;
+	}
+	ublk_io_done(NULL, success, io);
+}
+
+/*
+ * READ/WRITE fast path: issue straight to the queue's own NVMe qpair, skipping
+ * bdev_io allocation, the bdev channel and the bdev_nvme submit path. Completions
+ * are reaped from ublk_poll(). Returns -ENOMEM when the qpair is out of requests,
+ * in which case the caller falls back to the bdev path for this IO.
+ */
+static int
+ublk_nvme_submit_io(struct ublk_queue *q, struct ublk_io *io, uint8_t ublk_op,
+		    uint64_t offset_blocks, uint64_t num_blocks)
+{
+	struct spdk_ublk_dev *ublk = q->dev;
+	uint64_t tsc = spdk_get_ticks();
+	int rc;
+
+	if (ublk_op == UBLK_IO_OP_READ) {
+		rc = spdk_nvme_ns_cmd_read(ublk->nvme_ns, q->nvme_qpair, io->payload,
+					   offset_blocks, (uint32_t)num_blocks,
+					   ublk_nvme_io_done, io, 0);
+	} else {
+		rc = spdk_nvme_ns_cmd_write(ublk->nvme_ns, q->nvme_qpair, io->payload,
+					    offset_blocks, (uint32_t)num_blocks,
+					    ublk_nvme_io_done, io, 0);
+	}
+
+	if (spdk_likely(rc == 0)) {
+		q->nvme_submit_tsc += spdk_get_ticks() - tsc;
+		q->nvme_submit_cnt++;
+	}
+
+	return rc;
+}
+
+/* FLUSH on a tiered device: the fast bdev first, then the slow one */
+static void
+ublk_tier_flush_done(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+	struct ublk_io	*io = cb_arg;
+	struct spdk_ublk_dev *ublk = io->q->dev;
+	int rc;
+
+	if (!success || !spdk_bdev_io_type_supported(ublk->bdev, SPDK_BDEV_IO_TYPE_FLUSH)) {
+		ublk_io_done(bdev_io, success, io);
+		return;
+	}
+	spdk_bdev_free_io(bdev_io);
+	rc = spdk_bdev_flush_blocks(io->bdev_desc, io->bdev_ch, 0, spdk_bdev_get_num_blocks(ublk->bdev),
+				    ublk_io_done, io);
+	if (rc != 0) {
+		SPDK_ERRLOG("ublk%u flush of slow tier failed, rc=%d\n", ublk->ublk_id, rc);
+		ublk_io_done(NULL, false, io);
+	}
+}
+
+/*
+ * Route and issue an IO without recording it: everything _ublk_submit_bdev_io()
+ * does after the trace record, the ublk_bdev_submit probe and zmap accounting.
+ * Retries of an IO that was already submitted once (-ENOMEM requeue, tier wait,
+ * a bypass IO aborted by a qpair disconnect) call this directly, so the trace
+ * and qd_timeline.py see one submit per IO.
+ */
+static void
+ublk_issue_bdev_io(struct ublk_queue *q, struct ublk_io *io)
 {
 	struct spdk_ublk_dev *ublk = q->dev;
 	struct spdk_bdev_desc *desc = io->bdev_desc;
@@ -1393,6 +2002,7 @@ _ublk_submit_bdev_io(struct ublk_queue *q, struct ublk_io *io)
 	uint64_t offset_blocks, num_blocks;
 	spdk_bdev_io_completion_cb read_cb;
 	uint8_t ublk_op;
+	uint64_t tsc;
 	int rc = 0;
 	const struct ublksrv_io_desc *iod = io->iod;
 
@@ -1400,10 +2010,46 @@ _ublk_submit_bdev_io(struct ublk_queue *q, struct ublk_io *io)
 	offset_blocks = iod->start_sector >> ublk->sector_per_block_shift;
 	num_blocks = iod->nr_sectors >> ublk->sector_per_block_shift;
 
-	spdk_trace_record(TRACE_UBLK_BDEV_SUBMIT, OWNER_TYPE_UBLK, 0,
-			  ublk_trace_oid(q, io), q->q_id, io->tag, (int)ublk_op,
-			  iod->start_sector, num_blocks);
+	if (ublk->tier != NULL && (ublk_op == UBLK_IO_OP_READ || ublk_op == UBLK_IO_OP_WRITE)) {
+		enum ublk_tier_target target;
 
+		target = ublk_tier_route(ublk->tier, q->q_id, ublk_op == UBLK_IO_OP_WRITE, io->tier_retry,
+					 &offset_blocks, num_blocks);
+		io->tier_retry = false;
+		switch (target) {
+		case UBLK_TIER_TO_WAIT:
+			io->tier_retry = true;
+			TAILQ_INSERT_TAIL(&q->tier_wait_list, io, wait_tailq);
+			return;
+		case UBLK_TIER_TO_ERROR:
+			SPDK_ERRLOG("ublk%u IO crosses a tier extent, sector %llu nr %u\n", ublk->ublk_id,
+				    (unsigned long long)iod->start_sector, iod->nr_sectors);
+			ublk_io_done(NULL, false, io);
+			return;
+		case UBLK_TIER_TO_FAST:
+			desc = ublk->tier->fast_desc;
+			ch = q->tier_fast_ch;
+			break;
+		default:
+			break;
+		}
+		io->tier_fast_offset = target == UBLK_TIER_TO_FAST ? offset_blocks : UINT64_MAX;
+		io->tier_held = true;
+	}
+
+	if (q->nvme_qpair != NULL && !q->nvme_down &&
+	    (ublk_op == UBLK_IO_OP_READ || ublk_op == UBLK_IO_OP_WRITE)) {
+		rc = ublk_nvme_submit_io(q, io, ublk_op, offset_blocks, num_blocks);
+		if (spdk_likely(rc == 0)) {
+			return;
+		}
+		if (rc != -ENOMEM) {
+			SPDK_ERRLOG("ublk nvme bypass submit failed, rc=%d, ublk_op=%u\n", rc, ublk_op);
+			ublk_io_done(NULL, false, io);
+			return;
+		}
+		/* qpair out of requests: take the bdev path for this IO */
+	}
 
 	switch (ublk_op) {
 	case UBLK_IO_OP_READ:
@@ -1412,12 +2058,27 @@ _ublk_submit_bdev_io(struct ublk_queue *q, struct ublk_io *io)
 		} else {
 			read_cb = ublk_io_done;
 		}
+		tsc = spdk_get_ticks();
 		rc = spdk_bdev_read_blocks(desc, ch, io->payload, offset_blocks, num_blocks, read_cb, io);
+		q->bdev_submit_tsc += spdk_get_ticks() - tsc;
+		q->bdev_submit_cnt++;
 		break;
 	case UBLK_IO_OP_WRITE:
+		tsc = spdk_get_ticks();
 		rc = spdk_bdev_write_blocks(desc, ch, io->payload, offset_blocks, num_blocks, ublk_io_done, io);
+		q->bdev_submit_tsc += spdk_get_ticks() - tsc;
+		q->bdev_submit_cnt++;
 		break;
 	case UBLK_IO_OP_FLUSH:
+		if (ublk->tier != NULL &&
+		    spdk_bdev_io_type_supported(spdk_bdev_desc_get_bdev(ublk->tier->fast_desc),
+						SPDK_BDEV_IO_TYPE_FLUSH)) {
+			desc = ublk->tier->fast_desc;
+			ch = q->tier_fast_ch;
+			rc = spdk_bdev_flush_blocks(desc, ch, 0, spdk_bdev_get_num_blocks(spdk_bdev_desc_get_bdev(desc)),
+						    ublk_tier_flush_done, io);
+			break;
+		}
 		rc = spdk_bdev_flush_blocks(desc, ch, 0, spdk_bdev_get_num_blocks(ublk->bdev), ublk_io_done, io);
 		break;
 	case UBLK_IO_OP_DISCARD:
@@ -1431,7 +2092,13 @@ _ublk_submit_bdev_io(struct ublk_queue *q, struct ublk_io *io)
 	}
 
 	if (rc < 0) {
-		if (rc == -ENOMEM) {
+		ublk_tier_io_put(q, io);
+		if (rc == -ENOMEM && desc != io->bdev_desc) {
+			/* io_wait only covers the slow bdev, retry from ublk_poll() */
+			io->tier_retry = true;
+			TAILQ_INSERT_TAIL(&q->tier_wait_list, io, wait_tailq);
+		} else if (rc == -ENOMEM) {
+			io->tier_retry = ublk->tier != NULL;
 			SPDK_INFOLOG(ublk, "No memory, start to queue io.\n");
 			ublk_queue_io(io);
 		} else {
@@ -1441,6 +2108,25 @@ _ublk_submit_bdev_io(struct ublk_queue *q, struct ublk_io *io)
 	}
 }
 
+static void
+_ublk_submit_bdev_io(struct ublk_queue *q, struct ublk_io *io)
+{
+	struct spdk_ublk_dev *ublk = q->dev;
+	const struct ublksrv_io_desc *iod = io->iod;
+	uint8_t ublk_op = ublksrv_get_op(iod);
+
+	spdk_trace_record(TRACE_UBLK_BDEV_SUBMIT, OWNER_TYPE_UBLK, 0,
+			  ublk_trace_oid(q, io), q->q_id, io->tag, (int)ublk_op,
+			  iod->start_sector, iod->nr_sectors >> ublk->sector_per_block_shift);
+	SPDK_DTRACE_PROBE4(ublk_bdev_submit, ublk->ublk_id, q->q_id, io->tag, ublk_op);
+
+	if (ublk->zmap != NULL) {
+		ublk_zmap_submit(q, io, ublk_op);
+	}
+
+	ublk_issue_bdev_io(q, io);
+}
+
 static void
 read_get_buffer_done(struct ublk_io *io)
 {
@@ -1460,22 +2146,27 @@ ublk_submit_bdev_io(struct ublk_queue *q, struct ublk_io *io)
 	const struct ublksrv_io_desc *iod = io->iod;
 	uint8_t ublk_op;
 
+	spdk_trace_record(TRACE_UBLK_REQ_READY, OWNER_TYPE_UBLK, 0,
+			  ublk_trace_oid(q, io),
+			  q->q_id, io->tag, (int)ublksrv_get_op(iod),
+			  iod->start_sector, (uint32_t)iod->nr_sectors,
+			  (uint32_t)io->cmd_op);
+	SPDK_DTRACE_PROBE4(ublk_req_ready, q->dev->ublk_id, q->q_id, io->tag, iod->start_sector);
+
 	io->result = iod->nr_sectors * (1ULL << LINUX_SECTOR_SHIFT);
 	ublk_op = ublksrv_get_op(iod);
 	switch (ublk_op) {
 	case UBLK_IO_OP_READ:
+		if (q->dev->zmap != NULL && ublk_zmap_read(q, io)) {
+			break;
+		}
 		ublk_io_get_buffer(io, iobuf_ch, read_get_buffer_done);
 		break;
 	case UBLK_IO_OP_WRITE:
 		if (g_ublk_tgt.user_copy) {
 			ublk_io_get_buffer(io, iobuf_ch, user_copy_write_get_buffer_done);
 		} else {
-			_ 			spdk_trace_record(TRACE_UBLK_REQ_READY, OWNER_TYPE_UBLK, 0,
-					  ublk_trace_oid(q, io),
-					  q->q_id, io->tag, (int)ublksrv_get_op(io->iod),
-					  io->iod->start_sector, (uint32_t)io->iod->nr_sectors,
-					  (uint32_t)io->cmd_op);
-ublk_submit_bdev_io(q, io);
+			_ublk_submit_bdev_io(q, io);
 		}
 		break;
 	default:
@@ -1502,6 +2193,7 @@ ublksrv_queue_io_cmd(struct ublk_queue *q,
 	if (cmd_op == UBLK_IO_COMMIT_AND_FETCH_REQ) {
 		spdk_trace_record(TRACE_UBLK_COMMIT_PREP, OWNER_TYPE_UBLK, 0,
 				  ublk_trace_oid(q, io), q->q_id, tag, (uint32_t)io->result, (uint32_t)cmd_op);
+		SPDK_DTRACE_PROBE4(ublk_commit_prep, q->dev->ublk_id, q->q_id, tag, io->result);
 	}
 
 	sqe = io_uring_get_sqe(&q->ring);
@@ -1565,10 +2257,13 @@ ublk_io_xmit(struct ublk_queue *q)
 	}
 
 	q->cmd_inflight += count;
-		/* Single-IO latency helper: commit submit (batched). */
+	/* Single-IO latency helper: commit submit (batched). */
 	spdk_trace_record(TRACE_UBLK_COMMIT_SUBMIT, OWNER_TYPE_UBLK, 0,
 			  ((uint64_t)q->q_id << 32), q->q_id, 0, (uint32_t)count);
-rc = io_uring_submit(&q->ring);
+	SPDK_DTRACE_PROBE3(ublk_commit_submit, q->dev->ublk_id, q->q_id, count);
+	rc = io_uring_submit(&q->ring);
+	/* the kernel completes the committed requests inside io_uring_enter */
+	SPDK_DTRACE_PROBE4(ublk_commit_submitted, q->dev->ublk_id, q->q_id, count, rc);
 	if (rc != count) {
 		SPDK_ERRLOG("could not submit all commands\n");
 		assert(false);
@@ -1678,16 +2373,87 @@ ublk_io_recv(struct ublk_queue *q)
 	return count;
 }
 
+static void
+ublk_tier_resubmit(struct ublk_queue *q)
+{
+	TAILQ_HEAD(, ublk_io) waiting = TAILQ_HEAD_INITIALIZER(waiting);
+	struct ublk_io *io;
+
+	TAILQ_CONCAT(&waiting, &q->tier_wait_list, wait_tailq);
+	while ((io = TAILQ_FIRST(&waiting)) != NULL) {
+		TAILQ_REMOVE(&waiting, io, wait_tailq);
+		ublk_issue_bdev_io(q, io);
+	}
+}
+
+/*
+ * The bypass qpair got disconnected, usually by a controller reset in bdev_nvme.
+ * Reconnect with exponential backoff; -EAGAIN (reset still running) only delays.
+ * After UBLK_NVME_RECONNECT_MAX_FAILS hard failures the qpair is freed: its
+ * outstanding IOs come back aborted and are resubmitted on the bdev path by
+ * ublk_nvme_io_done(), which is also the path for all later IOs.
+ */
+static void
+ublk_nvme_qpair_reconnect(struct ublk_queue *q)
+{
+	struct spdk_ublk_dev *ublk = q->dev;
+	struct spdk_nvme_qpair *qpair = q->nvme_qpair;
+	uint64_t now = spdk_get_ticks();
+	uint64_t backoff_us;
+	int rc;
+
+	q->nvme_down = true;
+	if (now < q->nvme_reconnect_tsc) {
+		return;
+	}
+	rc = spdk_nvme_ctrlr_reconnect_io_qpair(qpair);
+	if (rc == 0) {
+		if (q->nvme_reconnect_fails > 0) {
+			SPDK_NOTICELOG("ublk%u q%u: NVMe qpair reconnected\n", ublk->ublk_id, q->q_id);
+		}
+		q->nvme_down = false;
+		q->nvme_reconnect_fails = 0;
+		q->nvme_reconnect_tsc = 0;
+		return;
+	}
+	if (rc != -EAGAIN && ++q->nvme_reconnect_fails >= UBLK_NVME_RECONNECT_MAX_FAILS) {
+		SPDK_ERRLOG("ublk%u q%u: NVMe qpair reconnect failed %u times (rc=%d), using bdev path\n",
+			    ublk->ublk_id, q->q_id, q->nvme_reconnect_fails, rc);
+		q->nvme_qpair = NULL;
+		spdk_nvme_qpair_abort_reqs(qpair, 0);
+		spdk_nvme_ctrlr_free_io_qpair(qpair);
+		return;
+	}
+	backoff_us = spdk_min((uint64_t)UBLK_NVME_RECONNECT_MIN_US << q->nvme_reconnect_fails,
+			      (uint64_t)UBLK_NVME_RECONNECT_MAX_US);
+	q->nvme_reconnect_tsc = now + backoff_us * spdk_get_ticks_hz() / SPDK_SEC_TO_USEC;
+}
+
 static int
 ublk_poll(void *arg)
 {
 	struct ublk_poll_group *poll_group = arg;
 	struct ublk_queue *q, *q_tmp;
-	int sent, received, count = 0;
+	int sent, received, reaped, count = 0;
 
 	TAILQ_FOREACH_SAFE(q, &poll_group->queue_list, tailq, q_tmp) {
 		sent = ublk_io_xmit(q);
 		received = ublk_io_recv(q);
+		if (q->nvme_qpair != NULL) {
+			reaped = spdk_nvme_qpair_process_completions(q->nvme_qpair, 0);
+			if (spdk_unlikely(reaped < 0)) {
+				/* Controller reset by bdev_nvme disconnects our qpair too */
+				ublk_nvme_qpair_reconnect(q);
+				reaped = 0;
+			} else if (spdk_unlikely(q->nvme_down) && q->nvme_reconnect_tsc == 0) {
+				/* an aborted IO marked the qpair down, but it still polls fine */
+				q->nvme_down = false;
+			}
+			received += reaped;
+		}
+		if (spdk_unlikely(!TAILQ_EMPTY(&q->tier_wait_list))) {
+			ublk_tier_resubmit(q);
+		}
 		if (spdk_unlikely(q->is_stopping)) {
 			ublk_try_close_queue(q);
 		}
@@ -1905,7 +2671,14 @@ ublk_info_param_init(struct spdk_ublk_dev *ublk)
 		uparams.basic.attrs = UBLK_ATTR_VOLATILE_CACHE;
 	}
 
-	if (spdk_bdev_io_type_supported(bdev, SPDK_BDEV_IO_TYPE_UNMAP)) {
+	if (ublk->tier != NULL) {
+		/* no READ/WRITE across an extent; DISCARD would have to be split per tier */
+		uparams.basic.chunk_sectors = ublk_tier_extent_blocks(ublk->tier) * sectors_per_block;
+		if (spdk_bdev_io_type_supported(spdk_bdev_desc_get_bdev(ublk->tier->fast_desc),
+						SPDK_BDEV_IO_TYPE_FLUSH)) {
+			uparams.basic.attrs = UBLK_ATTR_VOLATILE_CACHE;
+		}
+	} else if (spdk_bdev_io_type_supported(bdev, SPDK_BDEV_IO_TYPE_UNMAP)) {
 		uparams.types |= UBLK_PARAM_TYPE_DISCARD;
 		uparams.discard.discard_alignment = sectors_per_block;
 		/* 32768 sectors for 16MiB */
@@ -1975,6 +2748,11 @@ ublk_free_dev(struct spdk_ublk_dev *ublk)
 	/* All of the buffers associated with the queues have been freed, so now
 	 * continue with releasing resources for the rest of the ublk device.
 	 */
+	ublk_zmap_fini(ublk);
+	if (ublk->tier != NULL) {
+		ublk_tier_close(ublk->tier);
+		ublk->tier = NULL;
+	}
 	if (ublk->bdev_desc) {
 		spdk_bdev_close(ublk->bdev_desc);
 		ublk->bdev_desc = NULL;
@@ -1998,6 +2776,7 @@ ublk_ios_init(struct spdk_ublk_dev *ublk)
 
 		TAILQ_INIT(&q->completed_io_list);
 		TAILQ_INIT(&q->inflight_io_list);
+		TAILQ_INIT(&q->tier_wait_list);
 		q->dev = ublk;
 		q->q_id = i;
 		q->q_depth = ublk->queue_depth;
@@ -2033,6 +2812,65 @@ ublk_queue_recovery_done(void *arg)
 	}
 }
 
+/*
+ * nvme_bypass is only taken for bdevs that are a whole, single-namespace NVMe
+ * controller with plain (no metadata) sectors, so that bdev LBAs and NVMe LBAs
+ * are identical. Anything else silently keeps the generic bdev path.
+ */
+static void
+ublk_nvme_bypass_init(struct spdk_ublk_dev *ublk)
+{
+	struct spdk_nvme_ctrlr *ctrlr;
+	struct spdk_nvme_ns *ns;
+	uint32_t nsid;
+
+	if (strcmp(spdk_bdev_get_module_name(ublk->bdev), "nvme") != 0) {
+		UBLK_DEBUGLOG(ublk, "bdev %s is not an NVMe bdev, no bypass\n",
+			      spdk_bdev_get_name(ublk->bdev));
+		return;
+	}
+
+	ctrlr = bdev_nvme_get_ctrlr(ublk->bdev);
+	if (ctrlr == NULL) {
+		return;
+	}
+
+	nsid = spdk_nvme_ctrlr_get_first_active_ns(ctrlr);
+	if (nsid == 0 || spdk_nvme_ctrlr_get_next_active_ns(ctrlr, nsid) != 0) {
+		SPDK_NOTICELOG("ublk%u: controller has multiple namespaces, no bypass\n", ublk->ublk_id);
+		return;
+	}
+
+	ns = spdk_nvme_ctrlr_get_ns(ctrlr, nsid);
+	if (spdk_nvme_ns_get_md_size(ns) != 0 ||
+	    spdk_nvme_ns_get_sector_size(ns) != spdk_bdev_get_data_block_size(ublk->bdev)) {
+		SPDK_NOTICELOG("ublk%u: namespace format differs from bdev, no bypass\n", ublk->ublk_id);
+		return;
+	}
+
+	ublk->nvme_ctrlr = ctrlr;
+	ublk->nvme_ns = ns;
+	SPDK_NOTICELOG("ublk%u: READ/WRITE bypass bdev layer to NVMe ns %u\n", ublk->ublk_id, nsid);
+}
+
+/* Must run on the poll group thread: the qpair is polled only from ublk_poll() */
+static void
+ublk_nvme_qpair_init(struct ublk_queue *q)
+{
+	struct spdk_ublk_dev *ublk = q->dev;
+	struct spdk_nvme_io_qpair_opts opts;
+
+	spdk_nvme_ctrlr_get_default_io_qpair_opts(ublk->nvme_ctrlr, &opts, sizeof(opts));
+	/* one request per tag, plus headroom for MDTS splitting */
+	opts.io_queue_requests = spdk_max(opts.io_queue_requests, q->q_depth * 2);
+
+	q->nvme_qpair = spdk_nvme_ctrlr_alloc_io_qpair(ublk->nvme_ctrlr, &opts, sizeof(opts));
+	if (q->nvme_qpair == NULL) {
+		SPDK_WARNLOG("ublk%u q%u: alloc NVMe qpair failed, using bdev path\n",
+			     ublk->ublk_id, q->q_id);
+	}
+}
+
 static void
 ublk_queue_run(void *arg1)
 {
@@ -2042,6 +2880,12 @@ ublk_queue_run(void *arg1)
 
 	assert(spdk_get_thread() == poll_group->ublk_thread);
 	q->bdev_ch = spdk_bdev_get_io_channel(ublk->bdev_desc);
+	if (ublk->tier != NULL) {
+		q->tier_fast_ch = spdk_bdev_get_io_channel(ublk->tier->fast_desc);
+	}
+	if (ublk->nvme_ns != NULL) {
+		ublk_nvme_qpair_init(q);
+	}
 	/* Queues must be filled with IO in the io pthread */
 	ublk_dev_queue_io_init(q);
 
@@ -2100,6 +2944,16 @@ ublk_start_disk(const char *bdev_name, uint32_t ublk_id,
 	ublk->bdev = bdev;
 	sector_per_block = spdk_bdev_get_data_block_size(ublk->bdev) >> LINUX_SECTOR_SHIFT;
 	ublk->sector_per_block_shift = spdk_u32log2(sector_per_block);
+	rc = ublk_tier_open(ublk->bdev_desc, ublk_id, &ublk->tier);
+	if (rc != 0) {
+		spdk_bdev_close(ublk->bdev_desc);
+		free(ublk);
+		return rc;
+	}
+	/* a tiered device routes every READ/WRITE itself */
+	if (g_nvme_bypass && ublk->tier == NULL) {
+		ublk_nvme_bypass_init(ublk);
+	}
 
 	ublk->queues_closed = 0;
 	ublk->num_queues = num_queues;
@@ -2120,8 +2974,15 @@ ublk_start_disk(const char *bdev_name, uint32_t ublk_id,
 
 	ublk_dev_info_init(ublk);
 	ublk_info_param_init(ublk);
-	rc = ublk_ios_init(ublk);
+	rc = ublk_zmap_init(ublk);
+	if (rc == 0) {
+		rc = ublk_ios_init(ublk);
+	}
 	if (rc != 0) {
+		ublk_zmap_fini(ublk);
+		if (ublk->tier != NULL) {
+			ublk_tier_close(ublk->tier);
+		}
 		spdk_bdev_close(ublk->bdev_desc);
 		free(ublk);
 		return rc;
@@ -2267,6 +3128,26 @@ ublk_start_disk_recovery(const char *bdev_name, uint32_t ublk_id, ublk_ctrl_cb c
 	ublk->bdev = bdev;
 	sector_per_block = spdk_bdev_get_data_block_size(ublk->bdev) >> LINUX_SECTOR_SHIFT;
 	ublk->sector_per_block_shift = spdk_u32log2(sector_per_block);
+	rc = ublk_tier_open(ublk->bdev_desc, ublk_id, &ublk->tier);
+	if (rc != 0) {
+		spdk_bdev_close(ublk->bdev_desc);
+		free(ublk);
+		return rc;
+	}
+	/* a tiered device routes every READ/WRITE itself */
+	if (g_nvme_bypass && ublk->tier == NULL) {
+		ublk_nvme_bypass_init(ublk);
+	}
+
+	rc = ublk_zmap_init(ublk);
+	if (rc != 0) {
+		if (ublk->tier != NULL) {
+			ublk_tier_close(ublk->tier);
+		}
+		spdk_bdev_close(ublk->bdev_desc);
+		free(ublk);
+		return rc;
+	}
 
 	SPDK_NOTICELOG("Recovering ublk %d with bdev %s\n", ublk->ublk_id, bdev_name);
 
@@ -0,0 +1,515 @@
+#!/usr/bin/env python3
+"""
+Trace-driven what-if model (ublk → bdev 路徑的 discrete-event simulation)
+
+1) 從 parser_new.py 的 trace CSV 抽出每個 ublk IO 的實測 stage 時間 (reservoir sampling，記憶體有上限)：
+     dispatch  UBLK_REQ_READY → UBLK_BDEV_SUBMIT，扣掉 buf_wait         (ublk core 上的 CPU)
+     buf_wait  UBLK_BUF_WAIT_BEGIN → DONE                              (等 iobuf)
+     bdev      UBLK_BDEV_SUBMIT → UBLK_BDEV_DONE                       (bdev + device)
+     complete  UBLK_BDEV_DONE → UBLK_COMMIT_PREP                       (ublk core 上的 CPU)
+     kernel    UBLK_COMMIT_SUBMIT → 同一個 tag 的下一個 REQ_READY       (kernel 來回 + app think time)
+   以及每次 batched COMMIT_SUBMIT 的 batch 大小與 flush 成本 (最後一個 PREP → COMMIT_SUBMIT)
+   dispatch / complete / flush 是 core 上的 service time：實測區間裡 core 在做別的 IO 的部分 (queue wait) 要扣掉，
+   不然 replay 時 core 的 FIFO 又排一次隊，等於重複計算。做法是同一個 core 上的 UBLK event 依時間排成一列，
+   每段只從 max(段起點, 該 core 上一個 event) 開始算，也就是「輪到這個 IO 之後」的時間
+
+2) 用這些分布 replay 一個 closed-loop 模型：
+     iodepth 個 client → kernel 把 request 平均丟到各 ublk queue → 沒有空 tag 就在 kernel 排隊
+     → queue 所屬 core (單一 server, FIFO) 做 dispatch → buf_wait / bdev 延遲 (不佔 core)
+     → core 做 complete → 累積到 commit batch → core 閒下來或 batch 滿了就 flush (一次 io_uring_submit)
+     → tag 還給 kernel，client 經過 kernel 時間後再送下一個
+
+3) 先用 baseline (trace 本身的設定) 跑一次，和 trace 實測的 IOPS / READY→COMMIT p50/p99 比較，印出 calibration error；
+   再跑各個 scenario，例如：
+     --scenario "cores+2:ublk_cores=+2"          多 2 個 ublk core (queue 數跟著加)
+     --scenario "qd256:qdepth=256"               每個 queue 256 個 tag
+     --scenario "no_bufwait:buf_wait_scale=0"    iobuf 永遠夠
+     --scenario "batch2x:commit_batch_scale=2"   commit batch 上限加倍
+   可用 key：ublk_cores, queues, qdepth, iodepth, buf_wait_scale, bdev_scale, cpu_scale,
+            kernel_scale, commit_batch_scale  (數字前加 + / - 表示相對 baseline)
+
+另外可用 --measured-iops 給實際 engine / fio 跑出來的 IOPS，一起列出 prediction error
+"""
+import argparse
+import csv
+import heapq
+import random
+from collections import Counter, defaultdict, deque
+from typing import Dict, List, Optional, Tuple
+
+E_UBLK_READY       = "UBLK_REQ_READY"
+E_UBLK_BUF_BEGIN   = "UBLK_BUF_WAIT_BEGIN"
+E_UBLK_BUF_DONE    = "UBLK_BUF_WAIT_DONE"
+E_UBLK_BDEV_SUBMIT = "UBLK_BDEV_SUBMIT"
+E_UBLK_BDEV_DONE   = "UBLK_BDEV_DONE"
+E_UBLK_COMMIT_PREP = "UBLK_COMMIT_PREP"
+E_UBLK_COMMIT_SUB  = "UBLK_COMMIT_SUBMIT"
+
+DEFAULT_SCENARIOS = [
+    "cores+2:ublk_cores=+2",
+    "qd256:qdepth=256",
+    "no_bufwait:buf_wait_scale=0",
+    "batch2x:commit_batch_scale=2",
+]
+
+
+def ffloat(x: Optional[str]) -> Optional[float]:
+    try:
+        return float(x)
+    except Exception:
+        return None
+
+
+def fint(x: Optional[str]) -> Optional[int]:
+    try:
+        return int(float(x))
+    except Exception:
+        return None
+
+
+def warn(msg: str):
+    print(f"[WARN] {msg}")
+
+
+def info(msg: str):
+    print(f"[INFO] {msg}")
+
+
+def percentile(sorted_vals: List[float], p: float) -> Optional[float]:
+    # 與 spdk_trace_latency_noDuplicate.py 相同的線性內插
+    if not sorted_vals:
+        return None
+    k = (len(sorted_vals) - 1) * (p / 100.0)
+    f = int(k)
+    c = min(f + 1, len(sorted_vals) - 1)
+    if f == c:
+        return sorted_vals[f]
+    return sorted_vals[f] + (sorted_vals[c] - sorted_vals[f]) * (k - f)
+
+
+class Reservoir:
+    def __init__(self, cap: int, rng: random.Random):
+        self.cap = cap
+        self.rng = rng
+        self.n = 0
+        self.items: list = []
+
+    def add(self, x):
+        self.n += 1
+        if len(self.items) < self.cap:
+            self.items.append(x)
+        else:
+            j = self.rng.randrange(self.n)
+            if j < self.cap:
+                self.items[j] = x
+
+
+# ---------------------------------------------------------------------------
+# 1) 從 trace 抽分布
+# ---------------------------------------------------------------------------
+class Profile:
+    def __init__(self, max_samples: int, seed: int):
+        rng = random.Random(seed)
+        self.io = Reservoir(max_samples, rng)          # (dispatch, buf_wait, bdev, complete)
+        self.kernel = Reservoir(max_samples, rng)
+        self.flush = Reservoir(max_samples, rng)
+        self.batch = Counter()
+        self.ready_commit: Reservoir = Reservoir(max_samples, rng)
+        self.qid_core: Dict[int, Counter] = defaultdict(Counter)
+        self.max_tag = 0
+        self.completed = 0
+        self.t_first: Optional[float] = None
+        self.t_last = 0.0
+        self.cycle_sum = 0.0            # 每個 tag 一圈 (READY → 下一個 READY) 的總時間
+        self.cycles = 0
+        self.queue_wait_us = 0.0        # 從 dispatch / complete / flush 扣掉的 core queue wait
+        self.stage_us = 0.0             # 扣之前的總和
+
+    @property
+    def span_us(self) -> float:
+        return max(self.t_last - (self.t_first or 0.0), 1e-9)
+
+    def cores(self) -> int:
+        return len({c.most_common(1)[0][0] for c in self.qid_core.values()}) or 1
+
+    def queues(self) -> int:
+        return len(self.qid_core) or 1
+
+
+def build_profile(path: str, max_samples: int, seed: int) -> Profile:
+    prof = Profile(max_samples, seed)
+    st: Dict[Tuple[int, int], Dict[str, float]] = defaultdict(dict)
+    last_commit: Dict[Tuple[int, int], float] = {}
+    last_ready: Dict[Tuple[int, int], float] = {}
+    prepped: Dict[int, List[Tuple[int, float]]] = defaultdict(list)
+    core_last: Dict[str, float] = {}    # 每個 core 上一個 UBLK event 的 ts
+
+    def busy(start: float, end: float, prev: Optional[float]) -> float:
+        """[start, end] 裡扣掉 core 還在做前一件事的部分"""
+        svc = max(end - max(start, prev if prev is not None else start), 0.0)
+        prof.stage_us += max(end - start, 0.0)
+        prof.queue_wait_us += max(end - start, 0.0) - svc
+        return svc
+
+    with open(path, "r", encoding="utf-8", errors="replace") as f:
+        for row in csv.DictReader(f):
+            evt = (row.get("event_type") or "").strip()
+            if not evt.startswith("UBLK_"):
+                continue
+            ts = ffloat(row.get("ts"))
+            qid = fint(row.get("qid"))
+            if ts is None or qid is None:
+                continue
+            if prof.t_first is None:
+                prof.t_first = ts
+            prof.t_last = ts
+            core = (row.get("core") or "").strip()
+            if core:
+                prof.qid_core[qid][core] += 1
+            # 沒有 core 欄位時當作一個 queue 一個 core
+            ckey = core or f"q{qid}"
+            prev = core_last.get(ckey)
+            core_last[ckey] = ts
+
+            if evt == E_UBLK_COMMIT_SUB:
+                batch = prepped.pop(qid, [])
+                if not batch:
+                    continue
+                prof.batch[len(batch)] += 1
+                prof.flush.add(busy(max(t for _, t in batch), ts, prev))
+                for tag, _ in batch:
+                    key = (qid, tag)
+                    s = st.pop(key, {})
+                    if "ready" in s:
+                        prof.ready_commit.add(ts - s["ready"])
+                        prof.completed += 1
+                    if all(k in s for k in ("ready", "submit", "bdev_done", "prep")):
+                        prof.io.add((s.get("dispatch", 0.0), s.get("buf_wait", 0.0),
+                                     s["bdev_done"] - s["submit"], s["complete"]))
+                    last_commit[key] = ts
+                continue
+
+            tag = fint(row.get("tag"))
+            if tag is None:
+                continue
+            key = (qid, tag)
+            prof.max_tag = max(prof.max_tag, tag)
+            s = st[key]
+            if evt == E_UBLK_READY:
+                s.clear()
+                s["ready"] = ts
+                if key in last_commit:
+                    prof.kernel.add(ts - last_commit.pop(key))
+                if key in last_ready:
+                    prof.cycle_sum += ts - last_ready[key]
+                    prof.cycles += 1
+                last_ready[key] = ts
+            elif evt == E_UBLK_BUF_BEGIN:
+                if "ready" in s:
+                    s["dispatch"] = s.get("dispatch", 0.0) + busy(s.get("cpu_from", s["ready"]), ts, prev)
+                s["buf_begin"] = ts
+            elif evt == E_UBLK_BUF_DONE:
+                if "buf_begin" in s:
+                    s["buf_wait"] = s.get("buf_wait", 0.0) + ts - s.pop("buf_begin")
+                    s["cpu_from"] = ts
+            elif evt == E_UBLK_BDEV_SUBMIT:
+                if "ready" in s:
+                    s["dispatch"] = s.get("dispatch", 0.0) + busy(s.get("cpu_from", s["ready"]), ts, prev)
+                s["submit"] = ts
+            elif evt == E_UBLK_BDEV_DONE:
+                s["bdev_done"] = ts
+            elif evt == E_UBLK_COMMIT_PREP:
+                if "bdev_done" in s:
+                    s["complete"] = busy(s["bdev_done"], ts, prev)
+                s["prep"] = ts
+                prepped[qid].append((tag, ts))
+    return prof
+
+
+# ---------------------------------------------------------------------------
+# 2) discrete-event model
+# ---------------------------------------------------------------------------
+class Config:
+    KEYS = ("ublk_cores", "queues", "qdepth", "iodepth", "buf_wait_scale", "bdev_scale",
+            "cpu_scale", "kernel_scale", "commit_batch_scale")
+
+    def __init__(self, **kw):
+        self.ublk_cores = 1
+        self.queues = 1
+        self.qdepth = 128
+        self.iodepth = 32
+        self.buf_wait_scale = 1.0
+        self.bdev_scale = 1.0
+        self.cpu_scale = 1.0
+        self.kernel_scale = 1.0
+        self.commit_batch_scale = 1.0
+        self.max_batch = 32
+        for k, v in kw.items():
+            setattr(self, k, v)
+
+    def derive(self, spec: str) -> "Config":
+        c = Config(**vars(self))
+        queues_set = False
+        for part in filter(None, (p.strip() for p in spec.split(","))):
+            k, _, v = part.partition("=")
+            k = k.strip()
+            v = v.strip()
+            if k not in self.KEYS:
+                raise SystemExit(f"ERROR: unknown scenario key '{k}', use one of {', '.join(self.KEYS)}")
+            base = getattr(self, k)
+            val = base + float(v) if v[:1] in "+-" else float(v)
+            setattr(c, k, type(base)(val) if isinstance(base, int) else val)
+            queues_set |= (k == "queues")
+        # 多加 ublk core 通常也會多開 queue (一個 queue 綁一個 core)
+        if c.ublk_cores != self.ublk_cores and not queues_set:
+            c.queues = max(c.queues, c.ublk_cores)
+        return c
+
+    def describe(self) -> str:
+        return (f"cores={self.ublk_cores} queues={self.queues} qdepth={self.qdepth} iodepth={self.iodepth} "
+                f"buf_wait x{self.buf_wait_scale:g} bdev x{self.bdev_scale:g} cpu x{self.cpu_scale:g} "
+                f"kernel x{self.kernel_scale:g} batch<={int(self.max_batch * self.commit_batch_scale)}")
+
+
+class Sim:
+    """
+    event heap 元素：(time, seq, kind, payload)
+      "arrive"  payload=client        kernel 送出一個新 request
+      "cpu"     payload=core          core 上目前的工作做完
+      "device"  payload=io            buf_wait + bdev 延遲結束，回到 core 做 complete
+    """
+
+    def __init__(self, prof: Profile, cfg: Config, seed: int):
+        self.p = prof
+        self.c = cfg
+        self.rng = random.Random(seed)
+        self.io_samples = prof.io.items
+        self.kernel_samples = prof.kernel.items or [0.0]
+        self.flush_samples = prof.flush.items or [0.0]
+        self.max_batch = max(1, int(cfg.max_batch * cfg.commit_batch_scale))
+        self.q_core = [q % cfg.ublk_cores for q in range(cfg.queues)]
+        self.free_tags = [cfg.qdepth] * cfg.queues
+        self.kwait: List[deque] = [deque() for _ in range(cfg.queues)]     # 在 kernel 等 tag 的 request
+        self.prepped: List[List[dict]] = [[] for _ in range(cfg.queues)]
+        self.flush_pending = [False] * cfg.queues
+        self.core_fifo: List[deque] = [deque() for _ in range(cfg.ublk_cores)]
+        self.core_busy = [False] * cfg.ublk_cores
+        self.core_busy_us = [0.0] * cfg.ublk_cores
+        self.core_cur: List[Optional[tuple]] = [None] * cfg.ublk_cores
+        self.heap: list = []
+        self.seq = 0
+        self.now = 0.0
+        self.rr = 0
+        self.lat_ready_commit: List[float] = []
+        self.lat_e2e: List[float] = []
+        self.done = 0
+        self.total = 0
+        self.t_measure = None
+
+    def push(self, t: float, kind: str, payload):
+        self.seq += 1
+        heapq.heappush(self.heap, (t, self.seq, kind, payload))
+
+    # ---- core (單一 server) ----
+    def core_submit(self, core: int, job: tuple):
+        self.core_fifo[core].append(job)
+        if not self.core_busy[core]:
+            self.core_next(core)
+
+    def core_next(self, core: int):
+        fifo = self.core_fifo[core]
+        if not fifo:
+            # poll loop 走到底：把這個 core 上所有 queue 已 prep 的 IO flush 掉
+            for q in range(self.c.queues):
+                if self.q_core[q] == core and self.prepped[q] and not self.flush_pending[q]:
+                    self.flush_pending[q] = True
+                    fifo.append(("flush", q))
+            if not fifo:
+                self.core_busy[core] = False
+                return
+        job = fifo.popleft()
+        kind, obj = job
+        if kind == "dispatch":
+            svc = obj["s"][0] * self.c.cpu_scale
+        elif kind == "complete":
+            svc = obj["s"][3] * self.c.cpu_scale
+        else:
+            svc = self.rng.choice(self.flush_samples) * self.c.cpu_scale
+        self.core_busy[core] = True
+        self.core_cur[core] = job
+        self.core_busy_us[core] += svc
+        self.push(self.now + svc, "cpu", core)
+
+    def cpu_done(self, core: int):
+        kind, obj = self.core_cur[core]
+        self.core_cur[core] = None
+        if kind == "dispatch":
+            bw = obj["s"][1] * self.c.buf_wait_scale
+            bd = obj["s"][2] * self.c.bdev_scale
+            self.push(self.now + bw + bd, "device", obj)
+        elif kind == "complete":
+            q = obj["q"]
+            self.prepped[q].append(obj)
+            if len(self.prepped[q]) >= self.max_batch and not self.flush_pending[q]:
+                self.flush_pending[q] = True
+                self.core_fifo[core].append(("flush", q))
+        else:
+            self.do_flush(obj)
+        self.core_next(core)
+
+    def do_flush(self, q: int):
+        self.flush_pending[q] = False
+        batch, self.prepped[q] = self.prepped[q], []
+        for io in batch:
+            self.total += 1
+            if self.t_measure is not None and io["t_ready"] >= self.t_measure:
+                self.lat_ready_commit.append(self.now - io["t_ready"])
+                self.lat_e2e.append(self.now - io["t_arrive"])
+                self.done += 1
+            self.free_tags[q] += 1
+            think = self.rng.choice(self.kernel_samples) * self.c.kernel_scale
+            self.push(self.now + think, "arrive", io["client"])
+        while self.free_tags[q] > 0 and self.kwait[q]:
+            self.start_io(q, self.kwait[q].popleft())
+
+    # ---- request ----
+    def start_io(self, q: int, io: dict):
+        self.free_tags[q] -= 1
+        io["t_ready"] = self.now
+        io["s"] = self.rng.choice(self.io_samples)
+        self.core_submit(self.q_core[q], ("dispatch", io))
+
+    def arrive(self, client: int):
+        q = self.rr % self.c.queues
+        self.rr += 1
+        io = {"client": client, "q": q, "t_arrive": self.now}
+        if self.free_tags[q] > 0:
+            self.start_io(q, io)
+        else:
+            self.kwait[q].append(io)
+
+    def run(self, n_ios: int, warmup: float) -> dict:
+        for cl in range(self.c.iodepth):
+            self.push(self.rng.random() * 10.0, "arrive", cl)
+        n_warm = int(n_ios * warmup)
+        busy_at_measure = None
+        while self.heap and self.done < n_ios:
+            self.now, _, kind, payload = heapq.heappop(self.heap)
+            if kind == "arrive":
+                self.arrive(payload)
+            elif kind == "cpu":
+                self.cpu_done(payload)
+            else:
+                self.core_submit(self.q_core[payload["q"]], ("complete", payload))
+            if self.t_measure is None and self.total >= n_warm:
+                self.t_measure = self.now
+                busy_at_measure = list(self.core_busy_us)
+        span = max(self.now - (self.t_measure or 0.0), 1e-9)
+        rc = sorted(self.lat_ready_commit)
+        e2e = sorted(self.lat_e2e)
+        util = [(b - b0) / span * 100.0 for b, b0 in zip(self.core_busy_us, busy_at_measure or self.core_busy_us)]
+        return {
+            "iops": self.done / span * 1e6,
+            "rc_mean": sum(rc) / len(rc) if rc else 0.0,
+            "rc_p50": percentile(rc, 50) or 0.0,
+            "rc_p99": percentile(rc, 99) or 0.0,
+            "rc_p999": percentile(rc, 99.9) or 0.0,
+            "e2e_p99": percentile(e2e, 99) or 0.0,
+            "core_util": max(util) if util else 0.0,
+        }
+
+
+def err_pct(pred: float, meas: float) -> str:
+    if not meas:
+        return ""
+    return f"{(pred - meas) * 100.0 / meas:+.1f}%"
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Trace-driven what-if discrete-event model for the ublk/bdev path.")
+    ap.add_argument("csv_in", help="Input CSV produced by parser_new.py (UBLK tpoints enabled)")
+    ap.add_argument("--scenario", action="append", default=None,
+                    help="name:key=val,key=val (repeatable). Default: " + "; ".join(DEFAULT_SCENARIOS))
+    ap.add_argument("--qdepth", type=int, default=None, help="ublk queue depth of the traced run (default: max tag+1)")
+    ap.add_argument("--iodepth", type=int, default=None,
+                    help="Outstanding IOs the kernel keeps (fio iodepth x jobs). Default: IOPS x mean tag cycle from "
+                         "the trace, an upper bound since idle tags count as kernel time; pass the real value")
+    ap.add_argument("--measured-iops", type=float, default=None,
+                    help="IOPS measured by the engine/fio for the traced run, for an extra calibration point")
+    ap.add_argument("--sim-ios", type=int, default=200000, help="Completions to simulate per scenario")
+    ap.add_argument("--warmup", type=float, default=0.1, help="Fraction of --sim-ios treated as warmup")
+    ap.add_argument("--max-samples", type=int, default=200000, help="Reservoir size per distribution")
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--output", default="whatif.csv", help="Output CSV (one row per scenario)")
+    args = ap.parse_args()
+
+    prof = build_profile(args.csv_in, args.max_samples, args.seed)
+    if not prof.io.items:
+        raise SystemExit("ERROR: no complete UBLK READY→COMMIT sequences found in trace")
+
+    meas_iops = prof.completed / prof.span_us * 1e6
+    rc = sorted(prof.ready_commit.items)
+    mean_cycle = prof.cycle_sum / prof.cycles if prof.cycles else 0.0
+    est_iodepth = max(1, round(meas_iops / 1e6 * mean_cycle)) if mean_cycle else 32
+    batches = sorted(prof.batch.elements())
+    max_batch = int(percentile(batches, 95) or 1) if batches else 32
+
+    base = Config(ublk_cores=prof.cores(), queues=prof.queues(),
+                  qdepth=args.qdepth or prof.max_tag + 1,
+                  iodepth=args.iodepth or est_iodepth, max_batch=max(1, max_batch))
+    info(f"trace: {prof.completed} IOs in {prof.span_us:.0f}us, {meas_iops:.0f} IOPS, "
+         f"READY->COMMIT p50={percentile(rc, 50):.2f} p99={percentile(rc, 99):.2f}us, "
+         f"commit batch p95={max_batch}, samples io={len(prof.io.items)} kernel={len(prof.kernel.items)}")
+    if prof.stage_us > 0:
+        info(f"core queue wait removed from dispatch/complete/flush: {prof.queue_wait_us:.0f}us "
+             f"({prof.queue_wait_us * 100.0 / prof.stage_us:.1f}% of measured)")
+    info(f"baseline: {base.describe()}")
+
+    fields = ["scenario", "config", "iops", "iops_vs_base", "rc_mean_us", "rc_p50_us", "rc_p99_us",
+              "rc_p999_us", "e2e_p99_us", "max_core_util_pct"]
+    rows = []
+
+    # ---- calibration：baseline replay vs trace ----
+    b = Sim(prof, base, args.seed).run(args.sim_ios, args.warmup)
+    print("\ncalibration (baseline model vs trace)")
+    print(f"  IOPS          model {b['iops']:12.0f}  trace {meas_iops:12.0f}  error {err_pct(b['iops'], meas_iops)}")
+    print(f"  READY->COMMIT p50  model {b['rc_p50']:8.2f}  trace {percentile(rc, 50):8.2f}  "
+          f"error {err_pct(b['rc_p50'], percentile(rc, 50))}")
+    print(f"  READY->COMMIT p99  model {b['rc_p99']:8.2f}  trace {percentile(rc, 99):8.2f}  "
+          f"error {err_pct(b['rc_p99'], percentile(rc, 99))}")
+    if args.measured_iops:
+        print(f"  IOPS vs engine     model {b['iops']:12.0f}  measured {args.measured_iops:12.0f}  "
+              f"error {err_pct(b['iops'], args.measured_iops)}")
+    rows.append(("baseline", base, b))
+
+    # ---- scenarios ----
+    for spec in args.scenario or DEFAULT_SCENARIOS:
+        name, _, kv = spec.partition(":")
+        cfg = base.derive(kv)
+        rows.append((name, cfg, Sim(prof, cfg, args.seed).run(args.sim_ios, args.warmup)))
+
+    print(f"\n{'scenario':<14} {'IOPS':>10} {'vs base':>8} {'p50':>8} {'p99':>8} {'p999':>8} {'core%':>6}  config")
+    with open(args.output, "w", newline="", encoding="utf-8") as f:
+        w = csv.DictWriter(f, fieldnames=fields)
+        w.writeheader()
+        for name, cfg, r in rows:
+            vs = err_pct(r["iops"], b["iops"])
+            print(f"{name:<14} {r['iops']:10.0f} {vs:>8} {r['rc_p50']:8.2f} {r['rc_p99']:8.2f} "
+                  f"{r['rc_p999']:8.2f} {r['core_util']:6.1f}  {cfg.describe()}")
+            w.writerow({
+                "scenario": name,
+                "config": cfg.describe(),
+                "iops": f"{r['iops']:.0f}",
+                "iops_vs_base": vs,
+                "rc_mean_us": f"{r['rc_mean']:.3f}",
+                "rc_p50_us": f"{r['rc_p50']:.3f}",
+                "rc_p99_us": f"{r['rc_p99']:.3f}",
+                "rc_p999_us": f"{r['rc_p999']:.3f}",
+                "e2e_p99_us": f"{r['e2e_p99']:.3f}",
+                "max_core_util_pct": f"{r['core_util']:.1f}",
+            })
+    print(f"[OK] Wrote {args.output}")
+
+
+if __name__ == "__main__":
+    main()